@@ -223,12 +223,24 @@ int osd_command_set_get_attributes(struct osd_command *command, uint64_t pid,
 }
 
 
+/*
+ * Attributes of at most numoid members of cid from initial_oid on, 0 for
+ * no limit; use ATTR_GET_MULTI. With alloc_len of at least 24 the indata
+ * begins with the length the retrieved list would need for every member,
+ * then the member to continue from, 0 when done.
+ */
 int osd_command_set_get_member_attributes(struct osd_command *command,
-					  uint64_t pid, uint64_t cid)
+					  uint64_t pid, uint64_t cid,
+					  uint32_t alloc_len,
+					  uint64_t initial_oid,
+					  uint16_t numoid)
 {
         varlen_cdb_init(command, OSD_GET_MEMBER_ATTRIBUTES);
         set_htonll(&command->cdb[16], pid);
         set_htonll(&command->cdb[24], cid);
+        set_htons(&command->cdb[32], numoid);
+        set_htonl(&command->cdb[36], alloc_len);
+        set_htonll(&command->cdb[40], initial_oid);
         return 0;
 }
 
@@ -365,6 +377,20 @@ int osd_command_set_remove_partition(struct osd_command *command, uint64_t pid)
 }
 
 
+/*
+ * Vendor extension: remove the partition along with all its objects.  The
+ * target does the removal in the background, progress is on the command
+ * tracking page of the partition.
+ */
+int osd_command_set_remove_partition_force(struct osd_command *command,
+					   uint64_t pid)
+{
+	osd_command_set_remove_partition(command, pid);
+	command->cdb[11] |= 1;
+	return 0;
+}
+
+
 int osd_command_set_set_attributes(struct osd_command *command, uint64_t pid,
 				   uint64_t oid)
 {
@@ -391,7 +417,7 @@ int osd_command_set_set_master_key(struct osd_command *command, int dh_step,
 				   uint64_t key, uint32_t param_len,
 				   uint32_t alloc_len)
 {
-        varlen_cdb_init(command, OSD_SET_KEY);
+        varlen_cdb_init(command, OSD_SET_MASTER_KEY);
         command->cdb[11] = (command->cdb[11] & ~0x3) | dh_step;
         set_htonll(&command->cdb[24], key);
         set_htonl(&command->cdb[32], param_len);
@@ -461,6 +487,115 @@ int osd_command_set_cond_setattr(struct osd_command *command, uint64_t pid,
 	return 0;
 }
 
+/*
+ * Wait until the CAS value is no longer the one in the first 8 bytes of
+ * the data-out buffer, or the milliseconds in the next 4 passed.  The
+ * value at that time is returned like the original value of a CAS.
+ */
+int osd_command_set_cas_wait(struct osd_command *command, uint64_t pid,
+			     uint64_t oid, uint64_t len, uint64_t offset)
+{
+        varlen_cdb_init(command, OSD_CAS_WAIT);
+        set_htonll(&command->cdb[16], pid);
+        set_htonll(&command->cdb[24], oid);
+        set_htonll(&command->cdb[32], len);
+        set_htonll(&command->cdb[40], offset);
+        return 0;
+}
+
+/* continuation header, then the OBJECT_IO_LIST descriptor header */
+#define MULTI_RW_CONT_HDR (40 + 8)
+
+/*
+ * Bytes of the data-out buffer of osd_command_set_multi_rw: the CDB
+ * continuation, then for writes the data of all objects.
+ */
+size_t osd_command_multi_rw_outlen(const struct osd_object_io *io, int n,
+				   int write)
+{
+        int i;
+        size_t len = MULTI_RW_CONT_HDR + n * MULTI_RW_ENTRY_LEN;
+
+        for (i = 0; write && i < n; i++)
+                len += io[i].len;
+        return len;
+}
+
+/*
+ * READ or WRITE of n objects of the partition in one command.  buf holds
+ * osd_command_multi_rw_outlen bytes and becomes the data-out buffer.  The
+ * data-in buffer starts with a MULTI_RW_STATUS_LEN record per object,
+ * status, sense key, asc and ascq, then the bytes transferred at 8.  Read
+ * data of all objects follow, each len bytes.
+ */
+int osd_command_set_multi_rw(struct osd_command *command, uint64_t pid,
+			     int write, const struct osd_object_io *io, int n,
+			     uint8_t *buf)
+{
+        int i;
+        uint8_t *p;
+        uint32_t cont_len = MULTI_RW_CONT_HDR + n * MULTI_RW_ENTRY_LEN;
+        uint64_t inlen = n * MULTI_RW_STATUS_LEN;
+
+        if (n <= 0)
+                return -EINVAL;
+
+        varlen_cdb_init(command, OSD_MULTI_RW);
+        if (write)
+                command->cdb[11] |= MULTI_RW_WRITE;
+        set_htonll(&command->cdb[16], pid);
+        set_htonl(&command->cdb[48], cont_len);
+
+        memset(buf, 0, MULTI_RW_CONT_HDR);
+        buf[0] = 1; /* CDB continuation format */
+        set_htons(&buf[2], OSD_MULTI_RW);
+        set_htons(&buf[40], OBJECT_IO_LIST);
+        set_htonl(&buf[44], n * MULTI_RW_ENTRY_LEN);
+
+        p = buf + MULTI_RW_CONT_HDR;
+        for (i = 0; i < n; i++, p += MULTI_RW_ENTRY_LEN) {
+                set_htonll(p, io[i].oid);
+                set_htonll(p + 8, io[i].offset);
+                set_htonll(p + 16, io[i].len);
+        }
+        for (i = 0; i < n; i++) {
+                if (write) {
+                        memcpy(p, io[i].data, io[i].len);
+                        p += io[i].len;
+                } else {
+                        inlen += io[i].len;
+                }
+        }
+
+        set_htonll(&command->cdb[32], inlen);
+        command->outdata = buf;
+        command->outlen = p - buf;
+        command->inlen_alloc = inlen;
+        return 0;
+}
+
+/*
+ * Capability for the command, osd2r04 sec 4.11.2.2, never expiring.  Its
+ * request integrity check value must be computed by whoever holds the
+ * capability key.
+ */
+void osd_command_set_capability(struct osd_command *command, uint8_t method,
+				uint8_t key_version, uint16_t permissions,
+				uint8_t odt, uint64_t pid, uint64_t oid)
+{
+        uint8_t *cap = &command->cdb[CAP_OFF];
+
+        memset(cap, 0, CAP_LEN);
+        cap[CAP_FORMAT] = CAP_FORMAT_V2;
+        cap[CAP_KEY_VERSION] = (key_version << 4) | CAP_ALG_HMAC_SHA1;
+        cap[CAP_SECURITY_METHOD] = method;
+        cap[CAP_PERMISSIONS] = permissions & 0xff;
+        cap[CAP_PERMISSIONS + 1] = permissions >> 8;
+        cap[CAP_OBJECT_DESC_TYPE] = odt << 4;
+        set_htonll(&cap[CAP_ALLOWED_PID], pid);
+        set_htonll(&cap[CAP_ALLOWED_OID], oid);
+}
+
 void osd_command_set_ddt(struct osd_command *command, uint8_t ddt_type)
 {
 	/*
@@ -490,6 +625,7 @@ struct attr_malloc_header {
 	uint64_t start_retrieved;
 	/* for convenience of resolve, points into the big buffer */
 	struct attribute_get_multi_results *mr;
+	int getmulti_num_objects;
 };
 
 /*
@@ -624,13 +760,20 @@ int osd_command_attr_build(struct osd_command *command,
 					  __func__);
 				return -EINVAL;
 			}
-			if (action != OSD_CREATE) {
+			if (action != OSD_CREATE &&
+			    action != OSD_GET_MEMBER_ATTRIBUTES) {
 				osd_error(
-			    "%s: ATTR_GET_MULTI must only be used with CREATE",
-					  __func__);
+			    "%s: ATTR_GET_MULTI must only be used with CREATE"
+			    " or GET MEMBER ATTRIBUTES", __func__);
+				return -EINVAL;
+			}
+			getmulti_num_objects = get_ntohs(&command->cdb[32]);
+			if (action == OSD_GET_MEMBER_ATTRIBUTES &&
+			    getmulti_num_objects == 0) {
+				osd_error("%s: ATTR_GET_MULTI needs a number of"
+					  " members", __func__);
 				return -EINVAL;
 			}
-			getmulti_num_objects = get_ntohs(&command->cdb[36]);
 		}
 		use_getpage = 0;
 		if (numget == 0 && numgetmulti == 0 && numset == 1) {
@@ -798,6 +941,7 @@ int osd_command_attr_build(struct osd_command *command,
 
 	/* for ATTR_GET_MULTI results */
 	header->mr = (void *) p;
+	header->getmulti_num_objects = getmulti_num_objects;
 	p += getmulti_result_space;
 
 	/* space for replacement out and in iovecs */
@@ -1065,14 +1209,14 @@ int osd_command_attr_resolve(struct osd_command *command)
 				  __func__);
 			goto unwind;
 		}
-	} else if ((p[0] & 0xf) == 0xf) {
+	} else if ((p[0] & 0xf) == 0xe || (p[0] & 0xf) == 0xf) {
 		if (!numgetmulti) {
 			osd_error("%s: got list type f, not expecting multi",
 				  __func__);
 			goto unwind;
 		}
 	} else {
-		osd_error("%s: expecting list type 9 or f, got 0x%x",
+		osd_error("%s: expecting list type 9, e or f, got 0x%x",
 			  __func__, p[0] & 0xf);
 		goto unwind;
 	}
@@ -1145,10 +1289,12 @@ int osd_command_attr_resolve(struct osd_command *command)
 			struct attribute_get_multi_results *mr
 				= attr[i].val;
 
-			mr->oid[mr->numoid] = oid;
-			mr->val[mr->numoid] = avail_len ? p : NULL;
-			mr->outlen[mr->numoid] = avail_len;
-			++mr->numoid;
+			if (mr->numoid < header->getmulti_num_objects) {
+				mr->oid[mr->numoid] = oid;
+				mr->val[mr->numoid] = avail_len ? p : NULL;
+				mr->outlen[mr->numoid] = avail_len;
+				++mr->numoid;
+			}
 		} else {
 			attr[i].val = avail_len ? p : NULL;
 			attr[i].outlen = avail_len;
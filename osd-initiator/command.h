@@ -129,7 +129,10 @@ int osd_command_set_format_osd(struct osd_command *command, uint64_t capacity);
 int osd_command_set_get_attributes(struct osd_command *command, uint64_t pid,
 				   uint64_t oid);
 int osd_command_set_get_member_attributes(struct osd_command *command,
-					  uint64_t pid, uint64_t cid);
+					  uint64_t pid, uint64_t cid,
+					  uint32_t alloc_len,
+					  uint64_t initial_oid,
+					  uint16_t numoid);
 int osd_command_set_list(struct osd_command *command, uint64_t pid,
 			 uint32_t list_id, uint64_t alloc_len,
 			 uint64_t initial_oid, int list_attr);
@@ -157,6 +160,8 @@ int osd_command_set_remove_member_objects(struct osd_command *command,
 					  uint64_t pid, uint64_t cid);
 int osd_command_set_remove_partition(struct osd_command *command,
 				     uint64_t pid);
+int osd_command_set_remove_partition_force(struct osd_command *command,
+					   uint64_t pid);
 int osd_command_set_set_attributes(struct osd_command *command, uint64_t pid,
 				   uint64_t oid);
 int osd_command_set_set_key(struct osd_command *command, int key_to_set,
@@ -168,6 +173,9 @@ int osd_command_set_set_member_attributes(struct osd_command *command,
 					  uint64_t pid, uint64_t cid);
 int osd_command_set_write(struct osd_command *command, uint64_t pid,
 			  uint64_t oid, uint64_t len, uint64_t offset);
+void osd_command_set_capability(struct osd_command *command, uint8_t method,
+				uint8_t key_version, uint16_t permissions,
+				uint8_t odt, uint64_t pid, uint64_t oid);
 void osd_command_set_ddt(struct osd_command *command, uint8_t ddt_type);
 uint8_t osd_command_get_ddt(struct osd_command *command);
 /*
@@ -181,6 +189,22 @@ int osd_command_set_gen_cas(struct osd_command *command, uint64_t pid,
 			    uint64_t oid);
 int osd_command_set_cond_setattr(struct osd_command *command, uint64_t pid,
 				 uint64_t oid);
+int osd_command_set_cas_wait(struct osd_command *command, uint64_t pid,
+			     uint64_t oid, uint64_t len, uint64_t offset);
+
+/* One object of osd_command_set_multi_rw */
+struct osd_object_io {
+	uint64_t oid;
+	uint64_t offset;
+	uint64_t len;
+	const void *data;		/* written, unused for reads */
+};
+
+size_t osd_command_multi_rw_outlen(const struct osd_object_io *io, int n,
+				   int write);
+int osd_command_set_multi_rw(struct osd_command *command, uint64_t pid,
+			     int write, const struct osd_object_io *io, int n,
+			     uint8_t *buf);
 
 /* Attributes */
 int osd_command_attr_build(struct osd_command *command,
@@ -576,9 +576,12 @@ static PyObject *pyosd_command_set_get_member_attributes(PyObject *self,
 {
 	struct pyosd_command *py_command = (struct pyosd_command *) self;
 	struct osd_command *command = &py_command->command;
-	uint64_t pid, cid;
+	uint64_t pid, cid, initial_oid = 0;
+	uint32_t alloc_len = 0;
+	uint16_t numoid = 0;
 
-	if (!PyArg_ParseTuple(args, "KK:set_get_member_attributes", &pid, &cid))
+	if (!PyArg_ParseTuple(args, "KK|IKH:set_get_member_attributes", &pid,
+			      &cid, &alloc_len, &initial_oid, &numoid))
 		return NULL;
 	if (py_command->set) {
 		PyErr_SetString(PyExc_RuntimeError, "command already set");
@@ -586,7 +589,8 @@ static PyObject *pyosd_command_set_get_member_attributes(PyObject *self,
 	}
 
 	py_command->set = 1;
-	osd_command_set_get_member_attributes(command, pid, cid);
+	osd_command_set_get_member_attributes(command, pid, cid, alloc_len,
+					      initial_oid, numoid);
 	Py_IncRef(self);
 	return self;
 }
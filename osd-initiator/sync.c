@@ -894,7 +894,6 @@ int set_member_attributes(int fd, uint64_t pid, uint64_t cid,
 	return 0;
 }
 
-/* Unimplemented */
 int get_member_attributes(int fd, uint64_t pid, uint64_t cid)
 {
 	int ret;
@@ -904,7 +903,7 @@ int get_member_attributes(int fd, uint64_t pid, uint64_t cid)
 	osd_debug("****** GET MEMBER ATTRIBUTES ******");
 	osd_debug("PID: %llu CID: %llu", llu(pid), llu(cid));
 
-	osd_command_set_get_member_attributes(&command, pid, cid);
+	osd_command_set_get_member_attributes(&command, pid, cid, 24, 0, 0);
 	command.indata = buf;
 	command.inlen_alloc = sizeof(buf);
 	memset(buf, 0, sizeof(buf));
@@ -44,7 +44,8 @@
 static int rank, numprocs;
 static const int WORK_MAX = 600;
 static const int test_lb = 1;
-static const int test_ub = 24;
+static const int test_ub = 27;
+static const uint32_t WAIT_MS = 1000; /* longest a cas_wait parks */
 
 static void usage(void)
 {
@@ -151,6 +152,38 @@ static int fa(int fd, struct osd_command *cmd, uint64_t pid, uint64_t oid,
 }
 
 
+/*
+ * Park on the target while the cas value is val, at most ms.
+ * return values
+ * -1: error
+ *  0: timed out, still val
+ *  1: value changed
+ */
+static int cas_wait(int fd, struct osd_command *cmd, uint64_t pid,
+		    uint64_t oid, uint64_t val, uint32_t ms)
+{
+	int ret;
+	uint64_t inbuf[1];
+	uint8_t outbuf[12];
+
+	osd_command_set_cas_wait(cmd, pid, oid, 8, 0);
+	cmd->outdata = outbuf;
+	cmd->outlen = sizeof(outbuf);
+	cmd->indata = inbuf;
+	cmd->inlen_alloc = sizeof(inbuf);
+
+	inbuf[0] = 0xdeadbeef;
+	set_htonll(&outbuf[0], val);
+	set_htonl(&outbuf[8], ms);
+	ret = osd_submit_and_wait(fd, cmd);
+	if (ret != 0)
+		return -1;
+	if (get_ntohll((uint8_t *)inbuf) == val)
+		return 0;
+	else
+		return 1;
+}
+
 static void busy_wait(int fd, uint64_t pid, uint64_t oid, const int numlocks,
 		      const int dowork)
 {
@@ -593,6 +626,56 @@ static void beb(int fd, uint64_t pid, uint64_t oid, int numlocks,
 }
 
 
+/*
+ * no backoff at all: a failed lock waits on the target for the unlock
+ */
+static void srv_wait(int fd, uint64_t pid, uint64_t oid, int numlocks,
+		     int dowork, int *my_att, int *my_req, double *latency)
+{
+	int ret;
+	int reqs, attempts;
+	int locks = 0;
+	int first_attempt;
+	double mhz = get_mhz();
+	uint64_t lat_beg, lat_end;
+	struct osd_command cmd;
+
+	reqs = 0, attempts = 0, first_attempt = 1;
+	while (locks < numlocks) {
+		if (first_attempt) {
+			rdtsc(lat_beg);
+			first_attempt = 0;
+		}
+		ret = cas(fd, &cmd, pid, oid, 0, 1); /* lock */
+		++attempts;
+		++reqs;
+		if (ret == 1) {
+			rdtsc(lat_end);
+			latency[locks] = ((double)(lat_end - lat_beg)/mhz);
+			first_attempt = 1;
+			++locks;
+			if (dowork == 1) 
+				local_work();
+			else if (dowork == 2)
+				remote_work(fd, pid, oid);
+			ret = cas(fd, &cmd, pid, oid, 1, 0); /* unlock */
+			assert(ret == 1);
+			++reqs;
+		} else if (ret == 0) {
+			ret = cas_wait(fd, &cmd, pid, oid, 1, WAIT_MS);
+			if (ret == -1)
+				osd_error_fatal("cas_wait error");
+			++reqs;
+			continue;
+		} else {
+			osd_error_fatal("cas error");
+		}
+	}
+	*my_att = attempts;
+	*my_req = reqs;
+}
+
+
 static void spec_idle(int fd, uint64_t pid, uint64_t oid, int numlocks,
 		      int dowork, int scheme)
 {
@@ -655,6 +738,9 @@ static void spec_idle(int fd, uint64_t pid, uint64_t oid, int numlocks,
 			latency);
 	} else if (scheme == 5) {
 		beb(fd, pid, oid, numlocks, dowork, &attempts, &reqs, latency);
+	} else if (scheme == 6) {
+		srv_wait(fd, pid, oid, numlocks, dowork, &attempts, &reqs,
+			 latency);
 	}
 
 
@@ -1150,6 +1236,40 @@ int main(int argc, char *argv[])
 			assert(ret == 0);
 		}
 		break;
+	case 25: /* Contention, cas_wait on the target, no work */
+	case 26: /* Contention, cas_wait on the target, local work */
+	case 27: /* Contention, cas_wait on the target, remote work */
+		if (rank == 0) {
+			osd_command_set_format_osd(&cmd, 1<<30);
+			ret = osd_submit_and_wait(fd, &cmd);
+			assert(ret == 0);
+
+			osd_command_set_create_partition(&cmd, pid);
+			ret = osd_submit_and_wait(fd, &cmd);
+			assert(ret == 0);
+
+			osd_command_set_create(&cmd, pid, oid, 1);
+			ret = osd_submit_and_wait(fd, &cmd);
+			assert(ret == 0);
+		}
+
+		if (test == 25)
+			spec_idle(fd, pid, oid, 100, 0, 6);
+		else if (test == 26)
+			spec_idle(fd, pid, oid, 100, 1, 6);
+		else if (test == 27)
+			spec_idle(fd, pid, oid, 100, 2, 6);
+		
+		if (rank == 0) {
+			osd_command_set_remove(&cmd, pid, oid);
+			ret = osd_submit_and_wait(fd, &cmd);
+			assert(ret == 0);
+
+			osd_command_set_remove_partition(&cmd, pid);
+			ret = osd_submit_and_wait(fd, &cmd);
+			assert(ret == 0);
+		}
+		break;
 
 	default:
 		usage();
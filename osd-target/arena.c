@@ -0,0 +1,193 @@
+/*
+ * Per-command allocation arena.
+ *
+ * Copyright (C) 2007 OSD Team <pvfs-osd@osc.edu>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, version 2 of the License.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/*
+ * Memory that lives only as long as one command: parsed attribute lists,
+ * continuation descriptors, query criteria, generated SQL. It is carved
+ * from a bump allocator and given back all at once by arena_reset when
+ * osdemu_cmd_submit completes, so none of it is freed individually.
+ *
+ * One arena per osd_device, which is used by one thread. The base chunk
+ * stays allocated between commands; a command that needs more gets extra
+ * chunks, freed on reset.  While an async command has let go of the
+ * device lock for its data transfer, the others use a spare one, see
+ * async_io_begin; their allocations do not show in the statistics.
+ */
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+
+#include "osd.h"
+#include "arena.h"
+#include "osd-util/osd-util.h"
+
+#define ARENA_CHUNK (64 * 1024)
+#define ARENA_ALIGN 16
+
+struct arena_chunk {
+	struct arena_chunk *next;
+	size_t size;
+	size_t used;
+	uint8_t data[] __attribute__((aligned(ARENA_ALIGN)));
+};
+
+static struct arena_chunk *chunk_alloc(size_t size)
+{
+	struct arena_chunk *c;
+
+	c = Malloc(sizeof(*c) + size);
+	if (!c)
+		return NULL;
+	c->next = NULL;
+	c->size = size;
+	c->used = 0;
+	return c;
+}
+
+/*
+ * returns: an arena of its own, for work outside of commands; NULL if out
+ * of memory
+ */
+struct arena *arena_new(void)
+{
+	struct arena *a;
+
+	a = Calloc(1, sizeof(*a));
+	if (!a)
+		return NULL;
+	a->base = chunk_alloc(ARENA_CHUNK);
+	if (!a->base) {
+		free(a);
+		return NULL;
+	}
+	a->cur = a->base;
+	return a;
+}
+
+static void chunks_free(struct arena_chunk *c)
+{
+	struct arena_chunk *next;
+
+	for (; c; c = next) {
+		next = c->next;
+		free(c);
+	}
+}
+
+void arena_free(struct arena *a)
+{
+	if (!a)
+		return;
+	chunks_free(a->base);
+	free(a);
+}
+
+int arena_init(struct osd_device *osd)
+{
+	osd->arena = arena_new();
+	return osd->arena ? OSD_OK : -ENOMEM;
+}
+
+void arena_fini(struct osd_device *osd)
+{
+	arena_free(osd->arena);
+	osd->arena = NULL;
+}
+
+static inline size_t align(size_t size)
+{
+	return (size + ARENA_ALIGN - 1) & ~(size_t)(ARENA_ALIGN - 1);
+}
+
+/*
+ * returns: size bytes, not zeroed, valid until the next arena_reset; NULL
+ * if out of memory
+ */
+void *arena_alloc(struct arena *a, size_t size)
+{
+	void *p;
+	struct arena_chunk *c = a->cur;
+
+	size = align(size ? size : 1);
+	if (c->size - c->used < size) {
+		c = chunk_alloc(size > ARENA_CHUNK ? size : ARENA_CHUNK);
+		if (!c)
+			return NULL;
+		a->cur->next = c;
+		a->cur = c;
+		a->mallocs++;
+	}
+	p = &c->data[c->used];
+	c->used += size;
+	a->last = p;
+	a->nalloc++;
+	a->bytes += size;
+	return p;
+}
+
+/*
+ * Grow p, an earlier allocation of oldsize bytes. The most recent
+ * allocation grows in place when its chunk has room.
+ */
+void *arena_realloc(struct arena *a, void *p, size_t oldsize, size_t size)
+{
+	void *np;
+	struct arena_chunk *c = a->cur;
+
+	if (!p)
+		return arena_alloc(a, size);
+	if (size <= oldsize)
+		return p;
+
+	oldsize = align(oldsize);
+	size = align(size);
+	if (p == a->last && c->size - c->used >= size - oldsize) {
+		c->used += size - oldsize;
+		a->nalloc++;
+		a->bytes += size - oldsize;
+		return p;
+	}
+
+	np = arena_alloc(a, size);
+	if (np)
+		memcpy(np, p, oldsize);
+	return np;
+}
+
+/*
+ * Give back everything allocated since the last reset.
+ */
+void arena_reset(struct arena *a)
+{
+	a->commands++;
+	a->last_nalloc = a->nalloc;
+	a->last_bytes = a->bytes;
+	if (a->nalloc > a->max_nalloc)
+		a->max_nalloc = a->nalloc;
+	if (a->bytes > a->max_bytes)
+		a->max_bytes = a->bytes;
+	a->total_nalloc += a->nalloc;
+
+	chunks_free(a->base->next);
+	a->base->next = NULL;
+	a->base->used = 0;
+	a->cur = a->base;
+	a->last = NULL;
+	a->nalloc = 0;
+	a->bytes = 0;
+}
@@ -0,0 +1,58 @@
+/*
+ * Per-command allocation arena.
+ *
+ * Copyright (C) 2007 OSD Team <pvfs-osd@osc.edu>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, version 2 of the License.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#ifndef __ARENA_H
+#define __ARENA_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include "osd-types.h"
+
+struct arena_chunk;
+
+struct arena {
+	struct arena_chunk *base;	/* kept across commands */
+	struct arena_chunk *cur;	/* chunk being carved */
+	void *last;			/* most recent allocation */
+	uint64_t nalloc;		/* allocations since the last reset */
+	uint64_t bytes;			/* bytes handed out since then */
+
+	/* statistics, see ROOT_STATS_PG */
+	uint64_t commands;		/* resets */
+	uint64_t last_nalloc;		/* of the previous command */
+	uint64_t last_bytes;
+	uint64_t max_nalloc;		/* largest of any command */
+	uint64_t max_bytes;
+	uint64_t total_nalloc;
+	uint64_t mallocs;		/* chunks beyond the base one */
+};
+
+int arena_init(struct osd_device *osd);
+
+void arena_fini(struct osd_device *osd);
+
+struct arena *arena_new(void);
+
+void arena_free(struct arena *a);
+
+void *arena_alloc(struct arena *a, size_t size);
+
+void *arena_realloc(struct arena *a, void *p, size_t oldsize, size_t size);
+
+void arena_reset(struct arena *a);
+
+#endif /* __ARENA_H */
@@ -0,0 +1,670 @@
+/*
+ * Asynchronous command submission.
+ *
+ * Copyright (C) 2007 OSD Team <pvfs-osd@osc.edu>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, version 2 of the License.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/*
+ * osdemu_cmd_submit_async queues a command and returns; one of
+ * ASYNC_THREADS workers runs it through osdemu_cmd_submit and puts it on
+ * the completion queue. Each completion adds to an eventfd, so the
+ * transport can poll it along with its sockets, then call
+ * osdemu_async_reap to run the done callbacks on its own thread.
+ *
+ * The db handle, caches and counters of the device are used by one
+ * command at a time: once async is started, every submission path takes
+ * the device lock for the length of the command, except while a READ or
+ * WRITE moves its data to or from the data file (async_io_begin and
+ * async_io_end).  The fd and the buffers are its own then; its arena
+ * and timings are put aside and a spare arena serves the commands that
+ * run meanwhile.  Within a batch or a db transaction the lock is kept,
+ * as their commands must not interleave with others.  So the workers
+ * overlap the data transfers of the commands in flight, and those
+ * complete in any order, as SIMPLE tasks. Dependent commands must wait
+ * for the completion of the one before.
+ *
+ * Steps of background jobs (job.c) that commands left pending are run by
+ * a worker with nothing else to do, so they finish on an idle target too.
+ *
+ * A CAS WAIT whose value has not changed yet is parked instead of run:
+ * it waits on a list, oldest first, without holding a worker.  A change
+ * of the CAS value of an object (async_wake) marks its waiters woken; one
+ * worker at a time goes through the woken ones in list order, so they
+ * complete in the order they came, and either runs a waiter or leaves it
+ * in its place if the value is the same again.  Waiters past their
+ * deadline are woken by the idle workers.  Callers of osdemu_cmd_submit
+ * on other threads wait on the same list, each on a cond of its own.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sys/eventfd.h>
+#include <assert.h>
+
+#include "osd.h"
+#include "cdb.h"
+#include "async.h"
+#include "lat.h"
+#include "arena.h"
+#include "job.h"
+#include "osd-util/osd-util.h"
+
+#define ASYNC_THREADS 4
+#define ASYNC_SPARE ASYNC_THREADS	/* arenas kept for async_io_begin */
+
+struct async_req {
+	struct async_req *next;
+	struct osdemu_cmd *cmd;
+	osdemu_done_t done;
+	void *arg;
+	struct async_wait w;	/* of a parked CAS WAIT */
+};
+
+struct async_queue {
+	pthread_mutex_t dev_lock;	/* held while a command runs */
+	struct arena *spare[ASYNC_SPARE];	/* under dev_lock */
+	int nspare;
+
+	pthread_mutex_t lock;		/* protects everything below */
+	pthread_cond_t more;
+	struct async_req *shead, *stail;	/* submitted */
+	struct async_req *chead, *ctail;	/* completed */
+	struct async_wait *whead, *wtail;	/* waiting, oldest first */
+	int nwait;		/* read without the lock by async_wake */
+	int nparked;		/* commands among them */
+	int nready;		/* woken commands */
+	int serving;		/* a worker goes through those */
+	int jobs;		/* background jobs are pending */
+	int stop;
+
+	int efd;
+	int nthreads;
+	pthread_t threads[ASYNC_THREADS];
+	struct osd_device *osd;
+};
+
+static void push(struct async_req **head, struct async_req **tail,
+		 struct async_req *req)
+{
+	req->next = NULL;
+	if (*tail)
+		(*tail)->next = req;
+	else
+		*head = req;
+	*tail = req;
+}
+
+static struct async_req *pop(struct async_req **head, struct async_req **tail)
+{
+	struct async_req *req = *head;
+
+	if (req) {
+		*head = req->next;
+		if (!*head)
+			*tail = NULL;
+	}
+	return req;
+}
+
+static void wait_unlink(struct async_queue *aq, struct async_wait *w)
+{
+	struct async_wait *p, **pp;
+
+	for (pp = &aq->whead, p = NULL; *pp != w; p = *pp, pp = &p->next)
+		assert(*pp);
+	*pp = w->next;
+	if (aq->wtail == w)
+		aq->wtail = p;
+	__atomic_sub_fetch(&aq->nwait, 1, __ATOMIC_SEQ_CST);
+	if (w->req)
+		aq->nparked--;
+	if (w->woken && w->req)
+		aq->nready--;
+}
+
+static void wait_link(struct async_queue *aq, struct async_wait *w)
+{
+	w->next = NULL;
+	w->woken = 0;
+	if (aq->wtail)
+		aq->wtail->next = w;
+	else
+		aq->whead = w;
+	aq->wtail = w;
+	if (w->req)
+		aq->nparked++;
+	/* before the value is looked at, see async_wake */
+	__atomic_add_fetch(&aq->nwait, 1, __ATOMIC_SEQ_CST);
+}
+
+/* lock held */
+static void wake(struct async_queue *aq, uint64_t pid, uint64_t oid,
+		 int all)
+{
+	struct async_wait *w;
+
+	for (w = aq->whead; w; w = w->next) {
+		if (w->woken || (!all && (w->pid != pid || w->oid != oid)))
+			continue;
+		w->woken = 1;
+		if (w->req)
+			aq->nready++;
+		else
+			pthread_cond_signal(&w->cond);
+	}
+	if (aq->nready)
+		pthread_cond_signal(&aq->more);
+}
+
+/*
+ * Run the command and queue its completion.  Called and returns without
+ * the lock.
+ */
+static void run(struct async_queue *aq, struct async_req *req)
+{
+	uint64_t one = 1;
+	struct osdemu_cmd *c = req->cmd;
+
+	c->senselen_out = 0;
+	c->status = cmd_run(aq->osd, c->cdb, c->data_in, c->data_in_len,
+			    &c->data_out, &c->data_out_len, c->sense_out,
+			    &c->senselen_out);
+
+	pthread_mutex_lock(&aq->lock);
+	push(&aq->chead, &aq->ctail, req);
+	if (write(aq->efd, &one, sizeof(one)) != sizeof(one))
+		osd_error_errno("%s: eventfd write", __func__);
+	pthread_mutex_unlock(&aq->lock);
+}
+
+/*
+ * A CAS WAIT that has to wait is parked.  Called without the lock.
+ *
+ * returns: 1 if parked, 0 if the command is to run now
+ */
+static int park(struct async_queue *aq, struct async_req *req)
+{
+	struct osdemu_cmd *c = req->cmd;
+
+	if (cmd_wait_parse(c->cdb, c->data_in, c->data_in_len,
+			   &req->w) != OSD_OK)
+		return 0;
+	req->w.req = req;
+	req->w.aq = aq;
+
+	pthread_mutex_lock(&aq->lock);
+	if (aq->stop) {
+		pthread_mutex_unlock(&aq->lock);
+		return 0;
+	}
+	wait_link(aq, &req->w);
+	pthread_mutex_unlock(&aq->lock);
+
+	if (cmd_wait_check(aq->osd, &req->w))
+		return 1; /* if woken meanwhile, it is looked at again */
+
+	pthread_mutex_lock(&aq->lock);
+	wait_unlink(aq, &req->w);
+	pthread_mutex_unlock(&aq->lock);
+	return 0;
+}
+
+static struct async_wait *first_ready(struct async_queue *aq)
+{
+	struct async_wait *w;
+
+	for (w = aq->whead; w; w = w->next)
+		if (w->woken && w->req)
+			return w;
+	return NULL;
+}
+
+/*
+ * Go through the woken commands, oldest first.  Lock held; dropped while
+ * a value is looked at or a command runs.
+ */
+static void serve(struct async_queue *aq)
+{
+	int keep, stop;
+	struct async_wait *w;
+
+	aq->serving = 1;
+	while ((w = first_ready(aq)) != NULL) {
+		w->woken = 0;
+		aq->nready--;
+		stop = aq->stop;
+		pthread_mutex_unlock(&aq->lock);
+		keep = !stop && cmd_wait_check(aq->osd, w);
+		pthread_mutex_lock(&aq->lock);
+		if (keep)
+			continue; /* same value again, stays in its place */
+
+		wait_unlink(aq, w);
+		pthread_mutex_unlock(&aq->lock);
+		run(aq, w->req);
+		pthread_mutex_lock(&aq->lock);
+	}
+	aq->serving = 0;
+}
+
+/*
+ * Nothing to do: sleep until there is, or the next parked command times
+ * out.  Lock held.
+ */
+static void idle(struct async_queue *aq)
+{
+	uint64_t now, next = 0;
+	struct timespec ts;
+	struct async_wait *w;
+
+	for (w = aq->whead; w; w = w->next)
+		if (w->req && !w->woken && (!next || w->deadline < next))
+			next = w->deadline;
+	if (!next) {
+		pthread_cond_wait(&aq->more, &aq->lock);
+		return;
+	}
+
+	ts.tv_sec = next / 1000000000ULL;
+	ts.tv_nsec = next % 1000000000ULL;
+	pthread_cond_timedwait(&aq->more, &aq->lock, &ts);
+
+	now = lat_now();
+	for (w = aq->whead; w; w = w->next) {
+		if (w->req && !w->woken && w->deadline <= now) {
+			w->woken = 1;
+			aq->nready++;
+		}
+	}
+}
+
+/*
+ * One step of the background jobs, under the device lock.  Lock held;
+ * dropped meanwhile.
+ */
+static void run_job(struct async_queue *aq)
+{
+	int pending;
+	struct async_queue *dev;
+
+	aq->jobs = 0;
+	pthread_mutex_unlock(&aq->lock);
+	dev = async_lock(aq->osd);
+	pending = job_run(aq->osd, 1);
+	async_unlock(dev);
+	pthread_mutex_lock(&aq->lock);
+	if (pending)
+		aq->jobs = 1;
+}
+
+static void *worker(void *arg)
+{
+	struct async_req *req;
+	struct async_queue *aq = arg;
+
+	pthread_mutex_lock(&aq->lock);
+	for (;;) {
+		if (aq->nready && !aq->serving) {
+			serve(aq);
+			continue;
+		}
+		req = pop(&aq->shead, &aq->stail);
+		if (!req) {
+			if (aq->stop && !aq->nparked)
+				break;
+			if (aq->jobs && !aq->stop) {
+				run_job(aq);
+				continue;
+			}
+			idle(aq);
+			continue;
+		}
+		pthread_mutex_unlock(&aq->lock);
+
+		if (!park(aq, req))
+			run(aq, req);
+
+		pthread_mutex_lock(&aq->lock);
+	}
+	pthread_mutex_unlock(&aq->lock);
+	return NULL;
+}
+
+/*
+ * returns: the eventfd that becomes readable on completions, <0 on error
+ */
+int async_init(struct osd_device *osd)
+{
+	int i, ret;
+	struct async_queue *aq;
+	pthread_condattr_t attr;
+
+	if (osd->aq)
+		return osd->aq->efd;
+
+	aq = Calloc(1, sizeof(*aq));
+	if (!aq)
+		return -ENOMEM;
+	aq->efd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+	if (aq->efd < 0) {
+		ret = -errno;
+		osd_error_errno("%s: eventfd", __func__);
+		free(aq);
+		return ret;
+	}
+	pthread_mutex_init(&aq->dev_lock, NULL);
+	pthread_mutex_init(&aq->lock, NULL);
+	pthread_condattr_init(&attr);
+	pthread_condattr_setclock(&attr, CLOCK_MONOTONIC); /* as lat_now */
+	pthread_cond_init(&aq->more, &attr);
+	pthread_condattr_destroy(&attr);
+	aq->osd = osd;
+
+	for (i = 0; i < ASYNC_THREADS; i++) {
+		ret = pthread_create(&aq->threads[i], NULL, worker, aq);
+		if (ret != 0) {
+			osd_error("%s: pthread_create: %s", __func__,
+				  strerror(ret));
+			break;
+		}
+		aq->nthreads++;
+	}
+	if (aq->nthreads == 0) {
+		pthread_cond_destroy(&aq->more);
+		pthread_mutex_destroy(&aq->lock);
+		pthread_mutex_destroy(&aq->dev_lock);
+		close(aq->efd);
+		free(aq);
+		return -ret;
+	}
+
+	__atomic_store_n(&osd->aq, aq, __ATOMIC_RELEASE);
+	return aq->efd;
+}
+
+/*
+ * Runs what was submitted and parked, then the callbacks of all completions not yet
+ * reaped, so their buffers can be released.
+ */
+void async_fini(struct osd_device *osd)
+{
+	int i;
+	struct async_queue *aq = osd->aq;
+
+	if (!aq)
+		return;
+
+	pthread_mutex_lock(&aq->lock);
+	aq->stop = 1;
+	wake(aq, 0, 0, 1); /* parked commands run, at their current value */
+	pthread_cond_broadcast(&aq->more);
+	pthread_mutex_unlock(&aq->lock);
+	for (i = 0; i < aq->nthreads; i++)
+		pthread_join(aq->threads[i], NULL);
+
+	async_reap(osd, -1);
+
+	for (i = 0; i < aq->nspare; i++)
+		arena_free(aq->spare[i]);
+	pthread_cond_destroy(&aq->more);
+	pthread_mutex_destroy(&aq->lock);
+	pthread_mutex_destroy(&aq->dev_lock);
+	close(aq->efd);
+	free(aq);
+	__atomic_store_n(&osd->aq, NULL, __ATOMIC_RELEASE);
+}
+
+int async_submit(struct osd_device *osd, struct osdemu_cmd *cmd,
+		 osdemu_done_t done, void *arg)
+{
+	struct async_req *req;
+	struct async_queue *aq = osd->aq;
+
+	if (!aq)
+		return -EINVAL;
+	req = Malloc(sizeof(*req));
+	if (!req)
+		return -ENOMEM;
+	req->cmd = cmd;
+	req->done = done;
+	req->arg = arg;
+
+	pthread_mutex_lock(&aq->lock);
+	push(&aq->shead, &aq->stail, req);
+	pthread_cond_signal(&aq->more);
+	pthread_mutex_unlock(&aq->lock);
+	return OSD_OK;
+}
+
+/*
+ * Run the callbacks of at most max completed commands, all if max < 0.
+ *
+ * returns: number of callbacks run
+ */
+int async_reap(struct osd_device *osd, int max)
+{
+	int n = 0;
+	uint64_t count, one = 1;
+	struct async_req *req;
+	struct async_queue *aq = osd->aq;
+
+	if (!aq)
+		return 0;
+
+	while (max < 0 || n < max) {
+		pthread_mutex_lock(&aq->lock);
+		req = pop(&aq->chead, &aq->ctail);
+		if (!req) {
+			/* clear the counter; completions after this set it */
+			if (read(aq->efd, &count, sizeof(count)) < 0 &&
+			    errno != EAGAIN)
+				osd_error_errno("%s: eventfd read", __func__);
+			pthread_mutex_unlock(&aq->lock);
+			break;
+		}
+		pthread_mutex_unlock(&aq->lock);
+
+		req->done(req->cmd, req->arg);
+		free(req);
+		n++;
+	}
+
+	/* left some behind, keep the eventfd readable */
+	if (n == max) {
+		pthread_mutex_lock(&aq->lock);
+		if (aq->chead && write(aq->efd, &one, sizeof(one)) < 0)
+			osd_error_errno("%s: eventfd write", __func__);
+		pthread_mutex_unlock(&aq->lock);
+	}
+	return n;
+}
+
+/*
+ * Serialize a command against those of the workers. Pass the result to
+ * async_unlock.  osd->aq stays while the device is open, FORMAT OSD
+ * included, so a submitter on another thread either sees no async yet
+ * or waits for the lock.
+ */
+struct async_queue *async_lock(struct osd_device *osd)
+{
+	struct async_queue *aq = __atomic_load_n(&osd->aq, __ATOMIC_ACQUIRE);
+
+	if (aq)
+		pthread_mutex_lock(&aq->dev_lock);
+	return aq;
+}
+
+void async_unlock(struct async_queue *aq)
+{
+	if (aq)
+		pthread_mutex_unlock(&aq->dev_lock);
+}
+
+/*
+ * Let other commands run while this one, holding the device lock, moves
+ * data to or from a data file it has open.  Nothing of the device is to
+ * be touched until async_io_end.
+ *
+ * returns: 1 if the lock was let go, 0 if it is kept: async is not
+ * started, a batch or transaction is open, or no spare arena
+ */
+int async_io_begin(struct osd_device *osd, struct async_io *io)
+{
+	struct arena *a;
+	struct async_queue *aq = osd->aq;
+
+	io->aq = NULL;
+	if (!aq || osd->fdc || osd->dbc->txn_depth > 0)
+		return 0;
+	if (aq->nspare > 0)
+		a = aq->spare[--aq->nspare];
+	else
+		a = arena_new();
+	if (!a)
+		return 0;
+
+	io->aq = aq;
+	io->arena = osd->arena;
+	lat_save(osd, &io->lat);
+	osd->arena = a;
+	pthread_mutex_unlock(&aq->dev_lock);
+	return 1;
+}
+
+void async_io_end(struct osd_device *osd, struct async_io *io)
+{
+	struct async_queue *aq = io->aq;
+
+	if (!aq)
+		return;
+	pthread_mutex_lock(&aq->dev_lock);
+	if (aq->nspare < ASYNC_SPARE)
+		aq->spare[aq->nspare++] = osd->arena;
+	else
+		arena_free(osd->arena);
+	osd->arena = io->arena;
+	lat_restore(osd, &io->lat);
+}
+
+/*
+ * Park the CAS WAIT of a caller of osdemu_cmd_submit; look at the value
+ * after this.
+ *
+ * returns: -EINVAL if async is not started.  Then the caller is the only
+ * one submitting and nothing could change the value while it waits.
+ */
+int async_wait_add(struct osd_device *osd, struct async_wait *w)
+{
+	struct async_queue *aq = osd->aq;
+	pthread_condattr_t attr;
+
+	if (!aq)
+		return -EINVAL;
+	pthread_condattr_init(&attr);
+	pthread_condattr_setclock(&attr, CLOCK_MONOTONIC);
+	pthread_cond_init(&w->cond, &attr);
+	pthread_condattr_destroy(&attr);
+	w->req = NULL;
+	w->aq = aq;
+
+	pthread_mutex_lock(&aq->lock);
+	wait_link(aq, w);
+	pthread_mutex_unlock(&aq->lock);
+	return OSD_OK;
+}
+
+/*
+ * Sleep until woken or the deadline.  A waiter keeps its place in the
+ * list across sleeps.
+ *
+ * returns: -ETIMEDOUT at the deadline or when async stops
+ */
+int async_wait_sleep(struct async_wait *w)
+{
+	int woken;
+	struct timespec ts;
+	struct async_queue *aq = w->aq;
+
+	ts.tv_sec = w->deadline / 1000000000ULL;
+	ts.tv_nsec = w->deadline % 1000000000ULL;
+
+	pthread_mutex_lock(&aq->lock);
+	while (!w->woken && !aq->stop)
+		if (pthread_cond_timedwait(&w->cond, &aq->lock, &ts) != 0)
+			break;
+	woken = w->woken && !aq->stop;
+	w->woken = 0;
+	pthread_mutex_unlock(&aq->lock);
+	return woken ? OSD_OK : -ETIMEDOUT;
+}
+
+void async_wait_del(struct async_wait *w)
+{
+	struct async_queue *aq = w->aq;
+
+	pthread_mutex_lock(&aq->lock);
+	wait_unlink(aq, w);
+	pthread_mutex_unlock(&aq->lock);
+	pthread_cond_destroy(&w->cond);
+}
+
+/*
+ * The CAS value of the object changed, or may have: its waiters look
+ * again.  Cheap when nobody waits; called without the device lock by
+ * lockless CAS too.
+ */
+void async_wake(struct osd_device *osd, uint64_t pid, uint64_t oid)
+{
+	struct async_queue *aq = __atomic_load_n(&osd->aq, __ATOMIC_ACQUIRE);
+
+	if (!aq || __atomic_load_n(&aq->nwait, __ATOMIC_SEQ_CST) == 0)
+		return;
+	pthread_mutex_lock(&aq->lock);
+	wake(aq, pid, oid, 0);
+	pthread_mutex_unlock(&aq->lock);
+}
+
+void async_wake_all(struct osd_device *osd)
+{
+	struct async_queue *aq = __atomic_load_n(&osd->aq, __ATOMIC_ACQUIRE);
+
+	if (!aq || __atomic_load_n(&aq->nwait, __ATOMIC_SEQ_CST) == 0)
+		return;
+	pthread_mutex_lock(&aq->lock);
+	wake(aq, 0, 0, 1);
+	pthread_mutex_unlock(&aq->lock);
+}
+
+/*
+ * Commands leave background jobs pending: an idle worker runs their
+ * steps, one at a time, until none are left.  Called with the device
+ * lock.
+ */
+void async_jobs(struct osd_device *osd, int pending)
+{
+	struct async_queue *aq = osd->aq;
+
+	if (!aq || !pending)
+		return;
+	pthread_mutex_lock(&aq->lock);
+	if (!aq->jobs) {
+		aq->jobs = 1;
+		pthread_cond_signal(&aq->more);
+	}
+	pthread_mutex_unlock(&aq->lock);
+}
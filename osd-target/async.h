@@ -0,0 +1,94 @@
+/*
+ * Asynchronous command submission.
+ *
+ * Copyright (C) 2007 OSD Team <pvfs-osd@osc.edu>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, version 2 of the License.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#ifndef __ASYNC_H
+#define __ASYNC_H
+
+#include <pthread.h>
+#include "osd-types.h"
+#include "cdb.h"
+#include "lat.h"
+
+/*
+ * A CAS WAIT, parked while the CAS value of its object is val: either a
+ * caller of osdemu_cmd_submit sleeping on cond, or a command of the
+ * workers (req).
+ */
+struct async_req;
+struct async_wait {
+	struct async_wait *next;
+	uint64_t pid;
+	uint64_t oid;
+	uint64_t val;
+	uint64_t deadline;	/* lat_now() */
+	int woken;
+	pthread_cond_t cond;
+	struct async_req *req;
+	struct async_queue *aq;
+};
+
+/*
+ * A command that let go of the device lock for its data transfer, with
+ * what it keeps aside meanwhile.
+ */
+struct arena;
+struct async_io {
+	struct async_queue *aq;	/* NULL if it kept the lock */
+	struct arena *arena;
+	struct lat_cmd lat;
+};
+
+int async_init(struct osd_device *osd);
+
+void async_fini(struct osd_device *osd);
+
+int async_submit(struct osd_device *osd, struct osdemu_cmd *cmd,
+		 osdemu_done_t done, void *arg);
+
+int async_reap(struct osd_device *osd, int max);
+
+struct async_queue *async_lock(struct osd_device *osd);
+
+void async_unlock(struct async_queue *aq);
+
+int async_io_begin(struct osd_device *osd, struct async_io *io);
+
+void async_io_end(struct osd_device *osd, struct async_io *io);
+
+int async_wait_add(struct osd_device *osd, struct async_wait *w);
+
+int async_wait_sleep(struct async_wait *w);
+
+void async_wait_del(struct async_wait *w);
+
+void async_wake(struct osd_device *osd, uint64_t pid, uint64_t oid);
+
+void async_wake_all(struct osd_device *osd);
+
+void async_jobs(struct osd_device *osd, int pending);
+
+/* in cdb.c */
+int cmd_run(struct osd_device *osd, uint8_t *cdb, const uint8_t *data_in,
+	    uint64_t data_in_len, uint8_t **data_out, uint64_t *data_out_len,
+	    uint8_t *sense_out, int *senselen_out);
+
+int cmd_wait_parse(const uint8_t *cdb, const uint8_t *data_in,
+		   uint64_t data_in_len, struct async_wait *w);
+
+int cmd_wait_check(struct osd_device *osd, const struct async_wait *w);
+
+#endif /* __ASYNC_H */
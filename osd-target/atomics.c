@@ -0,0 +1,493 @@
+/*
+ * User object atomics table.
+ *
+ * Copyright (C) 2007 OSD Team <pvfs-osd@osc.edu>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, version 2 of the License.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/*
+ * The CAS and FA values of user objects (UAP_CAS and UAP_FA of
+ * USER_ATOMICS_PG), held in memory so those commands need no db access
+ * and can run without the device lock, see osdemu_cmd_submit.
+ *
+ * A user object gets an entry on its first CAS or FA under the lock.
+ * From then on both values are changed with atomic instructions, by any
+ * number of threads, and written to the attr table later ("write-behind"):
+ * before any other command runs under the lock, and when a lockless
+ * command finds the last write more than the interval ago; a CAS or FA
+ * that has to take the lock then writes them.  So everything that reads
+ * attributes sees the current values, and FLUSH, osd_close and FORMAT
+ * leave nothing behind.
+ *
+ * A CAS that changes the value, and atomics_forget, wake the CAS WAITs
+ * of the object, see async.c.
+ *
+ * On a crash the changes since the last write are lost: after restart
+ * the values are those of at most the interval, default ATOMICS_SYNC_MS,
+ * before the last CAS or FA that reported success, and no command other
+ * than CAS and FA will have seen a value that is lost.
+ *
+ * The table is open addressed.  A slot gets its key while empty, under
+ * the lock, and then goes live.  A lockless user counts itself in the
+ * slot's users and then checks that it is live and still has its key;
+ * whoever takes a slot out of use under the lock marks it dead and waits
+ * for users to drain before touching it.  Dead slots keep the key and
+ * come back to life if the object does.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <sched.h>
+#include <assert.h>
+
+#include "osd.h"
+#include "db.h"
+#include "attr.h"
+#include "lat.h"
+#include "async.h"
+#include "atomics.h"
+#include "osd-util/osd-util.h"
+
+#define ATOMICS_SLOTS 16384 /* power of 2 */
+#define ATOMICS_PROBE 8
+
+enum {
+	ENT_EMPTY = 0,
+	ENT_LIVE = 1,
+	ENT_DEAD = 2,
+};
+
+/* one per cache line, ops on different objects do not share */
+struct atomic_ent {
+	uint64_t pid;
+	uint64_t oid;
+	uint64_t cas;
+	uint64_t fa;
+	uint64_t db_cas;	/* values in the db, lock held */
+	uint64_t db_fa;
+	uint32_t users;		/* lockless ops inside */
+	uint32_t state;
+	uint32_t dirty;		/* changed since written */
+} __attribute__((aligned(64)));
+
+struct atomics_table {
+	struct atomic_ent slot[ATOMICS_SLOTS];
+	uint64_t dirtymap[ATOMICS_SLOTS / 64];	/* slots maybe dirty */
+	uint64_t interval;	/* ns, 0 if the table is not used */
+	uint64_t last_sync;
+	uint32_t next_evict;
+	struct atomics_table *retired;	/* see atomics_keep */
+};
+
+static inline struct atomics_table *table(struct osd_device *osd)
+{
+	return __atomic_load_n(&osd->at, __ATOMIC_ACQUIRE);
+}
+
+static inline uint32_t slot_hash(uint64_t pid, uint64_t oid)
+{
+	return (oid ^ (pid * 0x9e3779b1)) & (ATOMICS_SLOTS - 1);
+}
+
+int atomics_init(struct osd_device *osd)
+{
+	struct atomics_table *at;
+
+	if (posix_memalign((void **) &at, 64, sizeof(*at)) != 0)
+		return -ENOMEM;
+	memset(at, 0, sizeof(*at));
+	at->interval = ATOMICS_SYNC_MS * 1000000ULL;
+	at->last_sync = lat_now();
+	__atomic_store_n(&osd->at, at, __ATOMIC_RELEASE);
+	return OSD_OK;
+}
+
+void atomics_fini(struct osd_device *osd)
+{
+	struct atomics_table *at = osd->at, *next;
+
+	if (!at)
+		return;
+	if (atomics_sync(osd) != OSD_OK)
+		osd_error("%s: CAS and FA values not written", __func__);
+	__atomic_store_n(&osd->at, NULL, __ATOMIC_RELEASE);
+	for (; at; at = next) {
+		next = at->retired;
+		free(at);
+	}
+}
+
+/*
+ * FORMAT OSD keeps the table, emptied by atomics_drop, across its
+ * osd_close and osd_open, so lockless ops never see it freed.  The table
+ * osd_open made may have been seen by them too and stays until the end.
+ */
+void atomics_keep(struct osd_device *osd, struct atomics_table *at)
+{
+	struct atomics_table *made = osd->at;
+
+	if (!at)
+		return;
+	if (made) {
+		made->retired = at->retired;
+		at->retired = made;
+	}
+	at->last_sync = lat_now();
+	__atomic_store_n(&osd->at, at, __ATOMIC_RELEASE);
+}
+
+/*
+ * Lockless: returns the live entry of the object with the caller counted
+ * in its users, NULL if there is none.
+ */
+static struct atomic_ent *ent_get(struct atomics_table *at, uint64_t pid,
+				  uint64_t oid)
+{
+	int i;
+	uint32_t h = slot_hash(pid, oid);
+	struct atomic_ent *e;
+
+	for (i = 0; i < ATOMICS_PROBE; i++) {
+		e = &at->slot[(h + i) & (ATOMICS_SLOTS - 1)];
+		if (__atomic_load_n(&e->state, __ATOMIC_ACQUIRE) == ENT_EMPTY)
+			return NULL;
+		if (__atomic_load_n(&e->pid, __ATOMIC_RELAXED) != pid ||
+		    __atomic_load_n(&e->oid, __ATOMIC_RELAXED) != oid)
+			continue;
+
+		__atomic_fetch_add(&e->users, 1, __ATOMIC_SEQ_CST);
+		if (__atomic_load_n(&e->state, __ATOMIC_SEQ_CST) == ENT_LIVE &&
+		    __atomic_load_n(&e->pid, __ATOMIC_RELAXED) == pid &&
+		    __atomic_load_n(&e->oid, __ATOMIC_RELAXED) == oid)
+			return e;
+		__atomic_fetch_sub(&e->users, 1, __ATOMIC_RELEASE);
+		return NULL;
+	}
+	return NULL;
+}
+
+static void ent_put(struct atomics_table *at, struct atomic_ent *e,
+		    int changed)
+{
+	uint32_t i = e - at->slot;
+
+	if (changed && !__atomic_load_n(&e->dirty, __ATOMIC_SEQ_CST)) {
+		__atomic_store_n(&e->dirty, 1, __ATOMIC_SEQ_CST);
+		__atomic_fetch_or(&at->dirtymap[i / 64], 1ULL << (i % 64),
+				  __ATOMIC_SEQ_CST);
+	}
+	__atomic_fetch_sub(&e->users, 1, __ATOMIC_RELEASE);
+}
+
+/*
+ * Lockless.  returns: OSD_OK with the value before in orig, -EAGAIN if
+ * the object has no entry; then the command must take the lock.
+ */
+int atomics_cas(struct osd_device *osd, uint64_t pid, uint64_t oid,
+		uint64_t cmp, uint64_t swap, uint64_t *orig)
+{
+	int swapped;
+	struct atomics_table *at = table(osd);
+	struct atomic_ent *e;
+
+	if (!at || !(e = ent_get(at, pid, oid)))
+		return -EAGAIN;
+	*orig = cmp; /* replaced by the value if it is not cmp */
+	swapped = __atomic_compare_exchange_n(&e->cas, orig, swap, 0,
+					      __ATOMIC_SEQ_CST,
+					      __ATOMIC_SEQ_CST);
+	ent_put(at, e, swapped);
+	if (swapped && cmp != swap)
+		async_wake(osd, pid, oid);
+	return OSD_OK;
+}
+
+/*
+ * Lockless.  returns: OSD_OK with the CAS value in val, -EAGAIN if the
+ * object has no entry.
+ */
+int atomics_peek(struct osd_device *osd, uint64_t pid, uint64_t oid,
+		 uint64_t *val)
+{
+	struct atomics_table *at = table(osd);
+	struct atomic_ent *e;
+
+	if (!at || !(e = ent_get(at, pid, oid)))
+		return -EAGAIN;
+	*val = __atomic_load_n(&e->cas, __ATOMIC_SEQ_CST);
+	ent_put(at, e, 0);
+	return OSD_OK;
+}
+
+int atomics_fa(struct osd_device *osd, uint64_t pid, uint64_t oid,
+	       uint64_t add, uint64_t *orig)
+{
+	struct atomics_table *at = table(osd);
+	struct atomic_ent *e;
+
+	if (!at || !(e = ent_get(at, pid, oid)))
+		return -EAGAIN;
+	*orig = __atomic_fetch_add(&e->fa, add, __ATOMIC_SEQ_CST);
+	ent_put(at, e, 1);
+	return OSD_OK;
+}
+
+int atomics_enabled(struct osd_device *osd)
+{
+	struct atomics_table *at = table(osd);
+
+	return at && at->interval != 0;
+}
+
+/*
+ * Lockless: is it time to write the values back?
+ */
+int atomics_due(struct osd_device *osd)
+{
+	struct atomics_table *at = table(osd);
+
+	if (!at || at->interval == 0)
+		return 0;
+	return lat_now() - __atomic_load_n(&at->last_sync, __ATOMIC_RELAXED)
+		>= at->interval;
+}
+
+/*
+ * Lock held from here on.
+ */
+
+static int ent_write(struct osd_device *osd, struct atomic_ent *e)
+{
+	int ret = OSD_OK;
+	uint64_t val;
+
+	if (!__atomic_exchange_n(&e->dirty, 0, __ATOMIC_SEQ_CST))
+		return OSD_OK;
+
+	val = __atomic_load_n(&e->cas, __ATOMIC_SEQ_CST);
+	if (val != e->db_cas) {
+		ret = attr_set_attr(osd->dbc, e->pid, e->oid, USER_ATOMICS_PG,
+				    UAP_CAS, &val, sizeof(val));
+		if (ret != OSD_OK)
+			goto out_err;
+		e->db_cas = val;
+	}
+	val = __atomic_load_n(&e->fa, __ATOMIC_SEQ_CST);
+	if (val != e->db_fa) {
+		ret = attr_set_attr(osd->dbc, e->pid, e->oid, USER_ATOMICS_PG,
+				    UAP_FA, &val, sizeof(val));
+		if (ret != OSD_OK)
+			goto out_err;
+		e->db_fa = val;
+	}
+	return OSD_OK;
+
+out_err:
+	osd_error("%s: pid %llu oid %llu", __func__, llu(e->pid),
+		  llu(e->oid));
+	__atomic_store_n(&e->dirty, 1, __ATOMIC_SEQ_CST);
+	return ret;
+}
+
+/*
+ * Take a slot out of use: no lockless op is inside or can get in.
+ */
+static void ent_kill(struct atomic_ent *e)
+{
+	__atomic_store_n(&e->state, ENT_DEAD, __ATOMIC_SEQ_CST);
+	while (__atomic_load_n(&e->users, __ATOMIC_SEQ_CST) != 0)
+		sched_yield();
+}
+
+/*
+ * Write changed values to the attr table.
+ */
+int atomics_sync(struct osd_device *osd)
+{
+	int ret = OSD_OK;
+	int in_txn = 0;
+	uint32_t w, b;
+	uint64_t bits;
+	struct atomics_table *at = osd->at;
+	struct atomic_ent *e;
+
+	if (!at)
+		return OSD_OK;
+	at->last_sync = lat_now();
+
+	for (w = 0; w < ATOMICS_SLOTS / 64; w++) {
+		if (__atomic_load_n(&at->dirtymap[w], __ATOMIC_RELAXED) == 0)
+			continue;
+		bits = __atomic_exchange_n(&at->dirtymap[w], 0,
+					   __ATOMIC_SEQ_CST);
+		if (!in_txn) {
+			ret = db_begin_txn(osd->dbc);
+			if (ret != OSD_OK) {
+				__atomic_fetch_or(&at->dirtymap[w], bits,
+						  __ATOMIC_SEQ_CST);
+				return ret;
+			}
+			in_txn = 1;
+		}
+		for (b = 0; bits; b++, bits >>= 1) {
+			if (!(bits & 1))
+				continue;
+			e = &at->slot[w * 64 + b];
+			if (ent_write(osd, e) != OSD_OK) {
+				/* again the next time */
+				__atomic_fetch_or(&at->dirtymap[w], 1ULL << b,
+						  __ATOMIC_SEQ_CST);
+				ret = OSD_ERROR;
+			}
+		}
+	}
+	if (in_txn)
+		db_end_txn(osd->dbc);
+	return ret;
+}
+
+static struct atomic_ent *ent_find(struct atomics_table *at, uint64_t pid,
+				   uint64_t oid)
+{
+	int i;
+	uint32_t h = slot_hash(pid, oid);
+	struct atomic_ent *e;
+
+	for (i = 0; i < ATOMICS_PROBE; i++) {
+		e = &at->slot[(h + i) & (ATOMICS_SLOTS - 1)];
+		if (e->state == ENT_EMPTY)
+			return NULL;
+		if (e->pid == pid && e->oid == oid)
+			return e;
+	}
+	return NULL;
+}
+
+/*
+ * returns: a slot for the object, emptied.  One of its probe window is
+ * given up if all are taken.
+ */
+static struct atomic_ent *ent_alloc(struct osd_device *osd,
+				    struct atomics_table *at, uint64_t pid,
+				    uint64_t oid)
+{
+	int i;
+	uint32_t h = slot_hash(pid, oid);
+	struct atomic_ent *e, *dead = NULL;
+
+	for (i = 0; i < ATOMICS_PROBE; i++) {
+		e = &at->slot[(h + i) & (ATOMICS_SLOTS - 1)];
+		if (e->state == ENT_EMPTY)
+			return e;
+		if (e->state == ENT_DEAD && !dead)
+			dead = e;
+	}
+	e = dead;
+	if (!e) {
+		e = &at->slot[(h + at->next_evict++ % ATOMICS_PROBE) &
+			      (ATOMICS_SLOTS - 1)];
+		ent_kill(e);
+		if (ent_write(osd, e) != OSD_OK)
+			return NULL;
+	}
+	/* the probe chains through e stay intact, keep it non-empty */
+	return e;
+}
+
+/*
+ * Make the object's CAS and FA values, as read from the db, live.
+ * returns: -EAGAIN if the table is not used
+ */
+int atomics_load(struct osd_device *osd, uint64_t pid, uint64_t oid,
+		 uint64_t cas, uint64_t fa)
+{
+	struct atomics_table *at = osd->at;
+	struct atomic_ent *e;
+
+	if (!atomics_enabled(osd))
+		return -EAGAIN;
+
+	e = ent_find(at, pid, oid);
+	if (e && e->state == ENT_LIVE)
+		return OSD_OK;
+	if (!e)
+		e = ent_alloc(osd, at, pid, oid);
+	if (!e)
+		return -EAGAIN;
+
+	__atomic_store_n(&e->pid, pid, __ATOMIC_RELAXED);
+	__atomic_store_n(&e->oid, oid, __ATOMIC_RELAXED);
+	e->cas = e->db_cas = cas;
+	e->fa = e->db_fa = fa;
+	e->dirty = 0;
+	__atomic_store_n(&e->state, ENT_LIVE, __ATOMIC_RELEASE);
+	return OSD_OK;
+}
+
+/*
+ * The object is removed or its atomics page is about to be changed
+ * through the db.
+ */
+void atomics_forget(struct osd_device *osd, uint64_t pid, uint64_t oid,
+		    int writeback)
+{
+	struct atomic_ent *e = NULL;
+
+	if (osd->at)
+		e = ent_find(osd->at, pid, oid);
+	if (e && e->state == ENT_LIVE) {
+		ent_kill(e);
+		if (writeback)
+			ent_write(osd, e);
+		else
+			e->dirty = 0;
+	}
+	/* CAS WAITs look again; with no entry they wait for the lock */
+	async_wake(osd, pid, oid);
+}
+
+/*
+ * Forget all, nothing is written.  For FORMAT OSD.
+ */
+void atomics_drop(struct osd_device *osd)
+{
+	int i;
+	struct atomics_table *at = osd->at;
+
+	if (!at)
+		return;
+	for (i = 0; i < ATOMICS_SLOTS; i++) {
+		if (at->slot[i].state != ENT_LIVE)
+			continue;
+		ent_kill(&at->slot[i]);
+		at->slot[i].dirty = 0;
+	}
+}
+
+void atomics_set_interval(struct osd_device *osd, uint32_t ms)
+{
+	int i;
+	struct atomics_table *at = osd->at;
+
+	if (!at)
+		return;
+	for (i = 0; ms == 0 && i < ATOMICS_SLOTS; i++) {
+		if (at->slot[i].state != ENT_LIVE)
+			continue;
+		ent_kill(&at->slot[i]);
+		ent_write(osd, &at->slot[i]);
+	}
+	at->interval = ms * 1000000ULL;
+}
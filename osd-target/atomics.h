@@ -0,0 +1,57 @@
+/*
+ * User object atomics table.
+ *
+ * Copyright (C) 2007 OSD Team <pvfs-osd@osc.edu>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, version 2 of the License.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#ifndef __ATOMICS_H
+#define __ATOMICS_H
+
+#include <stdint.h>
+#include "osd-types.h"
+
+#define ATOMICS_SYNC_MS 1000 /* default write-behind interval */
+
+int atomics_init(struct osd_device *osd);
+
+void atomics_fini(struct osd_device *osd);
+
+void atomics_keep(struct osd_device *osd, struct atomics_table *at);
+
+void atomics_set_interval(struct osd_device *osd, uint32_t ms);
+
+int atomics_cas(struct osd_device *osd, uint64_t pid, uint64_t oid,
+		uint64_t cmp, uint64_t swap, uint64_t *orig);
+
+int atomics_fa(struct osd_device *osd, uint64_t pid, uint64_t oid,
+	       uint64_t add, uint64_t *orig);
+
+int atomics_peek(struct osd_device *osd, uint64_t pid, uint64_t oid,
+		 uint64_t *val);
+
+int atomics_enabled(struct osd_device *osd);
+
+int atomics_due(struct osd_device *osd);
+
+int atomics_load(struct osd_device *osd, uint64_t pid, uint64_t oid,
+		 uint64_t cas, uint64_t fa);
+
+int atomics_sync(struct osd_device *osd);
+
+void atomics_forget(struct osd_device *osd, uint64_t pid, uint64_t oid,
+		    int writeback);
+
+void atomics_drop(struct osd_device *osd);
+
+#endif /* __ATOMICS_H */
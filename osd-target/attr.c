@@ -41,8 +41,10 @@ struct attr_tab {
 	sqlite3_stmt *setattr;  /* set an attr by inserting row */
 	sqlite3_stmt *delattr;  /* delete an attr */
 	sqlite3_stmt *delall;   /* delete all attr for an object */
+	sqlite3_stmt *delpage;  /* delete a page from every object */
 	sqlite3_stmt *getattr;  /* get an attr */
 	sqlite3_stmt *getval;   /* get attribute value */
+	sqlite3_stmt *rngval;   /* get an attribute of a range of objects */
 	sqlite3_stmt *pgaslst;  /* get page as list */
 	sqlite3_stmt *forallpg; /* for all pages get an attribute */
 	sqlite3_stmt *getall;   /* get all attributes of an object */
@@ -91,49 +93,61 @@ int attr_initialize(struct db_context *dbc)
 
 	sprintf(SQL, "INSERT OR REPLACE INTO %s VALUES (?, ?, ?, ?, ?);", 
 		dbc->attr->name);
-	ret = sqlite3_prepare(dbc->db, SQL, -1, &dbc->attr->setattr, NULL);
+	ret = db_prepare_lazy(dbc, SQL, &dbc->attr->setattr);
 	if (ret != SQLITE_OK)
 		goto out_finalize_setattr;
 
 	sprintf(SQL, "DELETE FROM %s WHERE pid = ? AND oid = ? AND page = ? "
 		" AND number = ?;", dbc->attr->name);
-	ret = sqlite3_prepare(dbc->db, SQL, -1, &dbc->attr->delattr, NULL);
+	ret = db_prepare_lazy(dbc, SQL, &dbc->attr->delattr);
 	if (ret != SQLITE_OK)
 		goto out_finalize_delattr;
 
 	sprintf(SQL, "DELETE FROM %s WHERE pid = ? AND oid = ?;",
 		dbc->attr->name);
-	ret = sqlite3_prepare(dbc->db, SQL, -1, &dbc->attr->delall, NULL);
+	ret = db_prepare_lazy(dbc, SQL, &dbc->attr->delall);
 	if (ret != SQLITE_OK)
 		goto out_finalize_delall;
 
+	sprintf(SQL, "DELETE FROM %s WHERE page = ?;", dbc->attr->name);
+	ret = db_prepare_lazy(dbc, SQL, &dbc->attr->delpage);
+	if (ret != SQLITE_OK)
+		goto out_finalize_delpage;
+
 	sprintf(SQL, "SELECT page, number, value FROM %s WHERE pid = ? AND "
 		" oid = ? AND page = ? AND number = ?;", dbc->attr->name);
-	ret = sqlite3_prepare(dbc->db, SQL, -1, &dbc->attr->getattr, NULL);
+	ret = db_prepare_lazy(dbc, SQL, &dbc->attr->getattr);
 	if (ret != SQLITE_OK)
 		goto out_finalize_getattr;
 
 	sprintf(SQL, "SELECT value FROM %s WHERE pid = ? AND oid = ? AND "
 		" page = ? AND number = ?;", dbc->attr->name);
-	ret = sqlite3_prepare(dbc->db, SQL, -1, &dbc->attr->getval, NULL);
+	ret = db_prepare_lazy(dbc, SQL, &dbc->attr->getval);
 	if (ret != SQLITE_OK)
 		goto out_finalize_getval;
 
+	sprintf(SQL, "SELECT oid, value FROM %s WHERE pid = ? AND "
+		" oid BETWEEN ? AND ? AND page = ? AND number = ? "
+		" ORDER BY oid;", dbc->attr->name);
+	ret = db_prepare_lazy(dbc, SQL, &dbc->attr->rngval);
+	if (ret != SQLITE_OK)
+		goto out_finalize_rngval;
+
 	sprintf(SQL, "SELECT page, number, value FROM %s WHERE pid = ? AND "
 		" oid = ? AND page = ?;", dbc->attr->name);
-	ret = sqlite3_prepare(dbc->db, SQL, -1, &dbc->attr->pgaslst, NULL);
+	ret = db_prepare_lazy(dbc, SQL, &dbc->attr->pgaslst);
 	if (ret != SQLITE_OK)
 		goto out_finalize_pgaslst;
 
 	sprintf(SQL, "SELECT page, number, value FROM %s WHERE pid = ? AND "
 		" oid = ? AND number = ?;", dbc->attr->name);
-	ret = sqlite3_prepare(dbc->db, SQL, -1, &dbc->attr->forallpg, NULL);
+	ret = db_prepare_lazy(dbc, SQL, &dbc->attr->forallpg);
 	if (ret != SQLITE_OK)
 		goto out_finalize_forallpg;
 
 	sprintf(SQL, "SELECT page, number, value FROM %s WHERE pid = ? AND "
 		"oid = ?;", dbc->attr->name);
-	ret = sqlite3_prepare(dbc->db, SQL, -1, &dbc->attr->getall, NULL);
+	ret = db_prepare_lazy(dbc, SQL, &dbc->attr->getall);
 	if (ret != SQLITE_OK)
 		goto out_finalize_getall;
 
@@ -157,7 +171,7 @@ int attr_initialize(struct db_context *dbc)
 		" SELECT page, value FROM attr "
 		"   WHERE pid = @pid AND oid = @oid AND number = 0;", 
 		dbc->attr->name);
-	ret = sqlite3_prepare(dbc->db, SQL, -1, &dbc->attr->dirpage, NULL);
+	ret = db_prepare_lazy(dbc, SQL, &dbc->attr->dirpage);
 	if (ret != SQLITE_OK)
 		goto out_finalize_dirpage;
 
@@ -176,12 +190,18 @@ out_finalize_forallpg:
 out_finalize_pgaslst:
 	db_sqfinalize(dbc->db, dbc->attr->pgaslst, SQL);
 	SQL[0] = '\0';
+out_finalize_rngval:
+	db_sqfinalize(dbc->db, dbc->attr->rngval, SQL);
+	SQL[0] = '\0';
 out_finalize_getval:
 	db_sqfinalize(dbc->db, dbc->attr->getval, SQL);
 	SQL[0] = '\0';
 out_finalize_getattr:
 	db_sqfinalize(dbc->db, dbc->attr->getattr, SQL);
 	SQL[0] = '\0';
+out_finalize_delpage:
+	db_sqfinalize(dbc->db, dbc->attr->delpage, SQL);
+	SQL[0] = '\0';
 out_finalize_delall:
 	db_sqfinalize(dbc->db, dbc->attr->delall, SQL);
 	SQL[0] = '\0';
@@ -205,12 +225,15 @@ int attr_finalize(struct db_context *dbc)
 	sqlite3_finalize(dbc->attr->setattr);
 	sqlite3_finalize(dbc->attr->delattr);
 	sqlite3_finalize(dbc->attr->delall);
+	sqlite3_finalize(dbc->attr->delpage);
 	sqlite3_finalize(dbc->attr->getattr);
 	sqlite3_finalize(dbc->attr->getval);
+	sqlite3_finalize(dbc->attr->rngval);
 	sqlite3_finalize(dbc->attr->pgaslst);
 	sqlite3_finalize(dbc->attr->forallpg);
 	sqlite3_finalize(dbc->attr->getall);
 	sqlite3_finalize(dbc->attr->dirpage);
+	db_forget_lazy(dbc, dbc->attr, sizeof(*dbc->attr));
 	free(dbc->attr->name);
 	free(dbc->attr);
 	dbc->attr = NULL;
@@ -244,7 +267,9 @@ int attr_set_attr(struct db_context *dbc, uint64_t pid, uint64_t oid,
 	int ret = 0;
 	sqlite3_stmt *stmt = NULL;
 
-	assert(dbc && dbc->db && dbc->attr && dbc->attr->setattr);
+	assert(dbc && dbc->db && dbc->attr);
+	if (db_stmt_ready(dbc, &dbc->attr->setattr) != OSD_OK)
+		return OSD_ERROR;
 
 repeat:
 	ret = 0;
@@ -274,7 +299,9 @@ int attr_delete_attr(struct db_context *dbc, uint64_t pid, uint64_t oid,
 	int ret = 0;
 	sqlite3_stmt *stmt = NULL;
 
-	assert(dbc && dbc->db && dbc->attr && dbc->attr->delattr);
+	assert(dbc && dbc->db && dbc->attr);
+	if (db_stmt_ready(dbc, &dbc->attr->delattr) != OSD_OK)
+		return OSD_ERROR;
 
 repeat:
 	ret = 0;
@@ -301,7 +328,9 @@ int attr_delete_all(struct db_context *dbc, uint64_t pid, uint64_t oid)
 {
 	int ret = 0;
 
-	assert(dbc && dbc->db && dbc->attr && dbc->attr->delall);
+	assert(dbc && dbc->db && dbc->attr);
+	if (db_stmt_ready(dbc, &dbc->attr->delall) != OSD_OK)
+		return OSD_ERROR;
 
 repeat:
 	ret = 0;
@@ -315,6 +344,31 @@ repeat:
 }
 
 
+/*
+ * Delete one page from all objects. Scans the whole table.
+ *
+ * returns:
+ * OSD_ERROR: some error
+ * OSD_OK: success
+ */
+int attr_delete_page(struct db_context *dbc, uint32_t page)
+{
+	int ret = 0;
+
+	assert(dbc && dbc->db && dbc->attr);
+	if (db_stmt_ready(dbc, &dbc->attr->delpage) != OSD_OK)
+		return OSD_ERROR;
+
+repeat:
+	ret = sqlite3_bind_int(dbc->attr->delpage, 1, page);
+	ret = db_exec_dms(dbc, dbc->attr->delpage, ret, __func__);
+	if (ret == OSD_REPEAT)
+		goto repeat;
+
+	return ret;
+}
+
+
 /* 
  * Gather the results into list_entry format. Each row has page, number, len,
  * value. Look at queries in attr_get_attr attr_get_attr_page.  See page 163.
@@ -481,7 +535,9 @@ int attr_get_attr(struct db_context *dbc, uint64_t pid, uint64_t oid,
 	int ret = 0;
 	sqlite3_stmt *stmt = NULL;
 
-	assert(dbc && dbc->db && dbc->attr && dbc->attr->getattr);
+	assert(dbc && dbc->db && dbc->attr);
+	if (db_stmt_ready(dbc, &dbc->attr->getattr) != OSD_OK)
+		return OSD_ERROR;
 
 repeat:
 	ret = 0;
@@ -519,7 +575,9 @@ int attr_get_val(struct db_context *dbc, uint64_t pid, uint64_t oid,
 	int ret = 0;
 	sqlite3_stmt *stmt = NULL;
 
-	assert(dbc && dbc->db && dbc->attr && dbc->attr->getval);
+	assert(dbc && dbc->db && dbc->attr);
+	if (db_stmt_ready(dbc, &dbc->attr->getval) != OSD_OK)
+		return OSD_ERROR;
 
 repeat:
 	ret = 0;
@@ -541,6 +599,111 @@ repeat:
 	return ret;
 }
 
+/*
+ * Hand one attribute value to fn where sqlite has it, instead of copying
+ * it out; val is valid only during the call, which must not use the db.
+ *
+ * returns:
+ * -ENOENT: attribute not found, fn not called
+ * OSD_ERROR: some other error
+ * else: what fn returned
+ */
+int attr_visit_val(struct db_context *dbc, uint64_t pid, uint64_t oid,
+		   uint32_t page, uint32_t number, attr_val_fn fn, void *arg)
+{
+	int ret = 0;
+	int bound, fnret;
+	sqlite3_stmt *stmt = NULL;
+
+	assert(dbc && dbc->db && dbc->attr && fn);
+	if (db_stmt_ready(dbc, &dbc->attr->getval) != OSD_OK)
+		return OSD_ERROR;
+
+repeat:
+	ret = 0;
+	fnret = -ENOENT;
+	stmt = dbc->attr->getval;
+	ret |= sqlite3_bind_int64(stmt, 1, pid);
+	ret |= sqlite3_bind_int64(stmt, 2, oid);
+	ret |= sqlite3_bind_int(stmt, 3, page);
+	ret |= sqlite3_bind_int(stmt, 4, number);
+	bound = (ret == SQLITE_OK);
+	if (!bound) {
+		error_sql(dbc->db, "%s: bind failed", __func__);
+	} else {
+		do {
+			ret = sqlite3_step(stmt);
+			PROBE3(sql_step, __func__, stmt, ret);
+		} while (ret == SQLITE_BUSY);
+		if (ret == SQLITE_ROW)
+			fnret = fn(sqlite3_column_blob(stmt, 0),
+				   sqlite3_column_bytes(stmt, 0), arg);
+	}
+	ret = db_reset_stmt(dbc, stmt, bound, __func__);
+	if (ret == OSD_REPEAT)
+		goto repeat;
+	if (ret != OSD_OK)
+		return ret;
+	return fnret;
+}
+
+/*
+ * Hand attribute (page, number) of every object in oid .. hi that has it
+ * to fn, in increasing oid order, all in one statement. Same rules for fn
+ * as attr_visit_val; a negative return of fn ends the walk.
+ *
+ * returns:
+ * OSD_ERROR: some error
+ * OSD_OK: success, fn saw every row
+ * <0: what fn returned to end the walk
+ */
+int attr_visit_range(struct db_context *dbc, uint64_t pid, uint64_t oid,
+		     uint64_t hi, uint32_t page, uint32_t number,
+		     attr_oid_val_fn fn, void *arg)
+{
+	int ret = 0;
+	int bound, fnret;
+	sqlite3_stmt *stmt = NULL;
+
+	assert(dbc && dbc->db && dbc->attr && fn);
+	if (db_stmt_ready(dbc, &dbc->attr->rngval) != OSD_OK)
+		return OSD_ERROR;
+
+repeat:
+	ret = 0;
+	fnret = OSD_OK;
+	stmt = dbc->attr->rngval;
+	ret |= sqlite3_bind_int64(stmt, 1, pid);
+	ret |= sqlite3_bind_int64(stmt, 2, oid);
+	ret |= sqlite3_bind_int64(stmt, 3, hi);
+	ret |= sqlite3_bind_int(stmt, 4, page);
+	ret |= sqlite3_bind_int(stmt, 5, number);
+	bound = (ret == SQLITE_OK);
+	if (!bound) {
+		error_sql(dbc->db, "%s: bind failed", __func__);
+		goto out_reset;
+	}
+
+	while (fnret >= 0) {
+		ret = sqlite3_step(stmt);
+		PROBE3(sql_step, __func__, stmt, ret);
+		if (ret == SQLITE_ROW)
+			fnret = fn(sqlite3_column_int64(stmt, 0),
+				   sqlite3_column_blob(stmt, 1),
+				   sqlite3_column_bytes(stmt, 1), arg);
+		else if (ret != SQLITE_BUSY)
+			break;
+	}
+
+out_reset:
+	ret = db_reset_stmt(dbc, stmt, bound, __func__);
+	if (ret == OSD_REPEAT)
+		goto repeat;
+	if (ret != OSD_OK)
+		return ret;
+	return fnret < 0 ? fnret : OSD_OK;
+}
+
 /*
  * get one page in list format
  *
@@ -559,7 +722,9 @@ int attr_get_page_as_list(struct db_context *dbc, uint64_t pid, uint64_t oid,
 	int ret = 0;
 	sqlite3_stmt *stmt = NULL;
 
-	assert(dbc && dbc->db && dbc->attr && dbc->attr->pgaslst);
+	assert(dbc && dbc->db && dbc->attr);
+	if (db_stmt_ready(dbc, &dbc->attr->pgaslst) != OSD_OK)
+		return OSD_ERROR;
 
 repeat:
 	ret = 0;
@@ -599,7 +764,9 @@ int attr_get_for_all_pages(struct db_context *dbc, uint64_t pid, uint64_t oid,
 	int ret = 0;
 	sqlite3_stmt *stmt = NULL;
 
-	assert(dbc && dbc->db && dbc->attr && dbc->attr->forallpg);
+	assert(dbc && dbc->db && dbc->attr);
+	if (db_stmt_ready(dbc, &dbc->attr->forallpg) != OSD_OK)
+		return OSD_ERROR;
 
 repeat:
 	ret = 0;
@@ -640,7 +807,9 @@ int attr_get_all_attrs(struct db_context *dbc, uint64_t pid, uint64_t oid,
 	int ret = 0;
 	sqlite3_stmt *stmt = NULL;
 
-	assert(dbc && dbc->db && dbc->attr && dbc->attr->getall);
+	assert(dbc && dbc->db && dbc->attr);
+	if (db_stmt_ready(dbc, &dbc->attr->getall) != OSD_OK)
+		return OSD_ERROR;
 
 repeat:
 	ret = 0;
@@ -677,7 +846,9 @@ int attr_get_dir_page(struct db_context *dbc, uint64_t pid, uint64_t oid,
 	int ret = 0;
 	sqlite3_stmt *stmt = NULL;
 
-	assert(dbc && dbc->db && dbc->attr && dbc->attr->dirpage);
+	assert(dbc && dbc->db && dbc->attr);
+	if (db_stmt_ready(dbc, &dbc->attr->dirpage) != OSD_OK)
+		return OSD_ERROR;
 
 	if (page != USEROBJECT_DIR_PG && page != COLLECTION_DIR_PG &&
 	    page != PARTITION_DIR_PG && page != ROOT_DIR_PG)
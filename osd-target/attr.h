@@ -36,6 +36,8 @@ int attr_delete_attr(struct db_context *dbc, uint64_t pid, uint64_t oid,
 
 int attr_delete_all(struct db_context *dbc, uint64_t pid, uint64_t oid);
 
+int attr_delete_page(struct db_context *dbc, uint32_t page);
+
 int attr_get_attr(struct db_context *dbc, uint64_t pid, uint64_t oid,
 		  uint32_t page, uint32_t number, uint64_t outlen,
 		  void *outdata, uint8_t listfmt, uint32_t *used_outlen);
@@ -44,6 +46,18 @@ int attr_get_val(struct db_context *dbc, uint64_t pid, uint64_t oid,
 		 uint32_t page, uint32_t number, uint64_t outlen,
 		 void *outdata, uint32_t *used_outlen);
 
+typedef int (*attr_val_fn)(const void *val, uint16_t len, void *arg);
+
+int attr_visit_val(struct db_context *dbc, uint64_t pid, uint64_t oid,
+		   uint32_t page, uint32_t number, attr_val_fn fn, void *arg);
+
+typedef int (*attr_oid_val_fn)(uint64_t oid, const void *val, uint16_t len,
+			      void *arg);
+
+int attr_visit_range(struct db_context *dbc, uint64_t pid, uint64_t oid,
+		     uint64_t hi, uint32_t page, uint32_t number,
+		     attr_oid_val_fn fn, void *arg);
+
 int attr_get_page_as_list(struct db_context *dbc, uint64_t pid, uint64_t oid,
 			  uint32_t page, uint64_t outlen, void *outdata,
 			  uint8_t listfmt, uint32_t *used_outlen);
@@ -30,6 +30,20 @@
 #include "cdb.h"
 #include "osd-util/osd-util.h"
 #include "list-entry.h"
+#include "job.h"
+#include "arena.h"
+#include "outbuf.h"
+#include "fdcache.h"
+#include "async.h"
+#include "lat.h"
+#include "atomics.h"
+#include "sec.h"
+#include "probe.h"
+#include "sqlprof.h"
+
+/* CAS WAIT data-out: the value waited on, then the timeout in ms */
+#define CAS_WAIT_LEN 12
+#define CAS_WAIT_MAX_MS 30000
 
 /*
  * Aggregate parameters for function calls in this file.
@@ -53,6 +67,7 @@ struct cdb_continuation {
 
 struct command {
 	struct osd_device *osd;
+	struct arena *arena;	/* for anything that ends with the command */
 	uint8_t *cdb;
 	uint16_t action;
 	uint8_t getset_cdbfmt;
@@ -243,6 +258,19 @@ static int get_attr_list(struct command *cmd, uint64_t pid, uint64_t oid,
 	cp = outbuf + 8;
 	cmd->get_used_outlen = 8;
 	list_alloc_len -= 8;
+	if (numoid > 1) {
+		uint32_t get_used_outlen;
+		ret = osd_getattr_multi(cmd->osd, pid, oid, numoid, list_hdr,
+					list_len, cp, list_alloc_len,
+					isembedded, listfmt, &get_used_outlen,
+					cdb_cont_len, cmd->sense);
+		if (ret != 0) {
+			cmd->senselen = ret;
+			goto out_err;
+		}
+		cmd->get_used_outlen += get_used_outlen;
+		list_len = 0;
+	}
 	while (list_len > 0) {
 		uint32_t page = get_ntohl(&list_hdr[0]);
 		uint32_t number = get_ntohl(&list_hdr[4]);
@@ -414,9 +442,8 @@ static int parse_getattr_list(struct command *cmd, uint64_t pid, uint64_t oid)
 
        if (list_len > 0) {
                cmd->get_attr.sz = list_len/8;
-               /* XXX: This leaks memory. free it somewhere */
-               cmd->get_attr.le = Malloc(cmd->get_attr.sz *
-                                         sizeof(*(cmd->get_attr.le)));
+               cmd->get_attr.le = arena_alloc(cmd->arena, cmd->get_attr.sz *
+                                              sizeof(*(cmd->get_attr.le)));
                if (!cmd->get_attr.le)
                        goto out_hw_err;
        }
@@ -479,9 +506,8 @@ static int parse_setattr_list(struct command *cmd, uint64_t pid, uint64_t oid)
 		 * values.
 		 */
 		cmd->set_attr.sz = list_len >> 4; /* min(list_len) == 16 */
-		/* XXX: this leaks memory */
-		cmd->set_attr.le = Malloc(cmd->set_attr.sz *
-					  sizeof(*(cmd->set_attr.le)));
+		cmd->set_attr.le = arena_alloc(cmd->arena, cmd->set_attr.sz *
+					       sizeof(*(cmd->set_attr.le)));
 		if (!cmd->set_attr.le)
 			goto out_hw_err;
 	}
@@ -527,6 +553,7 @@ static int get_attributes(struct command *cmd, uint64_t pid, uint64_t oid,
 {
 	int ret = 0;
 	uint8_t isembedded = true;
+	uint64_t t = lat_now();
 
 	if (numoid < 1)
 		goto out_cdb_err;
@@ -535,14 +562,16 @@ static int get_attributes(struct command *cmd, uint64_t pid, uint64_t oid,
 		isembedded = true;
 
 	if (cmd->getset_cdbfmt == GETPAGE_SETVALUE) {
-	        return get_attr_page(cmd, pid, oid, isembedded, numoid, cdb_cont_len);
+	        ret = get_attr_page(cmd, pid, oid, isembedded, numoid, cdb_cont_len);
 	} else if (cmd->getset_cdbfmt == GETLIST_SETLIST) {
-	        return get_attr_list(cmd, pid, oid, isembedded, numoid, cdb_cont_len);
+	        ret = get_attr_list(cmd, pid, oid, isembedded, numoid, cdb_cont_len);
 	} else if (cmd->getset_cdbfmt == GETFIELD_SETVALUE){
-	        return 0;
+	        ret = 0;
 	}else {
 		goto out_cdb_err;
 	}
+	lat_add(cmd->osd, RLAT_ATTR, t);
+	return ret;
 
 out_cdb_err:
 	return sense_basic_build(cmd->sense, OSD_SSK_ILLEGAL_REQUEST,
@@ -559,6 +588,7 @@ static int set_attributes(struct command *cmd, uint64_t pid, uint64_t oid,
 {
 	int ret = 0;
 	uint8_t isembedded = true;
+	uint64_t t = lat_now();
 
 	if (numoid < 1)
 		goto out_cdb_err;
@@ -567,14 +597,16 @@ static int set_attributes(struct command *cmd, uint64_t pid, uint64_t oid,
 		isembedded = true;
 
 	if (cmd->getset_cdbfmt == GETPAGE_SETVALUE) {
-	        return set_attr_value(cmd, pid, oid, isembedded, numoid, cdb_cont_len);
+	        ret = set_attr_value(cmd, pid, oid, isembedded, numoid, cdb_cont_len);
 	} else if (cmd->getset_cdbfmt == GETLIST_SETLIST) {
-	        return set_attr_list(cmd, pid, oid, isembedded, numoid, cdb_cont_len);
+	        ret = set_attr_list(cmd, pid, oid, isembedded, numoid, cdb_cont_len);
 	} else if (cmd->getset_cdbfmt == GETFIELD_SETVALUE) {
-	        return set_one_attr_value(cmd, pid, oid, isembedded, numoid, cdb_cont_len);
+	        ret = set_one_attr_value(cmd, pid, oid, isembedded, numoid, cdb_cont_len);
 	} else {
 		goto out_cdb_err;
 	}
+	lat_add(cmd->osd, RLAT_ATTR, t);
+	return ret;
 
 out_cdb_err:
 	return sense_basic_build(cmd->sense, OSD_SSK_ILLEGAL_REQUEST,
@@ -756,6 +788,7 @@ out_remove_obj:
 static int cdb_remove_partition(struct command *cmd, uint32_t cdb_cont_len)
 {
 	int ret = 0;
+	uint8_t fpr = (cmd->cdb[11] & 0x1); /* vendor: force, like fcr */
 	uint64_t pid = get_ntohll(&cmd->cdb[16]);
 
 	ret = set_attributes(cmd, pid, PARTITION_OID, 1, cdb_cont_len);
@@ -765,7 +798,8 @@ static int cdb_remove_partition(struct command *cmd, uint32_t cdb_cont_len)
 	if (ret != 0)
 		return ret;
 
-	return osd_remove_partition(cmd->osd, pid, cdb_cont_len, cmd->sense);
+	return osd_remove_partition(cmd->osd, pid, fpr, cdb_cont_len,
+				    cmd->sense);
 }
 
 /*
@@ -1018,6 +1052,47 @@ out_cdb_err:
 	return ret;
 }
 
+/*
+ * The get attributes list is for the members, the set attributes list for
+ * the collection. The number of members, alloc_len and initial_oid are
+ * vendor fields where CREATE, SET KEY and LIST have theirs.
+ */
+static int cdb_get_member_attributes(struct command *cmd,
+				     uint32_t cdb_cont_len)
+{
+	int ret = 0;
+	uint8_t *cdb = cmd->cdb;
+	uint64_t pid = get_ntohll(&cdb[16]);
+	uint64_t cid = get_ntohll(&cdb[24]);
+	uint16_t numoid = get_ntohs(&cdb[32]);
+	uint32_t alloc_len = get_ntohl(&cdb[36]);
+	uint64_t initial_oid = get_ntohll(&cdb[40]);
+	uint8_t *retrieved = NULL;
+
+	if (cmd->getset_cdbfmt != GETLIST_SETLIST)
+		goto out_cdb_err;
+	ret = parse_getattr_list(cmd, pid, cid);
+	if (ret)
+		goto out_cdb_err;
+
+	ret = set_attributes(cmd, pid, cid, 1, cdb_cont_len);
+	if (ret)
+		return ret;
+
+	if (cmd->outdata && cmd->retrieved_attr_off != -1LLU)
+		retrieved = &cmd->outdata[cmd->retrieved_attr_off];
+	return osd_get_member_attributes(cmd->osd, pid, cid, initial_oid,
+					 numoid, &cmd->get_attr, alloc_len,
+					 cmd->outdata, &cmd->used_outlen,
+					 retrieved, get_ntohl(&cdb[60]),
+					 &cmd->get_used_outlen, cdb_cont_len,
+					 cmd->sense);
+
+out_cdb_err:
+	ret = sense_basic_build(cmd->sense, OSD_SSK_ILLEGAL_REQUEST,
+				OSD_ASC_INVALID_FIELD_IN_CDB, pid, cid);
+	return ret;
+}
 
 static inline int std_get_set_attr(struct command *cmd, uint64_t pid,
 				   uint64_t oid, uint32_t cdb_cont_len)
@@ -1029,6 +1104,44 @@ static inline int std_get_set_attr(struct command *cmd, uint64_t pid,
 	return get_attributes(cmd, pid, oid, 1, cdb_cont_len);
 }
 
+/*
+ * With list_attr the get attributes list is for the listed objects, as in
+ * LIST, else for the collection.
+ */
+static int cdb_list_collection(struct command *cmd, uint32_t cdb_cont_len)
+{
+	int ret = 0;
+	uint8_t *cdb = cmd->cdb;
+	uint8_t list_attr = (cdb[11] & 0x40) >> 6;
+	uint64_t pid = get_ntohll(&cdb[16]);
+	uint64_t cid = get_ntohll(&cdb[24]);
+	uint32_t list_id = get_ntohl(&cdb[48]);
+	uint64_t alloc_len = get_ntohll(&cdb[32]);
+	uint64_t initial_oid = get_ntohll(&cdb[40]);
+
+	if (list_attr == 1) {
+		if (cmd->getset_cdbfmt != GETLIST_SETLIST)
+			goto out_cdb_err;
+		ret = parse_getattr_list(cmd, pid, cid);
+		if (ret)
+			goto out_cdb_err;
+	}
+
+	ret = osd_list_collection(cmd->osd, list_attr, pid, cid, alloc_len,
+				  initial_oid, &cmd->get_attr, list_id,
+				  cmd->outdata, &cmd->used_outlen, cmd->sense);
+	if (ret || list_attr == 1)
+		return ret;
+
+	return std_get_set_attr(cmd, pid, cid, cdb_cont_len);
+
+out_cdb_err:
+	ret = sense_basic_build(cmd->sense, OSD_SSK_ILLEGAL_REQUEST,
+				OSD_ASC_INVALID_FIELD_IN_CDB, pid,
+				initial_oid);
+	return ret;
+}
+
 static int cdb_cas(struct command *cmd, uint32_t cdb_cont_len)
 {
 	int ret = 0;
@@ -1057,6 +1170,9 @@ static int cdb_cas(struct command *cmd, uint32_t cdb_cont_len)
 	if (ret)
 		return ret;
 
+	if (get_ntohl(&cmd->cdb[52]) != 0)
+		atomics_sync(cmd->osd); /* attributes retrieved see it */
+
 	ret = set_attributes(cmd, pid, oid, 1, cdb_cont_len);
 	if (ret != 0)
 		return ret;
@@ -1069,6 +1185,41 @@ out_cdb_err:
 }
 
 
+/*
+ * Without waiting: osdemu_cmd_submit waits before it gets here.
+ */
+static int cdb_cas_wait(struct command *cmd, uint32_t cdb_cont_len)
+{
+	int ret = 0;
+	uint8_t *cdb = cmd->cdb;
+	uint64_t pid = get_ntohll(&cdb[16]);
+	uint64_t oid = get_ntohll(&cdb[24]);
+	uint64_t len = get_ntohll(&cdb[32]); /* len of the value */
+	uint64_t off = get_ntohll(&cdb[40]); /* offset in dataout */
+
+	if (cmd->outdata == NULL || cmd->indata == NULL)
+		goto out_cdb_err;
+
+	/* value and timeout at offset 0, get/set attributes follow them */
+	if (len < sizeof(uint64_t) || cmd->inlen < CAS_WAIT_LEN)
+		goto out_cdb_err;
+	if (off > cmd->outlen || cmd->outlen - off < sizeof(uint64_t))
+		goto out_cdb_err;
+
+	ret = osd_cas_read(cmd->osd, pid, oid, cmd->outdata + off,
+			   &cmd->used_outlen, cmd->sense);
+	if (ret)
+		return ret;
+
+	return std_get_set_attr(cmd, pid, oid, cdb_cont_len);
+
+out_cdb_err:
+	ret = sense_basic_build(cmd->sense, OSD_SSK_ILLEGAL_REQUEST,
+				OSD_ASC_INVALID_FIELD_IN_CDB, pid, oid);
+	return ret;
+}
+
+
 static int cdb_fa(struct command *cmd, uint32_t cdb_cont_len)
 {
 	int ret = 0;
@@ -1093,6 +1244,9 @@ static int cdb_fa(struct command *cmd, uint32_t cdb_cont_len)
 	if (ret)
 		return ret;
 
+	if (get_ntohl(&cmd->cdb[52]) != 0)
+		atomics_sync(cmd->osd); /* attributes retrieved see it */
+
 	ret = set_attributes(cmd, pid, oid, 1, cdb_cont_len);
 	if (ret != 0)
 		return ret;
@@ -1104,23 +1258,32 @@ out_cdb_err:
 	return ret;
 }
 
+/*
+ * The original value goes straight to the first entry of the retrieved
+ * attributes, exec_getattr puts the rest after it.
+ */
 static int exec_gen_cas(struct command *cmd, uint64_t pid, uint64_t oid,
-			const uint8_t **setattr_list, uint32_t *orig_page,
-			uint32_t *orig_number, uint8_t **orig,
-			uint16_t *orig_len, uint32_t *list_len,
-			uint8_t *cas_res)
+			const uint8_t **setattr_list, uint16_t *orig_len,
+			uint32_t *list_len, uint8_t *cas_res)
 {
-	int ret;
+	int ret, matched;
 	uint8_t pad, list_type;
 	uint32_t page, number;
 	const uint8_t *cmp, *swap;
 	uint16_t cmp_len, swap_len;
 	const uint8_t *list = *setattr_list;
 	uint32_t setattr_list_len = get_ntohl(&cmd->cdb[68]);
+	uint32_t alloc_len = get_ntohl(&cmd->cdb[60]);
+	uint8_t *orig_le;
 
 	if (setattr_list_len < LIST_HDR_LEN) /* need atleast cmp & swap */
 		goto out_param_list_err;
 
+	if (!cmd->outdata || cmd->retrieved_attr_off == -1LLU ||
+	    alloc_len < LIST_HDR_LEN)
+		goto out_cdb_err; /* nowhere to return the original value */
+	orig_le = &cmd->outdata[cmd->retrieved_attr_off + LIST_HDR_LEN];
+
 	list_type = list[0] & 0xF;
 	if (list_type != RTRVD_SET_ATTR_LIST)
 		goto out_param_list_err;
@@ -1157,19 +1320,14 @@ static int exec_gen_cas(struct command *cmd, uint64_t pid, uint64_t oid,
 	*list_len -= LE_VAL_OFF + swap_len + pad;
 	*setattr_list = list;
 
-	*orig = NULL;
-	*cas_res = 0;
 	ret = osd_gen_cas(cmd->osd, pid, oid, page, number, cmp, cmp_len,
-			  swap, swap_len, orig, orig_len, cmd->sense);
+			  swap, swap_len, orig_le, alloc_len - LIST_HDR_LEN,
+			  orig_len, &matched, cmd->sense);
 	if (ret != OSD_OK) {
 		cmd->senselen = ret;
 		goto out_err;
 	}
-
-	if (*orig_len == cmp_len && memcmp(cmp, *orig, cmp_len) == 0)
-		*cas_res = 1;
-	*orig_page = page;
-	*orig_number = number;
+	*cas_res = matched;
 	return OSD_OK;
 
 out_cdb_err:
@@ -1226,20 +1384,20 @@ out_err:
 /*
  * Following the order of the indata where cmp and swap values are the first
  * entries in the list, in the retrieved attributes case also, the first
- * entry will be the original value returned by the CAS operation. But if
- * there are more attributes to be fetched, then we need to call
- * get_attributes function. Since get_attributes creates the whole list along
- * with header, we need a way to stuff original value in the front of the
- * list. To do this we tamper with the retrieved_attr_off so that
- * get_attributes creates its list at an offset. Then we stuff the original
- * value from CAS op after the list header making it the first entry.
+ * entry will be the original value returned by the CAS operation; the CAS
+ * has put it there already. But if there are more attributes to be
+ * fetched, then we need to call get_attributes function. Since
+ * get_attributes creates the whole list along with header, we tamper with
+ * the retrieved_attr_off so that it creates its list right after the
+ * original value. Its header lands on the last 8 bytes of that entry,
+ * which are kept aside, and is then moved to the front.
  */
 static int exec_getattr(struct command *cmd, uint64_t pid, uint64_t oid,
-			uint32_t orig_page, uint32_t orig_number,
-			uint8_t *orig, uint16_t orig_len, uint32_t cdb_cont_len)
+			uint16_t orig_len, uint32_t cdb_cont_len)
 {
 	int ret;
 	uint8_t *cp, *sp;
+	uint8_t tail[LIST_HDR_LEN];
 	uint8_t *cdb = cmd->cdb;
 	uint64_t old_retr_attr_off;
 	uint32_t alloc_len = get_ntohl(&cdb[60]);
@@ -1251,43 +1409,23 @@ static int exec_getattr(struct command *cmd, uint64_t pid, uint64_t oid,
 	if (alloc_len - 8 < orig_le_len) /* need space for atleast le+hdr */
 		goto out_cdb_err;
 	cmd->retrieved_attr_off += orig_le_len;
-	cp = &cmd->outdata[cmd->retrieved_attr_off];
-	memset(cp, 0, LIST_HDR_LEN);
+	sp = &cmd->outdata[cmd->retrieved_attr_off];
+	memcpy(tail, sp, LIST_HDR_LEN);
+	memset(sp, 0, LIST_HDR_LEN);
 	set_htonl(&cdb[60], alloc_len - orig_le_len);
 	ret = get_attributes(cmd, pid, oid, 1, cdb_cont_len);
 	cmd->retrieved_attr_off = old_retr_attr_off;
 	if (ret != OSD_OK)
 		goto out_err;
-	if (cp[0] != RTRVD_SET_ATTR_LIST) /* getattr list was empty */
-		cp[0] = RTRVD_SET_ATTR_LIST;
+	if (sp[0] != RTRVD_SET_ATTR_LIST) /* getattr list was empty */
+		sp[0] = RTRVD_SET_ATTR_LIST;
 
-	/* move header to the start of the buffer */
+	/* move header to the start of the buffer, the entry gets its end */
 	cp = &cmd->outdata[old_retr_attr_off];
-	sp = &cmd->outdata[old_retr_attr_off + orig_le_len];
 	memcpy(cp, sp, LIST_HDR_LEN);
-	cp += LIST_HDR_LEN;
-
-	/* stuff original value from CAS operation */
-	if (orig != NULL && orig_len > 0) {
-		ret = le_pack_attr(cp, alloc_len - LIST_HDR_LEN, orig_page,
-				   orig_number, orig_len, orig);
-		free(orig);
-		orig = NULL;
-	} else {
-		ret = le_pack_attr(cp, alloc_len - LIST_HDR_LEN, orig_page,
-				   orig_number, 0, NULL);
-	}
-	if (ret <= 0) {
-		goto out_cdb_err;
-	} else {
-		if (orig_le_len <= alloc_len - LIST_HDR_LEN)
-			assert((uint32_t)ret == orig_le_len);
-		else
-			assert((uint32_t)ret == alloc_len - LIST_HDR_LEN);
-	}
+	memcpy(sp, tail, LIST_HDR_LEN);
 
 	/* modify list len to reflect new entry */
-	cp -= LIST_HDR_LEN;
 	list_len = get_ntohl(&cp[4]) + orig_le_len;
 	set_htonl(&cp[4], list_len);
 	cmd->get_used_outlen += list_len + 8;
@@ -1318,20 +1456,17 @@ static int cdb_gen_cas(struct command *cmd, int osd_cmd, uint32_t cdb_cont_len)
 	uint32_t list_len = 0;
 	uint32_t list_off = get_ntohoffset(&cmd->cdb[72]);
 	const uint8_t *list = &cmd->indata[list_off];
-	const uint8_t *list_pos;
-	uint8_t *orig;
-	uint16_t orig_len;
-	uint32_t orig_page = 0, orig_number = 0;
+	uint16_t orig_len = 0;
 	uint8_t cas_res = 0;
 
 	TICK_TRACE(cdb_gen_cas);
 	if (cmd->getset_cdbfmt != GETLIST_SETLIST)
 		goto out_cdb_err;
 
-	ret = exec_gen_cas(cmd, pid, oid, &list, &orig_page, &orig_number,
-			   &orig, &orig_len, &list_len, &cas_res);
+	ret = exec_gen_cas(cmd, pid, oid, &list, &orig_len, &list_len,
+			   &cas_res);
 	if (ret != OSD_OK)
-		goto out_err;
+		return ret;
 
 	if (osd_cmd == OSD_GEN_CAS && list_len == 0)
 		goto get_attr;
@@ -1342,23 +1477,15 @@ static int cdb_gen_cas(struct command *cmd, int osd_cmd, uint32_t cdb_cont_len)
 	/* set remaining attributes */
 	ret = exec_cas_setattr(cmd, pid, oid, list, list_len, cdb_cont_len);
 	if (ret != OSD_OK)
-		goto out_err;
+		return ret;
 get_attr:
-	ret = exec_getattr(cmd, pid, oid, orig_page, orig_number, orig,
-			   orig_len, cdb_cont_len);
+	ret = exec_getattr(cmd, pid, oid, orig_len, cdb_cont_len);
 	TICK_TRACE(cdb_gen_cas);
-	if (ret == OSD_OK)
-		return ret;
+	return ret;
 
 out_cdb_err:
-	if (orig)
-		free(orig);
 	return sense_basic_build(cmd->sense, OSD_SSK_ILLEGAL_REQUEST,
 				 OSD_ASC_INVALID_FIELD_IN_CDB, pid, oid);
-out_err:
-	if (orig)
-		free(orig);
-	return ret;
 }
 
 static int parse_cdb_continuation_segment(struct command *cmd,
@@ -1375,19 +1502,19 @@ static int parse_cdb_continuation_segment(struct command *cmd,
 		 * in the maximum CDB continuation length attribute in the root
 		 * information attributes page (7.1.3.8)
 		 */
-osd_warning("%s:%d:", __FILE__, __LINE__);
+osd_rlog(OSD_LOG_WARNING, "%s:%d:", __FILE__, __LINE__);
 		goto out_cdb_err;
 	}
 
 	if (cont_action != cmd->action) {
-osd_warning("%s:%d: cont_action=0x%x cmd->action=0x%x cdb_cont_len=%d cont_format=%d",
+osd_rlog(OSD_LOG_WARNING, "%s:%d: cont_action=0x%x cmd->action=0x%x cdb_cont_len=%d cont_format=%d",
 	__FILE__, __LINE__, cont_action, cmd->action, cdb_cont_len, cont_format);
 		goto out_cdb_err;
 	}
 
 	/* continuation format 1 is the only format defined in OSDr204 */
 	if (cont_format != 1) {
-osd_warning("%s:%d:", __FILE__, __LINE__);
+osd_rlog(OSD_LOG_WARNING, "%s:%d:", __FILE__, __LINE__);
 		goto out_cdb_err;
 	}
 
@@ -1409,9 +1536,15 @@ osd_warning("%s:%d:", __FILE__, __LINE__);
 		uint32_t desc_len = length + pad_length;
 
 		if (cont->num_descriptors % 8 == 0) {
+			size_t oldsize = cont->num_descriptors *
+				sizeof(struct cdb_continuation_descriptor);
 			size_t newsize = (cont->num_descriptors+8)*
 				sizeof(struct cdb_continuation_descriptor);
-			cont->descriptors = realloc(cont->descriptors, newsize);
+			cont->descriptors = arena_realloc(cmd->arena,
+							  cont->descriptors,
+							  oldsize, newsize);
+			if (!cont->descriptors)
+				goto out_hw_err;
 		}
 		desc = &cont->descriptors[cont->num_descriptors++];
 		desc->type = type;
@@ -1422,7 +1555,7 @@ osd_warning("%s:%d:", __FILE__, __LINE__);
 			 * than the value of the supported CDB continuation
 			 * descriptor type information attributes page (7.1.3.8)
 			 */
-osd_warning("%s:%d:", __FILE__, __LINE__);
+osd_rlog(OSD_LOG_WARNING, "%s:%d:", __FILE__, __LINE__);
 			goto out_cdb_err;
 		}
 
@@ -1435,7 +1568,7 @@ osd_warning("%s:%d:", __FILE__, __LINE__);
 			   length of this descriptor goes past the end
 			   of the continuation.  For now, we'll just
 			   return an error. */
-osd_warning("%s:%d:", __FILE__, __LINE__);
+osd_rlog(OSD_LOG_WARNING, "%s:%d:", __FILE__, __LINE__);
 			goto out_cdb_err;
 		}
 
@@ -1449,7 +1582,7 @@ osd_warning("%s:%d:", __FILE__, __LINE__);
 		case SCATTER_GATHER_LIST: {
 			if (pad_length != 0) {
 			     /* osd2r04 5.4.2 - pad length must be 0 */
-osd_warning("%s:%d:", __FILE__, __LINE__);
+osd_rlog(OSD_LOG_WARNING, "%s:%d:", __FILE__, __LINE__);
 			     goto out_cdb_err;
 			}
 
@@ -1464,7 +1597,7 @@ osd_warning("%s:%d:", __FILE__, __LINE__);
 		case QUERY_LIST: {
 			if (pad_length != 0) {
 			     /* osd2r04 5.4.3 - pad length must be 0 */
-osd_warning("%s:%d:", __FILE__, __LINE__);
+osd_rlog(OSD_LOG_WARNING, "%s:%d:", __FILE__, __LINE__);
 			     goto out_cdb_err;
 			}
 
@@ -1474,24 +1607,31 @@ osd_warning("%s:%d:", __FILE__, __LINE__);
 
 		case USER_OBJECT: {
 			/* not supported yet */
-osd_warning("%s:%d:", __FILE__, __LINE__);
+osd_rlog(OSD_LOG_WARNING, "%s:%d:", __FILE__, __LINE__);
 			goto out_cdb_err;
 		}
 
 		case COPY_USER_OBJECT_SOURCE: {
 			desc->desc_specific_hdr = (const uint8_t *)(desc_hdr+1);
-osd_warning("%s:%d:", __FILE__, __LINE__);
+osd_rlog(OSD_LOG_WARNING, "%s:%d:", __FILE__, __LINE__);
 			goto out_cdb_err;
 		}
 
+		case OBJECT_IO_LIST: {
+			if (pad_length != 0)
+				goto out_cdb_err;
+			desc->desc_specific_hdr = (const void *)(desc_hdr+1);
+			break;
+		}
+
 		case EXTENSION_CAPABILITIES: {
 			/* not supported yet */
-osd_warning("%s:%d:", __FILE__, __LINE__);
+osd_rlog(OSD_LOG_WARNING, "%s:%d:", __FILE__, __LINE__);
 			goto out_cdb_err;
 		}
 
 		default:
-osd_warning("%s:%d:", __FILE__, __LINE__);
+osd_rlog(OSD_LOG_WARNING, "%s:%d:", __FILE__, __LINE__);
 			goto out_cdb_err;
 		}
 
@@ -1504,6 +1644,10 @@ osd_warning("%s:%d:", __FILE__, __LINE__);
  out_cdb_err:
 	return sense_basic_build(cmd->sense, OSD_SSK_ILLEGAL_REQUEST,
 				 OSD_ASC_INVALID_FIELD_IN_CDB, pid, oid);
+
+ out_hw_err:
+	return sense_basic_build(cmd->sense, OSD_SSK_HARDWARE_ERROR,
+				 OSD_ASC_SYSTEM_RESOURCE_FAILURE, pid, oid);
 }
 
 /*
@@ -1523,6 +1667,62 @@ static int verify_enough_input_data(struct command *cmd, uint64_t cdblen)
 	return ret;
 }
 
+/*
+ * The objects are listed in the only continuation descriptor.  Reads
+ * need room for a status record per object and all of their data,
+ * writes for the records.
+ */
+static int cdb_multi_rw(struct command *cmd, uint32_t cdb_cont_len)
+{
+	int ret;
+	uint8_t *cdb = cmd->cdb;
+	int write = cdb[11] & MULTI_RW_WRITE;
+	uint64_t pid = get_ntohll(&cdb[16]);
+	uint64_t alloc_len = get_ntohll(&cdb[32]);
+	const struct cdb_continuation_descriptor *desc;
+	const uint8_t *entries;
+	uint64_t i, n, len, need, data_len = 0;
+
+	if (cmd->cont.num_descriptors != 1 ||
+	    cmd->cont.descriptors[0].type != OBJECT_IO_LIST)
+		goto out_cdb_err;
+	desc = &cmd->cont.descriptors[0];
+	if (desc->length == 0 || desc->length % MULTI_RW_ENTRY_LEN != 0)
+		goto out_cdb_err;
+	n = desc->length / MULTI_RW_ENTRY_LEN;
+	entries = desc->desc_specific_hdr;
+
+	for (i = 0; i < n; i++) {
+		len = get_ntohll(entries + i * MULTI_RW_ENTRY_LEN + 16);
+		if (data_len + len < data_len)
+			goto out_cdb_err;
+		data_len += len;
+	}
+
+	need = n * MULTI_RW_STATUS_LEN;
+	if (write) {
+		if (cdb_cont_len + data_len < data_len)
+			goto out_cdb_err;
+		ret = verify_enough_input_data(cmd, cdb_cont_len + data_len);
+		if (ret)
+			return ret;
+	} else {
+		if (need + data_len < need)
+			goto out_cdb_err;
+		need += data_len;
+	}
+	if (alloc_len < need)
+		goto out_cdb_err;
+
+	return osd_multi_rw(cmd->osd, pid, write, entries, n,
+			    cmd->indata + cdb_cont_len, cmd->outdata,
+			    &cmd->used_outlen, cmd->sense);
+
+out_cdb_err:
+	return sense_basic_build(cmd->sense, OSD_SSK_ILLEGAL_REQUEST,
+				 OSD_ASC_INVALID_FIELD_IN_CDB, pid, 0);
+}
+
 /* in exec_service_action(), most OSD commands do not allow CDB
    continuations.  The following function is a quick check to make sure
    there are no continuations. */
@@ -1548,10 +1748,22 @@ static void exec_service_action(struct command *cmd)
 	int ret;
 	
 //	osd_debug("%s: start 0x%04x", __func__, cmd->action);
+	/* the seed of SET KEY is where the continuation length would be */
+	if (cmd->action == OSD_SET_KEY)
+		cdb_cont_len = 0;
+
+	PROBE4(cmd_start, cmd->action, pid, oid, cdb_cont_len);
+
+	ret = sec_check(osd, cdb, sense);
+	if (ret != OSD_OK)
+		goto out_exec;
 
 	if (cdb_cont_len != 0) {
+		uint64_t t = lat_now();
+
 		ret = parse_cdb_continuation_segment(cmd, cdb_cont_len,
 						     pid, oid);
+		lat_add(osd, RLAT_PARSE, t);
 		if (ret != OSD_OK)
 			goto out_exec;
 	}
@@ -1773,9 +1985,7 @@ static void exec_service_action(struct command *cmd)
 
 	}
 	case OSD_GET_MEMBER_ATTRIBUTES: {
-		uint64_t pid = get_ntohll(&cdb[16]);
-		uint64_t cid = get_ntohll(&cdb[24]);
-		ret = osd_get_member_attributes(osd, pid, cid, cdb_cont_len, sense);
+		ret = cdb_get_member_attributes(cmd, cdb_cont_len);
 		break;
 	}
 	case OSD_LIST: {
@@ -1783,21 +1993,7 @@ static void exec_service_action(struct command *cmd)
 		break;
 	}
 	case OSD_LIST_COLLECTION: {
-		uint8_t list_attr = (cdb[11] & 0x40) >> 6;
-		uint64_t pid = get_ntohll(&cdb[16]);
-		uint64_t cid = get_ntohll(&cdb[24]);
-		uint32_t list_id = get_ntohl(&cdb[48]);
-		uint64_t alloc_len = get_ntohll(&cdb[32]);
-		uint64_t initial_oid = get_ntohll(&cdb[40]);
-		ret = osd_list_collection(cmd->osd, list_attr, pid, cid,
-					  alloc_len, initial_oid,
-					  &cmd->get_attr, list_id,
-					  cmd->outdata, &cmd->used_outlen,
-					  cmd->sense);
-		if (ret)
-			break;
-
-		ret = std_get_set_attr(cmd, pid, cid, cdb_cont_len);
+		ret = cdb_list_collection(cmd, cdb_cont_len);
 		break;
 	}
 	case OSD_PERFORM_SCSI_COMMAND:
@@ -1934,9 +2130,7 @@ static void exec_service_action(struct command *cmd)
 		int key_to_set = cdb[11] & 0x3;
 		uint64_t pid = get_ntohll(&cdb[16]);
 		uint64_t key = get_ntohll(&cdb[24]);
-		uint8_t seed[20];
-		memcpy(seed, &cdb[32], 20);
-		ret = osd_set_key(osd, key_to_set, pid, key, seed, sense);
+		ret = osd_set_key(osd, key_to_set, pid, key, &cdb[32], sense);
 		break;
 	}
 	case OSD_SET_MASTER_KEY: {
@@ -2015,6 +2209,14 @@ static void exec_service_action(struct command *cmd)
 	        ret = cdb_gen_cas(cmd, OSD_GEN_CAS, cdb_cont_len);
 		break;
 	}
+	case OSD_CAS_WAIT: {
+		ret = cdb_cas_wait(cmd, cdb_cont_len);
+		break;
+	}
+	case OSD_MULTI_RW: {
+		ret = cdb_multi_rw(cmd, cdb_cont_len);
+		break;
+	}
 	case OSD_COND_SETATTR: {
 	        ret = cdb_gen_cas(cmd, OSD_COND_SETATTR, cdb_cont_len);
 		break;
@@ -2033,6 +2235,7 @@ static void exec_service_action(struct command *cmd)
 	 * data.  Just save the senselen here and continue.
 	 */
 	cmd->senselen = ret;
+	PROBE4(cmd_done, cmd->action, pid, oid, ret);
 }
 
 /*
@@ -2052,9 +2255,12 @@ static int calc_max_out_len(struct command *cmd)
 	case OSD_CAS:
 	case OSD_FA:
 	case OSD_GEN_CAS:
+	case OSD_CAS_WAIT:
+	case OSD_MULTI_RW:
 		cmd->outlen = get_ntohll(&cmd->cdb[32]);
 		break;
 	case OSD_SET_MASTER_KEY:
+	case OSD_GET_MEMBER_ATTRIBUTES:
 		cmd->outlen = get_ntohl(&cmd->cdb[36]);
 		break;
 	default:
@@ -2087,19 +2293,16 @@ static int calc_max_out_len(struct command *cmd)
 	return 0 /* TODO: proper error code */;
 }
 
-/*
- * Inputs are write data from client.  Output are for the read results that
- * OSD will produce.  You can modify the data_out and data_out_len to return
- * a new buffer, or short read result.
- */
-int osdemu_cmd_submit(struct osd_device *osd, uint8_t *cdb,
+static int cmd_submit(struct osd_device *osd, uint8_t *cdb,
 		      const uint8_t *data_in, uint64_t data_in_len,
 		      uint8_t **data_out, uint64_t *data_out_len,
 		      uint8_t *sense_out, int *senselen_out)
 {
 	int ret = 0;
+	uint64_t t;
 	struct command cmd = {
 		.osd = osd,
+		.arena = osd->arena,
 		.cdb = cdb,
 		.action = (cdb[8] << 8) | cdb[9],
 		.getset_cdbfmt = (cdb[11] & 0x30) >> 4,
@@ -2124,6 +2327,9 @@ int osdemu_cmd_submit(struct osd_device *osd, uint8_t *cdb,
 		},
 	};
 
+	t = lat_begin(osd);
+	atomics_sync(osd); /* commands under the lock see current values */
+
 	/* check cdb opcode and length */
 	if (cdb[0] != VARLEN_CDB || cdb[7] != OSD_CDB_SIZE - 8)
 		goto out_opcode_err;
@@ -2140,13 +2346,17 @@ int osdemu_cmd_submit(struct osd_device *osd, uint8_t *cdb,
 			goto out_cdb_err;
 	} else {
 		if (cmd.outlen) {
-			/* old way: malloc our own outbuf, iscsi will free it */
-			cmd.outdata = Malloc(cmd.outlen);
+			/* our own outbuf, iscsi frees or releases it */
+			if (osd->op)
+				cmd.outdata = outbuf_get(osd, cmd.outlen);
+			else
+				cmd.outdata = Malloc(cmd.outlen); /* old way */
 			if (!cmd.outdata)
 				goto out_hw_err;
 		}
 	}
 
+	lat_add(osd, RLAT_PARSE, t); /* cdb and data-in buffer */
 	exec_service_action(&cmd); /* run the command. */
 
 	/*
@@ -2197,13 +2407,12 @@ out_hw_err:
 
 out_free_resource:
 	if (cmd.outlen && *data_out == NULL)
-		free(cmd.outdata);  /* old way */
+		osdemu_outbuf_release(osd, cmd.outdata);
 	*data_out_len = 0;
 
 out:
-	if (cmd.cont.descriptors != NULL) {
-		free(cmd.cont.descriptors);
-	}
+	lat_end(osd, cmd.action);
+	arena_reset(cmd.arena); /* parsed lists, descriptors, query state */
 
 	if (cmd.senselen == 0) {
 		return SAM_STAT_GOOD;
@@ -2215,3 +2424,388 @@ out:
 	}
 }
 
+/*
+ * A CAS or FA of a user object whose values are in the atomics table, and
+ * that neither gets nor sets attributes, runs here without the device
+ * lock.  Latency is not recorded for it.
+ *
+ * returns: -EAGAIN if the command must take the ordinary way
+ */
+static int cmd_submit_atomic(struct osd_device *osd, uint8_t *cdb,
+			     const uint8_t *data_in, uint64_t data_in_len,
+			     uint8_t **data_out, uint64_t *data_out_len)
+{
+	int ret;
+	uint64_t pid, oid, len, off, val;
+	uint8_t *outdata;
+	struct command cmd = {
+		.cdb = cdb,
+		.action = (cdb[8] << 8) | cdb[9],
+		.getset_cdbfmt = (cdb[11] & 0x30) >> 4,
+	};
+
+	if (cdb[0] != VARLEN_CDB || cdb[7] != OSD_CDB_SIZE - 8)
+		return -EAGAIN;
+	if (cmd.action != OSD_CAS && cmd.action != OSD_FA)
+		return -EAGAIN;
+	if (cmd.getset_cdbfmt != GETLIST_SETLIST || get_ntohl(&cdb[48]) ||
+	    get_ntohl(&cdb[52]) || get_ntohl(&cdb[68]))
+		return -EAGAIN; /* continuation or attribute lists */
+	if (calc_max_out_len(&cmd) < 0 || atomics_due(osd))
+		return -EAGAIN;
+	if (sec_method(osd) != OSD_SEC_NOSEC)
+		return -EAGAIN; /* capabilities are checked under the lock */
+
+	pid = get_ntohll(&cdb[16]);
+	oid = get_ntohll(&cdb[24]);
+	len = get_ntohll(&cdb[32]);
+	off = get_ntohll(&cdb[40]);
+	if (!data_in || len < sizeof(val) || off > cmd.outlen ||
+	    cmd.outlen - off < sizeof(val) ||
+	    data_in_len < (cmd.action == OSD_CAS ? 16 : 8))
+		return -EAGAIN;
+
+	if (*data_out != NULL) {
+		if (cmd.outlen != *data_out_len)
+			return -EAGAIN;
+		outdata = *data_out;
+	} else {
+		if (osd->op)
+			outdata = outbuf_get(osd, cmd.outlen);
+		else
+			outdata = Malloc(cmd.outlen);
+		if (!outdata)
+			return -EAGAIN;
+	}
+
+	PROBE4(cmd_start, cmd.action, pid, oid, 0);
+	if (cmd.action == OSD_CAS)
+		ret = atomics_cas(osd, pid, oid, get_ntohll(&data_in[0]),
+				  get_ntohll(&data_in[8]), &val);
+	else
+		ret = atomics_fa(osd, pid, oid, get_ntohll(&data_in[0]), &val);
+	if (ret != OSD_OK) {
+		if (*data_out == NULL)
+			osdemu_outbuf_release(osd, outdata);
+		return -EAGAIN;
+	}
+
+	PROBE4(cmd_done, cmd.action, pid, oid, 0);
+	set_htonll(outdata + off, val);
+	*data_out = outdata;
+	*data_out_len = sizeof(val); /* as osd_cas and osd_fa report it */
+	return SAM_STAT_GOOD;
+}
+
+/*
+ * The value and timeout of a CAS WAIT, from its data-out buffer.
+ *
+ * returns: OSD_OK if it may have to wait, -EINVAL if it is not a CAS
+ * WAIT or runs at once; the command reports any error itself.
+ */
+int cmd_wait_parse(const uint8_t *cdb, const uint8_t *data_in,
+		   uint64_t data_in_len, struct async_wait *w)
+{
+	uint32_t ms;
+
+	if (cdb[0] != VARLEN_CDB || cdb[7] != OSD_CDB_SIZE - 8)
+		return -EINVAL;
+	if (((cdb[8] << 8) | cdb[9]) != OSD_CAS_WAIT)
+		return -EINVAL;
+	if (!data_in || data_in_len < CAS_WAIT_LEN)
+		return -EINVAL;
+	ms = get_ntohl(&data_in[8]);
+	if (ms == 0)
+		return -EINVAL;
+	if (ms > CAS_WAIT_MAX_MS)
+		ms = CAS_WAIT_MAX_MS;
+
+	w->pid = get_ntohll(&cdb[16]);
+	w->oid = get_ntohll(&cdb[24]);
+	w->val = get_ntohll(&data_in[0]);
+	w->deadline = lat_now() + ms * 1000000ULL;
+	return OSD_OK;
+}
+
+/*
+ * Called without the device lock.
+ *
+ * returns: 1 while the CAS value is still the one waited on and the
+ * deadline has not passed, else 0
+ */
+int cmd_wait_check(struct osd_device *osd, const struct async_wait *w)
+{
+	int ret;
+	uint64_t val, used;
+	uint8_t buf[8];
+	uint8_t sense[OSD_MAX_SENSE];
+	struct async_queue *aq;
+
+	if (lat_now() >= w->deadline)
+		return 0;
+	if (atomics_peek(osd, w->pid, w->oid, &val) != OSD_OK) {
+		aq = async_lock(osd);
+		ret = osd_cas_read(osd, w->pid, w->oid, buf, &used, sense);
+		async_unlock(aq);
+		if (ret != OSD_OK)
+			return 0; /* the command reports it */
+		val = get_ntohll(buf);
+	}
+	return val == w->val;
+}
+
+/*
+ * Run one command under the device lock.
+ */
+int cmd_run(struct osd_device *osd, uint8_t *cdb, const uint8_t *data_in,
+	    uint64_t data_in_len, uint8_t **data_out, uint64_t *data_out_len,
+	    uint8_t *sense_out, int *senselen_out)
+{
+	int ret;
+	struct async_queue *aq;
+
+	aq = async_lock(osd);
+	ret = cmd_submit(osd, cdb, data_in, data_in_len, data_out,
+			 data_out_len, sense_out, senselen_out);
+	/* advance background work, idle workers take it from there */
+	async_jobs(osd, job_run(osd, 1));
+	async_unlock(aq);
+	return ret;
+}
+
+/*
+ * A CAS WAIT sleeps here while its value stays, then runs as usual and
+ * returns the value of that time.  Without async started nothing else
+ * can change the value, and it does not wait.
+ */
+static void cmd_submit_wait(struct osd_device *osd, const uint8_t *cdb,
+			    const uint8_t *data_in, uint64_t data_in_len)
+{
+	struct async_wait w;
+
+	if (cmd_wait_parse(cdb, data_in, data_in_len, &w) != OSD_OK)
+		return;
+	if (async_wait_add(osd, &w) != OSD_OK)
+		return;
+	while (cmd_wait_check(osd, &w) && async_wait_sleep(&w) == OSD_OK)
+		;
+	async_wait_del(&w);
+}
+
+/*
+ * Inputs are write data from client.  Output are for the read results that
+ * OSD will produce.  You can modify the data_out and data_out_len to return
+ * a new buffer, or short read result.
+ */
+int osdemu_cmd_submit(struct osd_device *osd, uint8_t *cdb,
+		      const uint8_t *data_in, uint64_t data_in_len,
+		      uint8_t **data_out, uint64_t *data_out_len,
+		      uint8_t *sense_out, int *senselen_out)
+{
+	int ret;
+
+	ret = cmd_submit_atomic(osd, cdb, data_in, data_in_len, data_out,
+				data_out_len);
+	if (ret != -EAGAIN)
+		return ret;
+
+	cmd_submit_wait(osd, cdb, data_in, data_in_len);
+	return cmd_run(osd, cdb, data_in, data_in_len, data_out,
+		       data_out_len, sense_out, senselen_out);
+}
+
+static int batch_begin(struct osd_device *osd)
+{
+	int ret;
+
+	ret = osd_begin_txn(osd);
+	if (ret != OSD_OK)
+		return ret;
+	fdcache_begin(osd); /* without it files are opened per command */
+	return OSD_OK;
+}
+
+/*
+ * Commit the changes of cmds.  If that fails none of them are kept, so
+ * those that had succeeded fail after all.
+ */
+static int batch_end(struct osd_device *osd, struct osdemu_cmd *cmds,
+		     int n)
+{
+	int i, ret, failed = 0;
+	struct osdemu_cmd *c;
+
+	fdcache_end(osd);
+	ret = osd_end_txn(osd);
+	if (ret == OSD_OK)
+		return 0;
+
+	osd_error("%s: commit of %d commands failed", __func__, n);
+	for (i = 0; i < n; i++) {
+		c = &cmds[i];
+		if (c->status != SAM_STAT_GOOD)
+			continue;
+		c->senselen_out = sense_build_sdd(c->sense_out,
+					OSD_SSK_HARDWARE_ERROR,
+					OSD_ASC_SYSTEM_RESOURCE_FAILURE,
+					get_ntohll(&c->cdb[16]),
+					get_ntohll(&c->cdb[24]));
+		c->status = SAM_STAT_CHECK_CONDITION;
+		failed++;
+	}
+	return failed;
+}
+
+/*
+ * Run n commands as if by osdemu_cmd_submit each, in order, but under one
+ * db transaction and with the data files they touch kept open until the
+ * end.  Every cmds[i] gets its own status and sense.  A FORMAT OSD
+ * replaces the db and runs outside of the transaction.
+ *
+ * returns: number of commands that ended in CHECK CONDITION
+ */
+int osdemu_cmd_submit_batch(struct osd_device *osd, struct osdemu_cmd *cmds,
+			    int n)
+{
+	int i;
+	int failed = 0;
+	int open = 0;
+	int first = 0;
+	struct osdemu_cmd *c;
+	uint16_t action;
+	struct async_queue *aq;
+
+	aq = async_lock(osd);
+	for (i = 0; i < n; i++) {
+		c = &cmds[i];
+		action = (c->cdb[8] << 8) | c->cdb[9];
+		if (action == OSD_FORMAT_OSD && open) {
+			failed += batch_end(osd, &cmds[first], i - first);
+			open = 0;
+		} else if (action != OSD_FORMAT_OSD && !open) {
+			/* if this fails, commands just run one by one */
+			open = (batch_begin(osd) == OSD_OK);
+			first = i;
+		}
+
+		c->senselen_out = 0;
+		c->status = cmd_submit(osd, c->cdb, c->data_in, c->data_in_len,
+				       &c->data_out, &c->data_out_len,
+				       c->sense_out, &c->senselen_out);
+		if (c->status != SAM_STAT_GOOD)
+			failed++;
+	}
+	if (open)
+		failed += batch_end(osd, &cmds[first], n - first);
+
+	async_jobs(osd, job_run(osd, n));
+	async_unlock(aq);
+	return failed;
+}
+
+/*
+ * Start the workers of osdemu_cmd_submit_async.  Call it after osd_open.
+ *
+ * returns: eventfd to poll for completions, <0 on error
+ */
+int osdemu_async_start(struct osd_device *osd)
+{
+	return async_init(osd);
+}
+
+int osdemu_cmd_submit_async(struct osd_device *osd, struct osdemu_cmd *cmd,
+			    osdemu_done_t done, void *arg)
+{
+	return async_submit(osd, cmd, done, arg);
+}
+
+int osdemu_jobs_run(struct osd_device *osd, int nsteps)
+{
+	int pending;
+	struct async_queue *aq;
+
+	aq = async_lock(osd);
+	pending = job_run(osd, nsteps);
+	async_unlock(aq);
+	return pending;
+}
+
+/*
+ * Call the done callbacks of at most max completed commands, all if
+ * max < 0.
+ *
+ * returns: number of callbacks called
+ */
+int osdemu_async_reap(struct osd_device *osd, int max)
+{
+	return async_reap(osd, max);
+}
+
+/*
+ * Allocate data-in buffers from the pool from now on.
+ * Call it after osd_open, before the first command.
+ */
+int osdemu_outbuf_pool(struct osd_device *osd, int flags)
+{
+	return outbuf_init(osd, flags);
+}
+
+/*
+ * Give back *data_out of a completed osdemu_cmd_submit that allocated it.
+ */
+void osdemu_outbuf_release(struct osd_device *osd, uint8_t *data_out)
+{
+	if (osd->op)
+		outbuf_put(osd, data_out);
+	else
+		free(data_out);
+}
+
+/*
+ * CAS and FA values are written to the db at most ms after they change,
+ * see atomics.c for what that means on a crash.  0 writes each at once
+ * and keeps every CAS and FA under the device lock.
+ */
+void osdemu_atomics_interval(struct osd_device *osd, uint32_t ms)
+{
+	struct async_queue *aq;
+
+	aq = async_lock(osd);
+	atomics_set_interval(osd, ms);
+	async_unlock(aq);
+}
+
+/*
+ * Start profiling the SQL statements of the device, see sqlprof.c.
+ * Calling it again changes slow_us and keeps the numbers.
+ */
+int osdemu_sql_profile(struct osd_device *osd, uint64_t slow_us)
+{
+	int ret;
+	struct async_queue *aq;
+
+	aq = async_lock(osd);
+	ret = sqlprof_start(osd->dbc, slow_us * 1000);
+	async_unlock(aq);
+	return ret;
+}
+
+int osdemu_sql_report(struct osd_device *osd, FILE *fp, int top)
+{
+	int ret;
+	struct async_queue *aq;
+
+	aq = async_lock(osd);
+	ret = sqlprof_report(osd->dbc, fp, top);
+	async_unlock(aq);
+	return ret;
+}
+
+void osdemu_sql_profile_stop(struct osd_device *osd)
+{
+	struct async_queue *aq;
+
+	aq = async_lock(osd);
+	sqlprof_stop(osd->dbc);
+	async_unlock(aq);
+}
@@ -18,6 +18,9 @@
 #ifndef __CDB_H
 #define __CDB_H
 
+#include <stdio.h>
+#include <stdint.h>
+
 /* module interface */
 struct osd_device;
 
@@ -25,10 +28,77 @@ struct osd_device *osd_device_alloc(void);
 void osd_device_free(struct osd_device *osd);
 int osd_open(const char *root, struct osd_device *osd);
 int osd_close(struct osd_device *osd);
+int osd_warmup(struct osd_device *osd);
 int osdemu_cmd_submit(struct osd_device *osd, uint8_t *cdb,
                       const uint8_t *data_in, uint64_t data_in_len,
 		      uint8_t **data_out, uint64_t *data_out_len,
 		      uint8_t *sense_out, int *senselen_out);
 int osd_set_name(struct osd_device *osd, char *osdname);
+int osd_set_master(struct osd_device *osd, const uint8_t *key);
+
+/*
+ * One command of osdemu_cmd_submit_batch, fields as the arguments of
+ * osdemu_cmd_submit.  status is filled in with the SAM status.
+ */
+struct osdemu_cmd {
+	uint8_t *cdb;
+	const uint8_t *data_in;
+	uint64_t data_in_len;
+	uint8_t *data_out;
+	uint64_t data_out_len;
+	uint8_t *sense_out;	/* OSD_MAX_SENSE bytes */
+	int senselen_out;
+	int status;
+};
+
+int osdemu_cmd_submit_batch(struct osd_device *osd, struct osdemu_cmd *cmds,
+			    int n);
+
+/*
+ * Asynchronous submission.  osdemu_async_start returns an eventfd that is
+ * readable while completions wait; osdemu_async_reap runs their done
+ * callbacks on the calling thread.  cmd must stay valid until done is
+ * called.  Commands in flight together may complete in any order.
+ * osd_close finishes queued commands and calls the remaining callbacks.
+ */
+typedef void (*osdemu_done_t)(struct osdemu_cmd *cmd, void *arg);
+
+int osdemu_async_start(struct osd_device *osd);
+int osdemu_cmd_submit_async(struct osd_device *osd, struct osdemu_cmd *cmd,
+			    osdemu_done_t done, void *arg);
+int osdemu_async_reap(struct osd_device *osd, int max);
+
+/*
+ * Background work (bulk removal and the like) advances a step after each
+ * command, and on the async workers when they have nothing else to do.
+ * Without async, call osdemu_jobs_run when idle: it runs at most nsteps
+ * steps and returns how many jobs are still pending.
+ */
+int osdemu_jobs_run(struct osd_device *osd, int nsteps);
+
+/*
+ * CAS and FA keep their values in memory and write them to the db at
+ * most ms later (default 1000), 0 to write them at once.
+ */
+void osdemu_atomics_interval(struct osd_device *osd, uint32_t ms);
+
+/*
+ * SQL statement profile: runs, time and rows per statement, and a log
+ * of those slower than slow_us (0: none).  The report ranks statements
+ * by total time, top of them or all if top <= 0.
+ */
+int osdemu_sql_profile(struct osd_device *osd, uint64_t slow_us);
+int osdemu_sql_report(struct osd_device *osd, FILE *fp, int top);
+void osdemu_sql_profile_stop(struct osd_device *osd);
+
+/*
+ * Data-in buffers allocated by osdemu_cmd_submit, when *data_out is NULL,
+ * come from a pool once it is enabled. They are page aligned and must be
+ * given back with osdemu_outbuf_release instead of free, before osd_close.
+ */
+#define OSDEMU_OUTBUF_HUGE 0x1	/* back large buffers with huge pages */
+
+int osdemu_outbuf_pool(struct osd_device *osd, int flags);
+void osdemu_outbuf_release(struct osd_device *osd, uint8_t *data_out);
 
 #endif /* __CDB_H */
@@ -47,6 +47,7 @@ struct coll_tab {
 	sqlite3_stmt *getcid;   /* get collection */
 	sqlite3_stmt *getoids;  /* get objects in a collection */
 	sqlite3_stmt *copyoids; /* copy oids from one collection to another */
+	sqlite3_stmt *getbatch; /* get a batch of objects in a collection */
 };
 
 
@@ -90,61 +91,70 @@ int coll_initialize(struct db_context *dbc)
 	}
 
 	sprintf(SQL, "INSERT INTO %s VALUES (?, ?, ?, ?);", dbc->coll->name);
-	ret = sqlite3_prepare(dbc->db, SQL, -1, &dbc->coll->insert, NULL);
+	ret = db_prepare_lazy(dbc, SQL, &dbc->coll->insert);
 	if (ret != SQLITE_OK)
 		goto out_finalize_insert;
 
 	sprintf(SQL, "DELETE FROM %s WHERE pid = ? AND cid = ? AND oid = ?;", 
 		dbc->coll->name);
-	ret = sqlite3_prepare(dbc->db, SQL, -1, &dbc->coll->delete, NULL);
+	ret = db_prepare_lazy(dbc, SQL, &dbc->coll->delete);
 	if (ret != SQLITE_OK)
 		goto out_finalize_delete;
 
 	sprintf(SQL, "DELETE FROM %s WHERE pid = ? AND cid = ?;", 
 		dbc->coll->name);
-	ret = sqlite3_prepare(dbc->db, SQL, -1, &dbc->coll->delcid, NULL);
+	ret = db_prepare_lazy(dbc, SQL, &dbc->coll->delcid);
 	if (ret != SQLITE_OK)
 		goto out_finalize_delcid;
 
 	sprintf(SQL, "DELETE FROM %s WHERE pid = ? AND oid = ?;", 
 		dbc->coll->name);
-	ret = sqlite3_prepare(dbc->db, SQL, -1, &dbc->coll->deloid, NULL);
+	ret = db_prepare_lazy(dbc, SQL, &dbc->coll->deloid);
 	if (ret != SQLITE_OK)
 		goto out_finalize_deloid;
 
 	sprintf(SQL, "SELECT COUNT (*) FROM %s WHERE pid = ? AND cid = ? "
 		" LIMIT 1;", dbc->coll->name);
-	ret = sqlite3_prepare(dbc->db, SQL, -1, &dbc->coll->emptycid, NULL);
+	ret = db_prepare_lazy(dbc, SQL, &dbc->coll->emptycid);
 	if (ret != SQLITE_OK)
 		goto out_finalize_emptycid;
 
 	sprintf(SQL, "SELECT MAX (number) FROM %s WHERE pid = ? AND cid = ?;",
 		dbc->coll->name);
-	ret = sqlite3_prepare(dbc->db, SQL, -1, &dbc->coll->max, NULL);
+	ret = db_prepare_lazy(dbc, SQL, &dbc->coll->max);
 	if (ret != SQLITE_OK)
 		goto out_finalize_max;
 
 	sprintf(SQL, "SELECT cid FROM %s WHERE pid = ? AND oid = ? AND "
 		" number = ?;", dbc->coll->name);
-	ret = sqlite3_prepare(dbc->db, SQL, -1, &dbc->coll->getcid, NULL);
+	ret = db_prepare_lazy(dbc, SQL, &dbc->coll->getcid);
 	if (ret != SQLITE_OK)
 		goto out_finalize_getcid;
 
 	sprintf(SQL, "SELECT oid FROM %s WHERE pid = ? AND cid = ? AND "
 		" oid >= ?;", dbc->coll->name);
-	ret = sqlite3_prepare(dbc->db, SQL, -1, &dbc->coll->getoids, NULL);
+	ret = db_prepare_lazy(dbc, SQL, &dbc->coll->getoids);
 	if (ret != SQLITE_OK)
 		goto out_finalize_getoids;
 
 	sprintf(SQL, "INSERT INTO %s SELECT ?, ?, oid, 0 FROM %s WHERE "
 		"pid = ? AND cid = ?;", dbc->coll->name, dbc->coll->name);
-	ret = sqlite3_prepare(dbc->db, SQL, -1, &dbc->coll->copyoids, NULL);
+	ret = db_prepare_lazy(dbc, SQL, &dbc->coll->copyoids);
 	if (ret != SQLITE_OK)
 		goto out_finalize_copyoids;
 
+	sprintf(SQL, "SELECT oid FROM %s WHERE pid = ? AND cid = ? LIMIT ?;",
+		dbc->coll->name);
+	ret = db_prepare_lazy(dbc, SQL, &dbc->coll->getbatch);
+	if (ret != SQLITE_OK)
+		goto out_finalize_getbatch;
+
 	ret = OSD_OK; /* success */
 	goto out;
 
+out_finalize_getbatch:
+	db_sqfinalize(dbc->db, dbc->coll->getbatch, SQL);
+	SQL[0] = '\0';
 out_finalize_copyoids:
 	db_sqfinalize(dbc->db, dbc->coll->copyoids, SQL);
 	SQL[0] = '\0';
@@ -192,6 +202,8 @@ int coll_finalize(struct db_context *dbc)
 	sqlite3_finalize(dbc->coll->getcid);
 	sqlite3_finalize(dbc->coll->getoids);
 	sqlite3_finalize(dbc->coll->copyoids);
+	sqlite3_finalize(dbc->coll->getbatch);
+	db_forget_lazy(dbc, dbc->coll, sizeof(*dbc->coll));
 	free(dbc->coll->name);
 	free(dbc->coll);
 	dbc->coll = NULL;
@@ -224,7 +236,9 @@ int coll_insert(struct db_context *dbc, uint64_t pid, uint64_t cid,
 {
 	int ret = 0;
 
-	assert(dbc && dbc->db && dbc->coll && dbc->coll->insert);
+	assert(dbc && dbc->db && dbc->coll);
+	if (db_stmt_ready(dbc, &dbc->coll->insert) != OSD_OK)
+		return OSD_ERROR;
 
 repeat:
 	ret = 0;
@@ -254,7 +268,9 @@ int coll_copyoids(struct db_context *dbc, uint64_t pid, uint64_t dest_cid,
 {
 	int ret = 0;
 
-	assert(dbc && dbc->db && dbc->coll && dbc->coll->copyoids);
+	assert(dbc && dbc->db && dbc->coll);
+	if (db_stmt_ready(dbc, &dbc->coll->copyoids) != OSD_OK)
+		return OSD_ERROR;
 
 repeat:
 	ret = 0;
@@ -281,7 +297,9 @@ int coll_delete(struct db_context *dbc, uint64_t pid, uint64_t cid,
 {
 	int ret = 0;
 
-	assert(dbc && dbc->db && dbc->coll && dbc->coll->delete);
+	assert(dbc && dbc->db && dbc->coll);
+	if (db_stmt_ready(dbc, &dbc->coll->delete) != OSD_OK)
+		return OSD_ERROR;
 
 repeat:
 	ret = 0;
@@ -306,7 +324,9 @@ int coll_delete_cid(struct db_context *dbc, uint64_t pid, uint64_t cid)
 {
 	int ret = 0;
 
-	assert(dbc && dbc->db && dbc->coll && dbc->coll->delcid);
+	assert(dbc && dbc->db && dbc->coll);
+	if (db_stmt_ready(dbc, &dbc->coll->delcid) != OSD_OK)
+		return OSD_ERROR;
 
 repeat:
 	ret = 0;
@@ -330,7 +350,9 @@ int coll_delete_oid(struct db_context *dbc, uint64_t pid, uint64_t oid)
 {
 	int ret = 0;
 
-	assert(dbc && dbc->db && dbc->coll && dbc->coll->deloid);
+	assert(dbc && dbc->db && dbc->coll);
+	if (db_stmt_ready(dbc, &dbc->coll->deloid) != OSD_OK)
+		return OSD_ERROR;
 
 repeat:
 	ret = 0;
@@ -361,7 +383,9 @@ int coll_isempty_cid(struct db_context *dbc, uint64_t pid, uint64_t cid,
 	int bound = 0;
 	*isempty = 0;
 
-	assert(dbc && dbc->db && dbc->coll && dbc->coll->emptycid);
+	assert(dbc && dbc->db && dbc->coll);
+	if (db_stmt_ready(dbc, &dbc->coll->emptycid) != OSD_OK)
+		return OSD_ERROR;
 
 repeat:
 	ret = 0;
@@ -386,6 +410,96 @@ out:
 }
 
 
+/*
+ * count the members of collection cid. Shares the statement with
+ * coll_isempty_cid, which already computes the full count.
+ *
+ * returns:
+ * -EINVAL: invalid arg
+ * OSD_ERROR: in case of other errors, ignore value of *count
+ * OSD_OK: success, *count is set
+ */
+int coll_count_cid(struct db_context *dbc, uint64_t pid, uint64_t cid,
+		   uint64_t *count)
+{
+	int ret = 0;
+	int bound = 0;
+	*count = 0;
+
+	assert(dbc && dbc->db && dbc->coll);
+	if (db_stmt_ready(dbc, &dbc->coll->emptycid) != OSD_OK)
+		return OSD_ERROR;
+
+repeat:
+	ret = 0;
+	ret |= sqlite3_bind_int64(dbc->coll->emptycid, 1, pid);
+	ret |= sqlite3_bind_int64(dbc->coll->emptycid, 2, cid);
+	bound = (ret == SQLITE_OK);
+	if (!bound) {
+		error_sql(dbc->db, "%s: bind failed", __func__);
+		goto out_reset;
+	}
+
+	while ((ret = sqlite3_step(dbc->coll->emptycid)) == SQLITE_BUSY);
+	if (ret == SQLITE_ROW)
+		*count = sqlite3_column_int64(dbc->coll->emptycid, 0);
+
+out_reset:
+	ret = db_reset_stmt(dbc, dbc->coll->emptycid, bound, __func__);
+	if (ret == OSD_REPEAT)
+		goto repeat;
+	return ret;
+}
+
+
+/*
+ * fetch at most 'max' members of collection cid. Used by bulk removal,
+ * which deletes every batch it gets, so no cursor is needed.
+ *
+ * returns:
+ * OSD_ERROR: in case of any error
+ * OSD_OK: success, *count is set to number of oids returned
+ */
+int coll_get_member_batch(struct db_context *dbc, uint64_t pid, uint64_t cid,
+			  uint64_t *oids, uint32_t max, uint32_t *count)
+{
+	int ret = 0;
+	int bound = 0;
+	sqlite3_stmt *stmt = NULL;
+
+	assert(dbc && dbc->db && dbc->coll);
+	if (db_stmt_ready(dbc, &dbc->coll->getbatch) != OSD_OK)
+		return OSD_ERROR;
+
+repeat:
+	*count = 0;
+	ret = 0;
+	stmt = dbc->coll->getbatch;
+	ret |= sqlite3_bind_int64(stmt, 1, pid);
+	ret |= sqlite3_bind_int64(stmt, 2, cid);
+	ret |= sqlite3_bind_int64(stmt, 3, max);
+	bound = (ret == SQLITE_OK);
+	if (!bound) {
+		error_sql(dbc->db, "%s: bind failed", __func__);
+		goto out_reset;
+	}
+
+	while (*count < max) {
+		ret = sqlite3_step(stmt);
+		if (ret == SQLITE_ROW)
+			oids[(*count)++] = sqlite3_column_int64(stmt, 0);
+		else if (ret != SQLITE_BUSY)
+			break;
+	}
+
+out_reset:
+	ret = db_reset_stmt(dbc, stmt, bound, __func__);
+	if (ret == OSD_REPEAT)
+		goto repeat;
+	return ret;
+}
+
+
 /*
  * return the max object pointer for a particular pid,cid
  *
@@ -403,7 +517,9 @@ int coll_max_pointer(struct db_context *dbc, uint64_t pid, uint64_t cid,
 	int bound = 0;
 	*number = 0;
 
-	assert(dbc && dbc->db && dbc->coll && dbc->coll->max);
+	assert(dbc && dbc->db && dbc->coll);
+	if (db_stmt_ready(dbc, &dbc->coll->max) != OSD_OK)
+		return OSD_ERROR;
 
 repeat:
 	ret = 0;
@@ -440,7 +556,9 @@ int coll_get_cid(struct db_context *dbc, uint64_t pid, uint64_t oid,
 	int ret = 0;
 	int bound = 0;
 
-	assert(dbc && dbc->db && dbc->coll && dbc->coll->getcid);
+	assert(dbc && dbc->db && dbc->coll);
+	if (db_stmt_ready(dbc, &dbc->coll->getcid) != OSD_OK)
+		return OSD_ERROR;
 
 repeat:
 	ret = 0;
@@ -481,7 +599,9 @@ int coll_get_oids_in_cid(struct db_context *dbc, uint64_t pid, uint64_t cid,
 	uint64_t len = 0;
 	sqlite3_stmt *stmt = NULL;
 
-	assert(dbc && dbc->db && dbc->coll && dbc->coll->getoids);
+	assert(dbc && dbc->db && dbc->coll);
+	if (db_stmt_ready(dbc, &dbc->coll->getoids) != OSD_OK)
+		return OSD_ERROR;
 
 repeat:
 	ret = 0;
@@ -41,6 +41,12 @@ int coll_delete_oid(struct db_context *dbc, uint64_t pid, uint64_t oid);
 int coll_isempty_cid(struct db_context *dbc, uint64_t pid, uint64_t cid,
 		     int *isempty);
 
+int coll_count_cid(struct db_context *dbc, uint64_t pid, uint64_t cid,
+		   uint64_t *count);
+
+int coll_get_member_batch(struct db_context *dbc, uint64_t pid, uint64_t cid,
+			  uint64_t *oids, uint32_t max, uint32_t *count);
+
 int coll_get_cid(struct db_context *dbc, uint64_t pid, uint64_t oid, 
 		 uint32_t number, uint64_t *cid);
 
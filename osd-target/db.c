@@ -26,6 +26,7 @@
 #include "osd-types.h"
 #include "osd.h"
 #include "db.h"
+#include "sqlprof.h"
 #include "obj.h"
 #include "coll.h"
 #include "osd-util/osd-util.h"
@@ -57,7 +58,7 @@ static int db_check_tables(struct db_context *dbc)
 	int ret = 0;
 	char SQL[MAXSQLEN];
 	char *err = NULL;
-	const char *tables[] = {"attr", "obj", "coll"};
+	const char *tables[] = {"attr", "obj", "coll", "seckey"};
 	struct array arr = {ARRAY_SIZE(tables), tables};
 
 	sprintf(SQL, "SELECT name FROM sqlite_master WHERE type='table' "
@@ -159,7 +160,9 @@ int osd_db_close(struct osd_device *osd)
 
 	assert(osd && osd->dbc && osd->dbc->db);
 
+	sqlprof_stop(osd->dbc);
 	db_finalize(osd->dbc);
+	assert(osd->dbc->lazy == NULL);
 	sqlite3_close(osd->dbc->db);
 	free(osd->dbc);
 	osd->dbc = NULL;
@@ -168,6 +171,110 @@ int osd_db_close(struct osd_device *osd)
 }
 
 
+/*
+ * Statements are compiled on first use rather than at open. Most of them
+ * are never needed by a given workload, and preparing all of them up front
+ * dominates the time to reopen an existing db. db_prepare_lazy records the
+ * SQL against the address of the stmt pointer, db_stmt_ready prepares it
+ * when the pointer is still NULL.
+ */
+struct db_lazy {
+	sqlite3_stmt **stmt;
+	struct db_lazy *next;
+	char SQL[1];
+};
+
+/*
+ * returns:
+ * SQLITE_NOMEM: out of memory
+ * SQLITE_OK: SQL remembered, *stmt is NULL until first use
+ */
+int db_prepare_lazy(struct db_context *dbc, const char *SQL,
+		    sqlite3_stmt **stmt)
+{
+	struct db_lazy *l;
+
+	assert(dbc && SQL && stmt);
+
+	l = Malloc(sizeof(*l) + strlen(SQL));
+	if (!l)
+		return SQLITE_NOMEM;
+	strcpy(l->SQL, SQL);
+	l->stmt = stmt;
+	l->next = dbc->lazy;
+	dbc->lazy = l;
+	*stmt = NULL;
+	return SQLITE_OK;
+}
+
+/*
+ * returns:
+ * OSD_ERROR: stmt was never registered or prepare failed
+ * OSD_OK: *stmt is prepared
+ */
+int db_prepare_deferred(struct db_context *dbc, sqlite3_stmt **stmt)
+{
+	int ret = 0;
+	struct db_lazy *l, **pl;
+
+	for (pl = &dbc->lazy; (l = *pl) != NULL; pl = &l->next)
+		if (l->stmt == stmt)
+			break;
+	if (!l) {
+		osd_error("%s: no SQL for stmt", __func__);
+		return OSD_ERROR;
+	}
+
+	ret = sqlite3_prepare(dbc->db, l->SQL, -1, stmt, NULL);
+	if (ret != SQLITE_OK) {
+		error_sql(dbc->db, "prepare of %s failed", l->SQL);
+		sqlite3_finalize(*stmt);
+		*stmt = NULL;
+		return OSD_ERROR;
+	}
+
+	*pl = l->next;
+	free(l);
+	return OSD_OK;
+}
+
+/*
+ * prepare everything still pending, used after a schema change where the
+ * callers expect their statements to be usable right away.
+ */
+int db_prepare_all(struct db_context *dbc)
+{
+	int ret = 0;
+
+	while (dbc->lazy) {
+		ret = db_prepare_deferred(dbc, dbc->lazy->stmt);
+		if (ret != OSD_OK)
+			return ret;
+	}
+	return OSD_OK;
+}
+
+/*
+ * drop the pending statements of a table, which is about to be freed
+ */
+void db_forget_lazy(struct db_context *dbc, const void *tab, size_t len)
+{
+	const char *lo = tab;
+	struct db_lazy *l, **pl;
+
+	pl = &dbc->lazy;
+	while ((l = *pl) != NULL) {
+		if ((const char *)l->stmt >= lo &&
+		    (const char *)l->stmt < lo + len) {
+			*pl = l->next;
+			free(l);
+		} else {
+			pl = &l->next;
+		}
+	}
+}
+
+
 int db_initialize(struct db_context *dbc)
 {
 	int ret = 0;
@@ -219,6 +326,10 @@ int db_finalize(struct db_context *dbc)
 }
 
 
+/*
+ * Transactions nest: only the outermost begin and end reach sqlite, so a
+ * batch of commands can run under one transaction.
+ */
 int db_begin_txn(struct db_context *dbc)
 {
 	int ret = 0;
@@ -226,10 +337,14 @@ int db_begin_txn(struct db_context *dbc)
 
 	assert(dbc && dbc->db);
 
+	if (dbc->txn_depth++ > 0)
+		return OSD_OK;
+
 	ret = sqlite3_exec(dbc->db, "BEGIN TRANSACTION;", NULL, NULL, &err);
 	if (ret != SQLITE_OK) {
 		osd_error("pragma failed: %s", err);
 		sqlite3_free(err);
+		dbc->txn_depth--;
 		return OSD_ERROR;
 	}
 
@@ -243,11 +358,18 @@ int db_end_txn(struct db_context *dbc)
 	char *err = NULL;
 
 	TICK_TRACE(db_end_txn);
-	assert(dbc && dbc->db);
+	assert(dbc && dbc->db && dbc->txn_depth > 0);
+
+	if (--dbc->txn_depth > 0)
+		return OSD_OK;
 
 	ret = sqlite3_exec(dbc->db, "END TRANSACTION;", NULL, NULL, &err);
 	if (ret != SQLITE_OK) {
-		osd_error("pragma failed: %s", err);
+		osd_error("%s: commit failed: %s", __func__, err);
+		sqlite3_free(err);
+		/* a failed COMMIT may leave it open, later ones would nest */
+		if (!sqlite3_get_autocommit(dbc->db))
+			sqlite3_exec(dbc->db, "ROLLBACK;", NULL, NULL, NULL);
 		return OSD_ERROR;
 	}
 
@@ -355,6 +477,7 @@ int db_exec_dms(struct db_context *dbc, sqlite3_stmt *stmt, int ret,
 	do {
 	    TICK_TRACE(sqlite3_step);
 	    ret = sqlite3_step(stmt);
+	    PROBE3(sql_step, func, stmt, ret);
 	} while (ret == SQLITE_BUSY);
 
 out_reset:
@@ -393,6 +516,7 @@ int db_exec_id_rtrvl_stmt(struct db_context *dbc, sqlite3_stmt *stmt,
 	*used_outlen = 0;
 	while (1) {
 		ret = sqlite3_step(stmt);
+		PROBE3(sql_step, func, stmt, ret);
 		if (ret == SQLITE_ROW) {
 			if ((alloc_len - len) >= 8) {
 				set_htonll(outdata, 
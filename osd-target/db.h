@@ -20,6 +20,7 @@
 
 #include <sqlite3.h>
 #include "osd-types.h"
+#include "probe.h"
 
 int osd_db_open(const char *path, struct osd_device *osd);
 
@@ -37,6 +38,25 @@ int db_exec_pragma(struct db_context *dbc);
 
 int db_print_pragma(struct db_context *dbc);
 
+int db_prepare_lazy(struct db_context *dbc, const char *SQL,
+		    sqlite3_stmt **stmt);
+
+int db_prepare_deferred(struct db_context *dbc, sqlite3_stmt **stmt);
+
+int db_prepare_all(struct db_context *dbc);
+
+void db_forget_lazy(struct db_context *dbc, const void *tab, size_t len);
+
+/*
+ * prepare stmt if this is its first use
+ */
+static inline int db_stmt_ready(struct db_context *dbc, sqlite3_stmt **stmt)
+{
+	if (*stmt != NULL)
+		return OSD_OK;
+	return db_prepare_deferred(dbc, stmt);
+}
+
 void error_sql(sqlite3 *db, const char *fmt, ...)
 	__attribute__((format(printf,2,3))); 
 
@@ -68,6 +88,7 @@ static inline int db_reset_stmt(struct db_context *dbc, sqlite3_stmt *stmt,
 				int bound, const char *func)
 {
 	int ret = sqlite3_reset(stmt);
+	PROBE3(sql_done, func, stmt, ret);
 	if (!bound) {
 		return OSD_ERROR;
 	} else if (ret == SQLITE_OK) {
@@ -75,6 +96,8 @@ static inline int db_reset_stmt(struct db_context *dbc, sqlite3_stmt *stmt,
 	} else if (ret == SQLITE_SCHEMA) {
 		db_finalize(dbc);
 		ret = db_initialize(dbc);
+		if (ret == OSD_OK)
+			ret = db_prepare_all(dbc);
 		if (ret == OSD_OK)
 			return OSD_REPEAT;
 	} 
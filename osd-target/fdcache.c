@@ -0,0 +1,144 @@
+/*
+ * Data file descriptor cache.
+ *
+ * Copyright (C) 2007 OSD Team <pvfs-osd@osc.edu>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, version 2 of the License.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/*
+ * While a batch of commands runs, the data files they read and write are
+ * opened once and kept open until the batch ends, instead of an open and
+ * close per command. Outside a batch fdcache_open and fdcache_close are
+ * plain open and close.
+ *
+ * Cached descriptors are opened read-write whatever the caller asked
+ * for. CREATE and REMOVE of an object drop its descriptor, the file
+ * behind it is no longer the object's. The table is direct mapped.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <errno.h>
+#include <unistd.h>
+#include <fcntl.h>
+
+#include "osd.h"
+#include "fdcache.h"
+#include "osd-util/osd-util.h"
+
+#define FDCACHE_SLOTS 64 /* power of 2 */
+
+struct fd_slot {
+	uint64_t pid;
+	uint64_t oid;
+	int fd;			/* -1 if empty */
+};
+
+struct fd_cache {
+	struct fd_slot slot[FDCACHE_SLOTS];
+};
+
+static inline struct fd_slot *fd_slot(struct fd_cache *fdc, uint64_t pid,
+				      uint64_t oid)
+{
+	return &fdc->slot[(oid ^ (pid * 0x9e3779b1)) & (FDCACHE_SLOTS - 1)];
+}
+
+static void slot_close(struct fd_slot *s)
+{
+	if (s->fd < 0)
+		return;
+	if (close(s->fd) != 0)
+		osd_error_errno("%s: close pid %llu oid %llu", __func__,
+				llu(s->pid), llu(s->oid));
+	s->fd = -1;
+}
+
+int fdcache_begin(struct osd_device *osd)
+{
+	int i;
+	struct fd_cache *fdc;
+
+	fdc = Malloc(sizeof(*fdc));
+	if (!fdc)
+		return -ENOMEM;
+	for (i = 0; i < FDCACHE_SLOTS; i++)
+		fdc->slot[i].fd = -1;
+	osd->fdc = fdc;
+	return OSD_OK;
+}
+
+void fdcache_end(struct osd_device *osd)
+{
+	int i;
+
+	if (!osd->fdc)
+		return;
+	for (i = 0; i < FDCACHE_SLOTS; i++)
+		slot_close(&osd->fdc->slot[i]);
+	free(osd->fdc);
+	osd->fdc = NULL;
+}
+
+/*
+ * returns: descriptor of the data file at path, <0 as open does
+ */
+int fdcache_open(struct osd_device *osd, const char *path, uint64_t pid,
+		 uint64_t oid, int flags)
+{
+	int fd;
+	struct fd_slot *s;
+
+	if (!osd->fdc)
+		return open(path, flags);
+
+	s = fd_slot(osd->fdc, pid, oid);
+	if (s->fd >= 0 && s->pid == pid && s->oid == oid)
+		return s->fd;
+
+	fd = open(path, O_RDWR|O_LARGEFILE);
+	if (fd < 0)
+		return open(path, flags); /* not cached */
+	slot_close(s);
+	s->pid = pid;
+	s->oid = oid;
+	s->fd = fd;
+	return fd;
+}
+
+/*
+ * returns: 0, or -1 with errno if the descriptor was not cached and close
+ * failed
+ */
+int fdcache_close(struct osd_device *osd, uint64_t pid, uint64_t oid, int fd)
+{
+	struct fd_slot *s;
+
+	if (osd->fdc) {
+		s = fd_slot(osd->fdc, pid, oid);
+		if (s->fd == fd && s->pid == pid && s->oid == oid)
+			return 0;
+	}
+	return close(fd);
+}
+
+void fdcache_forget(struct osd_device *osd, uint64_t pid, uint64_t oid)
+{
+	struct fd_slot *s;
+
+	if (!osd->fdc)
+		return;
+	s = fd_slot(osd->fdc, pid, oid);
+	if (s->fd >= 0 && s->pid == pid && s->oid == oid)
+		slot_close(s);
+}
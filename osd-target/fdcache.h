@@ -0,0 +1,35 @@
+/*
+ * Data file descriptor cache.
+ *
+ * Copyright (C) 2007 OSD Team <pvfs-osd@osc.edu>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, version 2 of the License.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#ifndef __FDCACHE_H
+#define __FDCACHE_H
+
+#include <stdint.h>
+#include "osd-types.h"
+
+int fdcache_begin(struct osd_device *osd);
+
+void fdcache_end(struct osd_device *osd);
+
+int fdcache_open(struct osd_device *osd, const char *path, uint64_t pid,
+		 uint64_t oid, int flags);
+
+int fdcache_close(struct osd_device *osd, uint64_t pid, uint64_t oid, int fd);
+
+void fdcache_forget(struct osd_device *osd, uint64_t pid, uint64_t oid);
+
+#endif /* __FDCACHE_H */
@@ -0,0 +1,413 @@
+/*
+ * Intent log.
+ *
+ * Copyright (C) 2007 OSD Team <pvfs-osd@osc.edu>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, version 2 of the License.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/*
+ * Commands like CREATE and REMOVE change both the db and the data files.
+ * The db runs with synchronous = OFF, so after a crash either side may
+ * have lost the last changes, leaving data files without an obj row or
+ * rows without data files.
+ *
+ * Before such a command touches anything, a begin record naming the
+ * objects is appended and synced. That is the only sync on the command
+ * path. An end record with the outcome is appended unsynced. osd_open
+ * replays the log through a fix callback which brings each named object
+ * back to a consistent state, then syncs the filesystem and truncates the
+ * log. The same checkpoint is taken when the log grows past
+ * INTENT_LOG_MAX and on osd_close.
+ *
+ * Only the outermost operation is logged; CREATE AND WRITE covers the
+ * CREATE and REMOVE it calls internally.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <assert.h>
+
+#include "osd.h"
+#include "db.h"
+#include "intent.h"
+#include "osd-util/osd-util.h"
+
+#define INTENT_MAGIC 0x4f534449 /* "OSDI" */
+#define INTENT_LOG_MAX (1 << 20)
+
+enum {
+	REC_BEGIN = 1,
+	REC_END = 2,
+};
+
+struct intent_rec {
+	uint32_t magic;
+	uint8_t type;
+	uint8_t op;
+	uint8_t state;
+	uint8_t pad;
+	uint64_t seq;
+	uint64_t pid;
+	uint64_t oid;
+	uint64_t num;
+	uint32_t csum;		/* over everything above */
+	uint32_t pad2;
+};
+
+struct intent_log {
+	int fd;
+	off_t size;
+	uint64_t seq;		/* last sequence number handed out */
+	uint64_t active;	/* seq of the open operation, 0 if none */
+};
+
+static uint32_t rec_csum(struct intent_rec *rec)
+{
+	return jenkins_one_at_a_time_hash((uint8_t *)rec,
+					  offsetof(struct intent_rec, csum));
+}
+
+static int rec_append(struct intent_log *il, struct intent_rec *rec)
+{
+	ssize_t ret;
+
+	rec->magic = INTENT_MAGIC;
+	rec->csum = rec_csum(rec);
+	ret = write(il->fd, rec, sizeof(*rec));
+	if (ret != sizeof(*rec)) {
+		osd_error_errno("%s: write", __func__);
+		return OSD_ERROR;
+	}
+	il->size += sizeof(*rec);
+	return OSD_OK;
+}
+
+/*
+ * Make everything the log describes durable, then drop the log.
+ */
+static int intent_checkpoint(struct intent_log *il)
+{
+	if (syncfs(il->fd) != 0)
+		goto out_err;
+	if (ftruncate(il->fd, 0) != 0)
+		goto out_err;
+	if (fsync(il->fd) != 0)
+		goto out_err;
+	il->size = 0;
+	return OSD_OK;
+
+out_err:
+	osd_error_errno("%s", __func__);
+	return OSD_ERROR;
+}
+
+/*
+ * Read back all intact records. A torn record at the tail ends the log.
+ */
+static int intent_read(struct intent_log *il, struct intent **out,
+		       size_t *count)
+{
+	size_t i = 0;
+	size_t n = 0, max = 0;
+	struct intent *in = NULL, *tmp = NULL;
+	struct intent_rec rec;
+
+	if (lseek(il->fd, 0, SEEK_SET) != 0)
+		return -errno;
+
+	while (read(il->fd, &rec, sizeof(rec)) == sizeof(rec)) {
+		if (rec.magic != INTENT_MAGIC || rec.csum != rec_csum(&rec))
+			break;
+		if (rec.seq > il->seq)
+			il->seq = rec.seq;
+
+		if (rec.type == REC_END) {
+			/* the matching begin is normally the last one */
+			for (i = n; i > 0; i--) {
+				if (in[i-1].seq == rec.seq) {
+					in[i-1].state = rec.state;
+					break;
+				}
+			}
+			continue;
+		}
+
+		if (n == max) {
+			max = max ? 2 * max : 64;
+			tmp = realloc(in, max * sizeof(*in));
+			if (!tmp) {
+				free(in);
+				return -ENOMEM;
+			}
+			in = tmp;
+		}
+		in[n].seq = rec.seq;
+		in[n].pid = rec.pid;
+		in[n].oid = rec.oid;
+		in[n].num = rec.num;
+		in[n].op = rec.op;
+		in[n].state = INTENT_INFLIGHT;
+		n++;
+	}
+
+	*out = in;
+	*count = n;
+	return OSD_OK;
+}
+
+/*
+ * Object ranges already handled by replay, sorted by (pid, lo), disjoint
+ * and not adjacent.
+ */
+struct span {
+	uint64_t pid;
+	uint64_t lo, hi;	/* [lo, hi) */
+};
+
+struct span_set {
+	struct span *s;
+	size_t n, max;
+};
+
+/* index of the first span of pid that ends after oid */
+static size_t span_find(struct span_set *ss, uint64_t pid, uint64_t oid)
+{
+	size_t lo = 0, hi = ss->n, mid;
+
+	while (lo < hi) {
+		mid = (lo + hi) / 2;
+		if (ss->s[mid].pid < pid ||
+		    (ss->s[mid].pid == pid && ss->s[mid].hi <= oid))
+			lo = mid + 1;
+		else
+			hi = mid;
+	}
+	return lo;
+}
+
+static int span_add(struct span_set *ss, uint64_t pid, uint64_t lo,
+		    uint64_t hi)
+{
+	size_t i, j;
+	struct span *tmp;
+
+	/* spans from i to j-1 overlap or touch [lo, hi) */
+	i = span_find(ss, pid, lo > 0 ? lo - 1 : 0);
+	for (j = i; j < ss->n && ss->s[j].pid == pid && ss->s[j].lo <= hi;
+	     j++) {
+		if (ss->s[j].lo < lo)
+			lo = ss->s[j].lo;
+		if (ss->s[j].hi > hi)
+			hi = ss->s[j].hi;
+	}
+
+	if (i == j) {
+		if (ss->n == ss->max) {
+			ss->max = ss->max ? 2 * ss->max : 64;
+			tmp = realloc(ss->s, ss->max * sizeof(*tmp));
+			if (!tmp)
+				return -ENOMEM;
+			ss->s = tmp;
+		}
+		memmove(&ss->s[i+1], &ss->s[i], (ss->n - i) * sizeof(*tmp));
+		ss->n++;
+	} else if (j > i + 1) {
+		memmove(&ss->s[i+1], &ss->s[j], (ss->n - j) * sizeof(*tmp));
+		ss->n -= j - i - 1;
+	}
+	ss->s[i].pid = pid;
+	ss->s[i].lo = lo;
+	ss->s[i].hi = hi;
+	return OSD_OK;
+}
+
+static void replay_fix(struct osd_device *osd, intent_fix_t fix,
+		       struct intent *in, uint64_t lo, uint64_t hi)
+{
+	struct intent piece = *in;
+
+	piece.oid = lo;
+	piece.num = hi - lo;
+	if (fix(osd, &piece) != OSD_OK)
+		osd_error("%s: op %u pid %llu oid %llu failed", __func__,
+			  in->op, llu(in->pid), llu(lo));
+}
+
+/*
+ * Only the last logged operation on an object says what state it should
+ * be in, so walk the log backwards and hand each operation just the
+ * objects no later one has covered.
+ */
+static int intent_replay(struct osd_device *osd, intent_fix_t fix)
+{
+	int ret = 0;
+	size_t i = 0, j = 0;
+	size_t count = 0;
+	uint64_t cur = 0, end = 0;
+	struct intent *in = NULL;
+	struct span_set ss = { NULL, 0, 0 };
+	struct intent_log *il = osd->il;
+
+	ret = intent_read(il, &in, &count);
+	if (ret != OSD_OK)
+		return ret;
+
+	if (count > 0) {
+		osd_info("%s: replaying %zu operations", __func__, count);
+		ret = db_begin_txn(osd->dbc);
+		if (ret != OSD_OK)
+			goto out;
+		for (i = count; i > 0; i--) {
+			struct intent *p = &in[i-1];
+
+			cur = p->oid;
+			end = p->oid + p->num;
+			for (j = span_find(&ss, p->pid, cur);
+			     j < ss.n && ss.s[j].pid == p->pid &&
+			     ss.s[j].lo < end; j++) {
+				if (cur < ss.s[j].lo)
+					replay_fix(osd, fix, p, cur,
+						   ss.s[j].lo);
+				cur = ss.s[j].hi;
+			}
+			if (cur < end)
+				replay_fix(osd, fix, p, cur, end);
+
+			ret = span_add(&ss, p->pid, p->oid, end);
+			if (ret != OSD_OK)
+				break;
+		}
+		if (db_end_txn(osd->dbc) != OSD_OK)
+			ret = OSD_ERROR;
+		if (ret != OSD_OK)
+			goto out;
+	}
+
+	ret = intent_checkpoint(il);
+out:
+	free(ss.s);
+	free(in);
+	return ret;
+}
+
+/*
+ * Open the log at path and replay whatever it holds. The db must be open.
+ */
+int intent_open(struct osd_device *osd, const char *path, intent_fix_t fix)
+{
+	int ret = 0;
+	struct intent_log *il;
+
+	il = Calloc(1, sizeof(*il));
+	if (!il)
+		return -ENOMEM;
+
+	il->fd = open(path, O_RDWR|O_CREAT|O_APPEND, 0600);
+	if (il->fd < 0) {
+		ret = -errno;
+		osd_error_errno("%s: open %s", __func__, path);
+		free(il);
+		return ret;
+	}
+
+	osd->il = il;
+	ret = intent_replay(osd, fix);
+	if (ret != OSD_OK) {
+		close(il->fd);
+		free(il);
+		osd->il = NULL;
+	}
+	return ret;
+}
+
+/*
+ * Called after the db is closed, so everything it wrote is covered by
+ * the checkpoint.
+ */
+void intent_close(struct osd_device *osd)
+{
+	struct intent_log *il = osd->il;
+
+	if (!il)
+		return;
+
+	intent_checkpoint(il);
+	close(il->fd);
+	free(il);
+	osd->il = NULL;
+}
+
+/*
+ * Log the start of an operation and sync it.
+ *
+ * returns: sequence number to pass to intent_end, 0 if nothing was logged
+ * because the log is closed, an outer operation is open, or the write
+ * failed.
+ */
+uint64_t intent_begin(struct osd_device *osd, uint8_t op, uint64_t pid,
+		      uint64_t oid, uint64_t num)
+{
+	struct intent_rec rec;
+	struct intent_log *il = osd->il;
+
+	if (!il || il->active)
+		return 0;
+
+	/* not inside a transaction, its db changes are not committed yet */
+	if (il->size >= INTENT_LOG_MAX && osd->dbc->txn_depth == 0)
+		intent_checkpoint(il);
+
+	memset(&rec, 0, sizeof(rec));
+	rec.type = REC_BEGIN;
+	rec.op = op;
+	rec.seq = ++il->seq;
+	rec.pid = pid;
+	rec.oid = oid;
+	rec.num = num;
+	if (rec_append(il, &rec) != OSD_OK)
+		return 0;
+	if (fdatasync(il->fd) != 0) {
+		osd_error_errno("%s: fdatasync", __func__);
+		return 0;
+	}
+
+	il->active = rec.seq;
+	return rec.seq;
+}
+
+/*
+ * Record the outcome, ret as returned by the command. Not synced: if it
+ * is lost the operation is treated as in flight by replay, which goes by
+ * the db then.
+ */
+void intent_end(struct osd_device *osd, uint64_t seq, int ret)
+{
+	struct intent_rec rec;
+	struct intent_log *il = osd->il;
+
+	if (!il || seq == 0)
+		return;
+
+	assert(il->active == seq);
+	memset(&rec, 0, sizeof(rec));
+	rec.type = REC_END;
+	rec.seq = seq;
+	rec.state = (ret == 0) ? INTENT_DONE_OK : INTENT_DONE_FAILED;
+	rec_append(il, &rec);
+	il->active = 0;
+}
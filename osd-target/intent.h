@@ -0,0 +1,61 @@
+/*
+ * Intent log.
+ *
+ * Copyright (C) 2007 OSD Team <pvfs-osd@osc.edu>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, version 2 of the License.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#ifndef __INTENT_H
+#define __INTENT_H
+
+#include <stdint.h>
+#include "osd-types.h"
+
+enum {
+	INTENT_CREATE = 1,	/* userobjects oid .. oid+num-1 */
+	INTENT_REMOVE = 2,	/* userobject oid */
+};
+
+/* how far an operation got before the crash */
+enum {
+	INTENT_INFLIGHT = 0,
+	INTENT_DONE_OK = 1,
+	INTENT_DONE_FAILED = 2,
+};
+
+struct intent {
+	uint64_t seq;
+	uint64_t pid;
+	uint64_t oid;
+	uint64_t num;
+	uint8_t op;
+	uint8_t state;
+};
+
+/*
+ * Called by replay for each logged operation, newest first, with only the
+ * objects no newer operation named, inside one db transaction. Must be
+ * idempotent.
+ */
+typedef int (*intent_fix_t)(struct osd_device *osd, const struct intent *in);
+
+int intent_open(struct osd_device *osd, const char *path, intent_fix_t fix);
+
+void intent_close(struct osd_device *osd);
+
+uint64_t intent_begin(struct osd_device *osd, uint8_t op, uint64_t pid,
+		      uint64_t oid, uint64_t num);
+
+void intent_end(struct osd_device *osd, uint64_t seq, int ret);
+
+#endif /* __INTENT_H */
@@ -0,0 +1,454 @@
+/*
+ * Background jobs.
+ *
+ * Copyright (C) 2007 OSD Team <pvfs-osd@osc.edu>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, version 2 of the License.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/*
+ * Long running commands (bulk removal and the like) are split into steps,
+ * each of which does a bounded amount of db work inside one transaction.
+ * The sqlite handle in osd->dbc is not used by two threads at once, so
+ * steps are run under the device lock when async submission is on:
+ * osdemu_cmd_submit runs one step after every command, idle async
+ * workers run the rest, and without async the transport calls
+ * osdemu_jobs_run when it has nothing to do.  job_drain runs everything
+ * to completion.
+ *
+ * Data files do not need the db, hence their unlinks are handed to a small
+ * pool of threads and proceed in parallel with the metadata work.
+ *
+ * REMOVE of a single object just renames its data file into the stranded
+ * directory. The reaper thread unlinks whatever it finds there, at most
+ * REAP_RATE files per second so freeing extents does not starve the data
+ * path. It sweeps the directory on startup, picking up leftovers of a
+ * previous run. FORMAT OSD uses the same mechanism for the old trees.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <dirent.h>
+#include <time.h>
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <assert.h>
+
+#include "osd.h"
+#include "job.h"
+#include "tracking.h"
+#include "osd-util/osd-util.h"
+
+#define NUM_UNLINKERS 4
+#define REAP_RATE 256 /* unlinks per second */
+
+struct unlink_req {
+	struct unlink_req *next;
+	char path[MAXNAMELEN];
+};
+
+struct job_context {
+	struct job *head, *tail;	/* only touched by command thread */
+
+	pthread_mutex_t lock;		/* protects everything below */
+	pthread_cond_t more;
+	pthread_cond_t idle;
+	struct unlink_req *uhead, *utail;
+	int nbusy;
+	int nthreads;
+	int stop;
+	pthread_t threads[NUM_UNLINKERS];
+
+	pthread_cond_t reap;		/* reaper wakeup */
+	int reap_kicked;
+	int reaper_running;
+	pthread_t reaper;
+	char stranded[MAXNAMELEN];
+};
+
+int job_init(struct osd_device *osd)
+{
+	struct job_context *jc;
+
+	jc = Calloc(1, sizeof(*jc));
+	if (!jc)
+		return -ENOMEM;
+
+	pthread_mutex_init(&jc->lock, NULL);
+	pthread_cond_init(&jc->more, NULL);
+	pthread_cond_init(&jc->idle, NULL);
+	pthread_cond_init(&jc->reap, NULL);
+	osd->jc = jc;
+	return OSD_OK;
+}
+
+void job_fini(struct osd_device *osd)
+{
+	int i;
+	struct job_context *jc = osd->jc;
+
+	if (!jc)
+		return;
+
+	job_drain(osd);
+
+	pthread_mutex_lock(&jc->lock);
+	jc->stop = 1;
+	pthread_cond_broadcast(&jc->more);
+	pthread_cond_broadcast(&jc->reap);
+	pthread_mutex_unlock(&jc->lock);
+	for (i = 0; i < jc->nthreads; i++)
+		pthread_join(jc->threads[i], NULL);
+	if (jc->reaper_running)
+		pthread_join(jc->reaper, NULL);
+
+	pthread_cond_destroy(&jc->reap);
+	pthread_cond_destroy(&jc->idle);
+	pthread_cond_destroy(&jc->more);
+	pthread_mutex_destroy(&jc->lock);
+	free(jc);
+	osd->jc = NULL;
+}
+
+/*
+ * Queue a job. The caller is expected to have done the first step inline
+ * if it wants small requests to finish before the command completes.
+ */
+int job_submit(struct osd_device *osd, uint64_t pid, uint64_t cid,
+	       struct ctp *ctp, job_step_t step)
+{
+	struct job *job;
+	struct job_context *jc = osd->jc;
+
+	assert(jc && step);
+
+	job = Malloc(sizeof(*job));
+	if (!job)
+		return -ENOMEM;
+
+	job->pid = pid;
+	job->cid = cid;
+	job->ctp = ctp;
+	job->step = step;
+	job->pos = 0;
+	job->next = NULL;
+
+	if (jc->tail)
+		jc->tail->next = job;
+	else
+		jc->head = job;
+	jc->tail = job;
+	return OSD_OK;
+}
+
+/*
+ * Run at most nsteps steps, round robin over the queued jobs.
+ *
+ * returns: number of jobs still pending
+ */
+int job_run(struct osd_device *osd, int nsteps)
+{
+	int ret, pending = 0;
+	struct job *job;
+	struct job_context *jc = osd->jc;
+
+	if (!jc)
+		return 0;
+
+	while (nsteps-- > 0 && jc->head) {
+		job = jc->head;
+		jc->head = job->next;
+		if (!jc->head)
+			jc->tail = NULL;
+		job->next = NULL;
+
+		ret = job->step(osd, job);
+		if (ret == OSD_REPEAT) {
+			if (jc->tail)
+				jc->tail->next = job;
+			else
+				jc->head = job;
+			jc->tail = job;
+			continue;
+		}
+		if (ret != OSD_OK)
+			osd_error("%s: job (%llu %llu) failed %d", __func__,
+				  llu(job->pid), llu(job->cid), ret);
+		free(job);
+	}
+
+	for (job = jc->head; job; job = job->next)
+		pending++;
+	return pending;
+}
+
+/*
+ * Drop the queued jobs without running them, for FORMAT OSD which throws
+ * their db away.  Their commands are tracked as aborted.
+ */
+void job_discard(struct osd_device *osd)
+{
+	struct job *job;
+	struct job_context *jc = osd->jc;
+
+	if (!jc)
+		return;
+
+	while ((job = jc->head) != NULL) {
+		jc->head = job->next;
+		if (job->ctp)
+			end_ctp(osd, job->ctp, SAM_STAT_TASK_ABORTED);
+		free(job);
+	}
+	jc->tail = NULL;
+}
+
+/*
+ * Run all jobs to completion and wait for the queued unlinks.
+ */
+void job_drain(struct osd_device *osd)
+{
+	struct job_context *jc = osd->jc;
+
+	if (!jc)
+		return;
+
+	while (job_run(osd, 1) > 0)
+		;
+
+	pthread_mutex_lock(&jc->lock);
+	while (jc->uhead || jc->nbusy)
+		pthread_cond_wait(&jc->idle, &jc->lock);
+	pthread_mutex_unlock(&jc->lock);
+}
+
+static void *unlink_thread(void *arg)
+{
+	struct job_context *jc = arg;
+	struct unlink_req *req;
+
+	pthread_mutex_lock(&jc->lock);
+	for (;;) {
+		while (!jc->uhead && !jc->stop)
+			pthread_cond_wait(&jc->more, &jc->lock);
+		if (!jc->uhead)
+			break; /* stop requested and queue is empty */
+
+		req = jc->uhead;
+		jc->uhead = req->next;
+		if (!jc->uhead)
+			jc->utail = NULL;
+		jc->nbusy++;
+		pthread_mutex_unlock(&jc->lock);
+
+		if (unlink(req->path) != 0 && errno != ENOENT)
+			osd_error_errno("%s: unlink %s", __func__, req->path);
+		free(req);
+
+		pthread_mutex_lock(&jc->lock);
+		jc->nbusy--;
+		if (!jc->uhead && !jc->nbusy)
+			pthread_cond_broadcast(&jc->idle);
+	}
+	pthread_mutex_unlock(&jc->lock);
+	return NULL;
+}
+
+/*
+ * Unlink path asynchronously. Worker threads are started on first use.
+ * Falls back to a synchronous unlink if no worker can be started.
+ */
+int job_unlink(struct osd_device *osd, const char *path)
+{
+	struct unlink_req *req;
+	struct job_context *jc = osd->jc;
+
+	if (!jc)
+		goto out_sync;
+
+	req = Malloc(sizeof(*req));
+	if (!req)
+		goto out_sync;
+	strncpy(req->path, path, sizeof(req->path) - 1);
+	req->path[sizeof(req->path) - 1] = '\0';
+	req->next = NULL;
+
+	pthread_mutex_lock(&jc->lock);
+	while (jc->nthreads < NUM_UNLINKERS) {
+		if (pthread_create(&jc->threads[jc->nthreads], NULL,
+				   unlink_thread, jc) != 0)
+			break;
+		jc->nthreads++;
+	}
+	if (jc->nthreads == 0) {
+		pthread_mutex_unlock(&jc->lock);
+		free(req);
+		goto out_sync;
+	}
+	if (jc->utail)
+		jc->utail->next = req;
+	else
+		jc->uhead = req;
+	jc->utail = req;
+	pthread_cond_signal(&jc->more);
+	pthread_mutex_unlock(&jc->lock);
+	return OSD_OK;
+
+out_sync:
+	if (unlink(path) != 0 && errno != ENOENT)
+		return -errno;
+	return OSD_OK;
+}
+
+/*
+ * unlink at most budget entries under dirname, descending into
+ * directories (FORMAT OSD moves whole trees here). Directories are
+ * removed once they are empty.
+ *
+ * returns: number of entries unlinked
+ */
+static int reap_dir(const char *dirname, int budget)
+{
+	int n = 0;
+	DIR *dir = NULL;
+	struct dirent *ent = NULL;
+	struct stat sb;
+	char path[MAXNAMELEN];
+
+	dir = opendir(dirname);
+	if (!dir)
+		return 0;
+
+	while (n < budget && (ent = readdir(dir)) != NULL) {
+		if (!strcmp(ent->d_name, ".") || !strcmp(ent->d_name, ".."))
+			continue;
+
+		if (ent->d_type == DT_UNKNOWN) {
+			if (fstatat(dirfd(dir), ent->d_name, &sb,
+				    AT_SYMLINK_NOFOLLOW) != 0)
+				continue;
+			if (S_ISDIR(sb.st_mode))
+				ent->d_type = DT_DIR;
+		}
+
+		if (ent->d_type == DT_DIR) {
+			if (snprintf(path, sizeof(path), "%s/%s", dirname,
+				     ent->d_name) >= (int)sizeof(path)) {
+				osd_error("%s: %s/%s too long", __func__,
+					  dirname, ent->d_name);
+				continue;
+			}
+			n += reap_dir(path, budget - n);
+			if (n < budget &&
+			    unlinkat(dirfd(dir), ent->d_name, AT_REMOVEDIR) == 0)
+				n++;
+			continue;
+		}
+
+		if (unlinkat(dirfd(dir), ent->d_name, 0) != 0) {
+			if (errno != ENOENT)
+				osd_error_errno("%s: unlink %s/%s", __func__,
+						dirname, ent->d_name);
+			continue;
+		}
+		n++;
+	}
+
+	closedir(dir);
+	return n;
+}
+
+/*
+ * Unlinks are counted per one second window, however many passes the
+ * kicks start in it.  Once a window has had REAP_RATE the reaper sleeps
+ * until the next one.
+ */
+static void *reaper_thread(void *arg)
+{
+	int budget = REAP_RATE;
+	struct timespec deadline, now;
+	struct job_context *jc = arg;
+
+	clock_gettime(CLOCK_REALTIME, &deadline);
+	deadline.tv_sec += 1;
+
+	pthread_mutex_lock(&jc->lock);
+	while (!jc->stop) {
+		jc->reap_kicked = 0;
+		pthread_mutex_unlock(&jc->lock);
+
+		budget -= reap_dir(jc->stranded, budget);
+
+		pthread_mutex_lock(&jc->lock);
+		if (budget == 0) {
+			/* possibly more, but stay within the rate */
+			while (!jc->stop &&
+			       pthread_cond_timedwait(&jc->reap, &jc->lock,
+						      &deadline) != ETIMEDOUT)
+				;
+		} else {
+			while (!jc->stop && !jc->reap_kicked)
+				pthread_cond_wait(&jc->reap, &jc->lock);
+		}
+
+		clock_gettime(CLOCK_REALTIME, &now);
+		if (now.tv_sec > deadline.tv_sec ||
+		    (now.tv_sec == deadline.tv_sec &&
+		     now.tv_nsec >= deadline.tv_nsec)) {
+			budget = REAP_RATE;
+			deadline = now;
+			deadline.tv_sec += 1;
+		}
+	}
+	pthread_mutex_unlock(&jc->lock);
+	return NULL;
+}
+
+/*
+ * Start the reaper on dir. The first pass sweeps files left behind by a
+ * previous run.
+ */
+int job_reaper_start(struct osd_device *osd, const char *dir)
+{
+	int ret = 0;
+	struct job_context *jc = osd->jc;
+
+	assert(jc && !jc->reaper_running);
+
+	strncpy(jc->stranded, dir, sizeof(jc->stranded) - 1);
+	jc->stranded[sizeof(jc->stranded) - 1] = '\0';
+	ret = pthread_create(&jc->reaper, NULL, reaper_thread, jc);
+	if (ret != 0)
+		return -ret;
+	jc->reaper_running = 1;
+	return OSD_OK;
+}
+
+/*
+ * Tell the reaper a file has been moved to the stranded directory.
+ */
+void job_reap_kick(struct osd_device *osd)
+{
+	struct job_context *jc = osd->jc;
+
+	if (!jc || !jc->reaper_running)
+		return;
+
+	pthread_mutex_lock(&jc->lock);
+	jc->reap_kicked = 1;
+	pthread_cond_signal(&jc->reap);
+	pthread_mutex_unlock(&jc->lock);
+}
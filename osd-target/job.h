@@ -0,0 +1,65 @@
+/*
+ * Background jobs.
+ *
+ * Copyright (C) 2007 OSD Team <pvfs-osd@osc.edu>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, version 2 of the License.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#ifndef __JOB_H
+#define __JOB_H
+
+#include <stdint.h>
+#include "osd-types.h"
+
+struct ctp;
+struct job;
+
+/*
+ * A step performs one bounded unit of work, normally one db transaction.
+ *
+ * returns:
+ * OSD_REPEAT: more work remains, call again
+ * OSD_OK: job is complete
+ * <0: job failed
+ */
+typedef int (*job_step_t)(struct osd_device *osd, struct job *job);
+
+struct job {
+	uint64_t pid;
+	uint64_t cid;
+	struct ctp *ctp;       /* command tracking page, may be NULL */
+	uint64_t pos;          /* where the step left off */
+	job_step_t step;
+	struct job *next;
+};
+
+int job_init(struct osd_device *osd);
+
+void job_fini(struct osd_device *osd);
+
+int job_submit(struct osd_device *osd, uint64_t pid, uint64_t cid,
+	       struct ctp *ctp, job_step_t step);
+
+int job_run(struct osd_device *osd, int nsteps);
+
+void job_drain(struct osd_device *osd);
+
+void job_discard(struct osd_device *osd);
+
+int job_unlink(struct osd_device *osd, const char *path);
+
+int job_reaper_start(struct osd_device *osd, const char *dir);
+
+void job_reap_kick(struct osd_device *osd);
+
+#endif /* __JOB_H */
@@ -0,0 +1,204 @@
+/*
+ * Per service action latency histograms.
+ *
+ * Copyright (C) 2007 OSD Team <pvfs-osd@osc.edu>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, version 2 of the License.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/*
+ * Every command is timed, in total and split into phases: parsing of the
+ * cdb and its lists, data file io, and attribute get/set.  Metadata is
+ * what remains of the total, mostly the db.  Each phase a command went
+ * through adds to a histogram of its service action with log2 buckets,
+ * read on ROOT_LATENCY_PG.
+ *
+ * Costs a few clock_gettime calls per command, always on.  Like the
+ * arena, used by one command at a time; one that lets go of the device
+ * lock for its data transfer keeps its timings aside meanwhile.
+ */
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+
+#include "osd.h"
+#include "lat.h"
+#include "osd-util/osd-util.h"
+
+#define LAT_ACTION_LB 0x8880
+#define LAT_ACTIONS 0x40
+
+struct lat_hist {
+	uint64_t count;
+	uint64_t sum;
+	uint64_t max;
+	uint64_t bucket[RLAT_BUCKETS];
+};
+
+struct lat_stats {
+	struct lat_cmd c;		/* of the current command */
+	struct lat_hist hist[LAT_ACTIONS][RLAT_PHASES];
+};
+
+int lat_init(struct osd_device *osd)
+{
+	struct lat_stats *ls;
+
+	ls = Calloc(1, sizeof(*ls));
+	if (!ls)
+		return -ENOMEM;
+	osd->lat = ls;
+	return OSD_OK;
+}
+
+void lat_fini(struct osd_device *osd)
+{
+	free(osd->lat);
+	osd->lat = NULL;
+}
+
+/*
+ * returns: the start time of the command
+ */
+uint64_t lat_begin(struct osd_device *osd)
+{
+	struct lat_stats *ls = osd->lat;
+
+	if (!ls)
+		return lat_now();
+	memset(&ls->c, 0, sizeof(ls->c));
+	ls->c.start = lat_now();
+	return ls->c.start;
+}
+
+/*
+ * Charge the time from since until now to phase.
+ */
+void lat_add(struct osd_device *osd, int phase, uint64_t since)
+{
+	struct lat_stats *ls = osd->lat;
+
+	if (!ls)
+		return;
+	ls->c.cur[phase] += lat_now() - since;
+	ls->c.seen |= 1U << phase;
+}
+
+/*
+ * A command that lets others run in the middle puts its timings aside
+ * and back.
+ */
+void lat_save(struct osd_device *osd, struct lat_cmd *lc)
+{
+	if (osd->lat)
+		*lc = osd->lat->c;
+}
+
+void lat_restore(struct osd_device *osd, const struct lat_cmd *lc)
+{
+	if (osd->lat)
+		osd->lat->c = *lc;
+}
+
+static void record(struct lat_hist *h, uint64_t ns)
+{
+	int b = 0;
+	uint64_t us = ns / 1000;
+
+	if (us >= 2)
+		b = 63 - __builtin_clzll(us);
+	if (b >= RLAT_BUCKETS)
+		b = RLAT_BUCKETS - 1;
+	h->count++;
+	h->sum += ns;
+	if (ns > h->max)
+		h->max = ns;
+	h->bucket[b]++;
+}
+
+void lat_end(struct osd_device *osd, uint16_t action)
+{
+	int i;
+	uint64_t other;
+	struct lat_stats *ls = osd->lat;
+	struct lat_cmd *c;
+	struct lat_hist *h;
+
+	if (!ls || action < LAT_ACTION_LB ||
+	    action >= LAT_ACTION_LB + LAT_ACTIONS)
+		return;
+	h = ls->hist[action - LAT_ACTION_LB];
+	c = &ls->c;
+
+	c->cur[RLAT_CMD] = lat_now() - c->start;
+	other = c->cur[RLAT_PARSE] + c->cur[RLAT_DATA] + c->cur[RLAT_ATTR];
+	if (c->cur[RLAT_CMD] > other)
+		c->cur[RLAT_META] = c->cur[RLAT_CMD] - other;
+	c->seen |= (1U << RLAT_CMD) | (1U << RLAT_META);
+
+	for (i = 0; i < RLAT_PHASES; i++)
+		if (c->seen & (1U << i))
+			record(&h[i], c->cur[i]);
+}
+
+static struct lat_hist *lookup(struct lat_stats *ls, uint32_t number)
+{
+	uint32_t action = number >> 4;
+	uint32_t phase = number & 0xf;
+
+	if (action < LAT_ACTION_LB || action >= LAT_ACTION_LB + LAT_ACTIONS ||
+	    phase >= RLAT_PHASES)
+		return NULL;
+	return &ls->hist[action - LAT_ACTION_LB][phase];
+}
+
+/*
+ * val: RLAT_LEN bytes
+ *
+ * returns: OSD_OK, -ENOENT if there is no such attribute
+ */
+int lat_get(struct osd_device *osd, uint32_t number, uint8_t *val)
+{
+	int i;
+	struct lat_hist *h;
+
+	if (!osd->lat)
+		return -ENOENT;
+	h = lookup(osd->lat, number);
+	if (!h)
+		return -ENOENT;
+	set_htonll(&val[RLAT_COUNT_OFF], h->count);
+	set_htonll(&val[RLAT_SUM_OFF], h->sum);
+	set_htonll(&val[RLAT_MAX_OFF], h->max);
+	for (i = 0; i < RLAT_BUCKETS; i++)
+		set_htonll(&val[RLAT_BUCKET_OFF + 8 * i], h->bucket[i]);
+	return OSD_OK;
+}
+
+int lat_reset(struct osd_device *osd, uint32_t number)
+{
+	struct lat_hist *h;
+	struct lat_stats *ls = osd->lat;
+
+	if (!ls)
+		return -ENOENT;
+	if (number == RLAT_RESET) {
+		memset(ls->hist, 0, sizeof(ls->hist));
+		return OSD_OK;
+	}
+	h = lookup(ls, number);
+	if (!h)
+		return -ENOENT;
+	memset(h, 0, sizeof(*h));
+	return OSD_OK;
+}
@@ -0,0 +1,58 @@
+/*
+ * Per service action latency histograms.
+ *
+ * Copyright (C) 2007 OSD Team <pvfs-osd@osc.edu>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, version 2 of the License.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#ifndef __LAT_H
+#define __LAT_H
+
+#include <stdint.h>
+#include <time.h>
+#include "osd-types.h"
+
+static inline uint64_t lat_now(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t) ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+/* the timings of the command running, see async_io_begin */
+struct lat_cmd {
+	uint64_t start;
+	uint64_t cur[RLAT_PHASES];	/* its time in each phase */
+	unsigned int seen;		/* phases it went through */
+};
+
+int lat_init(struct osd_device *osd);
+
+void lat_fini(struct osd_device *osd);
+
+uint64_t lat_begin(struct osd_device *osd);
+
+void lat_add(struct osd_device *osd, int phase, uint64_t since);
+
+void lat_end(struct osd_device *osd, uint16_t action);
+
+void lat_save(struct osd_device *osd, struct lat_cmd *lc);
+
+void lat_restore(struct osd_device *osd, const struct lat_cmd *lc);
+
+int lat_get(struct osd_device *osd, uint32_t number, uint8_t *val);
+
+int lat_reset(struct osd_device *osd, uint32_t number);
+
+#endif /* __LAT_H */
@@ -17,6 +17,7 @@
  */
 #include <stdlib.h>
 #include <stdio.h>
+#include <stdarg.h>
 #include <sqlite3.h>
 #include <errno.h>
 #include <string.h>
@@ -29,6 +30,7 @@
 #include "attr.h"
 #include "coll.h" 
 #include "mtq.h"
+#include "arena.h"
 #include "osd-util/osd-util.h"
 #include "list-entry.h"
 
@@ -44,8 +46,8 @@
  * OSD_ERROR: some other error
  * OSD_OK: success
  */
-int mtq_run_query(struct db_context *dbc, uint64_t pid, uint64_t cid, 
-		  struct query_criteria *qc, void *outdata, 
+int mtq_run_query(struct db_context *dbc, struct arena *a, uint64_t pid,
+		  uint64_t cid, struct query_criteria *qc, void *outdata, 
 		  uint32_t alloc_len, uint64_t *used_outlen,
 		  uint64_t matches_cid)
 {
@@ -77,7 +79,7 @@ int mtq_run_query(struct db_context *dbc, uint64_t pid, uint64_t cid,
 		goto out;
 	}
 
-	SQL = Malloc(MAXSQLEN*factor);
+	SQL = arena_alloc(a, MAXSQLEN*factor);
 	if (SQL == NULL) {
 		ret = -ENOMEM;
 		goto out;
@@ -129,7 +131,8 @@ int mtq_run_query(struct db_context *dbc, uint64_t pid, uint64_t cid,
 
 		if (sqlen >= (MAXSQLEN*factor - 400)) {
 			factor *= 2;
-			SQL = realloc(SQL, MAXSQLEN*factor);
+			SQL = arena_realloc(a, SQL, MAXSQLEN*factor/2,
+					    MAXSQLEN*factor);
 			if (!SQL) {
 				ret = -ENOMEM;
 				goto out;
@@ -140,13 +143,12 @@ int mtq_run_query(struct db_context *dbc, uint64_t pid, uint64_t cid,
 	cp = strcat(cp, " GROUP BY attr.oid ORDER BY 1;");
 
 	if (matches_cid != 0) {
-		char *SQL2 = Malloc(strlen(SQL) + 100);
+		char *SQL2 = arena_alloc(a, strlen(SQL) + 100);
 		if (SQL2 == NULL) {
 			ret = -ENOMEM;
 			goto out;
 		}
 		sprintf(SQL2, "INSERT INTO %s %s", coll, SQL);
-		free(SQL);
 		SQL = SQL2;
 	}
 
@@ -230,236 +232,353 @@ out_finalize:
 		error_sql(dbc->db, "%s: finalize", __func__);
 
 out:
-	free(SQL);
 	return ret;
 }
 
 
+/* in the order of sqlite, which has page and number as signed ints */
+static int mtq_attr_cmp(const void *a, const void *b)
+{
+	const struct mtq_attr *x = a, *y = b;
+
+	if (x->page != y->page)
+		return (int32_t) x->page < (int32_t) y->page ? -1 : 1;
+	if (x->number != y->number)
+		return (int32_t) x->number < (int32_t) y->number ? -1 : 1;
+	return 0;
+}
+
+/* the current row of the attr cursor against (oid, ma) */
+static int mtq_row_cmp(sqlite3_stmt *stmt, uint64_t oid,
+		       const struct mtq_attr *ma)
+{
+	uint64_t roid = sqlite3_column_int64(stmt, 0);
+	struct mtq_attr row = {
+		.page = sqlite3_column_int(stmt, 1),
+		.number = sqlite3_column_int(stmt, 2),
+	};
+
+	if (roid != oid)
+		return roid < oid ? -1 : 1;
+	return mtq_attr_cmp(&row, ma);
+}
+
+static inline int mtq_step(sqlite3_stmt *stmt)
+{
+	int ret;
+
+	do {
+		ret = sqlite3_step(stmt);
+	} while (ret == SQLITE_BUSY);
+	return ret;
+}
+
+/* handle overflow: osd2r01 Sec 6.14.2 */
+static inline int mtq_add_len(uint64_t *add_len, uint64_t len)
+{
+	if (*add_len + len < *add_len) {
+		*add_len = (uint64_t) -1;
+		return OSD_ERROR;
+	}
+	*add_len += len;
+	return OSD_OK;
+}
+
 /*
- * returns list of objects along with requested attributes
+ * returns list of objects along with requested attributes. cid != 0 lists
+ * the members of that collection, else the objects of the given type.
+ *
+ * This is a merge join: the members come in oid order, their rows in attr
+ * in (oid, page, number) order, both streamed straight from the primary
+ * keys without a sort. attrs is sorted the same way, so an object is
+ * encoded in one pass over its rows. Attributes with a len are computed
+ * and packed by fn; stored attributes an object does not have are left
+ * out.
+ *
+ * An object is listed whole or not at all: cont_id is the first one that
+ * did not fit, or the one after max_oids were listed if that is not 0, and
+ * nothing after it is listed. add_len counts them all.
+ *
+ * With listfmt RTRVD_MULTIOBJ_LIST the result is a multi-object attribute
+ * list instead, each entry prefixed with its oid, for GET MEMBER
+ * ATTRIBUTES. Otherwise it is in object descriptor format, for LIST:
+ *
+ * XXX:SD The spec is inconsistent in applying padding and alignment
+ * rules. Here we make changes to the spec. In our case object descriptor
+ * format header (table 79) is 16B instead of 12B, and attributes list
+ * length field is 4B instead of 2B as defined in spec, and starts at byte
+ * 12 in the header (not 10).
  *
  * return values:
  * -EINVAL: invalid argument
  * -EIO: prepare or some other sqlite function failed
- * OSD_ERROR: some other error
+ * -ENOMEM: out of memory
  * OSD_OK: success
  */
-int mtq_list_oids_attr(struct db_context *dbc, uint64_t pid,
-		       uint64_t initial_oid, struct getattr_list *get_attr,
-		       uint64_t alloc_len, void *outdata, 
-		       uint64_t *used_outlen, uint64_t *add_len, 
+int mtq_list_oids_attr(struct db_context *dbc, struct arena *a, uint64_t pid,
+		       uint64_t cid, uint8_t type, uint64_t initial_oid,
+		       struct mtq_attr *attrs, uint32_t nattr, mtq_attr_fn fn,
+		       void *arg, uint8_t listfmt, uint64_t max_oids,
+		       uint64_t alloc_len, void *outdata,
+		       uint64_t *used_outlen, uint64_t *add_len,
 		       uint64_t *cont_id)
 {
 	int ret = 0;
-	char *cp = NULL;
+	int arow = SQLITE_DONE;
+	int full = 0;
+	int c = 0;
 	char *SQL = NULL;
-	uint32_t i = 0;
-	uint32_t factor = 2; /* this query uses space fast */
-	uint32_t attr_list_len = 0; /*XXX:SD see below */
-	uint32_t sqlen = 0;
-	uint64_t oid = 0;
-	uint32_t page;
-	uint32_t number;
+	char *cp = NULL;
+	uint32_t i, n;
+	uint32_t npages = 0;
+	uint32_t used;
 	uint16_t len;
-	const void *val = NULL;
-	sqlite3_stmt *stmt = NULL;
-	uint8_t *head = NULL, *tail = NULL;
-	const char *select_stmt = NULL;
-	const char *obj = obj_getname(dbc);
-	const char *attr = attr_getname(dbc);
-
-	assert(dbc && dbc->db && get_attr && outdata && used_outlen 
-	       && add_len && obj && attr);
-
-	if (get_attr->sz == 0) {
-		ret = -EINVAL;
-		goto out;
+	uint64_t oid;
+	uint64_t need, odelen;
+	uint64_t left = alloc_len;
+	uint64_t listed = 0;
+	uint32_t hdr = 16;	/* object descriptor header */
+	uint32_t pre = 0;	/* in front of each list entry */
+	uint8_t *ode = NULL;
+	uint8_t *tail = outdata;
+	sqlite3_stmt *obj = NULL;
+	sqlite3_stmt *attr = NULL;
+
+	assert(dbc && dbc->db && attrs && fn && outdata && used_outlen &&
+	       add_len && cont_id);
+
+	if (nattr == 0)
+		return -EINVAL;
+	if (listfmt == RTRVD_MULTIOBJ_LIST) {
+		hdr = 0;
+		pre = sizeof(oid);
 	}
 
-	SQL = Malloc(MAXSQLEN*factor);
-	if (!SQL) {
-		ret = -ENOMEM;
-		goto out;
-	}
+	qsort(attrs, nattr, sizeof(*attrs), mtq_attr_cmp);
+	for (i = 1, n = 1; i < nattr; i++)
+		if (mtq_attr_cmp(&attrs[n - 1], &attrs[i]) != 0)
+			attrs[n++] = attrs[i];
+	nattr = n;
 
-	/* 
-	 * For each attribute requested, create a select statement,
-	 * which will try to index into the attr table with a full key rather
-	 * than just (pid, oid) prefix key. Analogous to loop unrolling, we
-	 * unroll each requested attribute into its own select statement.
-	 */
-	select_stmt = "SELECT obj.oid as myoid, attr.page, "
-		" attr.number, attr.value FROM %s as obj, %s as attr "
-		" WHERE obj.pid = attr.pid AND obj.oid = attr.oid AND "
-		" obj.pid = %llu AND obj.type = %u AND "
-		" attr.page = %u AND attr.number = %u AND obj.oid >= %llu ";
+	SQL = arena_alloc(a, MAXSQLEN + nattr * 12);
+	if (!SQL)
+		return -ENOMEM;
 
-	cp = SQL;
-	sqlen = 0;
-	sprintf(SQL, select_stmt, obj, attr, llu(pid), USEROBJECT,
-		USER_TMSTMP_PG, 0, llu(initial_oid));
-	SQL = strcat(SQL, " UNION ALL ");
-	sqlen += strlen(SQL);
-	cp += sqlen;
-	for (i = 0; i < get_attr->sz; i++) {
-		sprintf(cp, select_stmt, obj, attr, llu(pid), USEROBJECT,
-			get_attr->le[i].page, get_attr->le[i].number,
+	if (cid)
+		sprintf(SQL, "SELECT oid FROM %s WHERE pid = %llu AND "
+			" cid = %llu AND oid >= %llu ORDER BY oid;",
+			coll_getname(dbc), llu(pid), llu(cid),
 			llu(initial_oid));
-		if (i < (get_attr->sz - 1))
-			cp = strcat(cp, " UNION ALL ");
-
-		sqlen += strlen(cp);
-		if (sqlen > (MAXSQLEN*factor - 400)) {
-			factor *= 2;
-			SQL = realloc(SQL, MAXSQLEN*factor);
-			if (!SQL) {
-				ret = -ENOMEM;
-				goto out;
-			}
-		}
-
-		cp = SQL + sqlen;
-	}
-	sprintf(cp, " ORDER BY myoid; "); 
-
-	ret = sqlite3_prepare(dbc->db, SQL, strlen(SQL)+1, &stmt, NULL);
+	else
+		sprintf(SQL, "SELECT oid FROM %s WHERE pid = %llu AND "
+			" type = %u AND oid >= %llu ORDER BY oid;",
+			obj_getname(dbc), llu(pid), type, llu(initial_oid));
+	ret = sqlite3_prepare(dbc->db, SQL, -1, &obj, NULL);
 	if (ret != SQLITE_OK) {
 		error_sql(dbc->db, "%s: sqlite3_prepare", __func__);
+		ret = -EIO;
 		goto out;
 	}
 
-	/* execute the statement */
-	head = tail = outdata;
-	attr_list_len = 0;
-	while(1) {
-		ret = sqlite3_step(stmt);
-		if (ret == SQLITE_BUSY) {
+	cp = SQL + sprintf(SQL, "SELECT oid, page, number, value FROM %s "
+			   " WHERE pid = %llu AND oid >= %llu AND page IN (",
+			   attr_getname(dbc), llu(pid), llu(initial_oid));
+	for (i = 0; i < nattr; i++) {
+		if (attrs[i].len != 0)
 			continue;
-		} else if (ret != SQLITE_ROW) {
-			break;
-		} 
-		/* for the rest of loop body ret == SQLITE_ROW */
-
-		/*
-		 * XXX:SD The spec is inconsistent in applying padding and
-		 * alignment rules. Here we make changes to the spec. In our
-		 * case object descriptor format header (table 79) is 16B
-		 * instead of 12B, and attributes list length field is 4B
-		 * instead of 2B as defined in spec, and starts at byte 12
-		 * in the header (not 10).  ODE is object descriptor entry.
-		 */
-		oid = sqlite3_column_int64(stmt, 0);
-		page = sqlite3_column_int64(stmt, 1);
-		number = sqlite3_column_int64(stmt, 2);
-		len = sqlite3_column_bytes(stmt, 3);
-
-		if (page == USER_TMSTMP_PG && number == 0) {
-			/* look ahead in the buf to see if there is space */
-			if (alloc_len >= 16) {
-				/* start attr list of 'this' ODE */
-				set_htonll(tail, oid);
-				memset(tail + 8, 0, 4);  /* reserved */
-				if (head != tail) {
-					/* fill attr_list_len of prev ODE */
-					set_htonl(head, attr_list_len);
-					head = tail;
-					attr_list_len = 0;
-				}
-				alloc_len -= 16;
-				tail += 16;
-				head += 12;  /* points to attr-list-len */
-				*used_outlen += 16;
-			} else {
-				if (head != tail) {
-					/* fill attr_list_len of prev ODE */
-					set_htonl(head, attr_list_len);
-					head = tail;
-					attr_list_len = 0;
-				}
-				if (*cont_id == 0)
-					*cont_id = oid;
-			}
-			/* handle overflow: osd2r01 Sec 6.14.2 */
-			if (*add_len + 16 > *add_len) {
-				*add_len += 16;
-			} else {
-				/* terminate since add_len overflew */
-				*add_len = (uint64_t) -1;
-				ret = SQLITE_DONE; 
-				break;
-			}
+		if (npages > 0 && attrs[i].page == attrs[i-1].page)
 			continue;
-		} 
-		if (alloc_len >= 16) {
-			/* osd_debug("%s: oid %llu, page %u, number %u, len %u",
-				  __func__, llu(oid), page, number, len); */
-			val = sqlite3_column_blob(stmt, 3);
-			ret = le_pack_attr(tail, alloc_len, page, number, len, 
-					   val);
-			assert (ret != -EOVERFLOW);
-			if (ret > 0) {
-				alloc_len -= ret;
-				tail += ret;
-				attr_list_len += ret;
-				*used_outlen += ret;
-				if (alloc_len < 16){
-					set_htonl(head, attr_list_len);
-					head = tail;
-					attr_list_len = 0;
-					if (*cont_id == 0)
-						*cont_id = oid;
+		cp += sprintf(cp, "%s%d", npages++ ? ", " : "",
+			      (int32_t) attrs[i].page);
+	}
+	if (npages > 0) {
+		strcpy(cp, ") ORDER BY oid, page, number;");
+		ret = sqlite3_prepare(dbc->db, SQL, -1, &attr, NULL);
+		if (ret != SQLITE_OK) {
+			error_sql(dbc->db, "%s: sqlite3_prepare", __func__);
+			ret = -EIO;
+			goto out_finalize;
+		}
+		arow = mtq_step(attr);
+	}
+
+	while ((ret = mtq_step(obj)) == SQLITE_ROW) {
+		oid = sqlite3_column_int64(obj, 0);
+
+		/* rows of objects that are not listed */
+		while (arow == SQLITE_ROW &&
+		       (uint64_t) sqlite3_column_int64(attr, 0) < oid)
+			arow = mtq_step(attr);
+
+		ode = tail;
+		odelen = hdr;
+		if (left < odelen || (max_oids && listed == max_oids))
+			full = 1;
+		if (!full && hdr) {
+			set_htonll(tail, oid);
+			memset(tail + 8, 0, 8);
+			tail += hdr;
+		}
+
+		for (i = 0; i < nattr; i++) {
+			struct mtq_attr *ma = &attrs[i];
+
+			if (ma->len != 0) {
+				need = pre + roundup8(LE_VAL_OFF + ma->len);
+				if (!full && odelen + need > left)
+					full = 1;
+				if (full) {
+					odelen += need;
+					continue;
 				}
-			} else {
-				goto out_finalize;
+				used = 0;
+				if (pre)
+					set_htonll(tail, oid);
+				if (fn(arg, pid, oid, ma->page, ma->number,
+				       tail + pre, need - pre, &used) != OSD_OK)
+					continue; /* not this object's */
+				tail += pre + used;
+				odelen += pre + used;
+				continue;
 			}
-		} else {
-			if (head != tail) {
-				/* fill attr_list_len of this ODE */
-				set_htonl(head, attr_list_len);
-				head = tail;
-				attr_list_len = 0;
-				if (*cont_id == 0)
-					*cont_id = oid;
+
+			while (arow == SQLITE_ROW &&
+			       (c = mtq_row_cmp(attr, oid, ma)) < 0)
+				arow = mtq_step(attr);
+			if (arow != SQLITE_ROW || c != 0)
+				continue; /* not defined */
+
+			len = sqlite3_column_bytes(attr, 3);
+			need = pre + roundup8(LE_VAL_OFF + len);
+			if (!full && odelen + need > left)
+				full = 1;
+			if (!full) {
+				if (pre)
+					set_htonll(tail, oid);
+				ret = le_pack_attr(tail + pre, need - pre,
+						   ma->page, ma->number, len,
+						   sqlite3_column_blob(attr, 3));
+				if (ret < 0)
+					goto out_finalize;
+				tail += pre + ret;
 			}
+			odelen += need;
 		}
-		/* handle overflow: osd2r01 Sec 6.14.2 */
-		if ((*add_len + roundup8(4+4+2+len)) > *add_len) {
-			*add_len += roundup8(4+4+2+len);
+
+		if (full) {
+			tail = ode;
+			if (*cont_id == 0)
+				*cont_id = oid;
 		} else {
-			/* terminate since add_len overflew */
-			*add_len = (uint64_t) -1; 
-			ret = SQLITE_DONE; 
+			if (hdr)
+				set_htonl(ode + 12, odelen - hdr);
+			left -= odelen;
+			*used_outlen += odelen;
+			listed++;
+		}
+		if (mtq_add_len(add_len, odelen) != OSD_OK) {
+			ret = SQLITE_DONE; /* terminate since add_len overflew */
 			break;
 		}
 	}
-	if (ret != SQLITE_DONE) {
-		error_sql(dbc->db, "%s: query execution failed. SQL %s, "
-			  " add_len %llu attr_list_len %u", __func__, SQL, 
-			  llu(*add_len), attr_list_len);
+	if (ret != SQLITE_DONE || (arow != SQLITE_ROW && arow != SQLITE_DONE)) {
+		error_sql(dbc->db, "%s: query execution failed", __func__);
+		ret = -EIO;
 		goto out_finalize;
 	}
-	if (head != tail) {
-		set_htonl(head, attr_list_len);
-		head += (4 + attr_list_len);
-		assert(head == tail);
-	}
-
 	ret = OSD_OK; /* success */
 
 out_finalize:
-	if (sqlite3_finalize(stmt) != SQLITE_OK) {
+	if (attr && sqlite3_finalize(attr) != SQLITE_OK) {
+		ret = -EIO;
+		error_sql(dbc->db, "%s: finalize", __func__);
+	}
+	if (sqlite3_finalize(obj) != SQLITE_OK) {
 		ret = -EIO;
 		error_sql(dbc->db, "%s: finalize", __func__);
 	}
 
 out:
-	free(SQL);
 	return ret;
 }
 
 
 /*
- * set attributes on members of the give collection
+ * Append to the statement in the arena, growing it as needed.  sqlen is
+ * its length so far, size that of its buffer.
+ */
+static int __attribute__((format(printf,5,6)))
+sql_append(struct arena *a, char **sql, size_t *size, size_t *sqlen,
+	   const char *fmt, ...)
+{
+	int n;
+	char *tmp;
+	va_list ap;
+
+	for (;;) {
+		va_start(ap, fmt);
+		n = vsnprintf(*sql + *sqlen, *size - *sqlen, fmt, ap);
+		va_end(ap);
+		if (n < 0)
+			return OSD_ERROR;
+		if ((size_t) n < *size - *sqlen)
+			break;
+		tmp = arena_realloc(a, *sql, *size, 2 * *size);
+		if (!tmp)
+			return -ENOMEM;
+		*sql = tmp;
+		*size *= 2;
+	}
+	*sqlen += n;
+	return OSD_OK;
+}
+
+/*
+ * oid of the max'th member of collection cid from oid from on, in *hi;
+ * *found is 0 if there are fewer.
+ */
+static int chunk_end(struct db_context *dbc, uint64_t pid, uint64_t cid,
+		     uint64_t from, uint32_t max, uint64_t *hi, int *found)
+{
+	int ret = 0;
+	char SQL[MAXSQLEN];
+	sqlite3_stmt *stmt = NULL;
+
+	sprintf(SQL, "SELECT oid FROM %s WHERE pid = %llu AND cid = %llu "
+		" AND oid >= %llu ORDER BY oid LIMIT 1 OFFSET %u;",
+		coll_getname(dbc), llu(pid), llu(cid), llu(from), max - 1);
+	ret = sqlite3_prepare(dbc->db, SQL, strlen(SQL)+1, &stmt, NULL);
+	if (ret != SQLITE_OK) {
+		error_sql(dbc->db, "%s: sqlite3_prepare", __func__);
+		return -EIO;
+	}
+
+	*found = 0;
+	while ((ret = sqlite3_step(stmt)) == SQLITE_BUSY);
+	if (ret == SQLITE_ROW) {
+		*hi = sqlite3_column_int64(stmt, 0);
+		*found = 1;
+		ret = SQLITE_DONE;
+	}
+	if (ret != SQLITE_DONE) {
+		error_sql(dbc->db, "%s: sqlite3_step", __func__);
+		ret = -EIO;
+	} else {
+		ret = OSD_OK;
+	}
+
+	if (sqlite3_finalize(stmt) != SQLITE_OK)
+		error_sql(dbc->db, "%s: finalize", __func__);
+	return ret;
+}
+
+/*
+ * set attributes on at most max members of the given collection, those
+ * with the lowest oids from oid from on. Members are taken from the coll
+ * table, so a chunk is a range of its primary key.
+ *
+ * *next is where the following chunk starts, 0 if this was the last one;
+ * *count is the number of members done.
  *
  * return values:
  * -EINVAL: invalid argument
@@ -467,56 +586,56 @@ out:
  * OSD_ERROR: some other error
  * OSD_OK: success
  */
-int mtq_set_member_attrs(struct db_context *dbc, uint64_t pid, uint64_t cid, 
-			 struct setattr_list *set_attr)
+int mtq_set_member_attrs(struct db_context *dbc, struct arena *a,
+			 uint64_t pid, uint64_t cid,
+			 struct setattr_list *set_attr, uint64_t from,
+			 uint32_t max, uint64_t *next, uint32_t *count)
 {
 	int ret = 0;
-	int factor = 1;
+	int bounded = 0;
 	uint32_t i = 0;
-	char *cp = NULL;
+	uint64_t hi = 0;
 	char *SQL = NULL;
+	size_t size = MAXSQLEN;
 	size_t sqlen = 0;
 	sqlite3_stmt *stmt = NULL;
 	const char *attr = attr_getname(dbc);
+	const char *coll = coll_getname(dbc);
 
-	assert(dbc && dbc->db && set_attr && attr);
+	assert(dbc && dbc->db && set_attr && attr && next && count);
 
-	if (set_attr->sz == 0) {
+	*next = 0;
+	*count = 0;
+	if (set_attr->sz == 0 || max == 0) {
 		ret = 0;
 		goto out;
 	}
 
-	SQL = Malloc(MAXSQLEN*factor);
+	ret = chunk_end(dbc, pid, cid, from, max, &hi, &bounded);
+	if (ret != OSD_OK)
+		goto out;
+
+	SQL = arena_alloc(a, size);
 	if (!SQL) {
 		ret = -ENOMEM;
 		goto out;
 	}
 
-	cp = SQL;
-	sqlen = 0;
-	sprintf(SQL, "INSERT OR REPLACE INTO %s ", attr);
-	sqlen += strlen(SQL);
-	cp += sqlen;
-
-	for (i = 0; i < set_attr->sz; i++) {
-		sprintf(cp, " SELECT %llu, oid, %u, %u, ? FROM %s "
-			" WHERE pid = %llu AND page = %u AND value = %llu",
-			llu(pid), set_attr->le[i].page, set_attr->le[i].number,
-			attr, llu(pid), USER_COLL_PG, llu(cid));
-		if (i < (set_attr->sz - 1))
-			cp = strcat(cp, " UNION ALL ");
-		sqlen += strlen(cp);
-		if (sqlen > (MAXSQLEN*factor - 200)) {
-			factor *= 2;
-			SQL = realloc(SQL, MAXSQLEN*factor);
-			if (!SQL) {
-				ret = -ENOMEM;
-				goto out;
-			}
-		}
-		cp = SQL + sqlen;
-	}
-	cp = strcat(cp, " ;");
+	/* ?1 pid, ?2 cid, ?3 and ?4 the oid range, ?5 on the values */
+	ret = sql_append(a, &SQL, &size, &sqlen, "INSERT OR REPLACE INTO %s",
+			 attr);
+	for (i = 0; ret == OSD_OK && i < set_attr->sz; i++)
+		ret = sql_append(a, &SQL, &size, &sqlen,
+				 "%s SELECT ?1, oid, %u, %u, ?%u FROM %s"
+				 " WHERE pid = ?1 AND cid = ?2 AND oid %s",
+				 i > 0 ? " UNION ALL" : "",
+				 set_attr->le[i].page, set_attr->le[i].number,
+				 i + 5, coll,
+				 bounded ? "BETWEEN ?3 AND ?4" : ">= ?3");
+	if (ret == OSD_OK)
+		ret = sql_append(a, &SQL, &size, &sqlen, " ;");
+	if (ret != OSD_OK)
+		goto out;
 
 	ret = sqlite3_prepare(dbc->db, SQL, strlen(SQL)+1, &stmt, NULL);
 	if (ret != SQLITE_OK) {
@@ -526,13 +645,25 @@ int mtq_set_member_attrs(struct db_context *dbc, uint64_t pid, uint64_t cid,
 	}
 
 	/* bind values */
+	ret = sqlite3_bind_int64(stmt, 1, pid);
+	if (ret == SQLITE_OK)
+		ret = sqlite3_bind_int64(stmt, 2, cid);
+	if (ret == SQLITE_OK)
+		ret = sqlite3_bind_int64(stmt, 3, from);
+	if (ret == SQLITE_OK && bounded)
+		ret = sqlite3_bind_int64(stmt, 4, hi);
+	if (ret != SQLITE_OK) {
+		ret = -EIO;
+		error_sql(dbc->db, "%s: bind", __func__);
+		goto out_finalize;
+	}
 	for (i = 0; i < set_attr->sz; i++) {
-		ret = sqlite3_bind_blob(stmt, i+1, set_attr->le[i].cval, 
+		ret = sqlite3_bind_blob(stmt, i+5, set_attr->le[i].cval,
 					set_attr->le[i].len,
 					SQLITE_TRANSIENT);
 		if (ret != SQLITE_OK) {
 			ret = -EIO;
-			error_sql(dbc->db, "%s: blob @ %u", __func__, i+1);
+			error_sql(dbc->db, "%s: blob @ %u", __func__, i+5);
 			goto out_finalize;
 		}
 	}
@@ -544,6 +675,9 @@ int mtq_set_member_attrs(struct db_context *dbc, uint64_t pid, uint64_t cid,
 		ret = -EIO;
 		goto out_finalize;
 	}
+	*count = sqlite3_changes(dbc->db) / set_attr->sz;
+	if (bounded)
+		*next = hi + 1; /* wraps to 0 past the last oid */
 	ret = OSD_OK;
 
 out_finalize:
@@ -551,7 +685,6 @@ out_finalize:
 		error_sql(dbc->db, "%s: finalize", __func__);
 
 out:
-	free(SQL);
 	return ret;
 }
 
@@ -21,18 +21,37 @@
 #include <sqlite3.h>
 #include "osd-types.h"
 
-int mtq_run_query(struct db_context *dbc, uint64_t pid, uint64_t cid, 
-		  struct query_criteria *qc, void *outdata, 
+int mtq_run_query(struct db_context *dbc, struct arena *a, uint64_t pid,
+		  uint64_t cid, struct query_criteria *qc, void *outdata, 
 		  uint32_t alloc_len, uint64_t *used_outlen,
 		  uint64_t matches_cid);
 
-int mtq_list_oids_attr(struct db_context *dbc, uint64_t pid,
-		       uint64_t initial_oid, struct getattr_list *get_attr,
-		       uint64_t alloc_len, void *outdata, 
-		       uint64_t *used_outlen, uint64_t *add_len, 
+/*
+ * an attribute requested by LIST or GET MEMBER ATTRIBUTES; len is that of
+ * a computed value
+ */
+struct mtq_attr {
+	uint32_t page;
+	uint32_t number;
+	uint16_t len;		/* 0 if stored in attr */
+};
+
+/* packs computed attribute (page, number) of oid into buf */
+typedef int (*mtq_attr_fn)(void *arg, uint64_t pid, uint64_t oid,
+			   uint32_t page, uint32_t number, void *buf,
+			   uint32_t buflen, uint32_t *used);
+
+int mtq_list_oids_attr(struct db_context *dbc, struct arena *a, uint64_t pid,
+		       uint64_t cid, uint8_t type, uint64_t initial_oid,
+		       struct mtq_attr *attrs, uint32_t nattr, mtq_attr_fn fn,
+		       void *arg, uint8_t listfmt, uint64_t max_oids,
+		       uint64_t alloc_len, void *outdata,
+		       uint64_t *used_outlen, uint64_t *add_len,
 		       uint64_t *cont_id);
 
-int mtq_set_member_attrs(struct db_context *dbc, uint64_t pid, uint64_t cid, 
-			 struct setattr_list *set_attr);
+int mtq_set_member_attrs(struct db_context *dbc, struct arena *a,
+			 uint64_t pid, uint64_t cid,
+			 struct setattr_list *set_attr, uint64_t from,
+			 uint32_t max, uint64_t *next, uint32_t *count);
 
 #endif /* __MTQ_H */
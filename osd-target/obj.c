@@ -41,9 +41,13 @@ struct obj_tab {
 	sqlite3_stmt *emptypid; /* is partition empty */
 	sqlite3_stmt *pcount;   /* count of partitions */
 	sqlite3_stmt *gettype;  /* get type of the object */
+	sqlite3_stmt *rngtype;  /* get types of a range of objects */
 	sqlite3_stmt *getoids;  /* get oids in a pid */
 	sqlite3_stmt *getcids;  /* get cids in pid */
 	sqlite3_stmt *getpids;  /* get pids in db */
+	sqlite3_stmt *getbatch; /* get a batch of objects in pid */
+	sqlite3_stmt *getuobjs; /* next batch of userobjects in pid */
+	sqlite3_stmt *prefetch; /* walk the table in rowid order */
 };
 
 
@@ -87,77 +91,110 @@ int obj_initialize(struct db_context *dbc)
 	}
 
 	sprintf(SQL, "INSERT INTO %s VALUES (?, ?, ?, ?);", dbc->obj->name);
-	ret = sqlite3_prepare(dbc->db, SQL, -1, &dbc->obj->insert, NULL);
+	ret = db_prepare_lazy(dbc, SQL, &dbc->obj->insert);
 	if (ret != SQLITE_OK)
 		goto out_finalize_insert;
 
 	sprintf(SQL, "DELETE FROM %s WHERE pid = ? AND oid = ?;", 
 		dbc->obj->name);
-	ret = sqlite3_prepare(dbc->db, SQL, -1, &dbc->obj->delete, NULL);
+	ret = db_prepare_lazy(dbc, SQL, &dbc->obj->delete);
 	if (ret != SQLITE_OK)
 		goto out_finalize_delete;
 
 	sprintf(SQL, "DELETE FROM %s WHERE pid = ?;", dbc->obj->name);
-	ret = sqlite3_prepare(dbc->db, SQL, -1, &dbc->obj->delpid, NULL);
+	ret = db_prepare_lazy(dbc, SQL, &dbc->obj->delpid);
 	if (ret != SQLITE_OK)
 		goto out_finalize_delpid;
 
 	sprintf(SQL, "SELECT MAX(oid) FROM %s WHERE pid = ?;", 
 		dbc->obj->name);
-	ret = sqlite3_prepare(dbc->db, SQL, -1, &dbc->obj->nextoid, NULL);
+	ret = db_prepare_lazy(dbc, SQL, &dbc->obj->nextoid);
 	if (ret != SQLITE_OK)
 		goto out_finalize_nextoid;
 
 	sprintf(SQL, "SELECT MAX(pid) FROM %s;", dbc->obj->name);
-	ret = sqlite3_prepare(dbc->db, SQL, -1, &dbc->obj->nextpid, NULL);
+	ret = db_prepare_lazy(dbc, SQL, &dbc->obj->nextpid);
 	if (ret != SQLITE_OK)
 		goto out_finalize_nextpid;
 
 	sprintf(SQL, "SELECT COUNT(oid) FROM %s WHERE pid = ? AND oid = ?;",
 		dbc->obj->name);
-	ret = sqlite3_prepare(dbc->db, SQL, -1, &dbc->obj->isprsnt, NULL);
+	ret = db_prepare_lazy(dbc, SQL, &dbc->obj->isprsnt);
 	if (ret != SQLITE_OK)
 		goto out_finalize_isprsnt;
 
 	sprintf(SQL, "SELECT COUNT(oid) FROM %s WHERE pid = ? AND oid != 0 "
 		" LIMIT 1;", dbc->obj->name);
-	ret = sqlite3_prepare(dbc->db, SQL, -1, &dbc->obj->emptypid, NULL);
+	ret = db_prepare_lazy(dbc, SQL, &dbc->obj->emptypid);
 	if (ret != SQLITE_OK)
 		goto out_finalize_emptypid;
 
 	sprintf(SQL, "SELECT COUNT(pid) FROM %s WHERE oid = %llu AND type = %u;",
 		dbc->obj->name, llu(PARTITION_OID), PARTITION);
-	ret = sqlite3_prepare(dbc->db, SQL, -1, &dbc->obj->pcount, NULL);
+	ret = db_prepare_lazy(dbc, SQL, &dbc->obj->pcount);
 	if (ret != SQLITE_OK)
 		goto out_finalize_pcount;
 
 	sprintf(SQL, "SELECT type, coll_type FROM %s WHERE pid = ? AND oid = ?;",
 		dbc->obj->name);
-	ret = sqlite3_prepare(dbc->db, SQL, -1, &dbc->obj->gettype, NULL);
+	ret = db_prepare_lazy(dbc, SQL, &dbc->obj->gettype);
 	if (ret != SQLITE_OK)
 		goto out_finalize_gettype;
 
+	sprintf(SQL, "SELECT oid, type FROM %s WHERE pid = ? AND "
+		" oid BETWEEN ? AND ?;", dbc->obj->name);
+	ret = db_prepare_lazy(dbc, SQL, &dbc->obj->rngtype);
+	if (ret != SQLITE_OK)
+		goto out_finalize_rngtype;
+
 	sprintf(SQL, "SELECT oid FROM %s WHERE pid = ? AND type = %u AND "
 		" oid >= ?;", dbc->obj->name, USEROBJECT);
-	ret = sqlite3_prepare(dbc->db, SQL, -1, &dbc->obj->getoids, NULL);
+	ret = db_prepare_lazy(dbc, SQL, &dbc->obj->getoids);
 	if (ret != SQLITE_OK)
 		goto out_finalize_getoids;
 
 	sprintf(SQL, "SELECT oid FROM %s WHERE pid = ? AND type = %u AND "
 		" oid >= ?;", dbc->obj->name, COLLECTION);
-	ret = sqlite3_prepare(dbc->db, SQL, -1, &dbc->obj->getcids, NULL);
+	ret = db_prepare_lazy(dbc, SQL, &dbc->obj->getcids);
 	if (ret != SQLITE_OK)
 		goto out_finalize_getcids;
 
 	sprintf(SQL, "SELECT pid FROM %s WHERE oid = %llu AND type = %u AND "
 		" pid >= ?;", dbc->obj->name, llu(PARTITION_OID), PARTITION);
-	ret = sqlite3_prepare(dbc->db, SQL, -1, &dbc->obj->getpids, NULL);
+	ret = db_prepare_lazy(dbc, SQL, &dbc->obj->getpids);
 	if (ret != SQLITE_OK)
 		goto out_finalize_getpids;
 
+	sprintf(SQL, "SELECT oid, type FROM %s WHERE pid = ? AND oid != 0 "
+		" LIMIT ?;", dbc->obj->name);
+	ret = db_prepare_lazy(dbc, SQL, &dbc->obj->getbatch);
+	if (ret != SQLITE_OK)
+		goto out_finalize_getbatch;
+
+	sprintf(SQL, "SELECT oid FROM %s WHERE pid = ? AND type = %u AND "
+		" oid >= ? ORDER BY oid LIMIT ?;", dbc->obj->name, USEROBJECT);
+	ret = db_prepare_lazy(dbc, SQL, &dbc->obj->getuobjs);
+	if (ret != SQLITE_OK)
+		goto out_finalize_getuobjs;
+
+	sprintf(SQL, "SELECT rowid, type FROM %s WHERE rowid > ? LIMIT ?;",
+		dbc->obj->name);
+	ret = db_prepare_lazy(dbc, SQL, &dbc->obj->prefetch);
+	if (ret != SQLITE_OK)
+		goto out_finalize_prefetch;
+
 	ret = OSD_OK; /* success */
 	goto out;
 
+out_finalize_prefetch:
+	db_sqfinalize(dbc->db, dbc->obj->prefetch, SQL);
+	SQL[0] = '\0';
+out_finalize_getuobjs:
+	db_sqfinalize(dbc->db, dbc->obj->getuobjs, SQL);
+	SQL[0] = '\0';
+out_finalize_getbatch:
+	db_sqfinalize(dbc->db, dbc->obj->getbatch, SQL);
+	SQL[0] = '\0';
 out_finalize_getpids:
 	db_sqfinalize(dbc->db, dbc->obj->getpids, SQL);
 	SQL[0] = '\0';
@@ -167,6 +204,9 @@ out_finalize_getcids:
 out_finalize_getoids:
 	db_sqfinalize(dbc->db, dbc->obj->getoids, SQL);
 	SQL[0] = '\0';
+out_finalize_rngtype:
+	db_sqfinalize(dbc->db, dbc->obj->rngtype, SQL);
+	SQL[0] = '\0';
 out_finalize_gettype:
 	db_sqfinalize(dbc->db, dbc->obj->gettype, SQL);
 	SQL[0] = '\0';
@@ -214,9 +254,14 @@ int obj_finalize(struct db_context *dbc)
 	sqlite3_finalize(dbc->obj->emptypid);
 	sqlite3_finalize(dbc->obj->pcount);
 	sqlite3_finalize(dbc->obj->gettype);
+	sqlite3_finalize(dbc->obj->rngtype);
 	sqlite3_finalize(dbc->obj->getoids);
 	sqlite3_finalize(dbc->obj->getcids);
 	sqlite3_finalize(dbc->obj->getpids);
+	sqlite3_finalize(dbc->obj->getbatch);
+	sqlite3_finalize(dbc->obj->getuobjs);
+	sqlite3_finalize(dbc->obj->prefetch);
+	db_forget_lazy(dbc, dbc->obj, sizeof(*dbc->obj));
 	free(dbc->obj->name);
 	free(dbc->obj);
 	dbc->obj = NULL;
@@ -245,7 +290,9 @@ int obj_insert(struct db_context *dbc, uint64_t pid, uint64_t oid,
 	int ret = 0;
 
 	TICK_TRACE(obj_insert);
-	assert(dbc && dbc->db && dbc->obj && dbc->obj->insert);
+	assert(dbc && dbc->db && dbc->obj);
+	if (db_stmt_ready(dbc, &dbc->obj->insert) != OSD_OK)
+		return OSD_ERROR;
 
 repeat:
 	ret = 0;
@@ -274,7 +321,9 @@ int obj_delete(struct db_context *dbc, uint64_t pid, uint64_t oid)
 {
 	int ret = 0;
 
-	assert(dbc && dbc->db && dbc->obj && dbc->obj->delete);
+	assert(dbc && dbc->db && dbc->obj);
+	if (db_stmt_ready(dbc, &dbc->obj->delete) != OSD_OK)
+		return OSD_ERROR;
 
 repeat:
 	ret = 0;
@@ -298,7 +347,9 @@ int obj_delete_pid(struct db_context *dbc, uint64_t pid)
 {
 	int ret = 0;
 
-	assert(dbc && dbc->db && dbc->obj && dbc->obj->delpid);
+	assert(dbc && dbc->db && dbc->obj);
+	if (db_stmt_ready(dbc, &dbc->obj->delpid) != OSD_OK)
+		return OSD_ERROR;
 
 repeat:
 	ret = sqlite3_bind_int64(dbc->obj->delpid, 1, pid);
@@ -323,7 +374,9 @@ int obj_get_nextoid(struct db_context *dbc, uint64_t pid, uint64_t *oid)
 	int ret = 0;
 	int bound = 0;
 
-	assert(dbc && dbc->db && dbc->obj && dbc->obj->nextoid);
+	assert(dbc && dbc->db && dbc->obj);
+	if (db_stmt_ready(dbc, &dbc->obj->nextoid) != OSD_OK)
+		return OSD_ERROR;
 
 repeat:
 	ret = sqlite3_bind_int64(dbc->obj->nextoid, 1, pid);
@@ -358,7 +411,9 @@ int obj_get_nextpid(struct db_context *dbc, uint64_t *pid)
 {
 	int ret = 0;
 
-	assert(dbc && dbc->db && dbc->obj && dbc->obj->nextpid);
+	assert(dbc && dbc->db && dbc->obj);
+	if (db_stmt_ready(dbc, &dbc->obj->nextpid) != OSD_OK)
+		return OSD_ERROR;
 
 repeat:
 	while ((ret = sqlite3_step(dbc->obj->nextpid)) == SQLITE_BUSY);
@@ -392,7 +447,9 @@ int obj_ispresent(struct db_context *dbc, uint64_t pid, uint64_t oid,
 	int bound = 0;
 	*present = 0;
 
-	assert(dbc && dbc->db && dbc->obj && dbc->obj->isprsnt);
+	assert(dbc && dbc->db && dbc->obj);
+	if (db_stmt_ready(dbc, &dbc->obj->isprsnt) != OSD_OK)
+		return OSD_ERROR;
 
 repeat:
 	ret = 0;
@@ -433,7 +490,9 @@ int obj_isempty_pid(struct db_context *dbc, uint64_t pid, int *isempty)
 	int bound = 0;
 	*isempty = 0;
 
-	assert(dbc && dbc->db && dbc->obj && dbc->obj->emptypid);
+	assert(dbc && dbc->db && dbc->obj);
+	if (db_stmt_ready(dbc, &dbc->obj->emptypid) != OSD_OK)
+		return OSD_ERROR;
 
 repeat:
 	ret = sqlite3_bind_int64(dbc->obj->emptypid, 1, pid);
@@ -472,7 +531,9 @@ int obj_pcount(struct db_context *dbc, uint64_t *pcount)
 	int bound = 0;
 	*pcount = 0;
 
-	assert(dbc && dbc->db && dbc->obj && dbc->obj->pcount);
+	assert(dbc && dbc->db && dbc->obj);
+	if (db_stmt_ready(dbc, &dbc->obj->pcount) != OSD_OK)
+		return OSD_ERROR;
 
 repeat:
 	while ((ret = sqlite3_step(dbc->obj->pcount)) == SQLITE_BUSY);
@@ -500,7 +561,9 @@ int obj_get_type(struct db_context *dbc, uint64_t pid, uint64_t oid,
 	int bound = 0;
 	*obj_type = ILLEGAL_OBJ;
 
-	assert(dbc && dbc->db && dbc->obj && dbc->obj->gettype);
+	assert(dbc && dbc->db && dbc->obj);
+	if (db_stmt_ready(dbc, &dbc->obj->gettype) != OSD_OK)
+		return OSD_ERROR;
 
 repeat:
 	ret = 0;
@@ -531,6 +594,59 @@ out:
 }
 
 
+/*
+ * Types of the n objects oid, oid+1, .. in one query. types[i] is the type
+ * of oid+i, ILLEGAL_OBJ if it does not exist.
+ *
+ * returns:
+ * OSD_ERROR: some error, ignore types
+ * OSD_OK: success, types set
+ */
+int obj_get_types(struct db_context *dbc, uint64_t pid, uint64_t oid,
+		  uint32_t n, uint8_t *types)
+{
+	int ret = 0;
+	int bound = 0;
+	uint64_t i;
+	sqlite3_stmt *stmt = NULL;
+
+	assert(dbc && dbc->db && dbc->obj && n > 0);
+	if (db_stmt_ready(dbc, &dbc->obj->rngtype) != OSD_OK)
+		return OSD_ERROR;
+
+repeat:
+	memset(types, ILLEGAL_OBJ, n);
+	ret = 0;
+	stmt = dbc->obj->rngtype;
+	ret |= sqlite3_bind_int64(stmt, 1, pid);
+	ret |= sqlite3_bind_int64(stmt, 2, oid);
+	ret |= sqlite3_bind_int64(stmt, 3, oid + n - 1);
+	bound = (ret == SQLITE_OK);
+	if (!bound) {
+		error_sql(dbc->db, "%s: bind failed", __func__);
+		goto out_reset;
+	}
+
+	while (1) {
+		ret = sqlite3_step(stmt);
+		if (ret == SQLITE_ROW) {
+			i = sqlite3_column_int64(stmt, 0) - oid;
+			if (i < n)
+				types[i] = sqlite3_column_int(stmt, 1);
+		} else if (ret != SQLITE_BUSY) {
+			break;
+		}
+	}
+
+out_reset:
+	ret = db_reset_stmt(dbc, stmt, bound, __func__);
+	if (ret == OSD_REPEAT)
+		goto repeat;
+
+	return ret;
+}
+
+
 /*
  * returns:
  * -EINVAL: invalid arg
@@ -546,7 +662,9 @@ int obj_get_oids_in_pid(struct db_context *dbc, uint64_t pid,
 	int ret = 0;
 	sqlite3_stmt *stmt = NULL;
 
-	assert(dbc && dbc->db && dbc->obj && dbc->obj->getoids);
+	assert(dbc && dbc->db && dbc->obj);
+	if (db_stmt_ready(dbc, &dbc->obj->getoids) != OSD_OK)
+		return OSD_ERROR;
 
 repeat:
 	ret = 0;
@@ -577,7 +695,9 @@ int obj_get_cids_in_pid(struct db_context *dbc, uint64_t pid,
 	int ret = 0;
 	sqlite3_stmt *stmt = NULL;
 
-	assert(dbc && dbc->db && dbc->obj && dbc->obj->getcids);
+	assert(dbc && dbc->db && dbc->obj);
+	if (db_stmt_ready(dbc, &dbc->obj->getcids) != OSD_OK)
+		return OSD_ERROR;
 
 repeat:
 	ret = 0;
@@ -607,7 +727,9 @@ int obj_get_all_pids(struct db_context *dbc, uint64_t initial_pid,
 {
 	int ret = 0;
 
-	assert(dbc && dbc->db && dbc->obj && dbc->obj->getpids);
+	assert(dbc && dbc->db && dbc->obj);
+	if (db_stmt_ready(dbc, &dbc->obj->getpids) != OSD_OK)
+		return OSD_ERROR;
 
 repeat:
 	ret = sqlite3_bind_int64(dbc->obj->getpids, 1, initial_pid);
@@ -620,3 +742,154 @@ repeat:
 	return ret;
 }
 
+
+
+/*
+ * Fetch at most 'max' objects (userobjects and collections) of partition
+ * pid. The partition object itself is never returned. Used by bulk removal,
+ * which deletes every batch it gets, so no cursor is needed.
+ *
+ * returns:
+ * OSD_ERROR: some error
+ * OSD_OK: success, *count set to number of entries in oids and types
+ */
+int obj_get_pid_batch(struct db_context *dbc, uint64_t pid, uint64_t *oids,
+		      uint8_t *types, uint32_t max, uint32_t *count)
+{
+	int ret = 0;
+	int bound = 0;
+	sqlite3_stmt *stmt = NULL;
+
+	assert(dbc && dbc->db && dbc->obj);
+	if (db_stmt_ready(dbc, &dbc->obj->getbatch) != OSD_OK)
+		return OSD_ERROR;
+
+repeat:
+	*count = 0;
+	ret = 0;
+	stmt = dbc->obj->getbatch;
+	ret |= sqlite3_bind_int64(stmt, 1, pid);
+	ret |= sqlite3_bind_int64(stmt, 2, max);
+	bound = (ret == SQLITE_OK);
+	if (!bound) {
+		error_sql(dbc->db, "%s: bind failed", __func__);
+		goto out_reset;
+	}
+
+	while (*count < max) {
+		ret = sqlite3_step(stmt);
+		if (ret == SQLITE_ROW) {
+			oids[*count] = sqlite3_column_int64(stmt, 0);
+			types[*count] = sqlite3_column_int(stmt, 1);
+			(*count)++;
+		} else if (ret != SQLITE_BUSY) {
+			break;
+		}
+	}
+
+out_reset:
+	ret = db_reset_stmt(dbc, stmt, bound, __func__);
+	if (ret == OSD_REPEAT)
+		goto repeat;
+
+	return ret;
+}
+
+
+/*
+ * Fetch at most 'max' userobjects of partition pid from oid on, in oid
+ * order, for walks that resume where the last batch ended.
+ *
+ * returns:
+ * OSD_ERROR: some error
+ * OSD_OK: success, *count set to number of entries in oids
+ */
+int obj_get_oid_batch(struct db_context *dbc, uint64_t pid, uint64_t oid,
+		      uint64_t *oids, uint32_t max, uint32_t *count)
+{
+	int ret = 0;
+	int bound = 0;
+	sqlite3_stmt *stmt = NULL;
+
+	assert(dbc && dbc->db && dbc->obj);
+	if (db_stmt_ready(dbc, &dbc->obj->getuobjs) != OSD_OK)
+		return OSD_ERROR;
+
+repeat:
+	*count = 0;
+	ret = 0;
+	stmt = dbc->obj->getuobjs;
+	ret |= sqlite3_bind_int64(stmt, 1, pid);
+	ret |= sqlite3_bind_int64(stmt, 2, oid);
+	ret |= sqlite3_bind_int64(stmt, 3, max);
+	bound = (ret == SQLITE_OK);
+	if (!bound) {
+		error_sql(dbc->db, "%s: bind failed", __func__);
+		goto out_reset;
+	}
+
+	while (*count < max) {
+		ret = sqlite3_step(stmt);
+		if (ret == SQLITE_ROW)
+			oids[(*count)++] = sqlite3_column_int64(stmt, 0);
+		else if (ret != SQLITE_BUSY)
+			break;
+	}
+
+out_reset:
+	ret = db_reset_stmt(dbc, stmt, bound, __func__);
+	if (ret == OSD_REPEAT)
+		goto repeat;
+
+	return ret;
+}
+
+
+/*
+ * Read the next 'max' rows after *rowid, only to pull the table pages into
+ * the cache. *rowid is advanced past the rows read.
+ *
+ * returns:
+ * OSD_ERROR: some error
+ * OSD_OK: success, *count set to number of rows read
+ */
+int obj_prefetch(struct db_context *dbc, uint64_t *rowid, uint32_t max,
+		 uint32_t *count)
+{
+	int ret = 0;
+	int bound = 0;
+	sqlite3_stmt *stmt = NULL;
+
+	assert(dbc && dbc->db && dbc->obj);
+	if (db_stmt_ready(dbc, &dbc->obj->prefetch) != OSD_OK)
+		return OSD_ERROR;
+
+repeat:
+	*count = 0;
+	ret = 0;
+	stmt = dbc->obj->prefetch;
+	ret |= sqlite3_bind_int64(stmt, 1, *rowid);
+	ret |= sqlite3_bind_int64(stmt, 2, max);
+	bound = (ret == SQLITE_OK);
+	if (!bound) {
+		error_sql(dbc->db, "%s: bind failed", __func__);
+		goto out_reset;
+	}
+
+	while (*count < max) {
+		ret = sqlite3_step(stmt);
+		if (ret == SQLITE_ROW) {
+			*rowid = sqlite3_column_int64(stmt, 0);
+			(*count)++;
+		} else if (ret != SQLITE_BUSY) {
+			break;
+		}
+	}
+
+out_reset:
+	ret = db_reset_stmt(dbc, stmt, bound, __func__);
+	if (ret == OSD_REPEAT)
+		goto repeat;
+
+	return ret;
+}
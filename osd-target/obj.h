@@ -48,6 +48,9 @@ int obj_pcount(struct db_context *dbc, uint64_t *pcount);
 int obj_get_type(struct db_context *dbc, uint64_t pid, uint64_t oid, 
 		 uint8_t *obj_type, uint8_t *coll_type);
 
+int obj_get_types(struct db_context *dbc, uint64_t pid, uint64_t oid,
+		  uint32_t n, uint8_t *types);
+
 int obj_get_oids_in_pid(struct db_context *dbc, uint64_t pid, 
 			uint64_t initial_oid, uint64_t alloc_len, 
 			uint8_t *outdata, uint64_t *used_outlen, 
@@ -62,4 +65,13 @@ int obj_get_all_pids(struct db_context *dbc, uint64_t initial_oid,
 		     uint64_t alloc_len, uint8_t *outdata,
 		     uint64_t *used_outlen, uint64_t *add_len,
 		     uint64_t *cont_id);
+
+int obj_get_pid_batch(struct db_context *dbc, uint64_t pid, uint64_t *oids,
+		      uint8_t *types, uint32_t max, uint32_t *count);
+
+int obj_get_oid_batch(struct db_context *dbc, uint64_t pid, uint64_t oid,
+		      uint64_t *oids, uint32_t max, uint32_t *count);
+
+int obj_prefetch(struct db_context *dbc, uint64_t *rowid, uint32_t max,
+		 uint32_t *count);
 #endif /* __OBJ_H */
@@ -0,0 +1,259 @@
+/*
+ * User object information cache.
+ *
+ * Copyright (C) 2007 OSD Team <pvfs-osd@osc.edu>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, version 2 of the License.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/*
+ * Logical length, used capacity and timestamps of user objects, so GET
+ * ATTRIBUTES on the information and timestamps pages does not have to
+ * stat the data file and the db each time.
+ *
+ * An entry is filled from stat on first use. After that the data paths
+ * keep it current: writes extend the length and set the modify time,
+ * truncates set the length, reads set the access time. Used capacity
+ * depends on the filesystem and is looked up again only when asked for
+ * after the data changed.
+ *
+ * The data file remains the place where all of this is kept. The only
+ * thing not already on it is the access time of reads, which is written
+ * back when the entry is evicted and on osd_close.
+ *
+ * The table is direct mapped; a colliding object simply takes the slot.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <assert.h>
+
+#include "osd.h"
+#include "oinfo.h"
+#include "osd-util/osd-util.h"
+
+#define OINFO_SLOTS 4096 /* power of 2 */
+
+struct oinfo_cache {
+	char dbname[MAXNAMELEN];
+	struct oinfo slot[OINFO_SLOTS];
+};
+
+static inline struct oinfo *oinfo_slot(struct oinfo_cache *oc, uint64_t pid,
+				       uint64_t oid)
+{
+	return &oc->slot[(oid ^ (pid * 0x9e3779b1)) & (OINFO_SLOTS - 1)];
+}
+
+static inline struct oinfo *oinfo_lookup(struct osd_device *osd,
+					 uint64_t pid, uint64_t oid)
+{
+	struct oinfo *oi;
+
+	if (!osd->oc)
+		return NULL;
+	oi = oinfo_slot(osd->oc, pid, oid);
+	if (!oi->valid || oi->pid != pid || oi->oid != oid)
+		return NULL;
+	return oi;
+}
+
+static inline void now(struct timespec *ts)
+{
+	clock_gettime(CLOCK_REALTIME, ts);
+}
+
+static void oinfo_evict(struct osd_device *osd, struct oinfo *oi)
+{
+	char path[MAXNAMELEN];
+	struct timespec ts[2];
+
+	if (oi->valid && oi->atime_dirty) {
+		get_dfile_name(path, osd->root, oi->pid, oi->oid);
+		ts[0] = oi->atime;
+		ts[1].tv_sec = 0;
+		ts[1].tv_nsec = UTIME_OMIT;
+		if (utimensat(AT_FDCWD, path, ts, 0) != 0 && errno != ENOENT)
+			osd_error_errno("%s: utimensat %s", __func__, path);
+	}
+	oi->valid = 0;
+}
+
+int oinfo_init(struct osd_device *osd, const char *dbname)
+{
+	struct oinfo_cache *oc;
+
+	oc = Calloc(1, sizeof(*oc));
+	if (!oc)
+		return -ENOMEM;
+	strncpy(oc->dbname, dbname, sizeof(oc->dbname) - 1);
+	osd->oc = oc;
+	return OSD_OK;
+}
+
+void oinfo_fini(struct osd_device *osd)
+{
+	int i;
+
+	if (!osd->oc)
+		return;
+	for (i = 0; i < OINFO_SLOTS; i++)
+		oinfo_evict(osd, &osd->oc->slot[i]);
+	free(osd->oc);
+	osd->oc = NULL;
+}
+
+static int oinfo_stat(struct osd_device *osd, struct oinfo *oi)
+{
+	char path[MAXNAMELEN];
+	struct stat sb;
+
+	get_dfile_name(path, osd->root, oi->pid, oi->oid);
+	if (stat(path, &sb) != 0)
+		return OSD_ERROR;
+
+	oi->size = sb.st_size;
+	oi->alloc = sb.st_blocks * BLOCK_SZ;
+	oi->alloc_stale = 0;
+	oi->ctime = sb.st_ctim;
+	if (!oi->atime_dirty)
+		oi->atime = sb.st_atim;
+	oi->mtime = sb.st_mtim;
+	return OSD_OK;
+}
+
+/*
+ * returns: the entry of a user object, NULL if its data file cannot be
+ * stat'ed. With need_alloc set, used capacity is made current.
+ */
+struct oinfo *oinfo_get(struct osd_device *osd, uint64_t pid, uint64_t oid,
+			int need_alloc)
+{
+	struct stat sb;
+	struct oinfo *oi;
+
+	if (!osd->oc)
+		return NULL;
+
+	oi = oinfo_lookup(osd, pid, oid);
+	if (oi) {
+		if (need_alloc && oi->alloc_stale && oinfo_stat(osd, oi) != 0)
+			return NULL;
+		return oi;
+	}
+
+	oi = oinfo_slot(osd->oc, pid, oid);
+	oinfo_evict(osd, oi);
+	memset(oi, 0, sizeof(*oi));
+	oi->pid = pid;
+	oi->oid = oid;
+	if (oinfo_stat(osd, oi) != OSD_OK)
+		return NULL;
+
+	/* XXX: attributes have no times of their own, use those of the db */
+	if (stat(osd->oc->dbname, &sb) != 0)
+		return NULL;
+	oi->attr_atime = sb.st_atim;
+	oi->attr_mtime = sb.st_mtim;
+
+	oi->valid = 1;
+	return oi;
+}
+
+/*
+ * Logical length of a user object, from its entry if there is one, else
+ * from stat without taking a slot: for walks over a whole partition.
+ *
+ * returns: OSD_OK, OSD_ERROR if the data file cannot be stat'ed
+ */
+int oinfo_size(struct osd_device *osd, uint64_t pid, uint64_t oid,
+	       uint64_t *size)
+{
+	char path[MAXNAMELEN];
+	struct stat sb;
+	struct oinfo *oi = oinfo_lookup(osd, pid, oid);
+
+	if (oi) {
+		*size = oi->size;
+		return OSD_OK;
+	}
+	get_dfile_name(path, osd->root, pid, oid);
+	if (stat(path, &sb) != 0)
+		return OSD_ERROR;
+	*size = sb.st_size;
+	return OSD_OK;
+}
+
+/*
+ * Data was written up to end.
+ */
+void oinfo_wrote(struct osd_device *osd, uint64_t pid, uint64_t oid,
+		 uint64_t end)
+{
+	struct oinfo *oi = oinfo_lookup(osd, pid, oid);
+
+	if (!oi)
+		return;
+	if (end > oi->size)
+		oi->size = end;
+	oi->alloc_stale = 1;
+	now(&oi->mtime);
+	oi->ctime = oi->mtime;
+}
+
+void oinfo_resized(struct osd_device *osd, uint64_t pid, uint64_t oid,
+		   uint64_t size)
+{
+	struct oinfo *oi = oinfo_lookup(osd, pid, oid);
+
+	if (!oi)
+		return;
+	oi->size = size;
+	oi->alloc_stale = 1;
+	now(&oi->mtime);
+	oi->ctime = oi->mtime;
+}
+
+void oinfo_read(struct osd_device *osd, uint64_t pid, uint64_t oid)
+{
+	struct oinfo *oi = oinfo_lookup(osd, pid, oid);
+
+	if (!oi)
+		return;
+	now(&oi->atime);
+	oi->atime_dirty = 1;
+}
+
+void oinfo_attr_set(struct osd_device *osd, uint64_t pid, uint64_t oid)
+{
+	struct oinfo *oi = oinfo_lookup(osd, pid, oid);
+
+	if (!oi)
+		return;
+	now(&oi->attr_mtime);
+	oi->attr_atime = oi->attr_mtime;
+}
+
+/*
+ * The object is gone or new; nothing is written back.
+ */
+void oinfo_forget(struct osd_device *osd, uint64_t pid, uint64_t oid)
+{
+	struct oinfo *oi = oinfo_lookup(osd, pid, oid);
+
+	if (oi)
+		oi->valid = 0;
+}
@@ -0,0 +1,62 @@
+/*
+ * User object information cache.
+ *
+ * Copyright (C) 2007 OSD Team <pvfs-osd@osc.edu>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, version 2 of the License.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#ifndef __OINFO_H
+#define __OINFO_H
+
+#include <stdint.h>
+#include <time.h>
+#include "osd-types.h"
+
+struct oinfo {
+	uint64_t pid;
+	uint64_t oid;
+	uint64_t size;			/* logical length */
+	uint64_t alloc;			/* used capacity, unless alloc_stale */
+	struct timespec ctime;
+	struct timespec atime;		/* data access */
+	struct timespec mtime;		/* data modification */
+	struct timespec attr_atime;
+	struct timespec attr_mtime;
+	uint8_t valid;
+	uint8_t alloc_stale;		/* data changed since last stat */
+	uint8_t atime_dirty;		/* atime not yet on the data file */
+};
+
+int oinfo_init(struct osd_device *osd, const char *dbname);
+
+void oinfo_fini(struct osd_device *osd);
+
+struct oinfo *oinfo_get(struct osd_device *osd, uint64_t pid, uint64_t oid,
+			int need_alloc);
+
+int oinfo_size(struct osd_device *osd, uint64_t pid, uint64_t oid,
+	       uint64_t *size);
+
+void oinfo_wrote(struct osd_device *osd, uint64_t pid, uint64_t oid,
+		 uint64_t end);
+
+void oinfo_resized(struct osd_device *osd, uint64_t pid, uint64_t oid,
+		   uint64_t size);
+
+void oinfo_read(struct osd_device *osd, uint64_t pid, uint64_t oid);
+
+void oinfo_attr_set(struct osd_device *osd, uint64_t pid, uint64_t oid);
+
+void oinfo_forget(struct osd_device *osd, uint64_t pid, uint64_t oid);
+
+#endif /* __OINFO_H */
@@ -37,7 +37,8 @@ int _sense_header_build(uint8_t *data, int len, uint8_t key, uint16_t code,
 	data[2] = ASC(code);
 	data[3] = ASCQ(code);
 	data[7] = additional_len;  /* additional length, beyond these 8 bytes */
-	osd_warning("%s:%d: _sense_header_build key=%d code=%x additional_len=%d",
+	osd_rlog(OSD_LOG_WARNING,
+		 "%s:%d: _sense_header_build key=%d code=%x additional_len=%d",
 		 file, line, key, code, additional_len);
 
 	return 8;
@@ -59,7 +60,8 @@ static int sense_info_build(uint8_t *data, int len, uint32_t not_init_funcs,
 	set_htonl(&data[12], completed_funcs);
 	set_htonll(&data[16], pid);
 	set_htonll(&data[24], oid);
-	osd_warning("  identification pid=%llx oid=%llx",pid, oid);
+	osd_rlog(OSD_LOG_WARNING, "  identification pid=%llx oid=%llx",
+		 llu(pid), llu(oid));
 	return 32;
 }
 
@@ -73,7 +75,8 @@ static int sense_csi_build(uint8_t *data, int len, uint64_t csi)
 	data[0] = 0x1;
 	data[1] = 0xa;
 	set_htonll(&data[4], csi);
-	osd_warning("  command-specific information=%llx",csi);
+	osd_rlog(OSD_LOG_WARNING, "  command-specific information=%llx",
+		 llu(csi));
 	return 12;
 }
 
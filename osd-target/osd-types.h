@@ -59,6 +59,7 @@ struct multiobj_list_entry {
 	uint64_t oid;
 	uint32_t page;
 	uint32_t number;
+	uint8_t reserved[6];
 	uint16_t len;
 	void *val;
 } __attribute__((packed));
@@ -167,6 +168,18 @@ struct id_list {
 struct coll_tab;
 struct obj_tab;
 struct attr_tab;
+struct db_lazy;
+struct sqlprof;
+struct job_context;
+struct intent_log;
+struct oinfo_cache;
+struct part_table;
+struct arena;
+struct outbuf_pool;
+struct fd_cache;
+struct async_queue;
+struct lat_stats;
+struct atomics_table;
 
 /* 
  * Encapsulate all db structs in db context. each db context is handled by an
@@ -177,6 +190,9 @@ struct db_context {
 	struct coll_tab *coll;
 	struct obj_tab *obj;
 	struct attr_tab *attr;
+	struct db_lazy *lazy;   /* statements not prepared yet */
+	int txn_depth;          /* nesting of db_begin_txn */
+	struct sqlprof *prof;   /* statement profile, if on */
 };
 
 /*
@@ -198,6 +214,18 @@ struct osd_device {
 	struct cur_cmd_attr_pg ccap;
 	struct id_cache ic;
 	struct id_list idl;
+	struct job_context *jc;
+	struct intent_log *il;
+	struct oinfo_cache *oc;
+	struct part_table *pt;
+	struct arena *arena;
+	struct outbuf_pool *op;
+	struct fd_cache *fdc;      /* only while a batch runs */
+	struct async_queue *aq;
+	struct lat_stats *lat;
+	struct atomics_table *at;  /* read without the device lock */
+	struct track_table *tt;
+	struct sec_table *st;
 };
 
 enum {
@@ -23,7 +23,6 @@
 #include <unistd.h>
 #include <fcntl.h>
 #include <sys/stat.h>
-#include <sys/statfs.h>
 #include <sys/types.h>
 #include <dirent.h>
 #include <assert.h>
@@ -41,6 +40,18 @@
 #include "osd-util/osd-sense.h"
 #include "list-entry.h"
 #include "tracking.h"
+#include "job.h"
+#include "intent.h"
+#include "oinfo.h"
+#include "part.h"
+#include "arena.h"
+#include "outbuf.h"
+#include "fdcache.h"
+#include "async.h"
+#include "lat.h"
+#include "atomics.h"
+#include "sec.h"
+#include "probe.h"
 
 #define min(x,y) ({ \
 	typeof(x) _x = (x);	\
@@ -92,6 +103,9 @@ static const char *md = "md";
 static const char *dbname = "osd.db";
 static const char *dfiles = "dfiles";
 static const char *stranded = "stranded";
+static const char *layout = ".layout"; /* in dfiles, once subdirs exist */
+static const char *intentlog = "intent.log";
+static const char *acctclean = "acct.clean";
 
 static inline uint8_t get_obj_type(struct osd_device *osd,
 				   uint64_t pid, uint64_t oid)
@@ -211,40 +225,7 @@ static int create_dir(const char *dirname)
 	return 0;
 }
 
-/* This function recursively empties the directories */
-static int empty_dir(const char *dirname)
-{
-	int ret = 0;
-	char path[MAXNAMELEN];
-	DIR *dir = NULL;
-	struct dirent *ent = NULL;
-
-	if ((dir = opendir(dirname)) == NULL)
-		return -1;
-
-	while ((ent = readdir(dir)) != NULL) {
-		if (!strcmp(ent->d_name, ".") || !strcmp(ent->d_name, ".."))
-			continue;
-		sprintf(path, "%s/%s", dirname, ent->d_name);
-		if (ent->d_type == DT_DIR) {
-			ret = empty_dir(path);
-		} else {
-			ret = unlink(path);
-		}
-		if (ret != 0)
-			return -1;
-	}
-
-	closedir(dir);
-
-	ret = rmdir(dirname);
-	if (ret != 0)
-		return -1;
-
-	return 0;
-}
-
-inline void get_dfile_name(char *path, const char *root,
+void get_dfile_name(char *path, const char *root,
 			   uint64_t pid, uint64_t oid)
 {
 #ifdef PVFS_OSD_INTEGRATED
@@ -274,6 +255,38 @@ inline void get_dfile_name(char *path, const char *root,
 #endif
 }
 
+/*
+ * Move a removed data file to the stranded directory, under a name with
+ * a sequence number since a recreated and removed (pid, oid) may still
+ * have a file there that was not reaped yet, from this run or an earlier
+ * one.  Replacing that would free its extents right here, so the
+ * sequence starts from the time and pid and a name in use is skipped.
+ * Where the filesystem cannot refuse to replace, that start has to do.
+ */
+static int move_to_stranded(const char *root, uint64_t pid, uint64_t oid,
+			    const char *path)
+{
+	int i;
+	char spath[MAXNAMELEN];
+	static uint32_t seq = 0;
+
+	if (seq == 0)
+		seq = (uint32_t) time(NULL) ^ ((uint32_t) getpid() << 16);
+
+	for (i = 0; i < 16; i++) {
+		sprintf(spath, "%s/%s/%llx.%llx.%x", root, stranded, llu(pid),
+			llu(oid), seq++);
+		if (renameat2(AT_FDCWD, path, AT_FDCWD, spath,
+			      RENAME_NOREPLACE) == 0)
+			return 0;
+		if (errno == EINVAL || errno == ENOSYS)
+			return rename(path, spath);
+		if (errno != EEXIST)
+			return -1;
+	}
+	return -1;
+}
+
 static inline void get_dbname(char *path, const char *root)
 {
 	sprintf(path, "%s/%s/%s", root, md, dbname);
@@ -426,8 +439,7 @@ static int get_utsap(struct osd_device *osd, uint64_t pid, uint64_t oid,
 {
 	int ret = 0;
 	uint8_t *cp = outbuf;
-	struct stat asb, dsb;
-	char path[MAXNAMELEN];
+	struct oinfo *oi;
 
 	assert(osd && outbuf && used_outlen);
 
@@ -445,40 +457,30 @@ static int get_utsap(struct osd_device *osd, uint64_t pid, uint64_t oid,
 	set_htonl(&cp[0], USER_TMSTMP_PG);
 	set_htonl(&cp[4], UTSAP_TOTAL_LEN - 8);
 
-	get_dfile_name(path, osd->root, pid, oid);
-	memset(&dsb, 0, sizeof(dsb));
-	ret = stat(path, &dsb);
-	if (ret != 0)
-		return OSD_ERROR;
-
-	/* XXX: not exactly accurate to stat the entire db for the
-	 * access/mod time of one object */
-	get_dbname(path, osd->root);
-	memset(&asb, 0, sizeof(asb));
-	ret = stat(path, &asb);
-	if (ret != 0)
+	oi = oinfo_get(osd, pid, oid, 0);
+	if (!oi)
 		return OSD_ERROR;
 
-	ret = set_hton_time(&cp[UTSAP_CTIME_OFF], dsb.st_ctime,
-			    dsb.st_ctim.tv_nsec);
+	ret = set_hton_time(&cp[UTSAP_CTIME_OFF], oi->ctime.tv_sec,
+			    oi->ctime.tv_nsec);
 	if (ret != OSD_OK)
 		return ret;
 
-	ret = set_hton_time(&cp[UTSAP_ATTR_ATIME_OFF], asb.st_atime,
-			    asb.st_atim.tv_nsec);
+	ret = set_hton_time(&cp[UTSAP_ATTR_ATIME_OFF], oi->attr_atime.tv_sec,
+			    oi->attr_atime.tv_nsec);
 	if (ret != OSD_OK)
 		return ret;
-	ret = set_hton_time(&cp[UTSAP_ATTR_MTIME_OFF], asb.st_mtime,
-			    asb.st_mtim.tv_nsec);
+	ret = set_hton_time(&cp[UTSAP_ATTR_MTIME_OFF], oi->attr_mtime.tv_sec,
+			    oi->attr_mtime.tv_nsec);
 	if (ret != OSD_OK)
 		return ret;
 
-	ret = set_hton_time(&cp[UTSAP_DATA_ATIME_OFF], dsb.st_atime,
-			    dsb.st_atim.tv_nsec);
+	ret = set_hton_time(&cp[UTSAP_DATA_ATIME_OFF], oi->atime.tv_sec,
+			    oi->atime.tv_nsec);
 	if (ret != OSD_OK)
 		return ret;
-	ret = set_hton_time(&cp[UTSAP_DATA_MTIME_OFF], dsb.st_mtime,
-			    dsb.st_mtim.tv_nsec);
+	ret = set_hton_time(&cp[UTSAP_DATA_MTIME_OFF], oi->mtime.tv_sec,
+			    oi->mtime.tv_nsec);
 	if (ret != OSD_OK)
 		return ret;
 
@@ -503,8 +505,7 @@ static int get_utsap_aslist(struct osd_device *osd, uint64_t pid, uint64_t oid,
 	void *val = NULL;
 	uint64_t time = 0;
 	char name[ATTR_PAGE_ID_LEN] = {'\0'};
-	char path[MAXNAMELEN];
-	struct stat sb;
+	struct oinfo *oi;
 
 	assert(osd && outbuf && used_outlen);
 
@@ -517,33 +518,28 @@ static int get_utsap_aslist(struct osd_device *osd, uint64_t pid, uint64_t oid,
 	case UTSAP_CTIME:
 	case UTSAP_DATA_MTIME:
 	case UTSAP_DATA_ATIME:
-		get_dfile_name(path, osd->root, pid, oid);
-		memset(&sb, 0, sizeof(sb));
-		ret = stat(path, &sb);
-		if (ret != 0)
-			return OSD_ERROR;
-		len = 6;
-		val = &time;
-		if (number == UTSAP_CTIME)
-			set_hton_time(val, sb.st_ctime, sb.st_ctim.tv_nsec);
-		else if (number == UTSAP_DATA_ATIME)
-			set_hton_time(val, sb.st_atime, sb.st_atim.tv_nsec);
-		else
-			set_hton_time(val, sb.st_mtime, sb.st_mtim.tv_nsec);
-		break;
 	case UTSAP_ATTR_ATIME:
 	case UTSAP_ATTR_MTIME:
-		get_dbname(path, osd->root);
-		memset(&sb, 0, sizeof(sb));
-		ret = stat(path, &sb);
-		if (ret != 0)
+		oi = oinfo_get(osd, pid, oid, 0);
+		if (!oi)
 			return OSD_ERROR;
 		len = 6;
 		val = &time;
-		if (number == UTSAP_ATTR_ATIME)
-			set_hton_time(val, sb.st_atime, sb.st_atim.tv_nsec);
+		if (number == UTSAP_CTIME)
+			set_hton_time(val, oi->ctime.tv_sec,
+				      oi->ctime.tv_nsec);
+		else if (number == UTSAP_DATA_ATIME)
+			set_hton_time(val, oi->atime.tv_sec,
+				      oi->atime.tv_nsec);
+		else if (number == UTSAP_DATA_MTIME)
+			set_hton_time(val, oi->mtime.tv_sec,
+				      oi->mtime.tv_nsec);
+		else if (number == UTSAP_ATTR_ATIME)
+			set_hton_time(val, oi->attr_atime.tv_sec,
+				      oi->attr_atime.tv_nsec);
 		else
-			set_hton_time(val, sb.st_mtime, sb.st_mtim.tv_nsec);
+			set_hton_time(val, oi->attr_mtime.tv_sec,
+				      oi->attr_mtime.tv_nsec);
 		break;
 	default:
 		return OSD_ERROR;
@@ -587,11 +583,9 @@ static int get_uiap(struct osd_device *osd, uint64_t pid, uint64_t oid,
 	void *val = NULL;
 	uint16_t len = 0;
 	char name[ATTR_PAGE_ID_LEN];
-	char path[MAXNAMELEN];
-	struct stat sb;
-	struct statfs sfs;
+	struct oinfo *oi;
+	struct part *p;
 	uint8_t ll[8];
-	off_t sz = 0;
 	uint64_t value;
 
 	switch (number) {
@@ -612,41 +606,49 @@ static int get_uiap(struct osd_device *osd, uint64_t pid, uint64_t oid,
 		break;
 	case UIAP_USED_CAPACITY:
 		len = UIAP_USED_CAPACITY_LEN;
-		get_dfile_name(path, osd->root, pid, oid);
 		if (!oid) {
-			ret = statfs(path, &sfs);
-			if (ret != 0)
+			p = part_get(osd, pid);
+			if (!p)
 				return OSD_ERROR;
 
-			sz = (sfs.f_blocks - sfs.f_bfree) * BLOCK_SZ;
+			value = p->used;
 		} else {
-			ret = stat(path, &sb);
-			if (ret != 0)
+			oi = oinfo_get(osd, pid, oid, 1);
+			if (!oi)
 				return OSD_ERROR;
 
-			sz = sb.st_blocks*BLOCK_SZ;
+			value = oi->alloc;
 		}
-		value = sz;
 		val = ll;
 		break;
 	case UIAP_LOGICAL_LEN:
 		len = UIAP_LOGICAL_LEN_LEN;
-		get_dfile_name(path, osd->root, pid, oid);
-		ret = stat(path, &sb);
-		if (ret != 0)
+		oi = oinfo_get(osd, pid, oid, 0);
+		if (!oi)
 			return OSD_ERROR;
-		value = sb.st_size;
+		value = oi->size;
+		val = ll;
+		break;
+	case PARTITION_NUMBER_OF_OBJECTS:
+		if (oid)
+			return OSD_ERROR;
+		len = UIAP_USED_CAPACITY_LEN;
+		p = part_get(osd, pid);
+		if (!p)
+			return OSD_ERROR;
+		value = p->objects;
 		val = ll;
 		break;
 	case PARTITION_CAPACITY_QUOTA:
 		len = UIAP_USED_CAPACITY_LEN;
-		get_dfile_name(path, osd->root, pid, oid);
-		ret = statfs(path, &sfs);
-		osd_debug("PARTITION_CAPACITY_QUOTA statfs(%s)=>%d size=0x%llx\n",
-			path, ret, llu(sfs.f_blocks));
-		if (ret != 0)
+		p = part_get(osd, pid);
+		if (!p)
 			return OSD_ERROR;
-		value = sfs.f_blocks * BLOCK_SZ;
+		/* without a quota the whole filesystem is available */
+		if (p->quota == PART_NO_QUOTA)
+			value = part_capacity(osd);
+		else
+			value = p->quota;
 		val = ll;
 		break;
 	case UIAP_USERNAME:
@@ -681,6 +683,117 @@ static int get_uiap(struct osd_device *osd, uint64_t pid, uint64_t oid,
 	return OSD_OK;
 }
 
+/*
+ * Partition accounting around a change to the data of a user object.
+ * size_check gets the current length and reserves the growth to end, or
+ * by end with append, within the partition quota; size_charge then
+ * charges whatever the length became and releases the reservation, on
+ * success and failure alike. An object that cannot be looked up is not
+ * accounted, the command fails by itself.
+ */
+#define SIZE_UNKNOWN ((uint64_t)-1)
+
+struct size_acct {
+	uint64_t size;	/* length to charge from, SIZE_UNKNOWN if none */
+	uint64_t rsv;	/* growth reserved in the partition */
+};
+
+static int size_check(struct osd_device *osd, uint64_t pid, uint64_t oid,
+		      uint64_t end, int append, struct size_acct *sa)
+{
+	int ret;
+	struct oinfo *oi;
+
+	sa->size = SIZE_UNKNOWN;
+	sa->rsv = 0;
+	if (!(pid >= USEROBJECT_PID_LB && oid >= USEROBJECT_OID_LB))
+		return OSD_OK;
+	oi = oinfo_get(osd, pid, oid, 0);
+	if (!oi)
+		return OSD_OK;
+
+	if (append)
+		end += oi->size;
+	if (end > oi->size) {
+		ret = part_reserve(osd, pid, end - oi->size);
+		if (ret != OSD_OK)
+			return ret;
+		sa->rsv = end - oi->size;
+	}
+	sa->size = oi->size;
+	return OSD_OK;
+}
+
+static void size_charge(struct osd_device *osd, uint64_t pid, uint64_t oid,
+			struct size_acct *sa)
+{
+	struct oinfo *oi;
+
+	if (sa->size == SIZE_UNKNOWN)
+		return;
+	oi = oinfo_get(osd, pid, oid, 0);
+	if (oi)
+		part_resized(osd, pid, oid, sa->size, oi->size);
+	part_release(osd, pid, sa->rsv);
+	sa->size = SIZE_UNKNOWN;
+	sa->rsv = 0;
+}
+
+/* the size to charge from, if it changed while the device lock was let go */
+static void size_again(struct osd_device *osd, uint64_t pid, uint64_t oid,
+		       struct size_acct *sa)
+{
+	struct oinfo *oi;
+
+	if (sa->size == SIZE_UNKNOWN)
+		return;
+	oi = oinfo_get(osd, pid, oid, 0);
+	if (oi)
+		sa->size = oi->size;
+	else
+		size_charge(osd, pid, oid, sa);
+}
+
+static int size_sense(int ret, uint64_t pid, uint64_t oid, uint8_t *sense)
+{
+	if (ret == -EDQUOT)
+		return sense_build_sdd(sense, OSD_SSK_DATA_PROTECTION,
+				       OSD_ASC_QUOTA_ERROR, pid, oid);
+	return sense_build_sdd(sense, OSD_SSK_HARDWARE_ERROR,
+			       OSD_ASC_INVALID_FIELD_IN_CDB, pid, oid);
+}
+
+/* bytes spanned by a vector transfer: stride, length, then the data */
+static uint64_t vec_extent(const uint8_t *buf, uint64_t len)
+{
+	uint64_t stride, length, bytes, n;
+
+	if (len <= 2 * sizeof(uint64_t))
+		return 0;
+	stride = get_ntohll(buf);
+	length = get_ntohll(buf + sizeof(uint64_t));
+	bytes = len - 2 * sizeof(uint64_t);
+	if (length == 0)
+		return 0;
+	n = (bytes + length - 1) / length;
+	return (n - 1) * stride + (bytes - (n - 1) * length);
+}
+
+/* bytes spanned by a scatter list: count, then offset/length pairs */
+static uint64_t sgl_extent(const uint8_t *buf)
+{
+	uint64_t i, pairs, end, extent = 0;
+
+	pairs = get_ntohll(buf);
+	for (i = 0; i < pairs; i++) {
+		end = get_ntohll(buf + (2*i + 1) * sizeof(uint64_t)) +
+		      get_ntohll(buf + (2*i + 2) * sizeof(uint64_t));
+		if (end > extent)
+			extent = end;
+	}
+	return extent;
+}
+
 /*
  * returns:
  * OSD_ERROR: in case of error
@@ -697,14 +810,18 @@ static int set_uiap(struct osd_device *osd, uint64_t pid, uint64_t oid,
 					UIAP_USERNAME, val, len);
 	case UIAP_LOGICAL_LEN: {
 		char path[MAXNAMELEN];
+		struct size_acct sa;
 		uint64_t len = get_ntohll((const uint8_t *)val);
 		get_dfile_name(path, osd->root, pid, oid);
 		osd_debug("%s: %s %llu\n", __func__, path, llu(len));
+		ret = size_check(osd, pid, oid, len, 0, &sa);
+		if (ret != OSD_OK)
+			return ret;
 		ret = truncate(path, len);
-		if (ret < 0)
-			return OSD_ERROR;
-		else
-			return OSD_OK;
+		if (ret == 0)
+			oinfo_resized(osd, pid, oid, len);
+		size_charge(osd, pid, oid, &sa);
+		return ret < 0 ? OSD_ERROR : OSD_OK;
 	}
 	default:
 		return OSD_ERROR;
@@ -795,7 +912,9 @@ static int get_riap(struct osd_device *osd, uint64_t pid, uint64_t oid,
 		val = ll;
 		break;
 	case RIAP_NUMBER_OF_PARTITIONS:
-		ret = obj_pcount(osd->dbc, &pcount);
+		ret = part_count(osd, &pcount);
+		if (ret != OSD_OK)
+			return OSD_ERROR;
 		len = RIAP_NUMBER_OF_PARTITIONS_LEN;
 		set_htonll(ll, pcount);
 		val = ll;
@@ -836,6 +955,132 @@ static int get_riap(struct osd_device *osd, uint64_t pid, uint64_t oid,
 	return OSD_OK;
 }
 
+/*
+ * Counters of this osd_device since osd_open. The "last command" values
+ * are those of the command before the one reading them.
+ */
+static int get_rstats(struct osd_device *osd, uint64_t pid, uint64_t oid,
+		      uint32_t page, uint32_t number, void *outbuf,
+		      uint64_t outlen, uint8_t listfmt, uint32_t *used_outlen)
+{
+	int ret = 0;
+	const void *val = NULL;
+	uint16_t len = RSTATS_LEN;
+	char name[ATTR_PAGE_ID_LEN];
+	uint8_t ll[8];
+	uint64_t hits, misses;
+	struct arena *a = osd->arena;
+
+	switch (number) {
+	case 0:
+		len = ATTR_PAGE_ID_LEN;
+		memset(name, 0, sizeof(name));
+		sprintf(name, "OSC     OSDEMU Statistics");
+		val = name;
+		break;
+	case RSTATS_COMMANDS:
+		set_htonll(ll, a->commands);
+		break;
+	case RSTATS_ARENA_ALLOCS:
+		set_htonll(ll, a->last_nalloc);
+		break;
+	case RSTATS_ARENA_BYTES:
+		set_htonll(ll, a->last_bytes);
+		break;
+	case RSTATS_ARENA_MAX_ALLOCS:
+		set_htonll(ll, a->max_nalloc);
+		break;
+	case RSTATS_ARENA_MAX_BYTES:
+		set_htonll(ll, a->max_bytes);
+		break;
+	case RSTATS_ARENA_TOTAL_ALLOCS:
+		set_htonll(ll, a->total_nalloc);
+		break;
+	case RSTATS_ARENA_MALLOCS:
+		set_htonll(ll, a->mallocs);
+		break;
+	case RSTATS_OUTBUF_HITS:
+		outbuf_stats(osd, &hits, &misses);
+		set_htonll(ll, hits);
+		break;
+	case RSTATS_OUTBUF_MISSES:
+		outbuf_stats(osd, &hits, &misses);
+		set_htonll(ll, misses);
+		break;
+	case RSTATS_CAP_HITS:
+		sec_stats(osd, &hits, &misses);
+		set_htonll(ll, hits);
+		break;
+	case RSTATS_CAP_MISSES:
+		sec_stats(osd, &hits, &misses);
+		set_htonll(ll, misses);
+		break;
+	default:
+		return -ENOENT;
+	}
+	if (!val)
+		val = ll;
+
+	if (listfmt == RTRVD_SET_ATTR_LIST)
+		ret = le_pack_attr(outbuf, outlen, page, number, len, val);
+	else if (listfmt == RTRVD_MULTIOBJ_LIST)
+		ret = le_multiobj_pack_attr(outbuf, outlen, oid, page, number,
+					    len, val);
+	else
+		return OSD_ERROR;
+
+	assert(ret == -EINVAL || ret == -EOVERFLOW || ret > 0);
+	if (ret == -EOVERFLOW)
+		*used_outlen = 0;
+	else if (ret > 0)
+		*used_outlen = ret;
+	else
+		return ret;
+
+	return OSD_OK;
+}
+
+static int get_rlat(struct osd_device *osd, uint64_t pid, uint64_t oid,
+		    uint32_t page, uint32_t number, void *outbuf,
+		    uint64_t outlen, uint8_t listfmt, uint32_t *used_outlen)
+{
+	int ret = 0;
+	const void *val;
+	uint16_t len = RLAT_LEN;
+	char name[ATTR_PAGE_ID_LEN];
+	uint8_t hist[RLAT_LEN];
+
+	if (number == 0) {
+		len = ATTR_PAGE_ID_LEN;
+		memset(name, 0, sizeof(name));
+		sprintf(name, "OSC     OSDEMU Latency");
+		val = name;
+	} else {
+		ret = lat_get(osd, number, hist);
+		if (ret != OSD_OK)
+			return ret;
+		val = hist;
+	}
+
+	if (listfmt == RTRVD_SET_ATTR_LIST)
+		ret = le_pack_attr(outbuf, outlen, page, number, len, val);
+	else if (listfmt == RTRVD_MULTIOBJ_LIST)
+		ret = le_multiobj_pack_attr(outbuf, outlen, oid, page, number,
+					    len, val);
+	else
+		return OSD_ERROR;
+
+	assert(ret == -EINVAL || ret == -EOVERFLOW || ret > 0);
+	if (ret == -EOVERFLOW)
+		*used_outlen = 0;
+	else if (ret > 0)
+		*used_outlen = ret;
+	else
+		return ret;
+
+	return OSD_OK;
+}
+
 static int set_riap(struct osd_device *osd, uint64_t pid, uint64_t oid,
 		    uint32_t number, const void *val, uint16_t len)
 {
@@ -1103,23 +1348,83 @@ void osd_device_free(struct osd_device *osd)
 	free(osd);
 }
 
-int osd_open(const char *root, struct osd_device *osd)
+static int osd_create_datafile(struct osd_device *osd, uint64_t pid,
+			       uint64_t oid);
+
+/*
+ * Intent log replay. A CREATE that completed or was cut short takes the
+ * db as the truth: a row gets its data file back, a data file without a
+ * row goes. The END record is not synced, so a CREATE that was
+ * acknowledged may look cut short. A CREATE that failed is undone. A
+ * REMOVE is always finished, it may have gotten as far as moving the data
+ * file away.
+ */
+static int intent_fix(struct osd_device *osd, const struct intent *in)
 {
-	int i = 0;
 	int ret = 0;
+	uint64_t oid = 0;
+	uint8_t type = ILLEGAL_OBJ;
 	char path[MAXNAMELEN];
-	char *argv[] = { strdup("osd-target"), NULL };
 
-	osd_set_progname(1, argv);  /* for debug messages from libosdutil */
-	mhz = get_mhz(); /* XXX: find a better way of profiling */
+	if (in->pid < USEROBJECT_PID_LB || in->oid < USEROBJECT_OID_LB)
+		return OSD_OK;
 
-	if (strlen(root) > MAXROOTLEN) {
-		osd_error("strlen(%s) > MAXROOTLEN", root);
-		ret = -ENAMETOOLONG;
+	for (oid = in->oid; oid < in->oid + in->num; oid++) {
+		ret = obj_get_type(osd->dbc, in->pid, oid, &type, NULL);
+		if (ret != OSD_OK)
+			return ret;
+		if (type != ILLEGAL_OBJ && type != USEROBJECT)
+			continue; /* not ours to touch */
+
+		if (in->op == INTENT_CREATE &&
+		    in->state != INTENT_DONE_FAILED && type == USEROBJECT) {
+			ret = osd_create_datafile(osd, in->pid, oid);
+			if (ret != 0 && ret != -EEXIST)
+				return OSD_ERROR;
+			continue;
+		}
+
+		if (type == USEROBJECT) {
+			ret = attr_delete_all(osd->dbc, in->pid, oid);
+			if (ret == OSD_OK)
+				ret = coll_delete_oid(osd->dbc, in->pid, oid);
+			if (ret == OSD_OK)
+				ret = obj_delete(osd->dbc, in->pid, oid);
+			if (ret != OSD_OK)
+				return ret;
+		}
+		get_dfile_name(path, osd->root, in->pid, oid);
+		if (unlink(path) != 0 && errno != ENOENT)
+			return OSD_ERROR;
+		oinfo_forget(osd, in->pid, oid);
+	}
+	return OSD_OK;
+}
+
+static int set_members_resume(struct osd_device *osd);
+
+/*
+ * The db, its caches and the background work under root.  The per
+ * command arena and timings, the transport's buffers and the async
+ * workers are not part of it: FORMAT OSD closes and opens the store
+ * while those stay.
+ */
+static int store_open(const char *root, struct osd_device *osd)
+{
+	int i = 0;
+	int ret = 0;
+	char path[MAXNAMELEN];
+	struct stat sb;
+
+	ret = job_init(osd);
+	if (ret != 0) {
+		osd_error("!job_init");
 		goto out;
 	}
 
-	memset(osd, 0, sizeof(*osd));
+	ret = tracking_init(osd);
+	if (ret != 0)
+		goto out;
 
 	/* test if root exists and is a directory */
 	ret = create_dir(root);
@@ -1137,14 +1442,30 @@ int osd_open(const char *root, struct osd_device *osd)
 	}
 
 #ifndef __PANASAS_OSD__
-	/* to prevent fan-out create 256 subdirs under dfiles */
-	for (i = 0; i < 256; i++) {
-		sprintf(path, "%s/%s/%02x/", root, dfiles, i);
-		ret = create_dir(path);
-		if (ret != 0) {
-			osd_error("!create_dir_256(%s)", path);
+	/*
+	 * to prevent fan-out create 256 subdirs under dfiles. The layout
+	 * marker is written once they all exist, so that a restart does not
+	 * have to check each of them. FORMAT OSD moves it away with dfiles.
+	 */
+	sprintf(path, "%s/%s/%s", root, dfiles, layout);
+	if (stat(path, &sb) != 0) {
+		for (i = 0; i < 256; i++) {
+			sprintf(path, "%s/%s/%02x/", root, dfiles, i);
+			ret = create_dir(path);
+			if (ret != 0) {
+				osd_error("!create_dir_256(%s)", path);
+				goto out;
+			}
+		}
+		sprintf(path, "%s/%s/%s", root, dfiles, layout);
+		ret = open(path, O_CREAT|O_WRONLY, 0600);
+		if (ret < 0) {
+			ret = -errno;
+			osd_error("!create_layout(%s)", path);
 			goto out;
 		}
+		close(ret);
+		ret = 0;
 	}
 #endif
 
@@ -1156,6 +1477,13 @@ int osd_open(const char *root, struct osd_device *osd)
 		goto out;
 	}
 
+	/* removed data files are unlinked in background, sweep leftovers */
+	ret = job_reaper_start(osd, path);
+	if (ret != 0) {
+		osd_error("!job_reaper_start(%s)", path);
+		goto out;
+	}
+
 	/* create 'md' sub-directory */
 	sprintf(path, "%s/%s/", root, md);
 	ret = create_dir(path);
@@ -1172,6 +1500,10 @@ int osd_open(const char *root, struct osd_device *osd)
 	}
 	get_dbname(path, root);
 
+	ret = oinfo_init(osd, path);
+	if (ret != 0)
+		goto out;
+
 	/* auto-creates db if necessary, and sets osd->dbc */
 	ret = osd_db_open(path, osd);
 	if (ret != 0 && ret != 1) {
@@ -1186,11 +1518,63 @@ int osd_open(const char *root, struct osd_device *osd)
 		}
 	}
 	ret = db_exec_pragma(osd->dbc);
-out:
 	if (ret != 0)
-		osd_error("!db_exec_pragma => %d", ret);
+		goto out;
 
-	return ret;
+	/* repair whatever was half done when we went down */
+	sprintf(path, "%s/%s/%s", root, md, intentlog);
+	ret = intent_open(osd, path, intent_fix);
+	if (ret != 0)
+		goto out;
+
+	sprintf(path, "%s/%s/%s", root, md, acctclean);
+	ret = part_init(osd, path);
+	if (ret != 0)
+		goto out;
+
+	ret = sec_init(osd);
+	if (ret != 0)
+		goto out;
+
+	ret = atomics_init(osd);
+	if (ret != 0)
+		goto out;
+
+	/* what a crash cut short goes on in background */
+	ret = set_members_resume(osd);
+out:
+	if (ret != 0)
+		osd_error("%s: %s => %d", __func__, root, ret);
+
+	return ret;
+}
+
+int osd_open(const char *root, struct osd_device *osd)
+{
+	int ret = 0;
+	static char progname[] = "osd-target";
+	char *argv[] = { progname, NULL };
+
+	/* for debug messages from libosdutil, also looks up mhz */
+	if (mhz < 0)
+		osd_set_progname(1, argv);
+
+	if (strlen(root) > MAXROOTLEN) {
+		osd_error("strlen(%s) > MAXROOTLEN", root);
+		return -ENAMETOOLONG;
+	}
+
+	memset(osd, 0, sizeof(*osd));
+
+	ret = arena_init(osd);
+	if (ret != 0)
+		return ret;
+
+	ret = lat_init(osd);
+	if (ret != 0)
+		return ret;
+
+	return store_open(root, osd);
 }
 
 int osd_set_name(struct osd_device *osd, char *osdname)
@@ -1209,18 +1593,85 @@ int osd_set_name(struct osd_device *osd, char *osdname)
         return ret;
 }
 
-int osd_close(struct osd_device *osd)
+/*
+ * The master key, agreed on with the security manager out of band, since
+ * SET MASTER KEY is not implemented.
+ */
+int osd_set_master(struct osd_device *osd, const uint8_t *key)
+{
+	int ret = 0;
+
+	ret = sec_set_master(osd, key);
+	if (ret != OSD_OK)
+		osd_error("!sec_set_master => %d", ret);
+	return ret;
+}
+
+static int store_close(struct osd_device *osd)
 {
 	int ret;
 
+	job_fini(osd); /* finish background work while the db is open */
+	tracking_fini(osd);
+	atomics_fini(osd);
+	sec_fini(osd);
+	oinfo_fini(osd);
+	part_flush(osd);
 	ret = osd_db_close(osd);
 	if (ret != 0)
 		osd_error("%s: osd_db_close", __func__);
+	intent_close(osd); /* db changes are on disk, drop the log */
+	part_fini(osd);
 	free(osd->root);
 	osd->root = NULL;
 	return ret;
 }
 
+int osd_close(struct osd_device *osd)
+{
+	int ret;
+
+	async_fini(osd); /* commands in flight complete first */
+	ret = store_close(osd);
+	arena_fini(osd);
+	lat_fini(osd);
+	outbuf_fini(osd);
+	return ret;
+}
+
+#define WARMUP_BATCH 4096
+
+static int warmup_step(struct osd_device *osd, struct job *job)
+{
+	int ret = 0;
+	uint32_t count = 0;
+
+	ret = obj_prefetch(osd->dbc, &job->pos, WARMUP_BATCH, &count);
+	if (ret != OSD_OK)
+		return ret;
+	return count == WARMUP_BATCH ? OSD_REPEAT : OSD_OK;
+}
+
+/*
+ * Optional, after osd_open: start reading the db file ahead and walk the
+ * obj table in the background, so the first commands after a restart do
+ * not each wait for cold pages.
+ */
+int osd_warmup(struct osd_device *osd)
+{
+	int fd;
+	char path[MAXNAMELEN];
+
+	get_dbname(path, osd->root);
+	fd = open(path, O_RDONLY);
+	if (fd >= 0) {
+		posix_fadvise(fd, 0, 0, POSIX_FADV_WILLNEED);
+		close(fd);
+	}
+
+	return job_submit(osd, 0, 0, NULL, warmup_step);
+}
+
 int osd_begin_txn(struct osd_device *osd)
 {
 	return db_begin_txn(osd->dbc);
@@ -1278,7 +1729,8 @@ static int contig_append(struct osd_device *osd, uint64_t pid, uint64_t oid,
 		goto out_cdb_err;
 
 	get_dfile_name(path, osd->root, pid, oid);
-	fd = open(path, O_WRONLY|O_LARGEFILE); /* fails on non-existent obj */
+	/* fails on non-existent obj */
+	fd = fdcache_open(osd, path, pid, oid, O_WRONLY|O_LARGEFILE);
 	if (fd < 0)
 		goto out_cdb_err;
 
@@ -1288,13 +1740,15 @@ static int contig_append(struct osd_device *osd, uint64_t pid, uint64_t oid,
 		goto out_hw_err;
 
 	ret = pwrite(fd, appenddata, len, off);
+	PROBE5(data_write, pid, oid, off, len, ret);
 	if (ret < 0 || (uint64_t) ret != len)
 		goto out_hw_err;
 
-	ret = close(fd);
+	ret = fdcache_close(osd, pid, oid, fd);
 	if (ret != 0)
 		goto out_hw_err;
 
+	oinfo_wrote(osd, pid, oid, off + len);
 	fill_ccap(&osd->ccap, NULL, USEROBJECT, pid, oid, off);
 	return OSD_OK; /* success */
 
@@ -1337,7 +1791,8 @@ static int sgl_append(struct osd_device *osd, uint64_t pid, uint64_t oid,
 		goto out_cdb_err;
 
 	get_dfile_name(path, osd->root, pid, oid);
-	fd = open(path, O_WRONLY|O_LARGEFILE); /* fails on non-existent obj */
+	/* fails on non-existent obj */
+	fd = fdcache_open(osd, path, pid, oid, O_WRONLY|O_LARGEFILE);
 	if (fd < 0)
 		goto out_cdb_err;
 
@@ -1362,16 +1817,18 @@ static int sgl_append(struct osd_device *osd, uint64_t pid, uint64_t oid,
 
 		osd_debug("%s: ------------------------------", __func__);
 		ret = pwrite(fd, appenddata+data_offset, length, offset_val+off);
+		PROBE5(data_write, pid, oid, offset_val+off, length, ret);
 		data_offset += length;
 		osd_debug("%s: return value is %d", __func__, ret);
 		if (ret < 0 || (uint64_t)ret != length)
 			goto out_hw_err;
 	}
 
-	ret = close(fd);
+	ret = fdcache_close(osd, pid, oid, fd);
 	if (ret != 0)
 		goto out_hw_err;
 
+	oinfo_forget(osd, pid, oid); /* scattered, stat again */
 	fill_ccap(&osd->ccap, NULL, USEROBJECT, pid, oid, off);
 	return OSD_OK; /* success */
 
@@ -1412,7 +1869,8 @@ static int vec_append(struct osd_device *osd, uint64_t pid, uint64_t oid,
 		goto out_cdb_err;
 
 	get_dfile_name(path, osd->root, pid, oid);
-	fd = open(path, O_WRONLY|O_LARGEFILE); /* fails on non-existent obj */
+	/* fails on non-existent obj */
+	fd = fdcache_open(osd, path, pid, oid, O_WRONLY|O_LARGEFILE);
 	if (fd < 0)
 		goto out_cdb_err;
 
@@ -1433,6 +1891,7 @@ static int vec_append(struct osd_device *osd, uint64_t pid, uint64_t oid,
 		osd_debug("%s: Offset: %llu", __func__, llu(offset_val + off));
 		osd_debug("%s: ------------------------------", __func__);
 		ret = pwrite(fd, appenddata+data_offset, length, offset_val+off);
+		PROBE5(data_write, pid, oid, offset_val+off, length, ret);
 		if (ret < 0 || (uint64_t)ret != length)
 			goto out_hw_err;
 		data_offset += length;
@@ -1444,10 +1903,11 @@ static int vec_append(struct osd_device *osd, uint64_t pid, uint64_t oid,
 			  llu(bytes));
 	}
 
-	ret = close(fd);
+	ret = fdcache_close(osd, pid, oid, fd);
 	if (ret != 0)
 		goto out_hw_err;
 
+	oinfo_forget(osd, pid, oid); /* scattered, stat again */
 	fill_ccap(&osd->ccap, NULL, USEROBJECT, pid, oid, off);
 	return OSD_OK; /* success */
 
@@ -1466,27 +1926,56 @@ int osd_append(struct osd_device *osd, uint64_t pid, uint64_t oid,
 	       uint64_t len, const uint8_t *appenddata, uint32_t cdb_cont_len, 
 	       uint8_t *sense, uint8_t ddt)
 {
+	int ret;
+	struct size_acct sa;
+	uint64_t grow;
+	uint64_t t;
+
 	/*figure out what kind of write it is based on ddt and call appropriate
 	write function*/
 
+	switch(ddt) {
+		case DDT_CONTIG:
+			grow = len;
+			break;
+		case DDT_SGL:
+			grow = sgl_extent(appenddata+cdb_cont_len);
+			break;
+		case DDT_VEC:
+			grow = vec_extent(appenddata, len);
+			break;
+		default: {
+			return sense_build_sdd(sense, OSD_SSK_ILLEGAL_REQUEST,
+			               OSD_ASC_INVALID_FIELD_IN_CDB, pid, oid);
+		}
+	}
+
+	ret = size_check(osd, pid, oid, grow, 1, &sa);
+	if (ret != OSD_OK)
+		return size_sense(ret, pid, oid, sense);
+
+	t = lat_now();
 	switch(ddt) {
 		case DDT_CONTIG: {
-			return contig_append(osd, pid, oid, len,
-					     appenddata+cdb_cont_len, sense);
+			ret = contig_append(osd, pid, oid, len,
+					    appenddata+cdb_cont_len, sense);
+			break;
 		}
 		case DDT_SGL: {
-			return sgl_append(osd, pid, oid, len,
-					  appenddata+cdb_cont_len, sense);
-		}
-		case DDT_VEC: {
-			return vec_append(osd, pid, oid, len, appenddata, 
-					  sense);
+			ret = sgl_append(osd, pid, oid, len,
+					 appenddata+cdb_cont_len, sense);
+			break;
 		}
 		default: {
-			return sense_build_sdd(sense, OSD_SSK_ILLEGAL_REQUEST,
-			               OSD_ASC_INVALID_FIELD_IN_CDB, pid, oid);
+			ret = vec_append(osd, pid, oid, len, appenddata, 
+					 sense);
+			break;
 		}
 	}
+	lat_add(osd, RLAT_DATA, t);
+
+	size_charge(osd, pid, oid, &sa);
+	return ret;
 }
 
 
@@ -1514,6 +2003,8 @@ static int osd_create_datafile(struct osd_device *osd, uint64_t pid,
 		if (ret <= 0)
 			return ret;
 		close(ret);
+		oinfo_forget(osd, pid, oid);
+		fdcache_forget(osd, pid, oid);
 	} else {
 		return ret;
 	}
@@ -1566,6 +2057,7 @@ int osd_clear(struct osd_device *osd, uint64_t pid, uint64_t oid,
 {
 	int ret;
 	int fd=-1;
+	struct size_acct sa = { SIZE_UNKNOWN, 0 };
 	char path[MAXNAMELEN];
 	char *dinbuf;
 	dinbuf = calloc(len, sizeof(char));
@@ -1581,6 +2073,12 @@ int osd_clear(struct osd_device *osd, uint64_t pid, uint64_t oid,
 	if (!(pid >= USEROBJECT_PID_LB && oid >= USEROBJECT_OID_LB))
 	        goto out_cdb_err;
 
+	ret = size_check(osd, pid, oid, offset + len, 0, &sa);
+	if (ret != OSD_OK) {
+		free(dinbuf);
+		return size_sense(ret, pid, oid, sense);
+	}
+
 	get_dfile_name(path, osd->root, pid, oid);
 	
 	fd = open(path, O_RDWR|O_LARGEFILE); /* fails on non-existent obj */
@@ -1589,6 +2087,7 @@ int osd_clear(struct osd_device *osd, uint64_t pid, uint64_t oid,
 		goto out_cdb_err;
 
 	ret = pwrite(fd, dinbuf, len, offset); /* writing null characters to file */
+	PROBE5(data_write, pid, oid, offset, len, ret);
 
 	if (ret < 0 || (uint64_t)ret != len)
 		goto out_hw_err;
@@ -1597,6 +2096,8 @@ int osd_clear(struct osd_device *osd, uint64_t pid, uint64_t oid,
 	if (ret != 0)
 		goto out_hw_err;
 	        
+	oinfo_wrote(osd, pid, oid, offset + len);
+	size_charge(osd, pid, oid, &sa);
 	fill_ccap(&osd->ccap, NULL, USEROBJECT, pid, oid, 0);
 
 	free(dinbuf);
@@ -1604,6 +2105,7 @@ int osd_clear(struct osd_device *osd, uint64_t pid, uint64_t oid,
 	return OSD_OK; /* success */
 
 out_hw_err:
+	size_charge(osd, pid, oid, &sa);
 	ret = sense_build_sdd(sense, OSD_SSK_HARDWARE_ERROR,
 		     OSD_ASC_INVALID_FIELD_IN_CDB, pid, oid);
 	if(fd >= 0) 
@@ -1613,6 +2115,7 @@ out_hw_err:
 	return ret;
 
 out_cdb_err:
+	size_charge(osd, pid, oid, &sa);
 	ret = sense_build_sdd(sense, OSD_SSK_ILLEGAL_REQUEST,
 		     OSD_ASC_INVALID_FIELD_IN_CDB, pid, oid);
 	free(dinbuf);
@@ -1718,6 +2221,7 @@ int osd_create(struct osd_device *osd, uint64_t pid, uint64_t requested_oid,
 	int present = 0;
 	uint64_t i = 0;
 	uint64_t oid = 0;
+	uint64_t seq = 0;
 
 	TICK_TRACE(osd_create);
 	osd_debug("%s: pid %llu requested oid %llu numoid %hu", __func__,
@@ -1771,6 +2275,8 @@ int osd_create(struct osd_device *osd, uint64_t pid, uint64_t requested_oid,
 	if (numoid == 0)
 		numoid = 1; /* create atleast one object */
 
+	seq = intent_begin(osd, INTENT_CREATE, pid, oid, numoid);
+
 	for (i = oid; i < (oid + numoid); i++) {
 		ret = obj_insert(osd->dbc, pid, i, USEROBJECT, -1);
 		if (ret != 0) {
@@ -1785,6 +2291,7 @@ int osd_create(struct osd_device *osd, uint64_t pid, uint64_t requested_oid,
 			osd_remove_tmp_objects(osd, pid, oid, i, sense, cdb_cont_len);
 			goto out_hw_err;
 		}
+		part_objects(osd, pid, i, 1);
 
 #if 0
 		ret = osd_init_attr(osd, pid, i);
@@ -1802,6 +2309,7 @@ int osd_create(struct osd_device *osd, uint64_t pid, uint64_t requested_oid,
 
 	/* fill CCAP with highest oid, osd2r00 Sec 6.3, 3rd last para */
 	fill_ccap(&osd->ccap, NULL, USEROBJECT, pid, (oid+numoid-1), 0);
+	intent_end(osd, seq, OSD_OK);
 	TICK_TRACE(osd_create);
 	return OSD_OK; /* success */
 
@@ -1811,6 +2319,7 @@ out_illegal_req:
 			       pid, requested_oid);
 
 out_hw_err:
+	intent_end(osd, seq, OSD_ERROR);
 	osd->ic.cur_pid = osd->ic.next_id = 0; /* invalidate cache */
 	return sense_build_sdd(sense, OSD_SSK_HARDWARE_ERROR,
 			       OSD_ASC_INVALID_FIELD_IN_CDB,
@@ -1828,18 +2337,25 @@ int osd_create_and_write(struct osd_device *osd, uint64_t pid,
 			 uint8_t *sense, uint8_t ddt)
 {
 	int ret;
+	uint64_t seq;
+
+	/* one intent for both steps, the inner ones are not logged */
+	seq = intent_begin(osd, INTENT_CREATE, pid, oid, 1);
 
 	ret = osd_create(osd, pid, oid, 1, cdb_cont_len, sense);
 	if (ret) {
+		intent_end(osd, seq, ret);
 		return ret;
 	}
 
 	ret = osd_write(osd, pid, oid, len, offset, data, sglist, sense, ddt);
 	if (ret) {
 	        osd_remove(osd, pid, oid, cdb_cont_len, sense);
+		intent_end(osd, seq, ret);
 		return ret;
 	}
 
+	intent_end(osd, seq, ret);
 	return ret;
 
 }
@@ -1957,6 +2473,7 @@ int osd_create_partition(struct osd_device *osd, uint64_t requested_pid,
 	ret = obj_insert(osd->dbc, pid, PARTITION_OID, PARTITION, -1);
 	if (ret)
 		goto out_cdb_err;
+	part_created(osd, pid);
 
 	fill_ccap(&osd->ccap, NULL, PARTITION, pid, PARTITION_OID, 0);
 	return OSD_OK; /* success */
@@ -2026,7 +2543,6 @@ int osd_create_user_tracking_collection(struct osd_device *osd, uint64_t pid,
 	/* Checking validity of the source collection */
 	if (source_cid != 0) {
 		uint8_t obj_type, coll_type;
-		struct ctp* ctp;
 
 		ret = obj_get_type(osd->dbc, pid, source_cid,
 				   &obj_type, &coll_type);
@@ -2036,8 +2552,7 @@ int osd_create_user_tracking_collection(struct osd_device *osd, uint64_t pid,
 		     coll_type != CIAP_SPONTANEOUS_COLLECTION_TYPE))
 			goto out_cdb_err;
 
-		ctp = find_ctp(pid, cid);
-		if (ctp && ctp->status != 0x0000)
+		if (ctp_status(osd, pid, cid) != 0)
 			goto out_cdb_err;
 	}
 
@@ -2103,7 +2618,8 @@ int osd_flush(struct osd_device *osd, uint64_t pid, uint64_t oid,
 {
 	char path[MAXNAMELEN];
 	int ret, fd=-1;
-	struct stat sb;
+	struct oinfo *oi;
+	uint64_t size;
 	
 	osd_debug("%s: pid %llu oid %llu scope %d", __func__, llu(pid),
 		  llu(oid), flush_scope);
@@ -2127,19 +2643,20 @@ int osd_flush(struct osd_device *osd, uint64_t pid, uint64_t oid,
 
 	else if (flush_scope == 2) {  /* flush user object data range & attributes */
                 
-	        ret = stat(path, &sb);
-		if(ret) {
+	        oi = oinfo_get(osd, pid, oid, 0);
+		if(oi == NULL) {
 		        close(fd);
 		        return OSD_ERROR;
 		}
+		size = oi->size;
 	
 	        /* Offset beyond user object length */
-	        if(offset > (uint64_t)sb.st_size)
+	        if(offset > size)
 	                goto out_cdb_err; 
 	  
 	        /* Designated bytes beyond object length, only flush bytes within length */
-		else if(len > ((uint64_t)sb.st_size - offset)) {
-		        ret = sync_file_range(fd, offset, sb.st_size - offset, 0);
+		else if(len > (size - offset)) {
+		        ret = sync_file_range(fd, offset, size - offset, 0);
 			if (ret)
 			        goto out_hw_err;
 			/* flush attribute to be implemented */
@@ -2210,12 +2727,23 @@ int osd_flush_partition(struct osd_device *osd, uint64_t pid, int flush_scope,
 /*
  * Destroy the db and start over again.
  */
+/*
+ * Old metadata and data trees are renamed into a directory under
+ * stranded-files, which is O(1), and a fresh OSD is created at once. The
+ * reaper started by osd_open deletes the old trees at a bounded rate.
+ *
+ * md goes first: should we crash halfway, a fresh db with stale data files
+ * is harmless since create truncates, an old db without its data is not.
+ */
 int osd_format_osd(struct osd_device *osd, uint64_t capacity, uint32_t cdb_cont_len, uint8_t *sense)
 {
 	int ret;
 	char *root = NULL;
 	char path[MAXNAMELEN];
+	char trash[MAXNAMELEN];
+	char dest[MAXNAMELEN];
 	struct stat sb;
+	struct atomics_table *at;
 
 	osd_debug("%s: capacity %llu MB", __func__, llu(capacity >> 20));
 
@@ -2223,6 +2751,16 @@ int osd_format_osd(struct osd_device *osd, uint64_t capacity, uint32_t cdb_cont_
 
 	root = strdup(osd->root);
 
+	/*
+	 * Only the store is closed and opened again: the running command's
+	 * arena and timings, the transport's buffers and the async workers,
+	 * one of which may be running this, stay.  So does the atomics
+	 * table, emptied, as lockless CAS and FA look at it.
+	 */
+	at = osd->at;
+	atomics_drop(osd);
+	__atomic_store_n(&osd->at, NULL, __ATOMIC_RELEASE);
+
 	get_dbname(path, root);
 	if (stat(path, &sb) != 0) {
 		osd_error_errno("%s: DB %s does not exist, creating it",
@@ -2230,39 +2768,59 @@ int osd_format_osd(struct osd_device *osd, uint64_t capacity, uint32_t cdb_cont_
 		goto create;
 	}
 
-	ret = osd_close(osd);
+	/* what the background jobs had left to do goes with the old db */
+	job_discard(osd);
+	ret = store_close(osd);
 	if (ret) {
 		osd_error("%s: DB close failed, ret %d", __func__, ret);
 		goto out_sense;
 	}
 
-	sprintf(path, "%s/%s/", root, md);
-	ret = empty_dir(path);
+	if (snprintf(path, sizeof(path), "%s/%s", root, stranded) >=
+	    (int)sizeof(path))
+		goto out_sense;
+	ret = create_dir(path);
 	if (ret) {
-		osd_error("%s: empty_dir %s failed", __func__, path);
+		osd_error("%s: create_dir %s failed", __func__, path);
+		goto out_sense;
+	}
+
+	if (snprintf(trash, sizeof(trash), "%s/%s/format.XXXXXX", root,
+		     stranded) >= (int)sizeof(trash))
+		goto out_sense;
+	if (mkdtemp(trash) == NULL) {
+		osd_error_errno("%s: mkdtemp %s failed", __func__, trash);
 		goto out_sense;
 	}
 
-	sprintf(path, "%s/%s", root, stranded);
-	ret = empty_dir(path);
+	if (snprintf(path, sizeof(path), "%s/%s", root, md) >=
+	    (int)sizeof(path) ||
+	    snprintf(dest, sizeof(dest), "%s/%s", trash, md) >=
+	    (int)sizeof(dest))
+		goto out_sense;
+	ret = rename(path, dest);
 	if (ret) {
-		osd_error("%s: empty_dir %s failed", __func__, path);
+		osd_error_errno("%s: rename %s failed", __func__, path);
 		goto out_sense;
 	}
 
 #ifndef __PANASAS_OSD__
-	sprintf(path, "%s/%s", root, dfiles);
-	ret = empty_dir(path);
-	if (ret) {
-		osd_error("%s: empty_dir %s failed", __func__, path);
+	if (snprintf(path, sizeof(path), "%s/%s", root, dfiles) >=
+	    (int)sizeof(path) ||
+	    snprintf(dest, sizeof(dest), "%s/%s", trash, dfiles) >=
+	    (int)sizeof(dest))
+		goto out_sense;
+	ret = rename(path, dest);
+	if (ret && errno != ENOENT) {
+		osd_error_errno("%s: rename %s failed", __func__, path);
 		goto out_sense;
 	}
 #endif
 
 create:
-	ret = osd_open(root, osd); /* will create files/dirs under root */
+	ret = store_open(root, osd); /* will create files/dirs under root */
 	if (ret != 0) {
-		osd_error("%s: osd_open %s failed", __func__, root);
+		osd_error("%s: store_open %s failed", __func__, root);
 		goto out_sense;
 	}
 	memset(&osd->ccap, 0, sizeof(osd->ccap)); /* reset ccap */
@@ -2279,6 +2837,8 @@ out_sense:
 			      OSD_ASC_SYSTEM_RESOURCE_FAILURE, 0, 0);
 
 out:
+	atomics_keep(osd, at);
+	async_wake_all(osd); /* CAS WAITs find their objects gone */
 	free(root);
 	return ret;
 }
@@ -2440,6 +3000,14 @@ int osd_getattr_list(struct osd_device *osd, uint64_t pid, uint64_t oid,
 		ret = get_riap(osd, pid, oid, page, number, outbuf,
 			       outlen, listfmt, used_outlen);
 		break;
+	case ROOT_STATS_PG:
+		ret = get_rstats(osd, pid, oid, page, number, outbuf,
+				 outlen, listfmt, used_outlen);
+		break;
+	case ROOT_LATENCY_PG:
+		ret = get_rlat(osd, pid, oid, page, number, outbuf,
+			       outlen, listfmt, used_outlen);
+		break;
 	case COLL_INFO_PG:
 		ret = get_ciap(osd, pid, oid, number, outbuf,
 			       outlen, listfmt, used_outlen);
@@ -2496,6 +3064,217 @@ out_hw_err:
 	return ret;
 }
 
+/*
+ * true if (page, number) names one attribute kept in the attr table, as
+ * opposed to one computed by osd_getattr_list or a set of attributes
+ */
+static int is_stored_attr(uint32_t page, uint32_t number)
+{
+	if (page == GETALLATTR_PG || number == ATTRNUM_GETALL)
+		return false;
+
+	switch (page) {
+	case CUR_CMD_ATTR_PG:
+	case PARTITION_DIR_PG + USER_TMSTMP_PG:
+	case USER_TMSTMP_PG:
+	case PARTITION_DIR_PG + USER_QUOTA_PG:
+	case PARTITION_DIR_PG + USER_INFO_PG:
+	case USER_INFO_PG:
+	case ROOT_INFO_PG:
+	case ROOT_STATS_PG:
+	case ROOT_LATENCY_PG:
+	case COLL_INFO_PG:
+	case COLL_TRACKING_PG:
+		return false;
+	default:
+		return true;
+	}
+}
+
+struct getattr_range {
+	uint64_t next;		/* oid to be packed next */
+	uint32_t page;
+	uint32_t number;
+	uint8_t listfmt;
+	uint8_t *cp;
+	uint32_t outlen;
+	uint32_t used;
+};
+
+/*
+ * Pack the attribute of gr->next, a null one if val is NULL.
+ *
+ * returns:
+ * -EINVAL: misaligned buffer
+ * OSD_OK: success, nothing packed if it did not fit, Sec 5.2.2.2
+ */
+static int getattr_range_pack(struct getattr_range *gr, const void *val,
+			      uint16_t len)
+{
+	int ret;
+
+	if (gr->listfmt == RTRVD_MULTIOBJ_LIST)
+		ret = le_multiobj_pack_attr(gr->cp, gr->outlen, gr->next,
+					    gr->page, gr->number, len, val);
+	else if (gr->listfmt == RTRVD_CREATE_MULTIOBJ_LIST)
+		ret = le_create_multiobj_pack_attr(gr->cp, gr->outlen,
+						   gr->next, gr->page,
+						   gr->number, len, val);
+	else
+		ret = le_pack_attr(gr->cp, gr->outlen, gr->page, gr->number,
+				   len, val);
+	if (ret == -EOVERFLOW)
+		ret = 0;
+	if (ret < 0)
+		return ret;
+
+	gr->cp += ret;
+	gr->outlen -= ret;
+	gr->used += ret;
+	gr->next++;
+	return OSD_OK;
+}
+
+static int getattr_range_row(uint64_t oid, const void *val, uint16_t len,
+			     void *arg)
+{
+	int ret;
+	struct getattr_range *gr = arg;
+
+	while (gr->next < oid) {
+		ret = getattr_range_pack(gr, NULL, 0);
+		if (ret != OSD_OK)
+			return ret;
+	}
+	return getattr_range_pack(gr, val, len);
+}
+
+/*
+ * One stored attribute of the numoid user objects from oid on, whose types
+ * are known, read with a single query and packed in oid order. Objects
+ * without the attribute get a null entry, like osd_getattr_list does.
+ *
+ * returns:
+ * == OSD_OK: success, used_outlen modified
+ *  >0: failed, sense set accordingly
+ */
+static int getattr_range(struct osd_device *osd, uint64_t pid, uint64_t oid,
+			 uint16_t numoid, const uint8_t *types, uint32_t page,
+			 uint32_t number, uint8_t *outbuf, uint32_t outlen,
+			 uint8_t isembedded, uint8_t listfmt,
+			 uint32_t *used_outlen, uint8_t *sense)
+{
+	int ret = 0;
+	uint16_t i;
+	struct getattr_range gr = {
+		.next = oid, .page = page, .number = number,
+		.listfmt = listfmt, .cp = outbuf, .outlen = outlen,
+	};
+
+	for (i = 0; i < numoid; i++) {
+		if (types[i] == ILLEGAL_OBJ)
+			goto out_cdb_err;
+		if (isgettable_page(types[i], page) == false)
+			goto out_param_list;
+	}
+
+	ret = attr_visit_range(osd->dbc, pid, oid, oid + numoid - 1, page,
+			       number, getattr_range_row, &gr);
+	while (ret == OSD_OK && gr.next < oid + numoid)
+		ret = getattr_range_pack(&gr, NULL, 0);
+	if (ret != OSD_OK)
+		goto out_param_list;
+
+	if (!isembedded)
+		fill_ccap(&osd->ccap, NULL, types[numoid - 1], pid,
+			  oid + numoid - 1, 0);
+	*used_outlen = gr.used;
+	return OSD_OK;
+
+out_param_list:
+	return sense_build_sdd(sense, OSD_SSK_ILLEGAL_REQUEST,
+			       OSD_ASC_INVALID_FIELD_IN_PARAM_LIST, pid,
+			       gr.next);
+
+out_cdb_err:
+	return sense_build_sdd(sense, OSD_SSK_ILLEGAL_REQUEST,
+			       OSD_ASC_INVALID_FIELD_IN_CDB, pid, oid + i);
+}
+
+/*
+ * GET ATTRIBUTES list of numoid objects from oid on: the list_len bytes of
+ * (page, number) pairs at list, results in list order, for each pair in
+ * oid order. The types of user objects are looked up once; a stored
+ * attribute is read for all of them with one query, anything else goes
+ * through osd_getattr_list object by object.
+ *
+ * returns:
+ * == OSD_OK: success, used_outlen modified
+ *  >0: failed, sense set accordingly
+ */
+int osd_getattr_multi(struct osd_device *osd, uint64_t pid, uint64_t oid,
+		      uint16_t numoid, const uint8_t *list, uint32_t list_len,
+		      uint8_t *outbuf, uint32_t outlen, uint8_t isembedded,
+		      uint8_t listfmt, uint32_t *used_outlen,
+		      uint32_t cdb_cont_len, uint8_t *sense)
+{
+	int ret = 0;
+	uint64_t i;
+	uint32_t len;
+	uint8_t *types = NULL;
+
+	assert(osd && osd->dbc && list && outbuf && used_outlen && sense);
+
+	*used_outlen = 0;
+	if (numoid == 0)
+		return OSD_OK;
+
+	if (pid >= OBJECT_PID_LB && oid >= OBJECT_OID_LB) {
+		types = Malloc(numoid);
+		if (!types || obj_get_types(osd->dbc, pid, oid, numoid,
+					    types) != OSD_OK)
+			goto out_hw_err;
+	}
+
+	for (; list_len >= 8; list_len -= 8, list += 8) {
+		uint32_t page = get_ntohl(&list[0]);
+		uint32_t number = get_ntohl(&list[4]);
+
+		if (types && is_stored_attr(page, number)) {
+			ret = getattr_range(osd, pid, oid, numoid, types, page,
+					    number, outbuf, outlen, isembedded,
+					    listfmt, &len, sense);
+			if (ret != OSD_OK)
+				goto out;
+			outbuf += len;
+			outlen -= len;
+			*used_outlen += len;
+			continue;
+		}
+		for (i = oid; i < oid + numoid; i++) {
+			ret = osd_getattr_list(osd, pid, i, page, number,
+					       outbuf, outlen, isembedded,
+					       listfmt, &len, cdb_cont_len,
+					       sense);
+			if (ret != OSD_OK)
+				goto out;
+			outbuf += len;
+			outlen -= len;
+			*used_outlen += len;
+		}
+	}
+	ret = OSD_OK;
+
+out:
+	free(types);
+	return ret;
+
+out_hw_err:
+	free(types);
+	return sense_build_sdd(sense, OSD_SSK_HARDWARE_ERROR,
+			       OSD_ASC_SYSTEM_RESOURCE_FAILURE, pid, oid);
+}
+
 /*
  * This function can only be used for pages that have a defined
  * format.  Those appear to be only:
@@ -2579,30 +3358,184 @@ out_hw_err:
 	return ret;
 }
 
+/*
+ * Length of the value of an attribute LIST computes from the object
+ * information cache, 0 for one stored in the attr table.
+ */
+static uint16_t list_attr_len(uint32_t page, uint32_t number)
+{
+	if (page == USER_INFO_PG) {
+		switch (number) {
+		case 0:
+			return ATTR_PAGE_ID_LEN;
+		case UIAP_PID:
+			return UIAP_PID_LEN;
+		case UIAP_OID:
+			return UIAP_OID_LEN;
+		case UIAP_USED_CAPACITY:
+			return UIAP_USED_CAPACITY_LEN;
+		case UIAP_LOGICAL_LEN:
+			return UIAP_LOGICAL_LEN_LEN;
+		}
+	} else if (page == USER_TMSTMP_PG) {
+		switch (number) {
+		case 0:
+			return ATTR_PAGE_ID_LEN;
+		case UTSAP_CTIME:
+			return UTSAP_CTIME_LEN;
+		case UTSAP_ATTR_ATIME:
+			return UTSAP_ATTR_ATIME_LEN;
+		case UTSAP_ATTR_MTIME:
+			return UTSAP_ATTR_MTIME_LEN;
+		case UTSAP_DATA_ATIME:
+			return UTSAP_DATA_ATIME_LEN;
+		case UTSAP_DATA_MTIME:
+			return UTSAP_DATA_MTIME_LEN;
+		}
+	}
+	return 0;
+}
+
+static int list_attr_pack(void *arg, uint64_t pid, uint64_t oid,
+			  uint32_t page, uint32_t number, void *buf,
+			  uint32_t buflen, uint32_t *used)
+{
+	struct osd_device *osd = arg;
+
+	if (page == USER_TMSTMP_PG)
+		return get_utsap_aslist(osd, pid, oid, number, buf, buflen,
+					RTRVD_SET_ATTR_LIST, used);
+	return get_uiap(osd, pid, oid, page, number, buf, buflen,
+			RTRVD_SET_ATTR_LIST, used);
+}
 
-int osd_get_member_attributes(struct osd_device *osd, uint64_t pid,
-			      uint64_t cid, uint32_t cdb_cont_len, uint8_t *sense)
+/*
+ * LIST of the objects of type in pid, or of the members of cid, with the
+ * attributes in get_attr, in listfmt, at most max_oids of them if not 0
+ *
+ * returns:
+ * -ENOMEM: out of memory
+ * else: what mtq_list_oids_attr returns
+ */
+static int list_oids_attr(struct osd_device *osd, uint64_t pid, uint64_t cid,
+			  uint8_t type, uint64_t initial_oid,
+			  struct getattr_list *get_attr, uint8_t listfmt,
+			  uint64_t max_oids, uint64_t alloc_len,
+			  uint8_t *outdata, uint64_t *used_outlen,
+			  uint64_t *add_len, uint64_t *cont_id)
 {
-	osd_debug(__func__);
-	return osd_error_unimplemented(0, sense);
+	uint32_t i;
+	struct mtq_attr *attrs;
+
+	attrs = arena_alloc(osd->arena, get_attr->sz * sizeof(*attrs));
+	if (!attrs)
+		return -ENOMEM;
+	for (i = 0; i < get_attr->sz; i++) {
+		attrs[i].page = get_attr->le[i].page;
+		attrs[i].number = get_attr->le[i].number;
+		attrs[i].len = list_attr_len(attrs[i].page, attrs[i].number);
+	}
+	return mtq_list_oids_attr(osd->dbc, osd->arena, pid, cid, type,
+				  initial_oid, attrs, get_attr->sz,
+				  list_attr_pack, osd, listfmt, max_oids,
+				  alloc_len, outdata, used_outlen, add_len,
+				  cont_id);
 }
 
 /*
- * @outdata: pointer to start of the data-out-buffer: destination of
- * 	generated list results
+ * GET MEMBER ATTRIBUTES: the attributes in get_attr of the members of cid
+ * from initial_oid on, at most numoid of them if not 0, read with one
+ * scan of coll and attr. They go to retrieved in multi-object format,
+ * whole members only.
+ *
+ * Unless alloc_len is 0, the data-in buffer at outdata gets a 24 byte
+ * header like that of LIST: the length the retrieved list would have
+ * with every member in it, then the member to continue from, 0 if none.
  *
  * returns:
- * ==0: success, used_outlen is set
+ * ==0: success, used_outlen and get_used_outlen are set
  * > 0: error, sense is set
  */
-int osd_list(struct osd_device *osd, uint8_t list_attr, uint64_t pid,
-	     uint64_t alloc_len, uint64_t initial_oid,
-	     struct getattr_list *get_attr, uint32_t list_id,
-	     uint8_t *outdata, uint64_t *used_outlen, uint8_t *sense)
+int osd_get_member_attributes(struct osd_device *osd, uint64_t pid,
+			      uint64_t cid, uint64_t initial_oid,
+			      uint16_t numoid, struct getattr_list *get_attr,
+			      uint32_t alloc_len, uint8_t *outdata,
+			      uint64_t *used_outlen, uint8_t *retrieved,
+			      uint32_t retrieved_len,
+			      uint32_t *get_used_outlen, uint32_t cdb_cont_len,
+			      uint8_t *sense)
 {
 	int ret = 0;
-	uint8_t *cp = outdata;
-	uint64_t add_len = 0;
+	uint64_t used = 0;
+	uint64_t add_len = 8;
+	uint64_t cont_id = 0;
+
+	osd_debug("%s: pid %llu cid %llu initial_oid %llu", __func__,
+		  llu(pid), llu(cid), llu(initial_oid));
+
+	assert(osd && osd->dbc && get_attr && used_outlen &&
+	       get_used_outlen && sense);
+
+	if (get_obj_type(osd, pid, cid) != COLLECTION)
+		goto out_cdb_err;
+
+	if (alloc_len != 0 && (alloc_len < 24 || !outdata))
+		goto out_cdb_err;
+
+	if (get_attr->sz != 0) {
+		if (!retrieved || retrieved_len < 8)
+			goto out_param_list;
+		ret = list_oids_attr(osd, pid, cid, COLLECTION, initial_oid,
+				     get_attr, RTRVD_MULTIOBJ_LIST, numoid,
+				     retrieved_len - 8, &retrieved[8], &used,
+				     &add_len, &cont_id);
+		if (ret)
+			goto out_hw_err;
+		retrieved[0] = RTRVD_MULTIOBJ_LIST;
+		memset(&retrieved[1], 0, 3);
+		set_htonl(&retrieved[4], used);
+		*get_used_outlen = used + 8;
+	}
+
+	if (alloc_len != 0) {
+		memset(outdata, 0, 24);
+		set_htonll(outdata, add_len);
+		set_htonll(&outdata[8], cont_id);
+		*used_outlen = 24;
+	}
+
+	fill_ccap(&osd->ccap, NULL, COLLECTION, pid, cid, 0);
+	return OSD_OK;
+
+out_cdb_err:
+	return sense_build_sdd(sense, OSD_SSK_ILLEGAL_REQUEST,
+			       OSD_ASC_INVALID_FIELD_IN_CDB, pid, cid);
+
+out_param_list:
+	return sense_build_sdd(sense, OSD_SSK_ILLEGAL_REQUEST,
+			       OSD_ASC_INVALID_FIELD_IN_PARAM_LIST, pid, cid);
+
+out_hw_err:
+	return sense_build_sdd(sense, OSD_SSK_HARDWARE_ERROR,
+			       OSD_ASC_SYSTEM_RESOURCE_FAILURE, pid, cid);
+}
+
+/*
+ * @outdata: pointer to start of the data-out-buffer: destination of
+ * 	generated list results
+ *
+ * returns:
+ * ==0: success, used_outlen is set
+ * > 0: error, sense is set
+ */
+int osd_list(struct osd_device *osd, uint8_t list_attr, uint64_t pid,
+	     uint64_t alloc_len, uint64_t initial_oid,
+	     struct getattr_list *get_attr, uint32_t list_id,
+	     uint8_t *outdata, uint64_t *used_outlen, uint8_t *sense)
+{
+	int ret = 0;
+	uint8_t *cp = outdata;
+	uint64_t add_len = 0;
 	uint64_t cont_id = 0;
 
 	assert(osd && osd->root && osd->dbc && get_attr && outdata 
@@ -2654,15 +3587,17 @@ int osd_list(struct osd_device *osd, uint8_t list_attr, uint64_t pid,
 			add_len = (uint64_t) -1;
 		set_htonll(outdata, add_len);
 		set_htonll(&outdata[8], cont_id);
-osd_info("%s: add_len=%llu cont_id=0x%llx", __func__, add_len, cont_id);
+osd_rlog(OSD_LOG_DEBUG, "%s: add_len=%llu cont_id=0x%llx", __func__,
+	 llu(add_len), llu(cont_id));
 	} else if (list_attr == 1 && get_attr->sz != 0 && pid != 0) {
 		if (list_id)
 			initial_oid = cont_id;
 		outdata[23] = (0x22 << 2);
 		alloc_len -= 24;
-		ret = mtq_list_oids_attr(osd->dbc, pid, initial_oid,
-					 get_attr, alloc_len, &outdata[24],
-					 used_outlen, &add_len, &cont_id);
+		ret = list_oids_attr(osd, pid, 0, USEROBJECT, initial_oid,
+				     get_attr, RTRVD_SET_ATTR_LIST, 0,
+				     alloc_len, &outdata[24],
+				     used_outlen, &add_len, &cont_id);
 		if (ret)
 			goto out_hw_err;
 
@@ -2751,10 +3686,25 @@ int osd_list_collection(struct osd_device *osd, uint8_t list_attr,
 		set_htonll(outdata, add_len);
 		set_htonll(&outdata[8], cont_id);
 
-	} else if (list_attr == 1 && get_attr->sz != 0 && cid != 0) {
+	} else if (list_attr == 1 && get_attr->sz != 0) {
 		if (list_id)
 			initial_oid = cont_id;
-		goto out_cdb_err; /* XXX: unimplemented */
+		outdata[23] = (0x22 << 2);
+		alloc_len -= 24;
+		ret = list_oids_attr(osd, pid, cid, COLLECTION, initial_oid,
+				     get_attr, RTRVD_SET_ATTR_LIST, 0,
+				     alloc_len, &outdata[24],
+				     used_outlen, &add_len, &cont_id);
+		if (ret)
+			goto out_hw_err;
+
+		*used_outlen += 24;
+		if (add_len + 16 > add_len) /* overflow: osd2r01 Sec 6.14.2 */
+			add_len += 16;
+		else
+			add_len = (uint64_t) -1;
+		set_htonll(outdata, add_len);
+		set_htonll(&outdata[8], cont_id);
 	}
 
 	/* XXX: is this correct */
@@ -2775,10 +3725,10 @@ out_hw_err:
 int osd_punch(struct osd_device *osd, uint64_t pid, uint64_t oid, uint64_t len,
 	      uint64_t offset, uint32_t cdb_cont_len, uint8_t *sense)
 {
-	struct stat sb;       
+	struct oinfo *oi;
         ssize_t readlen;
         int ret,fd=-1;
-	uint64_t new_offset,new_len;
+	uint64_t size,new_offset,new_len;
 	char path[MAXNAMELEN];
 	char *buf = NULL;
        
@@ -2799,22 +3749,25 @@ int osd_punch(struct osd_device *osd, uint64_t pid, uint64_t oid, uint64_t len,
 
 	new_offset = len + offset;	 
 	
-	ret = stat(path, &sb);
+	oi = oinfo_get(osd, pid, oid, 0);
 	
-	if(ret != 0) {
+	if(oi == NULL) {
 	        close(fd);
 	        return OSD_ERROR;
 	}
+	size = oi->size;
 	
 	/* Handling Illegal Operation */
-	if(offset > (uint64_t)sb.st_size)
+	if(offset > size)
 	        goto out_cdb_err; 
 	  
 	/* Handling Special Case */
-	else if(new_offset > (uint64_t)sb.st_size) {
-	        ret = truncate(path, offset);
+	else if(new_offset > size) {
+	        ret = ftruncate(fd, offset);
 	        if (ret < 0)
 		        goto out_hw_err;
+		oinfo_resized(osd, pid, oid, offset);
+		part_resized(osd, pid, oid, size, offset);
 	      	    
 		ret = close(fd);
 	    
@@ -2825,7 +3778,7 @@ int osd_punch(struct osd_device *osd, uint64_t pid, uint64_t oid, uint64_t len,
 	}
 	
 	/* Regular Cases */
-	new_len = sb.st_size - new_offset;
+	new_len = size - new_offset;
 
 	buf = malloc(new_len);
 	
@@ -2834,6 +3787,7 @@ int osd_punch(struct osd_device *osd, uint64_t pid, uint64_t oid, uint64_t len,
 	  	
 	/* Read section following the bytes to be removed */
 	readlen = pread(fd, buf, new_len, new_offset);
+	PROBE5(data_read, pid, oid, new_offset, new_len, readlen);
 	
 	if (readlen < 0) 
 	        goto out_hw_err;
@@ -2841,14 +3795,17 @@ int osd_punch(struct osd_device *osd, uint64_t pid, uint64_t oid, uint64_t len,
 	
 	/* Overwrite the bytes to be removed and concatenate to new length */
 	ret = pwrite(fd, buf, new_len, offset);
+	PROBE5(data_write, pid, oid, offset, new_len, ret);
 	
 	if (ret < 0 || (uint64_t)ret != new_len)
 	        goto out_hw_err;
 	  	
-	ret = truncate(path, offset + new_len);
+	ret = ftruncate(fd, offset + new_len);
 	
 	if (ret < 0)
 	        goto out_hw_err;
+	oinfo_resized(osd, pid, oid, offset + new_len);
+	part_resized(osd, pid, oid, size, offset + new_len);
 	  
 	ret = close(fd);
 	
@@ -2881,8 +3838,15 @@ int osd_punch(struct osd_device *osd, uint64_t pid, uint64_t oid, uint64_t len,
 	return ret;
 }
 
-static inline int alloc_qc(struct query_criteria *qc)
+/* grow an array of the query criteria, from the command arena */
+#define qc_grow(a, qc, field, old, limit) \
+	((qc)->field = arena_realloc(a, (qc)->field, \
+				     sizeof(*((qc)->field))*(old), \
+				     sizeof(*((qc)->field))*(limit)))
+
+static inline int alloc_qc(struct arena *a, struct query_criteria *qc)
 {
+	uint32_t old = qc->qc_cnt_limit;
 	uint32_t limit = 0;
 
 	if (qc->qc_cnt_limit == 0)
@@ -2891,36 +3855,20 @@ static inline int alloc_qc(struct query_criteria *qc)
 		qc->qc_cnt_limit *= 2;
 
 	limit = qc->qc_cnt_limit;
-	qc->qce_len = realloc(qc->qce_len, sizeof(*(qc->qce_len))*limit);
-	qc->page = realloc(qc->page, sizeof(*(qc->page))*limit);
-	qc->number = realloc(qc->number, sizeof(*(qc->number))*limit);
-	qc->min_len = realloc(qc->min_len, sizeof(*(qc->min_len))*limit);
-	qc->min_val = realloc(qc->min_val, sizeof(void *)*limit);
-	qc->max_len = realloc(qc->max_len, sizeof(*(qc->max_len))*limit);
-	qc->max_val = realloc(qc->max_val, sizeof(void *)*limit);
-
-	if (!qc->qce_len || !qc->page || !qc->number || !qc->min_len ||
-	    !qc->min_val || !qc->max_len || !qc->max_val)
+	if (!qc_grow(a, qc, qce_len, old, limit) ||
+	    !qc_grow(a, qc, page, old, limit) ||
+	    !qc_grow(a, qc, number, old, limit) ||
+	    !qc_grow(a, qc, min_len, old, limit) ||
+	    !qc_grow(a, qc, min_val, old, limit) ||
+	    !qc_grow(a, qc, max_len, old, limit) ||
+	    !qc_grow(a, qc, max_val, old, limit))
 		return -ENOMEM;
 
 	return OSD_OK;
 }
 
-static inline void free_qc(struct query_criteria *qc)
-{
-	if (!qc)
-		return;
-	free(qc->qce_len);
-	free(qc->page);
-	free(qc->number);
-	free(qc->min_len);
-	free(qc->min_val);
-	free(qc->max_len);
-	free(qc->max_val);
-}
-
-static int parse_query_criteria(const uint8_t *cp, uint32_t qll,
-				struct query_criteria *qc)
+static int parse_query_criteria(struct arena *a, const uint8_t *cp,
+				uint32_t qll, struct query_criteria *qc)
 {
 	int ret = 0;
 
@@ -2949,7 +3897,7 @@ static int parse_query_criteria(const uint8_t *cp, uint32_t qll,
 		qc->qc_cnt++;
 
 		if (qc->qc_cnt == qc->qc_cnt_limit) {
-			ret = alloc_qc(qc);
+			ret = alloc_qc(a, qc);
 			if (ret != OSD_OK)
 				return ret;
 		}
@@ -2958,6 +3906,22 @@ static int parse_query_criteria(const uint8_t *cp, uint32_t qll,
 	return OSD_OK;
 }
 
+/*
+ * A command that tracks its progress on cid ended with an error.
+ */
+static void track_sense(struct ctp *ctp)
+{
+	ctp->senselen = sense_build_sdd(ctp->sense, OSD_SSK_HARDWARE_ERROR,
+					OSD_ASC_INVALID_FIELD_IN_CDB,
+					ctp->pid, ctp->cid);
+}
+
+static void track_failed(struct osd_device *osd, struct ctp *ctp)
+{
+	track_sense(ctp);
+	finish_ctp(osd, ctp, SAM_STAT_CHECK_CONDITION);
+}
+
 int osd_query(struct osd_device *osd, uint64_t pid, uint64_t cid,
 	      uint32_t query_list_len, uint64_t alloc_len, const void *indata,
 	      void *outdata, uint64_t *used_outlen, uint32_t cdb_cont_len,
@@ -3003,8 +3967,7 @@ int osd_query(struct osd_device *osd, uint64_t pid, uint64_t cid,
 	    coll_type != CIAP_TRACKING_COLLECTION_TYPE)
 		goto out_cdb_err;
 
-	ctp = find_ctp(pid, cid);
-	if (ctp && ctp->status != 0x0000)
+	if (ctp_status(osd, pid, cid) != 0)
 		goto out_cdb_err;
 
 	ret = obj_ispresent(osd->dbc, pid, matches_cid, &present);
@@ -3018,17 +3981,7 @@ int osd_query(struct osd_device *osd, uint64_t pid, uint64_t cid,
 		    coll_type != CIAP_TRACKING_COLLECTION_TYPE)
 			goto out_cdb_err;
 
-		ctp = find_ctp(pid, matches_cid);
-		if (ctp && ctp->status != 0x0000)
-			goto out_cdb_err;
-		if (!ctp)
-			ctp = init_ctp(pid, matches_cid, OSD_QUERY);
-		if (!ctp)
-			goto out_cdb_err;
-
-		/* remove members from matches collection */
-		ret = coll_delete_cid(osd->dbc, pid, matches_cid);
-		if (ret != 0)
+		if (ctp_status(osd, pid, matches_cid) != 0)
 			goto out_cdb_err;
 	}
 	if (immed_tr && !matches_cid)
@@ -3042,11 +3995,12 @@ int osd_query(struct osd_device *osd, uint64_t pid, uint64_t cid,
 	if (alloc_len != 0 && matches_cid != 0)
 		goto out_cdb_err;
 
-	ret = alloc_qc(&qc);
+	/* criteria live in the arena until the command completes */
+	ret = alloc_qc(osd->arena, &qc);
 	if (ret != OSD_OK)
 		goto out_hw_err;
 
-	ret = parse_query_criteria(indata, query_list_len, &qc);
+	ret = parse_query_criteria(osd->arena, indata, query_list_len, &qc);
 	if (ret != OSD_OK)
 		goto out_cdb_err;
 
@@ -3062,16 +4016,28 @@ int osd_query(struct osd_device *osd, uint64_t pid, uint64_t cid,
 		   we'll just wait for the query to finish. */
 	}
 	
-	ret = mtq_run_query(osd->dbc, pid, cid, &qc, outdata, alloc_len,
-			    used_outlen, matches_cid);
+	if (matches_cid) {
+		ctp = init_ctp(osd, pid, matches_cid, OSD_QUERY);
+		if (!ctp)
+			goto out_cdb_err;
+
+		/* remove members from matches collection */
+		ret = coll_delete_cid(osd->dbc, pid, matches_cid);
+		if (ret != 0) {
+			track_failed(osd, ctp);
+			goto out_cdb_err;
+		}
+	}
+
+	ret = mtq_run_query(osd->dbc, osd->arena, pid, cid, &qc, outdata,
+			    alloc_len, used_outlen, matches_cid);
 	if (matches_cid != 0) {
-		ctp->status = ret;
 		if (ret)
-			sense_build_sdd(ctp->sense, OSD_SSK_HARDWARE_ERROR,
-					OSD_ASC_INVALID_FIELD_IN_CDB, pid, cid);
+			track_failed(osd, ctp);
+		else
+			finish_ctp(osd, ctp, SAM_STAT_GOOD);
 	}
-		
-	free_qc(&qc);
+
 	if (ret != OSD_OK)
 		goto out_hw_err;
 
@@ -3105,6 +4071,7 @@ static int contig_read(struct osd_device *osd, uint64_t pid, uint64_t oid,
 	ssize_t readlen;
 	int ret, fd;
 	char path[MAXNAMELEN];
+	struct async_io io;
 
 	osd_debug("%s: pid %llu oid %llu len %llu offset %llu", __func__,
 		  llu(pid), llu(oid), llu(len), llu(offset));
@@ -3116,14 +4083,18 @@ static int contig_read(struct osd_device *osd, uint64_t pid, uint64_t oid,
 		goto out_cdb_err;
 
 	get_dfile_name(path, osd->root, pid, oid);
-	fd = open(path, O_RDONLY|O_LARGEFILE); /* fails on non-existent obj */
+	/* fails on non-existent obj */
+	fd = fdcache_open(osd, path, pid, oid, O_RDONLY|O_LARGEFILE);
 	if (fd < 0) {
 		osd_error("%s: open faild on [%s]", __func__, path);
 		goto out_cdb_err;
 	}
 
+	async_io_begin(osd, &io); /* others run while the data moves */
 	readlen = pread(fd, outdata, len, offset);
-	ret = close(fd);
+	async_io_end(osd, &io);
+	PROBE5(data_read, pid, oid, offset, len, readlen);
+	ret = fdcache_close(osd, pid, oid, fd);
 	if ((readlen < 0) || (ret != 0))
 		goto out_hw_err;
 
@@ -3137,6 +4108,7 @@ static int contig_read(struct osd_device *osd, uint64_t pid, uint64_t oid,
 
 	*used_outlen = readlen;
 
+	oinfo_read(osd, pid, oid);
 	fill_ccap(&osd->ccap, NULL, USEROBJECT, pid, oid, 0);
 	return ret;
 
@@ -3181,7 +4153,8 @@ static int sgl_read(struct osd_device *osd, uint64_t pid, uint64_t oid,
 		goto out_cdb_err;
 
 	get_dfile_name(path, osd->root, pid, oid);
-	fd = open(path, O_RDONLY|O_LARGEFILE); /* fails on non-existent obj */
+	/* fails on non-existent obj */
+	fd = fdcache_open(osd, path, pid, oid, O_RDONLY|O_LARGEFILE);
 	if (fd < 0)
 		goto out_cdb_err;
 
@@ -3201,6 +4174,7 @@ static int sgl_read(struct osd_device *osd, uint64_t pid, uint64_t oid,
 
 		osd_debug("%s: ------------------------------", __func__);
 		ret = pread(fd, outdata+data_offset, length, offset_val+offset);
+		PROBE5(data_read, pid, oid, offset_val+offset, length, ret);
 		osd_debug("%s: return value is %d", __func__, ret);
 		if (ret < 0)
 			goto out_hw_err;
@@ -3213,7 +4187,7 @@ static int sgl_read(struct osd_device *osd, uint64_t pid, uint64_t oid,
 		readlen += length;
 	}
 
-	ret = close(fd);
+	ret = fdcache_close(osd, pid, oid, fd);
 	if (ret != 0)
 		goto out_hw_err;
 
@@ -3225,6 +4199,7 @@ static int sgl_read(struct osd_device *osd, uint64_t pid, uint64_t oid,
 				      OSD_ASC_READ_PAST_END_OF_USER_OBJECT,
 				      pid, oid, readlen);
 
+	oinfo_read(osd, pid, oid);
 	fill_ccap(&osd->ccap, NULL, USEROBJECT, pid, oid, 0);
 	return ret;
 
@@ -3268,7 +4243,8 @@ static int vec_read(struct osd_device *osd, uint64_t pid, uint64_t oid,
 		goto out_cdb_err;
 
 	get_dfile_name(path, osd->root, pid, oid);
-	fd = open(path, O_RDONLY|O_LARGEFILE); /* fails on non-existent obj */
+	/* fails on non-existent obj */
+	fd = fdcache_open(osd, path, pid, oid, O_RDONLY|O_LARGEFILE);
 	if (fd < 0)
 		goto out_cdb_err;
 
@@ -3283,6 +4259,7 @@ static int vec_read(struct osd_device *osd, uint64_t pid, uint64_t oid,
 		osd_debug("%s: Offset: %llu", __func__, llu(offset_val + offset));
 		osd_debug("%s: ------------------------------", __func__);
 		ret = pread(fd, outdata+data_offset, length, offset_val+offset);
+		PROBE5(data_read, pid, oid, offset_val+offset, length, ret);
 		if (ret < 0 || (uint64_t)ret != length)
 			goto out_hw_err;
 		readlen += ret;
@@ -3295,7 +4272,7 @@ static int vec_read(struct osd_device *osd, uint64_t pid, uint64_t oid,
 			  llu(bytes));
 	}
 
-	ret = close(fd);
+	ret = fdcache_close(osd, pid, oid, fd);
 	if (ret != 0)
 		goto out_hw_err;
 
@@ -3307,6 +4284,7 @@ static int vec_read(struct osd_device *osd, uint64_t pid, uint64_t oid,
 				      OSD_ASC_READ_PAST_END_OF_USER_OBJECT,
 				      pid, oid, readlen);
 
+	oinfo_read(osd, pid, oid);
 	fill_ccap(&osd->ccap, NULL, USEROBJECT, pid, oid, 0);
 	return ret;
 
@@ -3329,21 +4307,27 @@ int osd_read(struct osd_device *osd, uint64_t pid, uint64_t oid, uint64_t len,
 	     uint64_t *used_outlen, const struct sg_list *sglist,
 	     uint8_t *sense, uint8_t ddt)
 {
+	int ret;
+	uint64_t t = lat_now();
+
 	/*figure out what kind of write it is based on ddt and call appropriate
 	write function*/
 
 	switch(ddt) {
 		case DDT_CONTIG: {
-			return contig_read(osd, pid, oid, len, offset, outdata,
+			ret = contig_read(osd, pid, oid, len, offset, outdata,
 					used_outlen, sense);
+			break;
 		}
 		case DDT_SGL: {
-			return sgl_read(osd, pid, oid, len, offset, sglist,
+			ret = sgl_read(osd, pid, oid, len, offset, sglist,
 				outdata, used_outlen, sense);
+			break;
 		}
 		case DDT_VEC: {
-			return vec_read(osd, pid, oid, len, offset, indata,
+			ret = vec_read(osd, pid, oid, len, offset, indata,
 				outdata, used_outlen, sense);
+			break;
 		}
 		default: {
 			return sense_build_sdd(sense, OSD_SSK_ILLEGAL_REQUEST,
@@ -3351,6 +4335,8 @@ int osd_read(struct osd_device *osd, uint64_t pid, uint64_t oid, uint64_t len,
 		}
 	}
 
+	lat_add(osd, RLAT_DATA, t);
+	return ret;
 }
 
 static inline int set_dscptr(uint16_t dscptr_type, uint32_t data_len, uint64_t byte_offset,
@@ -3374,7 +4360,7 @@ int osd_read_map(struct osd_device *osd, uint64_t pid, uint64_t oid, uint64_t al
 	uint8_t *pt;
 	uint64_t  byte_offset, file_size, add_len = 0;
 	uint32_t data_len;
-       	struct stat sb;
+       	struct oinfo *oi;
 
 	osd_debug("%s: pid %llu oid %llu alloc_len %llu offset %llu", __func__,
 		  llu(pid), llu(oid), llu(alloc_len), llu(offset));
@@ -3397,17 +4383,17 @@ int osd_read_map(struct osd_device *osd, uint64_t pid, uint64_t oid, uint64_t al
 	if (fd < 0)
 		goto out_cdb_err;
 		
-	ret = stat(path, &sb);
+	oi = oinfo_get(osd, pid, oid, 0);
 	
-	if (ret != 0) {
+	if (oi == NULL) {
 	        close(fd);
 		return OSD_ERROR;
 	}
 	
-	if (offset > (uint64_t)sb.st_size)
+	if (offset > oi->size)
 	        goto out_cdb_err; 
 
-	file_size = (uint64_t)sb.st_size - offset; /* Adjust to the offset */
+	file_size = oi->size - offset; /* Adjust to the offset */
 
 	if (map_type == WRITTEN_DATA) { 
   
@@ -3473,7 +4459,10 @@ int osd_remove(struct osd_device *osd, uint64_t pid, uint64_t oid,
 	       uint32_t cdb_cont_len, uint8_t *sense)
 {
 	int ret = 0;
+	uint64_t seq = 0;
+	uint64_t size = 0;
 	char path[MAXNAMELEN];
+	struct oinfo *oi;
 
 	osd_debug("%s: removing userobject pid %llu oid %llu", __func__,
 		  llu(pid), llu(oid));
@@ -3486,11 +4475,26 @@ int osd_remove(struct osd_device *osd, uint64_t pid, uint64_t oid,
 	/* XXX: invalidate ic_cache immediately */
 	osd->ic.cur_pid = osd->ic.next_id = 0;
 
-	/* if userobject is absent unlink will fail */
+	seq = intent_begin(osd, INTENT_REMOVE, pid, oid, 1);
+
+	/*
+	 * Unlinking a large file frees its extents synchronously. Move it
+	 * to the stranded directory instead, the reaper unlinks it later.
+	 * If userobject is absent rename will fail.
+	 */
+	oi = oinfo_get(osd, pid, oid, 0);
+	if (oi)
+		size = oi->size;
 	get_dfile_name(path, osd->root, pid, oid);
-	ret = unlink(path);
+	ret = move_to_stranded(osd->root, pid, oid, path);
 	if (ret != 0)
 		goto out_hw_err;
+	oinfo_forget(osd, pid, oid);
+	fdcache_forget(osd, pid, oid);
+	atomics_forget(osd, pid, oid, 0);
+	part_resized(osd, pid, oid, size, 0);
+	part_objects(osd, pid, oid, -1);
+	job_reap_kick(osd);
 
 	/* delete all attr of the object */
 	ret = attr_delete_all(osd->dbc, pid, oid);
@@ -3507,6 +4511,7 @@ int osd_remove(struct osd_device *osd, uint64_t pid, uint64_t oid,
 		goto out_hw_err;
 
 	fill_ccap(&osd->ccap, NULL, USEROBJECT, pid, oid, 0);
+	intent_end(osd, seq, OSD_OK);
 	return OSD_OK; /* success */
 
 out_cdb_err:
@@ -3515,6 +4520,7 @@ out_cdb_err:
 	return ret;
 
 out_hw_err:
+	intent_end(osd, seq, OSD_ERROR);
 	ret = sense_build_sdd(sense, OSD_SSK_HARDWARE_ERROR,
 			      OSD_ASC_INVALID_FIELD_IN_CDB, pid, oid);
 	return ret;
@@ -3589,25 +4595,282 @@ out_hw_err:
 }
 
 
+/*
+ * Bulk removal: objects are deleted REMOVE_BATCH at a time, one db
+ * transaction per batch. The first batch runs inline, the rest run as a
+ * background job between subsequent commands. Progress is reported
+ * through the command tracking page of the collection (or the partition,
+ * with cid == PARTITION_OID).
+ */
+#define REMOVE_BATCH (1024)
+
+/*
+ * delete metadata of one object inside caller's txn, queue unlink of its
+ * data file.
+ */
+static int remove_batch_obj(struct osd_device *osd, uint64_t pid,
+			    uint64_t oid, uint8_t obj_type)
+{
+	int ret = 0;
+	char path[MAXNAMELEN];
+	struct oinfo *oi;
+
+	ret = attr_delete_all(osd->dbc, pid, oid);
+	if (ret != 0)
+		return ret;
+
+	ret = coll_delete_oid(osd->dbc, pid, oid);
+	if (ret != 0)
+		return ret;
+
+	if (obj_type == COLLECTION) {
+		ret = coll_delete_cid(osd->dbc, pid, oid);
+		if (ret != 0)
+			return ret;
+	}
+
+	ret = obj_delete(osd->dbc, pid, oid);
+	if (ret != 0)
+		return ret;
+
+	if (obj_type == USEROBJECT) {
+		oi = oinfo_get(osd, pid, oid, 0);
+		if (oi)
+			part_resized(osd, pid, oid, oi->size, 0);
+		part_objects(osd, pid, oid, -1);
+		get_dfile_name(path, osd->root, pid, oid);
+		oinfo_forget(osd, pid, oid);
+		fdcache_forget(osd, pid, oid);
+		atomics_forget(osd, pid, oid, 0);
+		ret = job_unlink(osd, path);
+	}
+	return ret;
+}
+
+static int remove_members_step(struct osd_device *osd, struct job *job)
+{
+	int ret = 0;
+	int err = 0;
+	uint32_t i = 0;
+	uint32_t count = 0;
+	uint64_t oids[REMOVE_BATCH];
+	struct ctp *ctp = job->ctp;
+
+	err = db_begin_txn(osd->dbc);
+	assert(err == 0);
+
+	ret = coll_get_member_batch(osd->dbc, job->pid, job->cid, oids,
+				    REMOVE_BATCH, &count);
+	for (i = 0; ret == OSD_OK && i < count; i++)
+		ret = remove_batch_obj(osd, job->pid, oids[i], USEROBJECT);
+
+	err = db_end_txn(osd->dbc);
+	assert(err == 0);
+
+	if (ret != OSD_OK) {
+		track_failed(osd, ctp);
+		return OSD_ERROR;
+	}
+
+	ctp_progress(ctp, count);
+	if (count == REMOVE_BATCH)
+		return OSD_REPEAT;
+
+	finish_ctp(osd, ctp, SAM_STAT_GOOD);
+	return OSD_OK;
+}
+
+/*
+ * returns:
+ * ==0: OSD_OK on success; removal may still be running in background
+ *  >0: error, sense set approprirately
+ */
 int osd_remove_member_objects(struct osd_device *osd, uint64_t pid,
 			      uint64_t cid, uint32_t cdb_cont_len, uint8_t *sense)
 {
-	osd_debug(__func__);
-	return osd_error_unimplemented(0, sense);
+	int ret = 0;
+	int present = 0;
+	uint64_t members = 0;
+	struct ctp *ctp = NULL;
+	struct job job;
+
+	osd_debug("%s: pid %llu cid %llu", __func__, llu(pid), llu(cid));
+
+	assert(osd && osd->root && osd->dbc && sense);
+
+	if (pid < COLLECTION_PID_LB || cid < COLLECTION_OID_LB)
+		goto out_cdb_err;
+
+	ret = obj_ispresent(osd->dbc, pid, cid, &present);
+	if (ret != OSD_OK || !present)
+		goto out_cdb_err;
+
+	if (get_obj_type(osd, pid, cid) != COLLECTION)
+		goto out_cdb_err;
+
+	/* only one tracked command per collection at a time */
+	if (ctp_status(osd, pid, cid) == CTP_ACTIVE)
+		goto out_cdb_err;
+
+	ctp = init_ctp(osd, pid, cid, OSD_REMOVE_MEMBER_OBJECTS);
+	if (!ctp)
+		goto out_resource_err;
+
+	/* XXX: invalidate ic_cache */
+	osd->ic.cur_pid = osd->ic.next_id = 0;
+
+	ret = coll_count_cid(osd->dbc, pid, cid, &members);
+	if (ret != OSD_OK) {
+		track_failed(osd, ctp);
+		goto out_hw_err;
+	}
+	ctp_members(ctp, members);
+
+	memset(&job, 0, sizeof(job));
+	job.pid = pid;
+	job.cid = cid;
+	job.ctp = ctp;
+	ret = remove_members_step(osd, &job);
+	if (ret == OSD_REPEAT) {
+		ret = job_submit(osd, pid, cid, ctp, remove_members_step);
+		if (ret != OSD_OK) {
+			track_failed(osd, ctp);
+		}
+	}
+	if (ret != OSD_OK)
+		goto out_hw_err;
+
+	fill_ccap(&osd->ccap, NULL, COLLECTION, pid, cid, 0);
+	return OSD_OK; /* success */
+
+out_cdb_err:
+	return sense_build_sdd(sense, OSD_SSK_ILLEGAL_REQUEST,
+			       OSD_ASC_INVALID_FIELD_IN_CDB, pid, cid);
+
+out_resource_err:
+	return sense_build_sdd(sense, OSD_SSK_HARDWARE_ERROR,
+			       OSD_ASC_SYSTEM_RESOURCE_FAILURE, pid, cid);
+
+out_hw_err:
+	return sense_build_sdd(sense, OSD_SSK_HARDWARE_ERROR,
+			       OSD_ASC_INVALID_FIELD_IN_CDB, pid, cid);
+}
+
+/*
+ * Force removal of a partition: its userobjects and collections go first,
+ * the partition object goes with the last batch. Once it is gone the
+ * tracking page is not flushed to the db since the partition attributes
+ * are removed with it; it stays readable in memory. A removal that fails
+ * leaves the partition, and its page is flushed like any other.
+ */
+static int remove_partition_step(struct osd_device *osd, struct job *job)
+{
+	int ret = 0;
+	int err = 0;
+	uint32_t i = 0;
+	uint32_t count = 0;
+	uint64_t oids[REMOVE_BATCH];
+	uint8_t types[REMOVE_BATCH];
+	struct ctp *ctp = job->ctp;
+
+	err = db_begin_txn(osd->dbc);
+	assert(err == 0);
+
+	ret = obj_get_pid_batch(osd->dbc, job->pid, oids, types,
+				REMOVE_BATCH, &count);
+	for (i = 0; ret == OSD_OK && i < count; i++)
+		ret = remove_batch_obj(osd, job->pid, oids[i], types[i]);
+
+	if (ret == OSD_OK && count < REMOVE_BATCH) {
+		ret = attr_delete_all(osd->dbc, job->pid, PARTITION_OID);
+		if (ret == OSD_OK)
+			ret = obj_delete(osd->dbc, job->pid, PARTITION_OID);
+		if (ret == OSD_OK) {
+			part_removed(osd, job->pid);
+			sec_removed(osd, job->pid);
+		}
+	}
+
+	err = db_end_txn(osd->dbc);
+	assert(err == 0);
+
+	if (ret != OSD_OK) {
+		track_sense(ctp);
+		finish_ctp(osd, ctp, SAM_STAT_CHECK_CONDITION);
+		return OSD_ERROR;
+	}
+
+	ctp_progress(ctp, count);
+	if (count == REMOVE_BATCH)
+		return OSD_REPEAT;
+
+	end_ctp(osd, ctp, SAM_STAT_GOOD);
+	return OSD_OK;
+}
+
+static int remove_partition_force(struct osd_device *osd, uint64_t pid,
+				  uint8_t *sense)
+{
+	int ret = 0;
+	struct ctp *ctp = NULL;
+	struct job job;
+
+	if (ctp_status(osd, pid, PARTITION_OID) == CTP_ACTIVE)
+		goto out_cdb_err;
+
+	ctp = init_ctp(osd, pid, PARTITION_OID, OSD_REMOVE_PARTITION);
+	if (!ctp)
+		goto out_resource_err;
+
+	memset(&job, 0, sizeof(job));
+	job.pid = pid;
+	job.cid = PARTITION_OID;
+	job.ctp = ctp;
+	ret = remove_partition_step(osd, &job);
+	if (ret == OSD_REPEAT) {
+		ret = job_submit(osd, pid, PARTITION_OID, ctp,
+				 remove_partition_step);
+		if (ret != OSD_OK) {
+			track_sense(ctp);
+			finish_ctp(osd, ctp, SAM_STAT_CHECK_CONDITION);
+		}
+	}
+	if (ret != OSD_OK)
+		goto out_hw_err;
+
+	fill_ccap(&osd->ccap, NULL, PARTITION, pid, PARTITION_OID, 0);
+	return OSD_OK;
+
+out_cdb_err:
+	return sense_build_sdd(sense, OSD_SSK_ILLEGAL_REQUEST,
+			       OSD_ASC_INVALID_FIELD_IN_CDB, pid,
+			       PARTITION_OID);
+
+out_resource_err:
+	return sense_build_sdd(sense, OSD_SSK_HARDWARE_ERROR,
+			       OSD_ASC_SYSTEM_RESOURCE_FAILURE, pid,
+			       PARTITION_OID);
+
+out_hw_err:
+	return sense_build_sdd(sense, OSD_SSK_HARDWARE_ERROR,
+			       OSD_ASC_INVALID_FIELD_IN_CDB, pid,
+			       PARTITION_OID);
 }
 
 /*
+ * @fpr: force partition removal, removes all objects in the partition
+ *
  * returns:
  * ==0: OSD_OK on success
  *  >0: error, sense set approprirately
  */
-int osd_remove_partition(struct osd_device *osd, uint64_t pid, uint32_t cdb_cont_len,
-			 uint8_t *sense)
+int osd_remove_partition(struct osd_device *osd, uint64_t pid, uint8_t fpr,
+			 uint32_t cdb_cont_len, uint8_t *sense)
 {
 	int ret = 0;
 	int isempty = 0;
 
-	osd_debug("%s: pid %llu", __func__, llu(pid));
+	osd_debug("%s: pid %llu fpr %u", __func__, llu(pid), fpr);
 
 	assert(osd && osd->root && osd->dbc && sense);
 
@@ -3615,12 +4878,18 @@ int osd_remove_partition(struct osd_device *osd, uint64_t pid, uint32_t cdb_cont
 		goto out_cdb_err;
 
 	ret = obj_isempty_pid(osd->dbc, pid, &isempty);
-	if (ret != OSD_OK || !isempty)
+	if (ret != OSD_OK)
 		goto out_not_empty;
 
 	/* XXX: invalidate ic_cache */
 	osd->ic.cur_pid = osd->ic.next_id = 0;
 
+	if (!isempty) {
+		if (fpr == 0)
+			goto out_not_empty;
+		return remove_partition_force(osd, pid, sense);
+	}
+
 	ret = attr_delete_all(osd->dbc, pid, PARTITION_OID);
 	if (ret != 0)
 		goto out_err;
@@ -3628,6 +4897,8 @@ int osd_remove_partition(struct osd_device *osd, uint64_t pid, uint32_t cdb_cont
 	ret = obj_delete(osd->dbc, pid, PARTITION_OID);
 	if (ret != 0)
 		goto out_err;
+	part_removed(osd, pid);
+	sec_removed(osd, pid);
 
 	fill_ccap(&osd->ccap, NULL, PARTITION, pid, PARTITION_OID, 0);
 	return OSD_OK; /* success */
@@ -3658,20 +4929,50 @@ out_not_empty:
  *
  * -	XXX: attr directory setting
  */
-int osd_set_attributes(struct osd_device *osd, uint64_t pid, uint64_t oid,
-		       uint32_t page, uint32_t number, const void *val,
-		       uint16_t len, uint8_t isembedded, uint32_t cdb_cont_len, 
-		       uint8_t *sense)
+/*
+ * Partition capacity quota. Stored like any attribute, the copy in the
+ * partition counters is what writes are checked against.
+ */
+static int set_capacity_quota(struct osd_device *osd, uint64_t pid,
+			      const void *val, uint16_t len)
 {
 	int ret = 0;
-	int present = 0;
-	uint8_t obj_type = 0;
 
-#ifdef PVFS_OSD_INTEGRATED
-	if (page == USER_INFO_PG && number == UIAP_LOGICAL_LEN) {
-		ret = set_uiap(osd, pid, oid, number, val, len);
+	if (len == 0) {
+		ret = attr_delete_attr(osd->dbc, pid, PARTITION_OID,
+				       PARTITION_PG + QUOTA_OFFSET,
+				       PARTITION_CAPACITY_QUOTA);
+		if (ret == OSD_OK)
+			part_set_quota(osd, pid, PART_NO_QUOTA);
+		return ret;
+	}
+
+	if (len != UIAP_USED_CAPACITY_LEN)
+		return OSD_ERROR;
+	ret = attr_set_attr(osd->dbc, pid, PARTITION_OID,
+			    PARTITION_PG + QUOTA_OFFSET,
+			    PARTITION_CAPACITY_QUOTA, val, len);
+	if (ret == OSD_OK)
+		part_set_quota(osd, pid, get_ntohll((const uint8_t *)val));
+	return ret;
+}
+
+int osd_set_attributes(struct osd_device *osd, uint64_t pid, uint64_t oid,
+		       uint32_t page, uint32_t number, const void *val,
+		       uint16_t len, uint8_t isembedded, uint32_t cdb_cont_len, 
+		       uint8_t *sense)
+{
+	int ret = 0;
+	int present = 0;
+	uint8_t obj_type = 0;
+
+#ifdef PVFS_OSD_INTEGRATED
+	if (page == USER_INFO_PG && number == UIAP_LOGICAL_LEN) {
+		ret = set_uiap(osd, pid, oid, number, val, len);
 		if (ret == OSD_OK)
 			goto out_success;
+		else if (ret == -EDQUOT)
+			goto out_quota;
 		else
 			goto out_cdb_err;
 	}
@@ -3696,12 +4997,25 @@ int osd_set_attributes(struct osd_device *osd, uint64_t pid, uint64_t oid,
 		goto out_cdb_err;
 	}
 
+	/* vendor root page, setting an attribute only clears it */
+	if (obj_type == ROOT && page == ROOT_LATENCY_PG) {
+		ret = lat_reset(osd, number);
+		if (ret == OSD_OK)
+			goto out_success;
+		else
+			goto out_param_list;
+	}
+
 	if (issettable_page(obj_type, page) == false)
 		goto out_param_list;
 
 	if (number == ATTRNUM_UNMODIFIABLE)
 		goto out_param_list;
 
+	/* the in-memory CAS and FA values would hide this */
+	if (obj_type == USEROBJECT && page == USER_ATOMICS_PG)
+		atomics_forget(osd, pid, oid, 1);
+
 	/* information page, make sure null terminated. osd2r00 7.1.2.2 */
 	if (number == ATTRNUM_INFO) {
 		int i;
@@ -3726,6 +5040,16 @@ int osd_set_attributes(struct osd_device *osd, uint64_t pid, uint64_t oid,
 	switch (page) {
 	case USER_INFO_PG:
 		ret = set_uiap(osd, pid, oid, number, val, len);
+		if (ret == OSD_OK)
+			goto out_success;
+		else if (ret == -EDQUOT)
+			goto out_quota;
+		else
+			goto out_cdb_err;
+	case PARTITION_PG + QUOTA_OFFSET:
+		if (number != PARTITION_CAPACITY_QUOTA)
+			break;
+		ret = set_capacity_quota(osd, pid, val, len);
 		if (ret == OSD_OK)
 			goto out_success;
 		else
@@ -3742,6 +5066,17 @@ int osd_set_attributes(struct osd_device *osd, uint64_t pid, uint64_t oid,
 			goto out_success;
 		else
 			goto out_cdb_err;
+	case ROOT_POLICY_PG:
+		if (number != RPSAP_DEFAULT_SECURITY_METHOD)
+			break;
+		if (len > RPSAP_DEFAULT_SECURITY_METHOD_LEN)
+			goto out_param_list;
+		/* stored below as well, len 0 turns checking off */
+		ret = sec_set_method(osd, len ? *(const uint8_t *)val :
+				     OSD_SEC_NOSEC);
+		if (ret != OSD_OK)
+			goto out_param_list;
+		break;
 	default:
 		break;
 	}
@@ -3765,6 +5100,7 @@ int osd_set_attributes(struct osd_device *osd, uint64_t pid, uint64_t oid,
 		goto out_hw_err;
 
 out_success:
+	oinfo_attr_set(osd, pid, oid);
 	if (!isembedded)
 		fill_ccap(&osd->ccap, NULL, obj_type, pid, oid, 0);
 	return OSD_OK; /* success */
@@ -3777,17 +5113,62 @@ out_param_list:
 out_cdb_err:
 	return sense_build_sdd(sense, OSD_SSK_ILLEGAL_REQUEST,
 			      OSD_ASC_INVALID_FIELD_IN_CDB, pid, oid);
+out_quota:
+	return sense_build_sdd(sense, OSD_SSK_DATA_PROTECTION,
+			       OSD_ASC_QUOTA_ERROR, pid, oid);
 out_hw_err:
 	return sense_build_sdd(sense, OSD_SSK_HARDWARE_ERROR,
 			       OSD_ASC_INVALID_FIELD_IN_CDB, pid, oid);
 }
 
 
+/*
+ * key: key version in the top byte, then the key identifier, which is
+ * not kept.  Only working keys have versions.
+ */
 int osd_set_key(struct osd_device *osd, int key_to_set, uint64_t pid,
-		uint64_t key, uint8_t seed[20], uint8_t *sense)
+		uint64_t key, const uint8_t seed[OSD_KEY_LEN], uint8_t *sense)
 {
-	osd_debug(__func__);
-	return osd_error_unimplemented(0, sense);
+	int ret = 0;
+	uint8_t obj_type = ROOT;
+	uint64_t oid = ROOT_OID;
+	uint8_t version = key >> 56;
+
+	switch (key_to_set) {
+	case OSD_KEY_ROOT:
+		if (pid != ROOT_PID)
+			goto out_cdb_err;
+		break;
+	case OSD_KEY_WORKING:
+		if (version >= OSD_WORKING_KEYS)
+			goto out_cdb_err;
+		/* fall through */
+	case OSD_KEY_PARTITION:
+		obj_type = PARTITION;
+		oid = PARTITION_OID;
+		if (pid == ROOT_PID ||
+		    get_obj_type(osd, pid, PARTITION_OID) != PARTITION)
+			goto out_cdb_err;
+		break;
+	default:
+		goto out_cdb_err;
+	}
+
+	ret = sec_set_key(osd, key_to_set, pid, version, seed);
+	if (ret == -ENOENT || ret == -EINVAL)
+		goto out_cdb_err; /* parent key not set */
+	else if (ret != OSD_OK)
+		goto out_hw_err;
+
+	fill_ccap(&osd->ccap, NULL, obj_type, pid, oid, 0);
+	return OSD_OK;
+
+out_cdb_err:
+	return sense_build_sdd(sense, OSD_SSK_ILLEGAL_REQUEST,
+			       OSD_ASC_INVALID_FIELD_IN_CDB, pid, oid);
+out_hw_err:
+	return sense_build_sdd(sense, OSD_SSK_HARDWARE_ERROR,
+			       OSD_ASC_SYSTEM_RESOURCE_FAILURE, pid, oid);
 }
 
 
@@ -3801,27 +5182,374 @@ int osd_set_master_key(struct osd_device *osd, int dh_step, uint64_t key,
 }
 
 
+/*
+ * SET MEMBER ATTRIBUTES sets the list on SETMEMBER_BATCH members at a
+ * time, in oid order, one db transaction per chunk. As with bulk removal
+ * the first chunk runs inline and the rest as a background job, and
+ * progress goes to the command tracking page of the collection.
+ *
+ * To go on after a crash, the list and the oid the next chunk starts at
+ * are kept on SETMEMBER_PG of the collection, the latter updated in the
+ * transaction of each chunk, and the collection is listed on the root
+ * object. osd_open resubmits the collections listed there. A clean close
+ * runs all jobs to the end, so only a crash leaves any.
+ */
+#define SETMEMBER_BATCH (1024)
+#define SETMEMBER_JOBS_MAX (32)
+
+/* not visible to SET ATTRIBUTES, like other vendor pages */
+#define SETMEMBER_PG ((uint32_t)COLLECTION_PG + VEND_PG_LB)
+#define SETMEMBER_ROOT_PG (ROOT_PG + VEND_PG_LB + 2)
+enum {
+	SETMEMBER_POS = 1,	/* next oid, members done, list entries */
+	SETMEMBER_LIST = 2,	/* each entry: page, number, value */
+	SETMEMBER_JOBS = 1,	/* on the root: pid, cid of each */
+};
+
+struct setmember_pos {
+	uint64_t next;
+	uint64_t done;
+	uint32_t nattr;
+};
+
+static int setmember_store_pos(struct osd_device *osd, uint64_t pid,
+			       uint64_t cid, const struct setmember_pos *sp)
+{
+	uint8_t buf[20];
+
+	set_htonll(&buf[0], sp->next);
+	set_htonll(&buf[8], sp->done);
+	set_htonl(&buf[16], sp->nattr);
+	return attr_set_attr(osd->dbc, pid, cid, SETMEMBER_PG, SETMEMBER_POS,
+			     buf, sizeof(buf));
+}
+
+static int setmember_load_pos(struct osd_device *osd, uint64_t pid,
+			      uint64_t cid, struct setmember_pos *sp)
+{
+	int ret = 0;
+	uint8_t buf[20];
+	uint32_t len = 0;
+
+	ret = attr_get_val(osd->dbc, pid, cid, SETMEMBER_PG, SETMEMBER_POS,
+			   sizeof(buf), buf, &len);
+	if (ret != OSD_OK)
+		return ret;
+	if (len != sizeof(buf))
+		return OSD_ERROR;
+	sp->next = get_ntohll(&buf[0]);
+	sp->done = get_ntohll(&buf[8]);
+	sp->nattr = get_ntohl(&buf[16]);
+	return OSD_OK;
+}
+
+struct setmember_entry {
+	struct arena *a;
+	struct list_entry *le;
+};
+
+static int setmember_copy_entry(const void *val, uint16_t len, void *arg)
+{
+	const uint8_t *cp = val;
+	struct setmember_entry *se = arg;
+	struct list_entry *le = se->le;
+
+	if (len < 8)
+		return OSD_ERROR;
+	le->page = get_ntohl(&cp[0]);
+	le->number = get_ntohl(&cp[4]);
+	le->len = len - 8;
+	le->val = arena_alloc(se->a, le->len + 1);
+	if (!le->val)
+		return -ENOMEM;
+	memcpy(le->val, &cp[8], le->len);
+	return OSD_OK;
+}
+
+static int setmember_load_list(struct osd_device *osd, struct arena *a,
+			       uint64_t pid, uint64_t cid, uint32_t nattr,
+			       struct setattr_list *sl)
+{
+	int ret = 0;
+	uint32_t i = 0;
+	struct setmember_entry se;
+
+	sl->sz = nattr;
+	sl->le = arena_alloc(a, nattr * sizeof(*sl->le));
+	if (!sl->le)
+		return -ENOMEM;
+	se.a = a;
+	for (i = 0; i < nattr; i++) {
+		se.le = &sl->le[i];
+		ret = attr_visit_val(osd->dbc, pid, cid, SETMEMBER_PG,
+				     SETMEMBER_LIST + i, setmember_copy_entry,
+				     &se);
+		if (ret != OSD_OK)
+			return ret;
+	}
+	return OSD_OK;
+}
+
+/*
+ * Add (pid, cid) to the collections listed on the root, or drop it.
+ */
+static int setmember_list_job(struct osd_device *osd, uint64_t pid,
+			      uint64_t cid, int add)
+{
+	int ret = 0;
+	uint32_t i = 0;
+	uint32_t len = 0;
+	uint8_t buf[SETMEMBER_JOBS_MAX * 16];
+
+	ret = attr_get_val(osd->dbc, ROOT_PID, ROOT_OID, SETMEMBER_ROOT_PG,
+			   SETMEMBER_JOBS, sizeof(buf), buf, &len);
+	if (ret == -ENOENT)
+		len = 0;
+	else if (ret != OSD_OK)
+		return ret;
+
+	for (i = 0; i + 16 <= len; i += 16)
+		if (get_ntohll(&buf[i]) == pid && get_ntohll(&buf[i+8]) == cid)
+			break;
+
+	if (add) {
+		if (i < len)
+			return OSD_OK;
+		if (len == sizeof(buf))
+			return -ENOSPC;
+		set_htonll(&buf[len], pid);
+		set_htonll(&buf[len+8], cid);
+		len += 16;
+	} else {
+		if (i >= len)
+			return OSD_OK;
+		memmove(&buf[i], &buf[i+16], len - i - 16);
+		len -= 16;
+	}
+
+	if (len == 0)
+		return attr_delete_attr(osd->dbc, ROOT_PID, ROOT_OID,
+					SETMEMBER_ROOT_PG, SETMEMBER_JOBS);
+	return attr_set_attr(osd->dbc, ROOT_PID, ROOT_OID, SETMEMBER_ROOT_PG,
+			     SETMEMBER_JOBS, buf, len);
+}
+
+/*
+ * Inside caller's txn.
+ */
+static int setmember_save(struct osd_device *osd, uint64_t pid, uint64_t cid,
+			  const struct setattr_list *set_attr)
+{
+	int ret = 0;
+	uint32_t i = 0;
+	uint8_t *buf = NULL;
+	const struct list_entry *le = NULL;
+	struct setmember_pos sp = { USEROBJECT_OID_LB, 0, set_attr->sz };
+
+	for (i = 0; i < set_attr->sz; i++) {
+		le = &set_attr->le[i];
+		buf = arena_alloc(osd->arena, 8 + le->len);
+		if (!buf)
+			return -ENOMEM;
+		set_htonl(&buf[0], le->page);
+		set_htonl(&buf[4], le->number);
+		memcpy(&buf[8], le->cval, le->len);
+		ret = attr_set_attr(osd->dbc, pid, cid, SETMEMBER_PG,
+				    SETMEMBER_LIST + i, buf, 8 + le->len);
+		if (ret != OSD_OK)
+			return ret;
+	}
+
+	ret = setmember_store_pos(osd, pid, cid, &sp);
+	if (ret != OSD_OK)
+		return ret;
+	return setmember_list_job(osd, pid, cid, 1);
+}
+
+/*
+ * Inside caller's txn. Whatever is left of the state goes.
+ */
+static int setmember_clear(struct osd_device *osd, uint64_t pid, uint64_t cid,
+			   uint32_t nattr)
+{
+	int ret = 0;
+	uint32_t i = 0;
+
+	for (i = 0; ret == OSD_OK && i < nattr; i++)
+		ret = attr_delete_attr(osd->dbc, pid, cid, SETMEMBER_PG,
+				       SETMEMBER_LIST + i);
+	if (ret == OSD_OK)
+		ret = attr_delete_attr(osd->dbc, pid, cid, SETMEMBER_PG,
+				       SETMEMBER_POS);
+	if (ret == OSD_OK)
+		ret = setmember_list_job(osd, pid, cid, 0);
+	return ret;
+}
+
+static int set_members_chunk(struct osd_device *osd, struct job *job,
+			     struct arena *a)
+{
+	int ret = 0;
+	int err = 0;
+	uint32_t count = 0;
+	uint64_t next = 0;
+	struct setattr_list sl = { 0, NULL };
+	struct setmember_pos sp = { 0, 0, 0 };
+	struct ctp *ctp = job->ctp;
+
+	err = db_begin_txn(osd->dbc);
+	assert(err == 0);
+
+	ret = setmember_load_pos(osd, job->pid, job->cid, &sp);
+	if (ret == OSD_OK)
+		ret = setmember_load_list(osd, a, job->pid, job->cid,
+					  sp.nattr, &sl);
+	if (ret == OSD_OK)
+		ret = mtq_set_member_attrs(osd->dbc, a, job->pid,
+					   job->cid, &sl, sp.next,
+					   SETMEMBER_BATCH, &next, &count);
+	if (ret == OSD_OK) {
+		sp.next = next;
+		sp.done += count;
+		if (next == 0)
+			ret = setmember_clear(osd, job->pid, job->cid,
+					      sp.nattr);
+		else
+			ret = setmember_store_pos(osd, job->pid, job->cid,
+						  &sp);
+	}
+
+	/* the collection went away, or its state is broken: give up */
+	if (ret != OSD_OK)
+		setmember_clear(osd, job->pid, job->cid, sp.nattr);
+
+	err = db_end_txn(osd->dbc);
+	assert(err == 0);
+
+	if (ret != OSD_OK) {
+		track_failed(osd, ctp);
+		return OSD_ERROR;
+	}
+
+	ctp_progress(ctp, count);
+	if (next != 0)
+		return OSD_REPEAT;
+
+	finish_ctp(osd, ctp, SAM_STAT_GOOD);
+	return OSD_OK;
+}
+
+/*
+ * Jobs run between commands, and while FORMAT OSD closes the device, so
+ * not from the command arena.
+ */
+static int set_members_step(struct osd_device *osd, struct job *job)
+{
+	int ret = 0;
+	struct arena *a = arena_new();
+
+	if (!a) {
+		track_failed(osd, job->ctp);
+		return -ENOMEM;
+	}
+	ret = set_members_chunk(osd, job, a);
+	arena_free(a);
+	return ret;
+}
+
+static int set_members_track(struct osd_device *osd, uint64_t pid,
+			      uint64_t cid, uint64_t done, struct ctp **ctpp)
+{
+	int ret = 0;
+	uint64_t members = 0;
+	struct ctp *ctp = NULL;
+
+	ctp = init_ctp(osd, pid, cid, OSD_SET_MEMBER_ATTRIBUTES);
+	if (!ctp)
+		return -ENOMEM;
+	*ctpp = ctp;
+
+	ret = coll_count_cid(osd->dbc, pid, cid, &members);
+	if (ret != OSD_OK)
+		return ret;
+	ctp_members(ctp, members);
+	ctp_progress(ctp, done);
+	return OSD_OK;
+}
+
+/*
+ * Called by osd_open: go on with what a crash interrupted.
+ */
+static int set_members_resume(struct osd_device *osd)
+{
+	int ret = 0;
+	uint32_t i = 0;
+	uint32_t len = 0;
+	uint64_t pid, cid;
+	uint8_t buf[SETMEMBER_JOBS_MAX * 16];
+	struct setmember_pos sp;
+	struct ctp *ctp = NULL;
+
+	ret = attr_get_val(osd->dbc, ROOT_PID, ROOT_OID, SETMEMBER_ROOT_PG,
+			   SETMEMBER_JOBS, sizeof(buf), buf, &len);
+	if (ret == -ENOENT)
+		return OSD_OK;
+	if (ret != OSD_OK)
+		return ret;
+
+	for (i = 0; i + 16 <= len; i += 16) {
+		pid = get_ntohll(&buf[i]);
+		cid = get_ntohll(&buf[i+8]);
+		osd_debug("%s: pid %llu cid %llu", __func__, llu(pid),
+			  llu(cid));
+
+		ret = setmember_load_pos(osd, pid, cid, &sp);
+		if (ret == -ENOENT) {
+			/* the collection is gone */
+			ret = setmember_list_job(osd, pid, cid, 0);
+			if (ret != OSD_OK)
+				return ret;
+			continue;
+		}
+		if (ret == OSD_OK)
+			ret = set_members_track(osd, pid, cid, sp.done, &ctp);
+		if (ret == OSD_OK)
+			ret = job_submit(osd, pid, cid, ctp, set_members_step);
+		if (ret != OSD_OK) {
+			/* stays listed, tried again on the next open */
+			osd_error("%s: pid %llu cid %llu: %d", __func__,
+				  llu(pid), llu(cid), ret);
+			if (ctp) {
+				track_failed(osd, ctp);
+			}
+		}
+		ctp = NULL;
+	}
+	return OSD_OK;
+}
+
+/*
+ * returns:
+ * ==0: OSD_OK on success; members may still be set in background
+ *  >0: error, sense set approprirately
+ */
 int osd_set_member_attributes(struct osd_device *osd, uint64_t pid,
 			      uint64_t cid, struct setattr_list *set_attr,
 			      uint32_t cdb_cont_len, uint8_t *sense)
 {
 	int ret = 0;
+	int err = 0;
 	size_t i = 0;
 	int present = 0;
 	uint8_t obj_type = 0;
-	uint8_t within_txn = 0;
-
+	struct ctp *ctp = NULL;
+	struct job job;
 
 	osd_debug("%s: set attrs on pid %llu cid %llu", __func__, llu(pid),
 		  llu(cid));
 
 	assert(osd && osd->root && osd->dbc && set_attr && sense);
 
-	/* encapsulate all db ops in txn */
-	ret = db_begin_txn(osd->dbc);
-	assert(ret == 0);
-	within_txn = 1;
-
 	ret = obj_ispresent(osd->dbc, pid, cid, &present);
 	if (ret != OSD_OK || !present) /* collection absent! */
 		goto out_cdb_err;
@@ -3832,44 +5560,78 @@ int osd_set_member_attributes(struct osd_device *osd, uint64_t pid,
 
 	/*
 	 * XXX: presently we only allow attrs to modify useobjects, not the
-	 * collection
+	 * collection. An entry is kept with its page and number in one
+	 * attribute while the command runs.
 	 */
 	for (i = 0; i < set_attr->sz; i++) {
 		if (!issettable_page(USEROBJECT, set_attr->le[i].page))
 			goto out_param_list;
+		/* rows written in bulk would miss the in-memory CAS and FA
+		 * values and the CAS WAITs, SET ATTRIBUTES minds those */
+		if (set_attr->le[i].page == USER_ATOMICS_PG)
+			goto out_param_list;
+		if (set_attr->le[i].len > UINT16_MAX - 8)
+			goto out_param_list;
 	}
 
-	ret = mtq_set_member_attrs(osd->dbc, pid, cid, set_attr);
-	if (ret != 0)
+	if (set_attr->sz == 0)
+		goto out_success;
+
+	/* only one tracked command per collection at a time */
+	if (ctp_status(osd, pid, cid) == CTP_ACTIVE)
+		goto out_cdb_err;
+
+	ret = set_members_track(osd, pid, cid, 0, &ctp);
+	if (ret == -ENOMEM)
+		goto out_resource_err;
+	if (ret == OSD_OK) {
+		err = db_begin_txn(osd->dbc);
+		assert(err == 0);
+		ret = setmember_save(osd, pid, cid, set_attr);
+		err = db_end_txn(osd->dbc);
+		assert(err == 0);
+	}
+	if (ret != OSD_OK) {
+		track_failed(osd, ctp);
 		goto out_hw_err;
+	}
 
-	ret = db_end_txn(osd->dbc);
-	assert(ret == 0);
+	memset(&job, 0, sizeof(job));
+	job.pid = pid;
+	job.cid = cid;
+	job.ctp = ctp;
+	ret = set_members_chunk(osd, &job, osd->arena);
+	if (ret == OSD_REPEAT) {
+		ret = job_submit(osd, pid, cid, ctp, set_members_step);
+		if (ret != OSD_OK) {
+			err = db_begin_txn(osd->dbc);
+			assert(err == 0);
+			setmember_clear(osd, pid, cid, set_attr->sz);
+			err = db_end_txn(osd->dbc);
+			assert(err == 0);
+			track_failed(osd, ctp);
+		}
+	}
+	if (ret != OSD_OK)
+		goto out_hw_err;
 
+out_success:
 	fill_ccap(&osd->ccap, NULL, COLLECTION, pid, cid, 0);
 	return OSD_OK; /* success */
 
+out_resource_err:
+	return sense_build_sdd(sense, OSD_SSK_HARDWARE_ERROR,
+			       OSD_ASC_SYSTEM_RESOURCE_FAILURE, pid, cid);
+
 out_hw_err:
-	if (within_txn) {
-		ret = db_end_txn(osd->dbc);
-		assert(ret == 0);
-	}
 	return sense_build_sdd(sense, OSD_SSK_HARDWARE_ERROR,
 			       OSD_ASC_INVALID_FIELD_IN_CDB, pid, cid);
 
 out_param_list:
-	if (within_txn) {
-		ret = db_end_txn(osd->dbc);
-		assert(ret == 0);
-	}
 	return sense_build_sdd(sense, OSD_SSK_ILLEGAL_REQUEST,
 			       OSD_ASC_INVALID_FIELD_IN_PARAM_LIST, pid, cid);
 
 out_cdb_err:
-	if (within_txn) {
-		ret = db_end_txn(osd->dbc);
-		assert(ret == 0);
-	}
 	return sense_build_sdd(sense, OSD_SSK_ILLEGAL_REQUEST,
 			       OSD_ASC_INVALID_FIELD_IN_CDB, pid, cid);
 }
@@ -3888,11 +5650,12 @@ out_cdb_err:
 
 static int contig_write(struct osd_device *osd, uint64_t pid, uint64_t oid, 
 			uint64_t len, uint64_t offset, const uint8_t *dinbuf, 
-			uint8_t *sense)
+			struct size_acct *sa, uint8_t *sense)
 {
 	int ret;
 	int fd;
 	char path[MAXNAMELEN];
+	struct async_io io;
 
 	osd_debug("%s: pid %llu oid %llu len %llu offset %llu data %p",
 		  __func__, llu(pid), llu(oid), llu(len), llu(offset), dinbuf);
@@ -3903,17 +5666,24 @@ static int contig_write(struct osd_device *osd, uint64_t pid, uint64_t oid,
 		goto out_cdb_err;
 
 	get_dfile_name(path, osd->root, pid, oid);
-	fd = open(path, O_RDWR|O_LARGEFILE); /* fails on non-existent obj */
+	/* fails on non-existent obj */
+	fd = fdcache_open(osd, path, pid, oid, O_RDWR|O_LARGEFILE);
 	if (fd < 0)
 		goto out_cdb_err;
 
+	async_io_begin(osd, &io); /* others run while the data moves */
 	ret = pwrite(fd, dinbuf, len, offset);
+	async_io_end(osd, &io);
+	PROBE5(data_write, pid, oid, offset, len, ret);
+	if (io.aq)
+		size_again(osd, pid, oid, sa); /* others may have written */
 	if (ret < 0 || (uint64_t)ret != len)
 		goto out_hw_err;
-	ret = close(fd);
+	ret = fdcache_close(osd, pid, oid, fd);
 	if (ret != 0)
 		goto out_hw_err;
 
+	oinfo_wrote(osd, pid, oid, offset + len);
 	fill_ccap(&osd->ccap, NULL, USEROBJECT, pid, oid, 0);
 	return OSD_OK; /* success */
 
@@ -3941,21 +5711,23 @@ static int sgl_write(struct osd_device *osd, uint64_t pid, uint64_t oid,
 	uint64_t pairs, data_offset, offset_val, length;
 	unsigned int i;
 
-	osd_info("%s: pid %llu oid %llu len %llu offset %llu data %p",
-		  __func__, llu(pid), llu(oid), llu(len), llu(offset), dinbuf);
+	osd_rlog(OSD_LOG_DEBUG, "%s: pid %llu oid %llu len %llu offset %llu",
+		 __func__, llu(pid), llu(oid), llu(len), llu(offset));
 
 	assert(osd && osd->root && osd->dbc && dinbuf && sense);
 
 	pairs = sglist->num_entries;
 	assert(pairs != 0);
 
-	osd_info("%s: offset,len pairs %llu", __func__, llu(pairs));
+	osd_rlog(OSD_LOG_DEBUG, "%s: offset,len pairs %llu", __func__,
+		 llu(pairs));
 
 	if (!(pid >= USEROBJECT_PID_LB && oid >= USEROBJECT_OID_LB))
 		goto out_cdb_err;
 
 	get_dfile_name(path, osd->root, pid, oid);
-	fd = open(path, O_RDWR|O_LARGEFILE); /* fails on non-existent obj */
+	/* fails on non-existent obj */
+	fd = fdcache_open(osd, path, pid, oid, O_RDWR|O_LARGEFILE);
 	if (fd < 0)
 		goto out_cdb_err;
 
@@ -3966,24 +5738,23 @@ static int sgl_write(struct osd_device *osd, uint64_t pid, uint64_t oid,
 		offset_val = get_ntohll(&sglist->entries[i].offset);
 		length = get_ntohll(&sglist->entries[i].bytes_to_transfer);
 
-		osd_info("%s: Offset: %llu Length: %llu",
-			  __func__, llu(offset_val + offset), llu(length));
-
-		osd_info("%s: Position in data buffer: %llu",
-			  __func__, llu(data_offset));
-
-		osd_info("%s: ------------------------------", __func__);
+		osd_rlog(OSD_LOG_DEBUG, "%s: offset %llu length %llu at %llu",
+			 __func__, llu(offset_val + offset), llu(length),
+			 llu(data_offset));
 		ret = pwrite(fd, dinbuf+data_offset, length, offset_val+offset);
+		PROBE5(data_write, pid, oid, offset_val+offset, length, ret);
 		data_offset += length;
-		osd_info("%s: return value is %d", __func__, ret);
+		osd_rlog(OSD_LOG_DEBUG, "%s: return value is %d", __func__,
+			 ret);
 		if (ret < 0 || (uint64_t)ret != length)
 			goto out_hw_err;
 	}
 
-	ret = close(fd);
+	ret = fdcache_close(osd, pid, oid, fd);
 	if (ret != 0)
 		goto out_hw_err;
 
+	oinfo_forget(osd, pid, oid); /* scattered, stat again */
 	fill_ccap(&osd->ccap, NULL, USEROBJECT, pid, oid, 0);
 	return OSD_OK; /* success */
 
@@ -4025,7 +5796,8 @@ static int vec_write(struct osd_device *osd, uint64_t pid, uint64_t oid,
 		goto out_cdb_err;
 
 	get_dfile_name(path, osd->root, pid, oid);
-	fd = open(path, O_RDWR|O_LARGEFILE); /* fails on non-existent obj */
+	/* fails on non-existent obj */
+	fd = fdcache_open(osd, path, pid, oid, O_RDWR|O_LARGEFILE);
 	if (fd < 0)
 		goto out_cdb_err;
 
@@ -4041,6 +5813,7 @@ static int vec_write(struct osd_device *osd, uint64_t pid, uint64_t oid,
 		osd_debug("%s: Offset: %llu", __func__, llu(offset_val + offset));
 		osd_debug("%s: ------------------------------", __func__);
 		ret = pwrite(fd, dinbuf+data_offset, length, offset_val+offset);
+		PROBE5(data_write, pid, oid, offset_val+offset, length, ret);
 		if (ret < 0 || (uint64_t)ret != length)
 			goto out_hw_err;
 		data_offset += length;
@@ -4051,10 +5824,11 @@ static int vec_write(struct osd_device *osd, uint64_t pid, uint64_t oid,
 		osd_debug("%s: Total Bytes Left to write: %llu", __func__,
 			  llu(bytes));
 	}
-	ret = close(fd);
+	ret = fdcache_close(osd, pid, oid, fd);
 	if (ret != 0)
 		goto out_hw_err;
 
+	oinfo_forget(osd, pid, oid); /* scattered, stat again */
 	fill_ccap(&osd->ccap, NULL, USEROBJECT, pid, oid, 0);
 	return OSD_OK; /* success */
 
@@ -4077,36 +5851,181 @@ int osd_write(struct osd_device *osd, uint64_t pid, uint64_t oid,
 	      const struct sg_list *sglist, uint8_t *sense, uint8_t ddt)
 {
 
+	int ret;
+	struct size_acct sa;
+	uint64_t i, end = offset;
+	uint64_t t;
+
 	/*figure out what kind of write it is based on ddt and call appropriate
 	write function*/
 
+	switch(ddt) {
+		case DDT_CONTIG:
+			end = offset + len;
+			break;
+		case DDT_SGL:
+			for (i = 0; sglist && i < sglist->num_entries; i++) {
+				uint64_t e = offset +
+				   get_ntohll(&sglist->entries[i].offset) +
+				   get_ntohll(&sglist->entries[i].bytes_to_transfer);
+				if (e > end)
+					end = e;
+			}
+			break;
+		case DDT_VEC:
+			end = offset + vec_extent(dinbuf, len);
+			break;
+		default: {
+			osd_info("osd_write!!! ddt=%d\n", ddt);
+
+			return sense_build_sdd(sense, OSD_SSK_ILLEGAL_REQUEST,
+			               OSD_ASC_INVALID_FIELD_IN_CDB, pid, oid);
+		}
+	}
+
+	ret = size_check(osd, pid, oid, end, 0, &sa);
+	if (ret != OSD_OK)
+		return size_sense(ret, pid, oid, sense);
+
+	t = lat_now();
 	switch(ddt) {
 		case DDT_CONTIG: {
-			return contig_write(osd, pid, oid, len, offset, dinbuf,
-				           sense);
+			ret = contig_write(osd, pid, oid, len, offset, dinbuf,
+				           &sa, sense);
+			break;
 		}
 		case DDT_SGL: {
-			return sgl_write(osd, pid, oid, len, offset, dinbuf,
-					 sglist, sense);
-		}
-		case DDT_VEC: {
-			return vec_write(osd, pid, oid, len, offset, dinbuf,
-				           sense);
+			ret = sgl_write(osd, pid, oid, len, offset, dinbuf,
+					sglist, sense);
+			break;
 		}
 		default: {
-			osd_info("osd_write!!! ddt=%d\n", ddt);
+			ret = vec_write(osd, pid, oid, len, offset, dinbuf,
+				        sense);
+			break;
+		}
+	}
+	lat_add(osd, RLAT_DATA, t);
 
-			return sense_build_sdd(sense, OSD_SSK_ILLEGAL_REQUEST,
-			               OSD_ASC_INVALID_FIELD_IN_CDB, pid, oid);
+	size_charge(osd, pid, oid, &sa);
+	return ret;
+}
+
+/*
+ * READ or WRITE of n user objects of a partition, the entries as in the
+ * OBJECT_IO_LIST descriptor.  Each object gets its status in a record at
+ * the start of outdata, one failing does not stop the others.  They are
+ * read or written in order, under one db transaction and with the data
+ * files kept open until the end, as in a batch.
+ *
+ * @data: write data of all objects, one after the other
+ *
+ * returns:
+ * ==0: success, used_outlen is set, the records tell about the objects
+ * > 0: error, sense is set
+ */
+int osd_multi_rw(struct osd_device *osd, uint64_t pid, int write,
+		 const uint8_t *entries, uint64_t n, const uint8_t *data,
+		 uint8_t *outdata, uint64_t *used_outlen, uint8_t *sense)
+{
+	int ret, own_fdc = 0;
+	uint64_t i, oid, offset, len, done;
+	const uint8_t *e;
+	uint8_t *st, *buf;
+	uint8_t esense[OSD_MAX_SENSE];
+
+	assert(osd && entries && outdata && used_outlen && sense);
+
+	ret = osd_begin_txn(osd);
+	if (ret != OSD_OK)
+		return sense_build_sdd(sense, OSD_SSK_HARDWARE_ERROR,
+				       OSD_ASC_SYSTEM_RESOURCE_FAILURE, pid, 0);
+	if (!osd->fdc) /* a batch may have them open already */
+		own_fdc = (fdcache_begin(osd) == OSD_OK);
+
+	buf = outdata + n * MULTI_RW_STATUS_LEN;
+	for (i = 0; i < n; i++) {
+		e = entries + i * MULTI_RW_ENTRY_LEN;
+		oid = get_ntohll(e);
+		offset = get_ntohll(e + 8);
+		len = get_ntohll(e + 16);
+
+		done = len;
+		if (write) {
+			ret = osd_write(osd, pid, oid, len, offset, data, NULL,
+					esense, DDT_CONTIG);
+			data += len;
+		} else {
+			ret = osd_read(osd, pid, oid, len, offset, NULL, buf,
+				       &done, NULL, esense, DDT_CONTIG);
 		}
+
+		st = outdata + i * MULTI_RW_STATUS_LEN;
+		memset(st, 0, MULTI_RW_STATUS_LEN);
+		if (ret != OSD_OK) {
+			st[0] = SAM_STAT_CHECK_CONDITION;
+			memcpy(&st[1], &esense[1], 3); /* key, asc, ascq */
+			/* a short read has its data, zero filled */
+			if (!sense_test_type(esense, OSD_SSK_RECOVERED_ERROR,
+				     OSD_ASC_READ_PAST_END_OF_USER_OBJECT)) {
+				done = 0;
+				if (!write)
+					memset(buf, 0, len);
+			}
+		}
+		set_htonll(&st[8], done);
+		if (!write)
+			buf += len;
 	}
+	*used_outlen = buf - outdata;
+
+	if (own_fdc)
+		fdcache_end(osd);
+	ret = osd_end_txn(osd);
+	if (ret != OSD_OK) {
+		/* none of the records holds */
+		osd_error("%s: commit of %llu objects failed", __func__,
+			  llu(n));
+		*used_outlen = 0;
+		return sense_build_sdd(sense, OSD_SSK_HARDWARE_ERROR,
+				       OSD_ASC_SYSTEM_RESOURCE_FAILURE, pid, 0);
+	}
+	return OSD_OK;
+}
+
+/*
+ * Read both atomics of a user object, created on first use, into the
+ * in-memory table.
+ */
+static int load_atomics(struct osd_device *osd, uint64_t pid, uint64_t oid)
+{
+	int i, ret;
+	uint64_t val[2];
+	uint32_t usedlen;
+	const uint32_t number[2] = { UAP_CAS, UAP_FA };
+
+	if (!atomics_enabled(osd))
+		return -EAGAIN;
+	for (i = 0; i < 2; i++) {
+		ret = attr_get_val(osd->dbc, pid, oid, USER_ATOMICS_PG,
+				   number[i], sizeof(val[i]), &val[i],
+				   &usedlen);
+		if (ret == -ENOENT) {
+			val[i] = 0;
+			ret = attr_set_attr(osd->dbc, pid, oid,
+					    USER_ATOMICS_PG, number[i],
+					    &val[i], sizeof(val[i]));
+		}
+		if (ret != OSD_OK)
+			return ret;
+	}
+	return atomics_load(osd, pid, oid, val[0], val[1]);
 }
 
 /*
  * OSD CAS: Available only for USEROBJECTs.
- * TODO: No explicit software locks used. If multithreaded OSD emulator is
- * used behavior is undefined.
- *
+ * Once the value is in the atomics table this also runs without the
+ * device lock, see atomics.c.
  */
 int osd_cas(struct osd_device *osd, uint64_t pid, uint64_t oid, uint64_t cmp,
 	    uint64_t swap, uint8_t *doutbuf, uint64_t *used_outlen,
@@ -4120,6 +6039,9 @@ int osd_cas(struct osd_device *osd, uint64_t pid, uint64_t oid, uint64_t cmp,
 
 	assert(osd && osd->dbc && doutbuf && sense);
 
+	if (atomics_cas(osd, pid, oid, cmp, swap, &val) == OSD_OK)
+		goto out;
+
 	ret = obj_ispresent(osd->dbc, pid, oid, &present);
 	if (ret != OSD_OK || !present) /* object not present! */
 		goto out_cdb_err;
@@ -4128,6 +6050,10 @@ int osd_cas(struct osd_device *osd, uint64_t pid, uint64_t oid, uint64_t cmp,
 	if (obj_type != USEROBJECT)
 		goto out_cdb_err;
 
+	if (load_atomics(osd, pid, oid) == OSD_OK &&
+	    atomics_cas(osd, pid, oid, cmp, swap, &val) == OSD_OK)
+		goto out;
+
 	ret = attr_get_val(osd->dbc, pid, oid, USER_ATOMICS_PG, UAP_CAS,
 			   sizeof(val), &val, &usedlen);
 	if (ret != -ENOENT && ret != OSD_OK)
@@ -4153,8 +6079,57 @@ int osd_cas(struct osd_device *osd, uint64_t pid, uint64_t oid, uint64_t cmp,
 				    UAP_CAS, &swap, sizeof(swap));
 		if (ret != OSD_OK)
 			goto out_hw_err;
+		if (swap != val)
+			async_wake(osd, pid, oid);
 	}
 
+out:
+	set_htonll(doutbuf, val);
+	*used_outlen = sizeof(val);
+	return OSD_OK;
+
+out_hw_err:
+	ret = sense_build_sdd(sense, OSD_SSK_HARDWARE_ERROR,
+			      OSD_ASC_INVALID_FIELD_IN_CDB, pid, oid);
+	return ret;
+
+out_cdb_err:
+	ret = sense_build_sdd(sense, OSD_SSK_ILLEGAL_REQUEST,
+			      OSD_ASC_INVALID_FIELD_IN_CDB, pid, oid);
+	return ret;
+}
+
+
+/*
+ * CAS WAIT: the CAS value as a CAS would return it, but never created or
+ * changed.  Waiters read it each time they are woken.
+ */
+int osd_cas_read(struct osd_device *osd, uint64_t pid, uint64_t oid,
+		 uint8_t *doutbuf, uint64_t *used_outlen, uint8_t *sense)
+{
+	int ret;
+	uint8_t obj_type;
+	uint64_t val;
+	uint32_t usedlen;
+
+	assert(osd && osd->dbc && doutbuf && sense);
+
+	if (atomics_peek(osd, pid, oid, &val) == OSD_OK)
+		goto out;
+
+	/* not present is ILLEGAL_OBJ too */
+	obj_type = get_obj_type(osd, pid, oid);
+	if (obj_type != USEROBJECT)
+		goto out_cdb_err;
+
+	ret = attr_get_val(osd->dbc, pid, oid, USER_ATOMICS_PG, UAP_CAS,
+			   sizeof(val), &val, &usedlen);
+	if (ret == -ENOENT)
+		val = 0;
+	else if (ret != OSD_OK)
+		goto out_hw_err;
+
+out:
 	set_htonll(doutbuf, val);
 	*used_outlen = sizeof(val);
 	return OSD_OK;
@@ -4173,9 +6148,8 @@ out_cdb_err:
 
 /*
  * OSD FA: Available only for USEROBJECTs.
- * TODO: No explicit software locks used. If multithreaded OSD emulator is
- * used, behavior is undefined.
- *
+ * Once the value is in the atomics table this also runs without the
+ * device lock, see atomics.c.
  */
 int osd_fa(struct osd_device *osd, uint64_t pid, uint64_t oid, int64_t add,
 	   uint8_t *doutbuf, uint64_t *used_outlen, uint8_t *sense)
@@ -4188,6 +6162,9 @@ int osd_fa(struct osd_device *osd, uint64_t pid, uint64_t oid, int64_t add,
 
 	assert(osd && osd->dbc && doutbuf && sense);
 
+	if (atomics_fa(osd, pid, oid, add, &val) == OSD_OK)
+		goto out;
+
 	ret = obj_ispresent(osd->dbc, pid, oid, &present);
 	if (ret != OSD_OK || !present) /* object not present! */
 		goto out_cdb_err;
@@ -4196,6 +6173,10 @@ int osd_fa(struct osd_device *osd, uint64_t pid, uint64_t oid, int64_t add,
 	if (obj_type != USEROBJECT)
 		goto out_cdb_err;
 
+	if (load_atomics(osd, pid, oid) == OSD_OK &&
+	    atomics_fa(osd, pid, oid, add, &val) == OSD_OK)
+		goto out;
+
 	ret = attr_get_val(osd->dbc, pid, oid, USER_ATOMICS_PG, UAP_FA,
 			   sizeof(val), &val, &usedlen);
 	if (ret != -ENOENT && ret != OSD_OK)
@@ -4219,6 +6200,7 @@ int osd_fa(struct osd_device *osd, uint64_t pid, uint64_t oid, int64_t add,
 	if (ret != OSD_OK)
 		goto out_hw_err;
 
+out:
 	set_htonll(doutbuf, val);
 	*used_outlen = sizeof(val);
 	return OSD_OK;
@@ -4234,71 +6216,108 @@ out_cdb_err:
 	return ret;
 }
 
+struct gen_cas_arg {
+	uint32_t page;
+	uint32_t number;
+	const uint8_t *cmp;
+	uint16_t cmp_len;
+	uint8_t *orig_le;
+	uint32_t orig_room;
+	uint16_t orig_len;
+	int matched;
+};
+
+/*
+ * Sees the current value where sqlite has it: compare, and put it in the
+ * retrieved attributes as it is.
+ */
+static int gen_cas_visit(const void *val, uint16_t len, void *arg)
+{
+	int ret;
+	struct gen_cas_arg *a = arg;
+
+	if (len == 0)
+		val = NULL;
+	a->orig_len = len;
+	a->matched = (len == a->cmp_len &&
+		      (len == 0 || memcmp(a->cmp, val, len) == 0));
+	ret = le_pack_attr(a->orig_le, a->orig_room, a->page, a->number, len,
+			   val);
+	return ret > 0 ? OSD_OK : ret;
+}
+
 /*
  * OSD_GEN_CAS: generalized cas
  *
  * max(cmp_len and swap_len) == ATTR_LEN_UB == 0xFFFE
  *
+ * The original value, or an empty one if the attribute was not set, is
+ * packed as a list entry into orig_le, orig_room bytes, truncated if it
+ * does not fit; orig_len is its full length.  matched tells whether it
+ * was cmp.  Nothing is copied or allocated on the way.
  */
 int osd_gen_cas(struct osd_device *osd, uint64_t pid, uint64_t oid,
 		uint32_t page, uint32_t number, const uint8_t *cmp,
 		uint16_t cmp_len, const uint8_t *swap, uint16_t swap_len,
-		uint8_t **orig_val, uint16_t *orig_len, uint8_t *sense)
+		uint8_t *orig_le, uint32_t orig_room, uint16_t *orig_len,
+		int *matched, uint8_t *sense)
 {
 	int ret;
 	int present;
 	uint8_t obj_type;
-	uint8_t *val;
-	uint32_t valen;
-
-	assert(osd && osd->dbc && orig_val && orig_len && sense);
-
-	val = malloc(ATTR_LEN_UB);
-	if (!val)
-		goto out_hw_err;
+	struct gen_cas_arg arg = {
+		.page = page,
+		.number = number,
+		.cmp = cmp,
+		.cmp_len = cmp_len,
+		.orig_le = orig_le,
+		.orig_room = orig_room,
+	};
 
-	ret = obj_ispresent(osd->dbc, pid, oid, &present);
-	if (ret != OSD_OK || !present) /* object not present */
-		goto out_cdb_err;
+	assert(osd && osd->dbc && orig_le && orig_len && matched && sense);
 
+	/* not present is ILLEGAL_OBJ too */
 	obj_type = get_obj_type(osd, pid, oid);
 	if (obj_type != USEROBJECT)
 		goto out_cdb_err;
 
-	ret = attr_get_val(osd->dbc, pid, oid, page, number, ATTR_LEN_UB,
-			   val, &valen);
-	if (ret != OSD_OK && ret != -ENOENT)
+	if (page == USER_ATOMICS_PG)
+		atomics_forget(osd, pid, oid, 1);
+
+	ret = attr_visit_val(osd->dbc, pid, oid, page, number, gen_cas_visit,
+			     &arg);
+	if (ret == -ENOENT) {
+		present = 0;
+		arg.matched = (cmp_len == 0);
+		ret = le_pack_attr(orig_le, orig_room, page, number, 0, NULL);
+		if (ret <= 0)
+			goto out_cdb_err;
+	} else if (ret == OSD_OK) {
+		present = 1;
+	} else if (ret == -EOVERFLOW || ret == -EINVAL) {
+		goto out_cdb_err; /* no room for the original value */
+	} else {
 		goto out_hw_err;
+	}
 
 	/*
 	 * swap_len determines if the new entry is being inserted or original
 	 * entry is to be removed.
 	 */
-	if ((swap_len > 0 && swap != NULL) &&
-	    (ret == -ENOENT ||
-	     (valen == cmp_len && memcmp(cmp, val, valen) == 0))) {
+	if ((swap_len > 0 && swap != NULL) && (!present || arg.matched)) {
 		ret = attr_set_attr(osd->dbc, pid, oid, page, number, swap,
 				    swap_len);
 		if (ret != OSD_OK)
 			goto out_hw_err;
-	} else if ((swap_len == 0 && swap == NULL) &&
-		   (valen == cmp_len && memcmp(cmp, val, valen) == 0)) {
+	} else if ((swap_len == 0 && swap == NULL) && present &&
+		   arg.matched) {
 		ret = attr_delete_attr(osd->dbc, pid, oid, page, number);
 		if (ret != OSD_OK)
 			goto out_hw_err;
 	}
 
-	/*
-	 * regardless of successful swap, we return original value, if
-	 * present, else undefined value
-	 */
-	if (ret == -ENOENT) {
-		*orig_val = NULL;
-		*orig_len = 0;
-	} else {
-		*orig_val = val;
-		*orig_len = valen;
-	}
+	*orig_len = arg.orig_len;
+	*matched = arg.matched;
 	return OSD_OK;
 
 out_hw_err:
@@ -78,8 +78,19 @@ int osd_getattr_list(struct osd_device *osd, uint64_t pid, uint64_t oid,
 		     uint32_t page, uint32_t number, uint8_t *outbuf,
 		     uint32_t outlen, uint8_t isembedded, uint8_t listfmt,
 		     uint32_t *used_outlen, uint32_t cdb_cont_len, uint8_t *sense);
+int osd_getattr_multi(struct osd_device *osd, uint64_t pid, uint64_t oid,
+		      uint16_t numoid, const uint8_t *list, uint32_t list_len,
+		      uint8_t *outbuf, uint32_t outlen, uint8_t isembedded,
+		      uint8_t listfmt, uint32_t *used_outlen,
+		      uint32_t cdb_cont_len, uint8_t *sense);
 int osd_get_member_attributes(struct osd_device *osd, uint64_t pid,
-			      uint64_t cid, uint32_t cdb_cont_len, uint8_t *sense);
+			      uint64_t cid, uint64_t initial_oid,
+			      uint16_t numoid, struct getattr_list *get_attr,
+			      uint32_t alloc_len, uint8_t *outdata,
+			      uint64_t *used_outlen, uint8_t *retrieved,
+			      uint32_t retrieved_len,
+			      uint32_t *get_used_outlen, uint32_t cdb_cont_len,
+			      uint8_t *sense);
 int osd_list(struct osd_device *osd, uint8_t list_attr, uint64_t pid,
 	     uint64_t alloc_len, uint64_t initial_oid,
 	     struct getattr_list *get_attr, uint32_t list_id,
@@ -107,13 +118,13 @@ int osd_remove_collection(struct osd_device *osd, uint64_t pid, uint64_t cid,
 			  uint8_t fcr, uint32_t cdb_cont_len, uint8_t *sense);
 int osd_remove_member_objects(struct osd_device *osd, uint64_t pid,
 			      uint64_t cid, uint32_t cdb_cont_len, uint8_t *sense);
-int osd_remove_partition(struct osd_device *osd, uint64_t pid, uint32_t cdb_cont_len, uint8_t *sense);
+int osd_remove_partition(struct osd_device *osd, uint64_t pid, uint8_t fpr,
+			 uint32_t cdb_cont_len, uint8_t *sense);
 int osd_set_attributes(struct osd_device *osd, uint64_t pid, uint64_t oid,
                        uint32_t page, uint32_t number, const void *val,
 		       uint16_t len, uint8_t cmd_type, uint32_t cdb_cont_len, uint8_t *sense);
 int osd_set_key(struct osd_device *osd, int key_to_set, uint64_t pid,
-		uint64_t key, uint8_t seed[OSD_CRYPTO_KEYID_SIZE],
-		uint8_t *sense);
+		uint64_t key, const uint8_t seed[OSD_KEY_LEN], uint8_t *sense);
 int osd_set_master_key(struct osd_device *osd, int dh_step, uint64_t key,
                        uint32_t param_len, uint32_t alloc_len,
 		       uint8_t *outdata, uint64_t *outlen, uint32_t cdb_cont_len, uint8_t *sense);
@@ -125,17 +136,25 @@ int osd_write(struct osd_device *osd, uint64_t pid, uint64_t oid,
 	      uint64_t len, uint64_t offset, const uint8_t *data, 
 	      const struct sg_list *sglist, uint8_t *sense, uint8_t ddt);
 
+int osd_multi_rw(struct osd_device *osd, uint64_t pid, int write,
+		 const uint8_t *entries, uint64_t n, const uint8_t *data,
+		 uint8_t *outdata, uint64_t *used_outlen, uint8_t *sense);
+
 int osd_cas(struct osd_device *osd, uint64_t pid, uint64_t oid, uint64_t cmp,
 	    uint64_t swap, uint8_t *doutbuf, uint64_t *used_outlen,
 	    uint8_t *sense);
 
+int osd_cas_read(struct osd_device *osd, uint64_t pid, uint64_t oid,
+		 uint8_t *doutbuf, uint64_t *used_outlen, uint8_t *sense);
+
 int osd_fa(struct osd_device *osd, uint64_t pid, uint64_t oid, int64_t add,
 	   uint8_t *doutbuf, uint64_t *used_outlen, uint8_t *sense);
 
 int osd_gen_cas(struct osd_device *osd, uint64_t pid, uint64_t oid,
 		uint32_t page, uint32_t number, const uint8_t *cmp,
 		uint16_t cmp_len, const uint8_t *swap, uint16_t swap_len,
-		uint8_t **orig_val, uint16_t *orig_len, uint8_t *sense);
+		uint8_t *orig_le, uint32_t orig_room, uint16_t *orig_len,
+		int *matched, uint8_t *sense);
 
 /* helper functions */
 static inline uint64_t osd_get_created_oid(struct osd_device *osd,
@@ -147,7 +166,7 @@ static inline uint64_t osd_get_created_oid(struct osd_device *osd,
 	return oid;
 }
 
-inline void get_dfile_name(char *path, const char *root,
+void get_dfile_name(char *path, const char *root,
 			   uint64_t pid, uint64_t oid);
 
 #endif /* __OSD_H */
@@ -0,0 +1,257 @@
+/*
+ * Response buffer pool.
+ *
+ * Copyright (C) 2007 OSD Team <pvfs-osd@osc.edu>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, version 2 of the License.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/*
+ * Data-in buffers that osdemu_cmd_submit allocates when the transport
+ * does not supply one. Without the pool each is malloc'ed and the
+ * transport frees it; a large READ then maps, faults in and unmaps its
+ * whole buffer every time.
+ *
+ * With the pool enabled buffers are page aligned mappings, rounded up to
+ * a power of two size class, so they can also be used for O_DIRECT. The
+ * transport hands them back with osdemu_outbuf_release and they are kept
+ * for the next command of that class, already faulted in. Each class
+ * keeps a few, and OUTBUF_CACHE_MAX bounds the total; buffers larger than
+ * the largest class are mapped and unmapped each time.
+ *
+ * The page in front of the data holds the header, so release needs no
+ * lookup. Release may come from another thread than the one submitting.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sys/mman.h>
+#include <assert.h>
+
+#include "osd.h"
+#include "cdb.h"
+#include "outbuf.h"
+#include "osd-util/osd-util.h"
+
+#define OUTBUF_MIN_SHIFT 12			/* 4 KiB */
+#define OUTBUF_CLASSES 15			/* up to 64 MiB */
+#define OUTBUF_KEEP 8				/* free buffers per class */
+#define OUTBUF_CACHE_MAX (256ULL << 20)
+#define OUTBUF_HUGE_SZ (2UL << 20)
+#define OUTBUF_MAGIC 0x4f55544255464652ULL	/* "OUTBUFFR" */
+
+struct outbuf_hdr {
+	uint64_t magic;
+	size_t maplen;			/* of header page and data */
+	int cls;			/* size class, -1 if not pooled */
+	struct outbuf_hdr *next;	/* on the free list */
+};
+
+struct outbuf_pool {
+	pthread_mutex_t lock;		/* protects everything below */
+	int flags;
+	size_t page;
+	struct outbuf_hdr *free[OUTBUF_CLASSES];
+	int nfree[OUTBUF_CLASSES];
+	uint64_t cached;		/* bytes on the free lists */
+	uint64_t hits;
+	uint64_t misses;
+};
+
+int outbuf_init(struct osd_device *osd, int flags)
+{
+	struct outbuf_pool *op;
+
+	if (osd->op)
+		return OSD_OK;
+	op = Calloc(1, sizeof(*op));
+	if (!op)
+		return -ENOMEM;
+	pthread_mutex_init(&op->lock, NULL);
+	op->flags = flags;
+	op->page = sysconf(_SC_PAGESIZE);
+	osd->op = op;
+	return OSD_OK;
+}
+
+static inline uint8_t *hdr_data(struct outbuf_pool *op, struct outbuf_hdr *h)
+{
+	return (uint8_t *)h + op->page;
+}
+
+static inline struct outbuf_hdr *data_hdr(struct outbuf_pool *op,
+					  uint8_t *buf)
+{
+	return (struct outbuf_hdr *)(buf - op->page);
+}
+
+static void unmap(struct outbuf_hdr *h)
+{
+	if (munmap(h, h->maplen) != 0)
+		osd_error_errno("%s: munmap", __func__);
+}
+
+/*
+ * Buffers still held by the transport are not found here; it must
+ * release them before osd_close.
+ */
+void outbuf_fini(struct osd_device *osd)
+{
+	int i;
+	struct outbuf_hdr *h, *next;
+	struct outbuf_pool *op = osd->op;
+
+	if (!op)
+		return;
+	for (i = 0; i < OUTBUF_CLASSES; i++) {
+		for (h = op->free[i]; h; h = next) {
+			next = h->next;
+			unmap(h);
+		}
+	}
+	pthread_mutex_destroy(&op->lock);
+	free(op);
+	osd->op = NULL;
+}
+
+static int size_class(uint64_t len)
+{
+	int cls = 0;
+
+	while (cls < OUTBUF_CLASSES &&
+	       (1ULL << (OUTBUF_MIN_SHIFT + cls)) < len)
+		cls++;
+	return cls < OUTBUF_CLASSES ? cls : -1;
+}
+
+static struct outbuf_hdr *map(struct outbuf_pool *op, size_t datalen)
+{
+	void *p = MAP_FAILED;
+	size_t maplen = op->page + datalen;
+	struct outbuf_hdr *h;
+
+#ifdef MAP_HUGETLB
+	if ((op->flags & OSDEMU_OUTBUF_HUGE) && datalen >= OUTBUF_HUGE_SZ) {
+		size_t hlen = (maplen + OUTBUF_HUGE_SZ - 1) &
+			~(OUTBUF_HUGE_SZ - 1);
+
+		/* reserved huge pages if there are any, else transparent */
+		p = mmap(NULL, hlen, PROT_READ|PROT_WRITE,
+			 MAP_PRIVATE|MAP_ANONYMOUS|MAP_HUGETLB, -1, 0);
+		if (p != MAP_FAILED)
+			maplen = hlen;
+	}
+#endif
+	if (p == MAP_FAILED) {
+		p = mmap(NULL, maplen, PROT_READ|PROT_WRITE,
+			 MAP_PRIVATE|MAP_ANONYMOUS, -1, 0);
+		if (p == MAP_FAILED) {
+			osd_error_errno("%s: mmap %zu", __func__, maplen);
+			return NULL;
+		}
+#ifdef MADV_HUGEPAGE
+		if ((op->flags & OSDEMU_OUTBUF_HUGE) &&
+		    datalen >= OUTBUF_HUGE_SZ)
+			madvise(p, maplen, MADV_HUGEPAGE);
+#endif
+	}
+	h = p;
+	h->magic = OUTBUF_MAGIC;
+	h->maplen = maplen;
+	h->next = NULL;
+	return h;
+}
+
+/*
+ * returns: a page aligned buffer of at least len bytes, not zeroed; NULL
+ * if out of memory
+ */
+uint8_t *outbuf_get(struct osd_device *osd, uint64_t len)
+{
+	int cls;
+	size_t datalen;
+	struct outbuf_hdr *h = NULL;
+	struct outbuf_pool *op = osd->op;
+
+	cls = size_class(len);
+	if (cls >= 0) {
+		pthread_mutex_lock(&op->lock);
+		h = op->free[cls];
+		if (h) {
+			op->free[cls] = h->next;
+			op->nfree[cls]--;
+			op->cached -= h->maplen;
+			op->hits++;
+		} else {
+			op->misses++;
+		}
+		pthread_mutex_unlock(&op->lock);
+		if (h)
+			return hdr_data(op, h);
+		datalen = 1ULL << (OUTBUF_MIN_SHIFT + cls);
+	} else {
+		pthread_mutex_lock(&op->lock);
+		op->misses++;
+		pthread_mutex_unlock(&op->lock);
+		datalen = (len + op->page - 1) & ~(op->page - 1);
+	}
+
+	h = map(op, datalen);
+	if (!h)
+		return NULL;
+	h->cls = cls;
+	return hdr_data(op, h);
+}
+
+void outbuf_put(struct osd_device *osd, uint8_t *buf)
+{
+	int cls;
+	struct outbuf_hdr *h;
+	struct outbuf_pool *op = osd->op;
+
+	if (!buf)
+		return;
+	h = data_hdr(op, buf);
+	assert(h->magic == OUTBUF_MAGIC);
+	cls = h->cls;
+	if (cls >= 0) {
+		pthread_mutex_lock(&op->lock);
+		if (op->nfree[cls] < OUTBUF_KEEP &&
+		    op->cached + h->maplen <= OUTBUF_CACHE_MAX) {
+			h->next = op->free[cls];
+			op->free[cls] = h;
+			op->nfree[cls]++;
+			op->cached += h->maplen;
+			h = NULL;
+		}
+		pthread_mutex_unlock(&op->lock);
+	}
+	if (h)
+		unmap(h);
+}
+
+void outbuf_stats(struct osd_device *osd, uint64_t *hits, uint64_t *misses)
+{
+	struct outbuf_pool *op = osd->op;
+
+	*hits = *misses = 0;
+	if (!op)
+		return;
+	pthread_mutex_lock(&op->lock);
+	*hits = op->hits;
+	*misses = op->misses;
+	pthread_mutex_unlock(&op->lock);
+}
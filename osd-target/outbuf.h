@@ -0,0 +1,34 @@
+/*
+ * Response buffer pool.
+ *
+ * Copyright (C) 2007 OSD Team <pvfs-osd@osc.edu>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, version 2 of the License.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#ifndef __OUTBUF_H
+#define __OUTBUF_H
+
+#include <stdint.h>
+#include "osd-types.h"
+
+int outbuf_init(struct osd_device *osd, int flags);
+
+void outbuf_fini(struct osd_device *osd);
+
+uint8_t *outbuf_get(struct osd_device *osd, uint64_t len);
+
+void outbuf_put(struct osd_device *osd, uint8_t *buf);
+
+void outbuf_stats(struct osd_device *osd, uint64_t *hits, uint64_t *misses);
+
+#endif /* __OUTBUF_H */
@@ -0,0 +1,566 @@
+/*
+ * Partition accounting.
+ *
+ * Copyright (C) 2007 OSD Team <pvfs-osd@osc.edu>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, version 2 of the License.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/*
+ * Used bytes and number of user objects of each partition, kept in memory
+ * and adjusted by every command that changes them, so the partition and
+ * root information pages and quota checks need neither statfs nor a
+ * COUNT query.
+ *
+ * Used bytes is the sum of the logical lengths of the user objects; that
+ * is what a write can be charged for exactly before it is done.
+ *
+ * Counters are written to PART_ACCT_PG of the partition on osd_close, and
+ * then the clean marker is created. osd_open removes the marker. If it
+ * was missing the last run did not close and the stored counters of each
+ * partition are dropped; a partition without stored counters is recounted
+ * from its data files.  The first write that checks them starts a
+ * background job for that, RECOUNT_BATCH objects a step, in oid order;
+ * reading the counters finishes it at once.
+ *
+ * Changes to a partition whose counters are stale are not tracked, the
+ * recount sees them.  While it runs, changes to the objects it has
+ * counted already are tracked, the others it sees when it gets there.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <sys/statfs.h>
+#include <assert.h>
+
+#include "osd.h"
+#include "db.h"
+#include "obj.h"
+#include "attr.h"
+#include "part.h"
+#include "oinfo.h"
+#include "job.h"
+#include "osd-util/osd-util.h"
+
+#define PART_BUCKETS 64 /* power of 2 */
+#define RECOUNT_BATCH 1024
+
+struct part_table {
+	char clean[MAXNAMELEN];	/* marker of a clean close */
+	uint64_t capacity;	/* of the filesystem */
+	int64_t npart;		/* number of partitions, -1 until counted */
+	struct part *bucket[PART_BUCKETS];
+};
+
+static inline struct part **part_bucket(struct part_table *pt, uint64_t pid)
+{
+	return &pt->bucket[pid & (PART_BUCKETS - 1)];
+}
+
+static int sync_dir(const char *path)
+{
+	int fd, ret;
+	char dir[MAXNAMELEN];
+	char *slash;
+
+	strcpy(dir, path);
+	slash = strrchr(dir, '/');
+	if (slash)
+		*slash = '\0';
+	fd = open(dir, O_RDONLY);
+	if (fd < 0)
+		return -errno;
+	ret = fsync(fd);
+	close(fd);
+	return ret;
+}
+
+/*
+ * Drop the stored counters of every partition, by key, rather than
+ * going through the whole attr table for the page.
+ */
+static int forget_stored(struct osd_device *osd)
+{
+	int ret = 0;
+	uint64_t i, pid = 0;
+	uint64_t used_len = 0, add_len = 0, cont_id = 0;
+	uint8_t buf[64 * 8];
+
+	ret = db_begin_txn(osd->dbc);
+	if (ret != OSD_OK)
+		return ret;
+	do {
+		ret = obj_get_all_pids(osd->dbc, pid, sizeof(buf), buf,
+				       &used_len, &add_len, &cont_id);
+		for (i = 0; ret == OSD_OK && i < used_len; i += 8) {
+			pid = get_ntohll(&buf[i]);
+			ret = attr_delete_attr(osd->dbc, pid, PARTITION_OID,
+					       PART_ACCT_PG, PART_ACCT_USED);
+			if (ret == OSD_OK)
+				ret = attr_delete_attr(osd->dbc, pid,
+						       PARTITION_OID,
+						       PART_ACCT_PG,
+						       PART_ACCT_OBJECTS);
+		}
+		pid = cont_id;
+	} while (ret == OSD_OK && cont_id != 0);
+	if (db_end_txn(osd->dbc) != OSD_OK && ret == OSD_OK)
+		ret = OSD_ERROR;
+	return ret;
+}
+
+/*
+ * clean: path of the marker, next to the db. The db must be open.
+ */
+int part_init(struct osd_device *osd, const char *clean)
+{
+	int ret = 0;
+	struct statfs sfs;
+	struct part_table *pt;
+
+	pt = Calloc(1, sizeof(*pt));
+	if (!pt)
+		return -ENOMEM;
+	strncpy(pt->clean, clean, sizeof(pt->clean) - 1);
+	pt->npart = -1;
+
+	if (statfs(clean, &sfs) == 0)
+		pt->capacity = sfs.f_blocks * BLOCK_SZ;
+	else if (statfs(osd->root, &sfs) == 0)
+		pt->capacity = sfs.f_blocks * BLOCK_SZ;
+
+	/* from here on a crash must not find the marker */
+	if (unlink(clean) == 0) {
+		ret = sync_dir(clean);
+	} else if (errno == ENOENT) {
+		osd_debug("%s: no clean close, partitions will be recounted",
+			  __func__);
+		ret = forget_stored(osd);
+	} else {
+		ret = -errno;
+	}
+	if (ret != OSD_OK) {
+		osd_error("%s: cannot reset %s", __func__, clean);
+		free(pt);
+		return ret;
+	}
+
+	osd->pt = pt;
+	return OSD_OK;
+}
+
+static int store(struct osd_device *osd, uint64_t pid, uint32_t number,
+		 uint64_t val)
+{
+	uint8_t ll[8];
+
+	set_htonll(ll, val);
+	return attr_set_attr(osd->dbc, pid, PARTITION_OID, PART_ACCT_PG,
+			     number, ll, sizeof(ll));
+}
+
+static int load(struct osd_device *osd, uint64_t pid, uint32_t page,
+		uint32_t number, uint64_t *val)
+{
+	int ret;
+	uint8_t ll[8];
+	uint32_t len = 0;
+
+	ret = attr_get_val(osd->dbc, pid, PARTITION_OID, page, number,
+			   sizeof(ll), ll, &len);
+	if (ret != OSD_OK)
+		return ret;
+	if (len != sizeof(ll))
+		return -ENOENT;
+	*val = get_ntohll(ll);
+	return OSD_OK;
+}
+
+/*
+ * Write the counters to the db. Called by osd_close before the db goes.
+ */
+void part_flush(struct osd_device *osd)
+{
+	int i;
+	int ret = 0;
+	struct part *p;
+	struct part_table *pt = osd->pt;
+
+	if (!pt)
+		return;
+
+	ret = db_begin_txn(osd->dbc);
+	if (ret != OSD_OK)
+		return;
+	for (i = 0; i < PART_BUCKETS; i++) {
+		for (p = pt->bucket[i]; p; p = p->next) {
+			if (p->stale)
+				continue;
+			ret = store(osd, p->pid, PART_ACCT_USED, p->used);
+			if (ret == OSD_OK)
+				ret = store(osd, p->pid, PART_ACCT_OBJECTS,
+					    p->objects);
+			if (ret != OSD_OK)
+				osd_error("%s: pid %llu", __func__,
+					  llu(p->pid));
+		}
+	}
+	db_end_txn(osd->dbc);
+}
+
+/*
+ * Called after the db is closed and the filesystem synced by intent_close,
+ * so the marker cannot be on disk before the counters it vouches for.
+ */
+void part_fini(struct osd_device *osd)
+{
+	int i, fd;
+	struct part *p, *next;
+	struct part_table *pt = osd->pt;
+
+	if (!pt)
+		return;
+
+	fd = open(pt->clean, O_WRONLY|O_CREAT|O_TRUNC, 0600);
+	if (fd >= 0)
+		close(fd);
+	else
+		osd_error_errno("%s: create %s", __func__, pt->clean);
+
+	for (i = 0; i < PART_BUCKETS; i++) {
+		for (p = pt->bucket[i]; p; p = next) {
+			next = p->next;
+			free(p);
+		}
+	}
+	free(pt);
+	osd->pt = NULL;
+}
+
+static struct part *part_find(struct part_table *pt, uint64_t pid)
+{
+	struct part *p;
+
+	for (p = *part_bucket(pt, pid); p; p = p->next)
+		if (p->pid == pid)
+			return p;
+	return NULL;
+}
+
+static struct part *part_lookup(struct osd_device *osd, uint64_t pid)
+{
+	int ret;
+	struct part *p;
+	struct part **head = part_bucket(osd->pt, pid);
+
+	p = part_find(osd->pt, pid);
+	if (p)
+		return p;
+
+	p = Calloc(1, sizeof(*p));
+	if (!p)
+		return NULL;
+	p->pid = pid;
+
+	ret = load(osd, pid, PARTITION_PG + QUOTA_OFFSET,
+		   PARTITION_CAPACITY_QUOTA, &p->quota);
+	if (ret == -ENOENT)
+		p->quota = PART_NO_QUOTA;
+	else if (ret != OSD_OK)
+		goto out_err;
+
+	ret = load(osd, pid, PART_ACCT_PG, PART_ACCT_USED, &p->used);
+	if (ret == OSD_OK)
+		ret = load(osd, pid, PART_ACCT_PG, PART_ACCT_OBJECTS,
+			   &p->objects);
+	if (ret == -ENOENT)
+		p->stale = 1;
+	else if (ret != OSD_OK)
+		goto out_err;
+
+	p->next = *head;
+	*head = p;
+	return p;
+
+out_err:
+	free(p);
+	return NULL;
+}
+
+/*
+ * Count the next RECOUNT_BATCH user objects of a partition being
+ * recounted.
+ *
+ * returns: OSD_REPEAT while more remain, OSD_OK once the counters are
+ * current, <0 on error
+ */
+static int recount_batch(struct osd_device *osd, struct part *p)
+{
+	int ret = 0;
+	uint32_t i, count = 0;
+	uint64_t size;
+	uint64_t oids[RECOUNT_BATCH];
+
+	osd_debug("%s: pid %llu from %llu", __func__, llu(p->pid),
+		  llu(p->cursor));
+
+	ret = obj_get_oid_batch(osd->dbc, p->pid, p->cursor, oids,
+				RECOUNT_BATCH, &count);
+	if (ret != OSD_OK) {
+		p->recounting = 0; /* starts over when needed again */
+		return ret;
+	}
+	for (i = 0; i < count; i++) {
+		if (oinfo_size(osd, p->pid, oids[i], &size) != OSD_OK)
+			continue;
+		p->used += size;
+		p->objects++;
+	}
+	if (count == RECOUNT_BATCH) {
+		p->cursor = oids[count - 1] + 1;
+		return OSD_REPEAT;
+	}
+	p->stale = 0;
+	p->recounting = 0;
+	return OSD_OK;
+}
+
+static int recount_step(struct osd_device *osd, struct job *job)
+{
+	struct part *p;
+
+	if (!osd->pt)
+		return OSD_OK;
+	/* the partition may have gone, or come again, meanwhile */
+	p = part_find(osd->pt, job->pid);
+	if (!p || !p->recounting)
+		return OSD_OK;
+	return recount_batch(osd, p);
+}
+
+static void recount_begin(struct part *p)
+{
+	p->used = 0;
+	p->objects = 0;
+	p->cursor = USEROBJECT_OID_LB;
+	p->recounting = 1;
+}
+
+/*
+ * returns: the counters of partition pid, recounted if needed, NULL on
+ * error
+ */
+struct part *part_get(struct osd_device *osd, uint64_t pid)
+{
+	int ret;
+	struct part *p;
+
+	if (!osd->pt)
+		return NULL;
+	p = part_lookup(osd, pid);
+	if (!p || !p->stale)
+		return p;
+	if (!p->recounting)
+		recount_begin(p);
+	do {
+		ret = recount_batch(osd, p);
+	} while (ret == OSD_REPEAT);
+	return ret == OSD_OK ? p : NULL;
+}
+
+/*
+ * A change to user object oid shows in the counters if they are current,
+ * or the recount has counted oid already.
+ */
+static inline int part_tracks(const struct part *p, uint64_t oid)
+{
+	return !p->stale || (p->recounting && oid < p->cursor);
+}
+
+uint64_t part_capacity(struct osd_device *osd)
+{
+	return osd->pt ? osd->pt->capacity : 0;
+}
+
+int part_count(struct osd_device *osd, uint64_t *npart)
+{
+	int ret;
+	uint64_t n = 0;
+	struct part_table *pt = osd->pt;
+
+	if (pt && pt->npart >= 0) {
+		*npart = pt->npart;
+		return OSD_OK;
+	}
+	ret = obj_pcount(osd->dbc, &n);
+	if (ret != OSD_OK)
+		return ret;
+	if (pt)
+		pt->npart = n;
+	*npart = n;
+	return OSD_OK;
+}
+
+/*
+ * Reserve growth bytes of the partition for a change that is yet to be
+ * done; part_release gives them back once it has been charged, or has
+ * failed.  Changes checked together, while the device lock is let go,
+ * cannot then go over the quota between them.
+ *
+ * returns: OSD_OK if the partition may grow by growth bytes, -EDQUOT if
+ * that goes over its quota, OSD_ERROR if the counters are unavailable
+ */
+int part_reserve(struct osd_device *osd, uint64_t pid, uint64_t growth)
+{
+	struct part *p;
+	uint64_t need;
+
+	if (growth == 0 || !osd->pt)
+		return OSD_OK;
+	p = part_lookup(osd, pid);
+	if (!p)
+		return OSD_ERROR;
+	if (p->stale && !p->recounting) {
+		recount_begin(p);
+		if (job_submit(osd, pid, PARTITION_OID, NULL,
+			       recount_step) != OSD_OK)
+			p->recounting = 0;
+	}
+	if (p->quota != PART_NO_QUOTA) {
+		if (p->stale && !p->recounting) {
+			p = part_get(osd, pid); /* no job, count now */
+			if (!p)
+				return OSD_ERROR;
+		}
+		/* while recounting, used is a lower bound */
+		need = p->used + p->reserved;
+		if (need < p->used || need + growth < need ||
+		    need + growth > p->quota)
+			return -EDQUOT;
+	}
+	p->reserved += growth;
+	return OSD_OK;
+}
+
+void part_release(struct osd_device *osd, uint64_t pid, uint64_t growth)
+{
+	struct part *p;
+
+	if (growth == 0 || !osd->pt)
+		return;
+	p = part_find(osd->pt, pid);
+	if (!p)
+		return; /* dropped with the partition */
+	if (p->reserved >= growth)
+		p->reserved -= growth;
+	else
+		p->reserved = 0;
+}
+
+/*
+ * A user object's logical length changed.
+ */
+void part_resized(struct osd_device *osd, uint64_t pid, uint64_t oid,
+		  uint64_t from, uint64_t to)
+{
+	struct part *p;
+
+	if (from == to || !osd->pt)
+		return;
+	p = part_lookup(osd, pid);
+	if (!p || !part_tracks(p, oid))
+		return;
+	if (to > from)
+		p->used += to - from;
+	else if (p->used >= from - to)
+		p->used -= from - to;
+	else
+		p->used = 0;
+}
+
+/*
+ * User object oid was created, n == 1, or removed, n == -1.
+ */
+void part_objects(struct osd_device *osd, uint64_t pid, uint64_t oid,
+		  int64_t n)
+{
+	struct part *p;
+
+	if (!osd->pt)
+		return;
+	p = part_lookup(osd, pid);
+	if (!p || !part_tracks(p, oid))
+		return;
+	if (n < 0 && p->objects < (uint64_t)-n)
+		p->objects = 0;
+	else
+		p->objects += n;
+}
+
+void part_set_quota(struct osd_device *osd, uint64_t pid, uint64_t quota)
+{
+	struct part *p;
+
+	if (!osd->pt)
+		return;
+	p = part_lookup(osd, pid);
+	if (p)
+		p->quota = quota;
+}
+
+static void part_drop(struct part_table *pt, uint64_t pid)
+{
+	struct part *p, **pp;
+
+	for (pp = part_bucket(pt, pid); (p = *pp); pp = &p->next) {
+		if (p->pid == pid) {
+			*pp = p->next;
+			free(p);
+			return;
+		}
+	}
+}
+
+void part_created(struct osd_device *osd, uint64_t pid)
+{
+	struct part *p;
+	struct part **head;
+
+	if (!osd->pt)
+		return;
+	if (osd->pt->npart >= 0)
+		osd->pt->npart++;
+	part_drop(osd->pt, pid); /* left over from an earlier pid */
+
+	p = Calloc(1, sizeof(*p));
+	if (!p)
+		return; /* looked up from the db when needed */
+	p->pid = pid;
+	p->quota = PART_NO_QUOTA;
+	head = part_bucket(osd->pt, pid);
+	p->next = *head;
+	*head = p;
+}
+
+void part_removed(struct osd_device *osd, uint64_t pid)
+{
+	if (!osd->pt)
+		return;
+	if (osd->pt->npart > 0)
+		osd->pt->npart--;
+	part_drop(osd->pt, pid);
+}
@@ -0,0 +1,73 @@
+/*
+ * Partition accounting.
+ *
+ * Copyright (C) 2007 OSD Team <pvfs-osd@osc.edu>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, version 2 of the License.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#ifndef __PART_H
+#define __PART_H
+
+#include <stdint.h>
+#include "osd-types.h"
+
+/* counters are kept here between runs, not visible to SET ATTRIBUTES */
+#define PART_ACCT_PG (PARTITION_PG + VEND_PG_LB)
+enum {
+	PART_ACCT_USED = 1,
+	PART_ACCT_OBJECTS = 2,
+};
+
+#define PART_NO_QUOTA ((uint64_t)-1)
+
+struct part {
+	uint64_t pid;
+	uint64_t used;		/* sum of logical lengths of user objects */
+	uint64_t objects;	/* number of user objects */
+	uint64_t quota;		/* capacity quota, PART_NO_QUOTA if none */
+	uint64_t reserved;	/* growth checked but not charged yet */
+	uint8_t stale;		/* counters must be recounted before use */
+	uint8_t recounting;	/* by a job, objects below cursor done */
+	uint64_t cursor;
+	struct part *next;
+};
+
+int part_init(struct osd_device *osd, const char *clean);
+
+void part_flush(struct osd_device *osd);
+
+void part_fini(struct osd_device *osd);
+
+struct part *part_get(struct osd_device *osd, uint64_t pid);
+
+uint64_t part_capacity(struct osd_device *osd);
+
+int part_count(struct osd_device *osd, uint64_t *npart);
+
+int part_reserve(struct osd_device *osd, uint64_t pid, uint64_t growth);
+
+void part_release(struct osd_device *osd, uint64_t pid, uint64_t growth);
+
+void part_resized(struct osd_device *osd, uint64_t pid, uint64_t oid,
+		  uint64_t from, uint64_t to);
+
+void part_objects(struct osd_device *osd, uint64_t pid, uint64_t oid,
+		  int64_t n);
+
+void part_set_quota(struct osd_device *osd, uint64_t pid, uint64_t quota);
+
+void part_created(struct osd_device *osd, uint64_t pid);
+
+void part_removed(struct osd_device *osd, uint64_t pid);
+
+#endif /* __PART_H */
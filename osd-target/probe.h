@@ -0,0 +1,57 @@
+/*
+ * Static tracepoints.
+ *
+ * Copyright (C) 2007 OSD Team <pvfs-osd@osc.edu>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, version 2 of the License.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#ifndef __PROBE_H
+#define __PROBE_H
+
+/*
+ * USDT probes of provider osdemu, built whenever sys/sdt.h from systemtap
+ * is found; OSD_USDT=0 leaves them out, OSD_USDT=1 insists on them.  Each
+ * is a nop in the code and a note in the binary, attach with e.g.
+ *
+ *   bpftrace -e 'usdt:./tgtd:osdemu:cmd_done { @[arg0] = count(); }'
+ *
+ * Arguments must be cheap, they are computed even when nothing is
+ * attached.  Without the header the probes are compiled out.
+ *
+ * cmd_start	action, pid, oid, cdb_cont_len
+ * cmd_done	action, pid, oid, senselen
+ * sql_step	caller, stmt, sqlite rc
+ * sql_done	caller, stmt, sqlite rc of reset
+ * data_read	pid, oid, offset, len, result
+ * data_write	pid, oid, offset, len, result
+ */
+#if !defined(OSD_USDT) && defined(__has_include)
+#if __has_include(<sys/sdt.h>)
+#define OSD_USDT 1
+#endif
+#endif
+
+#if defined(OSD_USDT) && OSD_USDT
+#include <sys/sdt.h>
+
+#define PROBE3(name, a, b, c) DTRACE_PROBE3(osdemu, name, a, b, c)
+#define PROBE4(name, a, b, c, d) DTRACE_PROBE4(osdemu, name, a, b, c, d)
+#define PROBE5(name, a, b, c, d, e) \
+	DTRACE_PROBE5(osdemu, name, a, b, c, d, e)
+#else
+#define PROBE3(name, a, b, c) do { } while (0)
+#define PROBE4(name, a, b, c, d) do { } while (0)
+#define PROBE5(name, a, b, c, d, e) do { } while (0)
+#endif
+
+#endif /* __PROBE_H */
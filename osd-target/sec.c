@@ -0,0 +1,656 @@
+/*
+ * Security methods: keys and capability checking.
+ *
+ * Copyright (C) 2007 OSD Team <pvfs-osd@osc.edu>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, version 2 of the License.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/*
+ * The key hierarchy of osd2r04 sec 4.11.5: the master key, the root key
+ * derived from it, a partition key per partition derived from the root
+ * key, and up to 16 working keys per partition derived from that.  SET
+ * KEY makes a new key as the HMAC of its parent key over the seed sent.
+ * Keys are kept in the seckey table, out of reach of GET ATTRIBUTES, and
+ * all of them in memory.  The master key is all zeros until the host
+ * provides one with sec_set_master.
+ *
+ * Commands are checked only if the default security method of the root
+ * policy/security page is other than NOSEC.  Then the capability of the
+ * CDB must use at least that method, allow the command on its object and
+ * not have expired, and the request integrity check value must verify
+ * with the capability key: the HMAC over the capability of the working
+ * key of the partition, or of the root key for the root object, or of
+ * the parent key for SET KEY.  Under CAPKEY the check value is the HMAC
+ * with the capability key over the channel identifier, empty on this
+ * target; under CMDRSP it is that over the CDB with the check value field
+ * zeroed.  ALLDATA and nonces are not supported.  A capability of an
+ * unknown format fails with INVALID FIELD IN CDB, one that does not grant
+ * the command or whose check value does not verify with ACCESS DENIED -
+ * NO ACCESS RIGHTS.  Check values are compared in constant time.
+ *
+ * Capability keys are cached by capability, direct mapped, and so is the
+ * last CAPKEY check value verified with each.  A command under a cached
+ * capability costs one HMAC with CMDRSP, none with CAPKEY.  Any key change
+ * invalidates the whole cache.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <time.h>
+#include <assert.h>
+#include <openssl/crypto.h>
+#include <openssl/evp.h>
+#include <openssl/hmac.h>
+
+#include "osd.h"
+#include "db.h"
+#include "attr.h"
+#include "sec.h"
+#include "target-sense.h"
+#include "osd-util/osd-util.h"
+#include "osd-util/osd-sense.h"
+
+#define SEC_BUCKETS 64 /* power of 2 */
+#define CAP_SLOTS 1024 /* power of 2 */
+
+struct sec_part {
+	uint64_t pid;
+	uint32_t working_set;	/* bit v: working key v is set */
+	uint8_t has_key;	/* partition key is set */
+	uint8_t key[OSD_KEY_LEN];
+	uint8_t working[OSD_WORKING_KEYS][OSD_KEY_LEN];
+	struct sec_part *next;
+};
+
+struct cap_slot {
+	uint64_t gen;		/* of the keys when filled, 0 if empty */
+	const uint8_t *secret;	/* key the capability key comes from */
+	uint8_t cap[CAP_LEN];
+	uint8_t key[OSD_KEY_LEN];	/* capability key */
+	uint8_t ricv[SEC_RICV_LEN];	/* last CAPKEY value verified */
+	uint8_t ricv_ok;
+};
+
+struct sec_table {
+	uint8_t method;		/* default security method */
+	uint8_t has_root;
+	uint8_t master[OSD_KEY_LEN];
+	uint8_t root[OSD_KEY_LEN];
+	uint64_t gen;		/* bumped by every key change */
+	uint64_t hits;
+	uint64_t misses;
+	struct sec_part *bucket[SEC_BUCKETS];
+	struct cap_slot slot[CAP_SLOTS];
+};
+
+/* created here, not in osd.schema, so that older stores get it too */
+static const char seckey_schema[] =
+	"CREATE TABLE IF NOT EXISTS seckey ("
+	" pid INTEGER NOT NULL,"
+	" kind INTEGER NOT NULL,"
+	" version INTEGER NOT NULL,"
+	" value BLOB NOT NULL,"
+	" PRIMARY KEY (pid, kind, version));";
+
+void sec_hmac(const uint8_t key[OSD_KEY_LEN], const void *data, size_t len,
+	      uint8_t mac[OSD_KEY_LEN])
+{
+	unsigned int maclen = OSD_KEY_LEN;
+
+	HMAC(EVP_sha1(), key, OSD_KEY_LEN, data, len, mac, &maclen);
+}
+
+/*
+ * The request integrity check value of cdb under its capability key.
+ */
+static void request_icv(const uint8_t *cdb, const uint8_t *cap_key,
+			uint8_t mac[OSD_KEY_LEN])
+{
+	uint8_t buf[OSD_CDB_SIZE];
+
+	if ((cdb[CAP_OFF + CAP_SECURITY_METHOD] & 0xF) == OSD_SEC_CAPKEY) {
+		sec_hmac(cap_key, "", 0, mac);
+		return;
+	}
+	memcpy(buf, cdb, OSD_CDB_SIZE);
+	memset(&buf[SEC_RICV_OFF], 0, SEC_RICV_LEN);
+	sec_hmac(cap_key, buf, OSD_CDB_SIZE, mac);
+}
+
+void sec_sign(uint8_t *cdb, const uint8_t cap_key[OSD_KEY_LEN])
+{
+	uint8_t mac[OSD_KEY_LEN];
+
+	request_icv(cdb, cap_key, mac);
+	memcpy(&cdb[SEC_RICV_OFF], mac, SEC_RICV_LEN);
+}
+
+static inline struct sec_part **sec_bucket(struct sec_table *st,
+					   uint64_t pid)
+{
+	return &st->bucket[pid & (SEC_BUCKETS - 1)];
+}
+
+static struct sec_part *sec_lookup(struct sec_table *st, uint64_t pid,
+				   int create)
+{
+	struct sec_part *p;
+	struct sec_part **head = sec_bucket(st, pid);
+
+	for (p = *head; p; p = p->next)
+		if (p->pid == pid)
+			return p;
+	if (!create)
+		return NULL;
+
+	p = Calloc(1, sizeof(*p));
+	if (!p)
+		return NULL;
+	p->pid = pid;
+	p->next = *head;
+	*head = p;
+	return p;
+}
+
+/*
+ * Put a key read from or going to the db in its place in memory.
+ */
+static int sec_place(struct sec_table *st, uint64_t pid, int kind,
+		     uint8_t version, const uint8_t *key)
+{
+	struct sec_part *p;
+
+	switch (kind) {
+	case OSD_KEY_MASTER:
+		memcpy(st->master, key, OSD_KEY_LEN);
+		break;
+	case OSD_KEY_ROOT:
+		memcpy(st->root, key, OSD_KEY_LEN);
+		st->has_root = 1;
+		break;
+	case OSD_KEY_PARTITION:
+	case OSD_KEY_WORKING:
+		if (version >= OSD_WORKING_KEYS)
+			return -EINVAL;
+		p = sec_lookup(st, pid, 1);
+		if (!p)
+			return -ENOMEM;
+		if (kind == OSD_KEY_PARTITION) {
+			memcpy(p->key, key, OSD_KEY_LEN);
+			p->has_key = 1;
+		} else {
+			memcpy(p->working[version], key, OSD_KEY_LEN);
+			p->working_set |= 1U << version;
+		}
+		break;
+	default:
+		return -EINVAL;
+	}
+	st->gen++;
+	return OSD_OK;
+}
+
+static int sec_load(struct osd_device *osd, struct sec_table *st)
+{
+	int ret = 0;
+	const char *SQL = "SELECT pid, kind, version, value FROM seckey;";
+	sqlite3_stmt *stmt = NULL;
+
+	ret = sqlite3_prepare(osd->dbc->db, SQL, strlen(SQL)+1, &stmt, NULL);
+	if (ret != SQLITE_OK) {
+		error_sql(osd->dbc->db, "%s: sqlite3_prepare", __func__);
+		return -EIO;
+	}
+
+	ret = OSD_OK;
+	while (sqlite3_step(stmt) == SQLITE_ROW) {
+		if (sqlite3_column_bytes(stmt, 3) != OSD_KEY_LEN)
+			continue;
+		ret = sec_place(st, sqlite3_column_int64(stmt, 0),
+				sqlite3_column_int(stmt, 1),
+				sqlite3_column_int(stmt, 2),
+				sqlite3_column_blob(stmt, 3));
+		if (ret != OSD_OK)
+			break;
+	}
+
+	if (sqlite3_finalize(stmt) != SQLITE_OK) {
+		error_sql(osd->dbc->db, "%s: finalize", __func__);
+		ret = -EIO;
+	}
+	return ret;
+}
+
+static int sec_store(struct osd_device *osd, uint64_t pid, int kind,
+		     uint8_t version, const uint8_t *key)
+{
+	int ret = 0;
+	const char *SQL = "INSERT OR REPLACE INTO seckey VALUES (?, ?, ?, ?);";
+	sqlite3_stmt *stmt = NULL;
+
+	ret = sqlite3_prepare(osd->dbc->db, SQL, strlen(SQL)+1, &stmt, NULL);
+	if (ret != SQLITE_OK) {
+		error_sql(osd->dbc->db, "%s: sqlite3_prepare", __func__);
+		return -EIO;
+	}
+
+	ret = sqlite3_bind_int64(stmt, 1, pid);
+	ret |= sqlite3_bind_int(stmt, 2, kind);
+	ret |= sqlite3_bind_int(stmt, 3, version);
+	ret |= sqlite3_bind_blob(stmt, 4, key, OSD_KEY_LEN, SQLITE_TRANSIENT);
+	if (ret == SQLITE_OK)
+		ret = sqlite3_step(stmt);
+	if (ret != SQLITE_DONE) {
+		error_sql(osd->dbc->db, "%s: sqlite3_step", __func__);
+		ret = -EIO;
+	} else {
+		ret = OSD_OK;
+	}
+
+	if (sqlite3_finalize(stmt) != SQLITE_OK)
+		error_sql(osd->dbc->db, "%s: finalize", __func__);
+	return ret;
+}
+
+static void sec_free(struct sec_table *st)
+{
+	int i;
+	struct sec_part *p, *next;
+
+	for (i = 0; i < SEC_BUCKETS; i++) {
+		for (p = st->bucket[i]; p; p = next) {
+			next = p->next;
+			free(p);
+		}
+	}
+	/* keys do not stay around in freed memory */
+	memset(st, 0, sizeof(*st));
+	free(st);
+}
+
+/*
+ * The db must be open.
+ */
+int sec_init(struct osd_device *osd)
+{
+	int ret = 0;
+	uint8_t method = OSD_SEC_NOSEC;
+	uint32_t len = 0;
+	char *err = NULL;
+	struct sec_table *st;
+
+	st = Calloc(1, sizeof(*st));
+	if (!st)
+		return -ENOMEM;
+	st->gen = 1;
+
+	ret = sqlite3_exec(osd->dbc->db, seckey_schema, NULL, NULL, &err);
+	if (ret != SQLITE_OK) {
+		osd_error("%s: create seckey: %s", __func__, err);
+		sqlite3_free(err);
+		ret = -EIO;
+		goto out_err;
+	}
+
+	ret = sec_load(osd, st);
+	if (ret != OSD_OK)
+		goto out_err;
+
+	ret = attr_get_val(osd->dbc, ROOT_PID, ROOT_OID, ROOT_POLICY_PG,
+			   RPSAP_DEFAULT_SECURITY_METHOD, sizeof(method),
+			   &method, &len);
+	if (ret == OSD_OK && len == sizeof(method))
+		st->method = method;
+	else if (ret != OSD_OK && ret != -ENOENT)
+		goto out_err;
+
+	osd->st = st;
+	return OSD_OK;
+
+out_err:
+	sec_free(st);
+	return ret;
+}
+
+void sec_fini(struct osd_device *osd)
+{
+	if (!osd->st)
+		return;
+	sec_free(osd->st);
+	osd->st = NULL;
+}
+
+uint8_t sec_method(struct osd_device *osd)
+{
+	return osd->st ? osd->st->method : OSD_SEC_NOSEC;
+}
+
+/*
+ * The default security method was set on the root policy/security page.
+ */
+int sec_set_method(struct osd_device *osd, uint8_t method)
+{
+	if (method > OSD_SEC_CMDRSP)
+		return -EINVAL;
+	if (osd->st)
+		osd->st->method = method;
+	return OSD_OK;
+}
+
+static uint16_t required_perm(uint16_t action, uint8_t options)
+{
+	switch (action) {
+	case OSD_READ:
+		return CAP_PERM_READ;
+	case OSD_MULTI_RW:
+		if (options & MULTI_RW_WRITE)
+			return CAP_PERM_WRITE;
+		return CAP_PERM_READ;
+	case OSD_WRITE:
+	case OSD_CLEAR:
+	case OSD_PUNCH:
+		return CAP_PERM_WRITE;
+	case OSD_APPEND:
+		return CAP_PERM_APPEND;
+	case OSD_CREATE_AND_WRITE:
+		return CAP_PERM_CREATE | CAP_PERM_WRITE;
+	case OSD_CREATE:
+	case OSD_CREATE_COLLECTION:
+	case OSD_CREATE_PARTITION:
+	case OSD_CREATE_USER_TRACKING_COLLECTION:
+	case OSD_COPY_USER_OBJECTS:
+		return CAP_PERM_CREATE;
+	case OSD_REMOVE:
+	case OSD_REMOVE_COLLECTION:
+	case OSD_REMOVE_MEMBER_OBJECTS:
+	case OSD_REMOVE_PARTITION:
+		return CAP_PERM_REMOVE;
+	case OSD_GET_ATTRIBUTES:
+	case OSD_GET_MEMBER_ATTRIBUTES:
+	case OSD_LIST:
+	case OSD_LIST_COLLECTION:
+		return CAP_PERM_GET_ATTR;
+	case OSD_SET_ATTRIBUTES:
+	case OSD_SET_MEMBER_ATTRIBUTES:
+	case OSD_CAS:
+	case OSD_FA:
+	case OSD_GEN_CAS:
+	case OSD_COND_SETATTR:
+	case OSD_CAS_WAIT:
+		return CAP_PERM_SET_ATTR;
+	case OSD_QUERY:
+		return CAP_PERM_QUERY;
+	case OSD_FORMAT_OSD:
+		return CAP_PERM_DEV_MGMT;
+	case OSD_SET_KEY:
+	case OSD_SET_MASTER_KEY:
+		return CAP_PERM_POL_SEC;
+	default:
+		return CAP_PERM_OBJ_MGMT;
+	}
+}
+
+static int cap_allows(const uint8_t *cap, const uint8_t *cdb,
+		      uint16_t action, uint64_t pid, uint64_t oid)
+{
+	uint16_t perm = cap[CAP_PERMISSIONS] | cap[CAP_PERMISSIONS + 1] << 8;
+	uint16_t need = required_perm(action, cdb[11]);
+
+	if (action == OSD_APPEND && (perm & CAP_PERM_WRITE))
+		need = CAP_PERM_WRITE;
+	if ((perm & need) != need)
+		return 0;
+
+	switch (cap[CAP_OBJECT_DESC_TYPE] >> 4) {
+	case CAP_ODT_LU:
+		return 1;
+	case CAP_ODT_PARTITION:
+		return get_ntohll(&cap[CAP_ALLOWED_PID]) == pid;
+	case CAP_ODT_OBJECT:
+		/* its objects are in the continuation, not the CDB */
+		if (action == OSD_MULTI_RW)
+			return 0;
+		return get_ntohll(&cap[CAP_ALLOWED_PID]) == pid &&
+		       get_ntohll(&cap[CAP_ALLOWED_OID]) == oid;
+	default:
+		return 0;
+	}
+}
+
+static int cap_expired(const uint8_t *cap)
+{
+	struct timespec ts;
+	uint64_t expire = get_ntohtime(&cap[CAP_EXPIRATION_TIME]);
+
+	if (expire == 0)
+		return 0;
+	clock_gettime(CLOCK_REALTIME, &ts);
+	return (uint64_t)ts.tv_sec * 1000 + ts.tv_nsec / 1000000 >= expire;
+}
+
+/*
+ * The key capability keys of this command are computed with, NULL if it
+ * is not set.
+ */
+static const uint8_t *secret_key(struct sec_table *st, const uint8_t *cdb,
+				 uint16_t action, uint64_t pid)
+{
+	struct sec_part *p;
+	uint8_t version = cdb[CAP_OFF + CAP_KEY_VERSION] >> 4;
+
+	switch (action) {
+	case OSD_SET_MASTER_KEY:
+		return st->master;
+	case OSD_SET_KEY:
+		switch (cdb[11] & 0x3) {
+		case OSD_KEY_ROOT:
+			return st->master;
+		case OSD_KEY_PARTITION:
+			return st->has_root ? st->root : NULL;
+		case OSD_KEY_WORKING:
+			p = sec_lookup(st, pid, 0);
+			return p && p->has_key ? p->key : NULL;
+		default:
+			return NULL;
+		}
+	case OSD_FORMAT_OSD:
+	case OSD_CREATE_PARTITION:
+		break;
+	default:
+		if (pid == ROOT_PID)
+			break;
+		p = sec_lookup(st, pid, 0);
+		if (!p || !(p->working_set & (1U << version)))
+			return NULL;
+		return p->working[version];
+	}
+	return st->has_root ? st->root : NULL;
+}
+
+static inline struct cap_slot *cap_slot(struct sec_table *st,
+					const uint8_t *cap)
+{
+	int i;
+	uint32_t h = 2166136261U; /* FNV-1a */
+
+	for (i = 0; i < CAP_LEN; i++)
+		h = (h ^ cap[i]) * 16777619U;
+	return &st->slot[h & (CAP_SLOTS - 1)];
+}
+
+int sec_check(struct osd_device *osd, const uint8_t *cdb, uint8_t *sense)
+{
+	struct sec_table *st = osd->st;
+	const uint8_t *cap = &cdb[CAP_OFF];
+	const uint8_t *secret;
+	uint16_t action = (cdb[8] << 8) | cdb[9];
+	uint64_t pid = get_ntohll(&cdb[16]);
+	uint64_t oid = get_ntohll(&cdb[24]);
+	uint8_t method = cap[CAP_SECURITY_METHOD] & 0xF;
+	uint8_t mac[OSD_KEY_LEN];
+	struct cap_slot *cs;
+
+	if (!st || st->method == OSD_SEC_NOSEC)
+		return OSD_OK;
+
+	if ((cap[CAP_FORMAT] & 0xF) != CAP_FORMAT_V2 ||
+	    (cap[CAP_KEY_VERSION] & 0xF) != CAP_ALG_HMAC_SHA1 ||
+	    method > OSD_SEC_CMDRSP)
+		goto out_cdb_err;
+	if (method < st->method)
+		goto out_denied;
+	if (!cap_allows(cap, cdb, action, pid, oid) || cap_expired(cap))
+		goto out_denied;
+
+	secret = secret_key(st, cdb, action, pid);
+	if (!secret)
+		goto out_denied;
+
+	cs = cap_slot(st, cap);
+	if (cs->gen == st->gen && cs->secret == secret &&
+	    memcmp(cs->cap, cap, CAP_LEN) == 0) {
+		st->hits++;
+		if (method == OSD_SEC_CAPKEY && cs->ricv_ok &&
+		    CRYPTO_memcmp(cs->ricv, &cdb[SEC_RICV_OFF],
+				  SEC_RICV_LEN) == 0)
+			return OSD_OK;
+	} else {
+		st->misses++;
+		sec_hmac(secret, cap, CAP_LEN, cs->key);
+		memcpy(cs->cap, cap, CAP_LEN);
+		cs->secret = secret;
+		cs->gen = st->gen;
+		cs->ricv_ok = 0;
+	}
+
+	request_icv(cdb, cs->key, mac);
+	if (CRYPTO_memcmp(mac, &cdb[SEC_RICV_OFF], SEC_RICV_LEN) != 0)
+		goto out_denied;
+	if (method == OSD_SEC_CAPKEY) {
+		memcpy(cs->ricv, mac, SEC_RICV_LEN);
+		cs->ricv_ok = 1;
+	}
+	return OSD_OK;
+
+out_denied:
+	return sense_build_sdd(sense, OSD_SSK_ILLEGAL_REQUEST,
+			       OSD_ASC_ACCESS_DENIED_NO_ACCESS_RIGHTS, pid, oid);
+
+out_cdb_err:
+	return sense_build_sdd(sense, OSD_SSK_ILLEGAL_REQUEST,
+			       OSD_ASC_INVALID_FIELD_IN_CDB, pid, oid);
+}
+
+/*
+ * Derive and keep a new key.  The caller checks that the partition
+ * exists.
+ *
+ * returns: -ENOENT if the parent key is not set
+ */
+int sec_set_key(struct osd_device *osd, int key_to_set, uint64_t pid,
+		uint8_t version, const uint8_t seed[OSD_KEY_LEN])
+{
+	int ret = 0;
+	struct sec_part *p;
+	const uint8_t *parent = NULL;
+	uint8_t key[OSD_KEY_LEN];
+	struct sec_table *st = osd->st;
+
+	if (!st)
+		return -EINVAL;
+
+	switch (key_to_set) {
+	case OSD_KEY_ROOT:
+		parent = st->master;
+		pid = ROOT_PID;
+		version = 0;
+		break;
+	case OSD_KEY_PARTITION:
+		parent = st->has_root ? st->root : NULL;
+		version = 0;
+		break;
+	case OSD_KEY_WORKING:
+		p = sec_lookup(st, pid, 0);
+		parent = p && p->has_key ? p->key : NULL;
+		break;
+	default:
+		return -EINVAL;
+	}
+	if (!parent)
+		return -ENOENT;
+	if (version >= OSD_WORKING_KEYS)
+		return -EINVAL;
+
+	sec_hmac(parent, seed, OSD_KEY_LEN, key);
+	ret = sec_store(osd, pid, key_to_set, version, key);
+	if (ret == OSD_OK)
+		ret = sec_place(st, pid, key_to_set, version, key);
+	memset(key, 0, sizeof(key));
+	return ret;
+}
+
+/*
+ * The master key, as agreed on outside of the OSD protocol.
+ */
+int sec_set_master(struct osd_device *osd, const uint8_t key[OSD_KEY_LEN])
+{
+	int ret = 0;
+
+	if (!osd->st)
+		return -EINVAL;
+	ret = sec_store(osd, ROOT_PID, OSD_KEY_MASTER, 0, key);
+	if (ret == OSD_OK)
+		ret = sec_place(osd->st, ROOT_PID, OSD_KEY_MASTER, 0, key);
+	return ret;
+}
+
+/*
+ * The partition is gone, and so are its keys.
+ */
+void sec_removed(struct osd_device *osd, uint64_t pid)
+{
+	int ret = 0;
+	char SQL[MAXSQLEN];
+	char *err = NULL;
+	struct sec_part *p, **pp;
+	struct sec_table *st = osd->st;
+
+	if (!st)
+		return;
+
+	sprintf(SQL, "DELETE FROM seckey WHERE pid = %llu AND kind >= %d;",
+		llu(pid), OSD_KEY_PARTITION);
+	ret = sqlite3_exec(osd->dbc->db, SQL, NULL, NULL, &err);
+	if (ret != SQLITE_OK) {
+		osd_error("%s: pid %llu: %s", __func__, llu(pid), err);
+		sqlite3_free(err);
+	}
+
+	for (pp = sec_bucket(st, pid); (p = *pp); pp = &p->next) {
+		if (p->pid == pid) {
+			*pp = p->next;
+			memset(p, 0, sizeof(*p));
+			free(p);
+			break;
+		}
+	}
+	st->gen++;
+}
+
+void sec_stats(struct osd_device *osd, uint64_t *hits, uint64_t *misses)
+{
+	*hits = osd->st ? osd->st->hits : 0;
+	*misses = osd->st ? osd->st->misses : 0;
+}
@@ -0,0 +1,59 @@
+/*
+ * Security methods: keys and capability checking.
+ *
+ * Copyright (C) 2007 OSD Team <pvfs-osd@osc.edu>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, version 2 of the License.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#ifndef __SEC_H
+#define __SEC_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include "osd-types.h"
+
+int sec_init(struct osd_device *osd);
+
+void sec_fini(struct osd_device *osd);
+
+/* security method every command must use, OSD_SEC_NOSEC if none */
+uint8_t sec_method(struct osd_device *osd);
+
+int sec_set_method(struct osd_device *osd, uint8_t method);
+
+/*
+ * returns: OSD_OK if the capability and integrity check value of the
+ * CDB allow the command, else the length of the sense data built
+ */
+int sec_check(struct osd_device *osd, const uint8_t *cdb, uint8_t *sense);
+
+int sec_set_key(struct osd_device *osd, int key_to_set, uint64_t pid,
+		uint8_t version, const uint8_t seed[OSD_KEY_LEN]);
+
+int sec_set_master(struct osd_device *osd, const uint8_t key[OSD_KEY_LEN]);
+
+void sec_removed(struct osd_device *osd, uint64_t pid);
+
+void sec_stats(struct osd_device *osd, uint64_t *hits, uint64_t *misses);
+
+/*
+ * The computations of the security manager side, as the checks expect
+ * them: keys and capability keys are derived with sec_hmac, sec_sign
+ * fills in the request integrity check value of a CDB.
+ */
+void sec_hmac(const uint8_t key[OSD_KEY_LEN], const void *data, size_t len,
+	      uint8_t mac[OSD_KEY_LEN]);
+
+void sec_sign(uint8_t *cdb, const uint8_t cap_key[OSD_KEY_LEN]);
+
+#endif /* __SEC_H */
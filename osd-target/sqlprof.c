@@ -0,0 +1,268 @@
+/*
+ * SQL statement profiling.
+ *
+ * Copyright (C) 2007 OSD Team <pvfs-osd@osc.edu>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, version 2 of the License.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/*
+ * While profiling, sqlite reports every statement run through
+ * sqlite3_trace_v2, whichever of obj.c, attr.c, coll.c or mtq.c stepped
+ * it. Runs, total and max time and rows are summed per prepared
+ * statement. Rows are those returned, or changed for statements that
+ * write. A run slower than the threshold is logged with its bound
+ * parameters filled in.
+ *
+ * The report merges statements with the same SQL, such as those prepared
+ * again after a schema change, and ranks them by total time.  Entries are
+ * not dropped when a statement is finalized, so SQL built per command
+ * would add up without bound; past SQLPROF_MAX_ENT entries the runs of
+ * new statements go to a single SQLPROF_OTHER entry.
+ *
+ * Only costs anything while on; then every row is a callback, too.
+ * FORMAT OSD opens a new db and so ends profiling.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <sqlite3.h>
+
+#include "osd.h"
+#include "db.h"
+#include "sqlprof.h"
+#include "osd-util/osd-util.h"
+
+#define SQLPROF_BUCKETS 256 /* power of 2 */
+
+struct sqlprof_ent {
+	struct sqlprof_ent *next;
+	sqlite3_stmt *stmt;
+	uint64_t runs;
+	uint64_t total;		/* ns */
+	uint64_t max;
+	uint64_t rows;
+	char sql[1];
+};
+
+struct sqlprof {
+	uint64_t slow_ns;	/* 0: no slow log */
+	uint64_t nent;
+	struct sqlprof_ent *other;	/* past SQLPROF_MAX_ENT */
+	struct sqlprof_ent *bucket[SQLPROF_BUCKETS];
+};
+
+static inline unsigned int stmt_hash(sqlite3_stmt *stmt)
+{
+	return ((uintptr_t) stmt >> 4) & (SQLPROF_BUCKETS - 1);
+}
+
+/*
+ * A stmt that was finalized may leave its address to another one, hence
+ * the SQL is compared too.
+ */
+static struct sqlprof_ent *lookup(struct sqlprof *sp, sqlite3_stmt *stmt)
+{
+	const char *sql = sqlite3_sql(stmt);
+	struct sqlprof_ent *e;
+	struct sqlprof_ent **head = &sp->bucket[stmt_hash(stmt)];
+	size_t len;
+
+	if (!sql)
+		sql = "";
+	for (e = *head; e; e = e->next)
+		if (e->stmt == stmt && strcmp(e->sql, sql) == 0)
+			return e;
+
+	if (sp->nent >= SQLPROF_MAX_ENT) {
+		if (!sp->other) {
+			len = strlen(SQLPROF_OTHER);
+			sp->other = Calloc(1, sizeof(*e) + len);
+			if (sp->other)
+				memcpy(sp->other->sql, SQLPROF_OTHER,
+				       len + 1);
+		}
+		return sp->other;
+	}
+
+	len = strlen(sql);
+	e = Calloc(1, sizeof(*e) + len);
+	if (!e)
+		return NULL;
+	e->stmt = stmt;
+	memcpy(e->sql, sql, len + 1);
+	e->next = *head;
+	*head = e;
+	sp->nent++;
+	return e;
+}
+
+static int trace(unsigned int type, void *ctx, void *p, void *x)
+{
+	struct db_context *dbc = ctx;
+	struct sqlprof *sp = dbc->prof;
+	sqlite3_stmt *stmt = p;
+	struct sqlprof_ent *e;
+	uint64_t ns;
+	char *sql;
+
+	if (!sp)
+		return 0;
+	e = lookup(sp, stmt);
+	if (!e)
+		return 0;
+
+	if (type == SQLITE_TRACE_ROW) {
+		e->rows++;
+		return 0;
+	}
+
+	/* SQLITE_TRACE_PROFILE */
+	ns = *(sqlite3_int64 *) x;
+	e->runs++;
+	e->total += ns;
+	if (ns > e->max)
+		e->max = ns;
+	if (!sqlite3_stmt_readonly(stmt))
+		e->rows += sqlite3_changes(dbc->db);
+
+	if (sp->slow_ns && ns >= sp->slow_ns) {
+		sql = sqlite3_expanded_sql(stmt);
+		osd_warning("%s: %llu us: %s", __func__, llu(ns / 1000),
+			    sql ? sql : e->sql);
+		sqlite3_free(sql);
+	}
+	return 0;
+}
+
+/*
+ * Start profiling, or restart with a new threshold keeping the numbers.
+ * slow_ns: log runs that take at least this long, 0 for none
+ */
+int sqlprof_start(struct db_context *dbc, uint64_t slow_ns)
+{
+	int ret;
+	struct sqlprof *sp = dbc->prof;
+
+	if (!sp) {
+		sp = Calloc(1, sizeof(*sp));
+		if (!sp)
+			return -ENOMEM;
+	}
+	sp->slow_ns = slow_ns;
+
+	ret = sqlite3_trace_v2(dbc->db, SQLITE_TRACE_PROFILE|SQLITE_TRACE_ROW,
+			       trace, dbc);
+	if (ret != SQLITE_OK) {
+		error_sql(dbc->db, "%s: sqlite3_trace_v2", __func__);
+		if (!dbc->prof)
+			free(sp);
+		return OSD_ERROR;
+	}
+	dbc->prof = sp;
+	return OSD_OK;
+}
+
+void sqlprof_stop(struct db_context *dbc)
+{
+	int i;
+	struct sqlprof_ent *e, *next;
+	struct sqlprof *sp = dbc->prof;
+
+	if (!sp)
+		return;
+	sqlite3_trace_v2(dbc->db, 0, NULL, NULL);
+	for (i = 0; i < SQLPROF_BUCKETS; i++) {
+		for (e = sp->bucket[i]; e; e = next) {
+			next = e->next;
+			free(e);
+		}
+	}
+	free(sp->other);
+	free(sp);
+	dbc->prof = NULL;
+}
+
+static int cmp_sql(const void *a, const void *b)
+{
+	const struct sqlprof_ent *x = *(struct sqlprof_ent * const *) a;
+	const struct sqlprof_ent *y = *(struct sqlprof_ent * const *) b;
+
+	return strcmp(x->sql, y->sql);
+}
+
+static int cmp_total(const void *a, const void *b)
+{
+	const struct sqlprof_ent *x = *(struct sqlprof_ent * const *) a;
+	const struct sqlprof_ent *y = *(struct sqlprof_ent * const *) b;
+
+	if (x->total != y->total)
+		return x->total < y->total ? 1 : -1;
+	return 0;
+}
+
+/*
+ * Write the top statements by total time to fp, all if top <= 0.
+ * Merges entries of the same SQL as it goes, so the numbers of those
+ * move to the first of them.
+ */
+int sqlprof_report(struct db_context *dbc, FILE *fp, int top)
+{
+	int i;
+	uint64_t j, n = 0;
+	struct sqlprof_ent *e, **v, *m;
+	struct sqlprof *sp = dbc->prof;
+
+	if (!sp)
+		return -EINVAL;
+	v = Malloc((sp->nent + 1) * sizeof(*v));
+	if (!v)
+		return -ENOMEM;
+	for (i = 0; i < SQLPROF_BUCKETS; i++)
+		for (e = sp->bucket[i]; e; e = e->next)
+			if (e->runs)
+				v[n++] = e;
+	if (sp->other && sp->other->runs)
+		v[n++] = sp->other;
+
+	qsort(v, n, sizeof(*v), cmp_sql);
+	for (i = 0, j = 1; j < n; j++) {
+		m = v[i];
+		if (strcmp(m->sql, v[j]->sql) == 0) {
+			m->runs += v[j]->runs;
+			m->total += v[j]->total;
+			m->rows += v[j]->rows;
+			if (v[j]->max > m->max)
+				m->max = v[j]->max;
+			v[j]->runs = v[j]->total = v[j]->max = v[j]->rows = 0;
+		} else {
+			v[++i] = v[j];
+		}
+	}
+	if (n)
+		n = i + 1;
+	qsort(v, n, sizeof(*v), cmp_total);
+
+	fprintf(fp, "%10s %12s %10s %10s %10s  %s\n", "runs", "total_us",
+		"avg_us", "max_us", "rows", "sql");
+	for (j = 0; j < n && (top <= 0 || j < (uint64_t) top); j++) {
+		e = v[j];
+		fprintf(fp, "%10llu %12llu %10llu %10llu %10llu  %s\n",
+			llu(e->runs), llu(e->total / 1000),
+			llu(e->total / 1000 / e->runs), llu(e->max / 1000),
+			llu(e->rows), e->sql);
+	}
+	free(v);
+	return OSD_OK;
+}
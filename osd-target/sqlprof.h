@@ -0,0 +1,35 @@
+/*
+ * SQL statement profiling.
+ *
+ * Copyright (C) 2007 OSD Team <pvfs-osd@osc.edu>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, version 2 of the License.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#ifndef __SQLPROF_H
+#define __SQLPROF_H
+
+#include <stdio.h>
+#include <stdint.h>
+#include "osd-types.h"
+
+/* statements kept apart; those past it add up under SQLPROF_OTHER */
+#define SQLPROF_MAX_ENT 1024
+#define SQLPROF_OTHER "(other statements)"
+
+int sqlprof_start(struct db_context *dbc, uint64_t slow_ns);
+
+void sqlprof_stop(struct db_context *dbc);
+
+int sqlprof_report(struct db_context *dbc, FILE *fp, int top);
+
+#endif /* __SQLPROF_H */
@@ -24,6 +24,10 @@
 #include <sys/stat.h>
 #include <unistd.h>
 #include <time.h>
+#include <poll.h>
+#include <pthread.h>
+#include <signal.h>
+#include <sqlite3.h>
 
 #include "osd-types.h"
 #include "osd.h"
@@ -31,6 +35,11 @@
 #include "osd-util/osd-util.h"
 #include "osd-util/osd-sense.h"
 #include "command.h"
+#include "sec.h"
+#include "async.h"
+#include "job.h"
+#include "db.h"
+#include "sqlprof.h"
 
 void test_partition(struct osd_device *osd);
 void test_create(struct osd_device *osd);
@@ -38,6 +47,10 @@ void test_query(struct osd_device *osd);
 void test_list(struct osd_device *osd);
 void test_set_member_attributes(struct osd_device *osd);
 void test_atomics(struct osd_device *osd);
+void test_stats(struct osd_device *osd);
+void test_outbuf(void);
+void test_atomics_mt(void);
+void test_cas_wait(void);
 
 void test_partition(struct osd_device *osd) 
 {
@@ -420,6 +433,743 @@ static void test_set_one_attr (struct osd_device *osd)
 }
 
 
+/* read one counter of the root stats page */
+static uint64_t get_stat(struct osd_device *osd, uint32_t number)
+{
+	struct osd_command cmd;
+	uint8_t sense_out[OSD_MAX_SENSE];
+	int senselen_out;
+	uint8_t *data_out = NULL;
+	uint64_t data_out_len;
+	uint64_t val;
+	uint8_t *cp;
+	int ret;
+	struct attribute_list attr = {
+		ATTR_GET, ROOT_STATS_PG, number, NULL, RSTATS_LEN, 0
+	};
+
+	ret = osd_command_set_get_attributes(&cmd, 0, 0);
+	assert(ret == 0);
+	ret = osd_command_attr_build(&cmd, &attr, 1);
+	assert(ret == 0);
+	ret = osdemu_cmd_submit(osd, cmd.cdb, cmd.outdata, cmd.outlen,
+				&data_out, &data_out_len,
+				sense_out, &senselen_out);
+	assert(ret == 0);
+	assert(data_out[0] == RTRVD_SET_ATTR_LIST);
+	cp = &data_out[8];
+	assert(get_ntohl(&cp[LE_NUMBER_OFF]) == number);
+	assert(get_ntohs(&cp[LE_LEN_OFF]) == RSTATS_LEN);
+	val = get_ntohll(&cp[LE_VAL_OFF]);
+	osdemu_outbuf_release(osd, data_out);
+	osd_command_attr_free(&cmd);
+	return val;
+}
+
+/* per-command arena allocations are counted on the root stats page */
+void test_stats(struct osd_device *osd)
+{
+	struct osd_command cmd;
+	uint8_t sense_out[OSD_MAX_SENSE];
+	int senselen_out;
+	uint8_t *data_out = NULL;
+	uint64_t data_out_len;
+	uint64_t commands;
+	uint32_t page = USEROBJECT_PG + LUN_PG_LB;
+	int ret;
+	struct attribute_list attr[] = {
+		{ATTR_GET, page, 1, NULL, 0, 0},
+		{ATTR_GET, page, 2, NULL, 0, 0},
+	};
+
+	/* list with attributes: parsed getattr list and generated SQL */
+	ret = osd_command_set_list(&cmd, USEROBJECT_PID_LB, 0, 4096, 0, 1);
+	assert(ret == 0);
+	ret = osd_command_attr_build(&cmd, attr, 2);
+	assert(ret == 0);
+	ret = osdemu_cmd_submit(osd, cmd.cdb, cmd.outdata, cmd.outlen,
+				&data_out, &data_out_len,
+				sense_out, &senselen_out);
+	assert(ret == 0);
+	free(data_out);
+	osd_command_attr_free(&cmd);
+
+	assert(get_stat(osd, RSTATS_ARENA_ALLOCS) >= 2);
+
+	/* get attributes walks its list in place */
+	commands = get_stat(osd, RSTATS_COMMANDS);
+	assert(get_stat(osd, RSTATS_COMMANDS) == commands + 1);
+	assert(get_stat(osd, RSTATS_ARENA_ALLOCS) == 0);
+}
+
+/* one batch: per-command status, data visible to later commands */
+static void test_batch(struct osd_device *osd)
+{
+	struct osd_command cmd[8];
+	struct osdemu_cmd bc[8];
+	uint8_t sense[8][OSD_MAX_SENSE];
+	uint64_t pid = USEROBJECT_PID_LB + 7;
+	uint64_t oid = USEROBJECT_OID_LB;
+	const char wbuf[] = "batched";
+	sqlite3 *db;
+	int i, n = 0;
+	int ret;
+
+	ret = osd_command_set_create_partition(&cmd[n++], pid);
+	assert(ret == 0);
+	ret = osd_command_set_create(&cmd[n++], pid, oid, 1);
+	assert(ret == 0);
+	ret = osd_command_set_write(&cmd[n++], pid, oid, sizeof(wbuf), 0);
+	assert(ret == 0);
+	ret = osd_command_set_read(&cmd[n++], pid, oid, sizeof(wbuf), 0);
+	assert(ret == 0);
+	ret = osd_command_set_read(&cmd[n++], pid, oid + 1, sizeof(wbuf), 0);
+	assert(ret == 0);
+	ret = osd_command_set_remove(&cmd[n++], pid, oid);
+	assert(ret == 0);
+	ret = osd_command_set_read(&cmd[n++], pid, oid, sizeof(wbuf), 0);
+	assert(ret == 0);
+
+	memset(bc, 0, sizeof(bc));
+	for (i = 0; i < n; i++) {
+		bc[i].cdb = cmd[i].cdb;
+		bc[i].sense_out = sense[i];
+	}
+	bc[2].data_in = (const uint8_t *) wbuf;
+	bc[2].data_in_len = sizeof(wbuf);
+
+	ret = osdemu_cmd_submit_batch(osd, bc, n);
+	assert(ret == 2);
+	for (i = 0; i < n; i++) {
+		if (i == 4 || i == 6) {
+			assert(bc[i].status == SAM_STAT_CHECK_CONDITION);
+			assert(bc[i].senselen_out > 0);
+			assert(bc[i].data_out_len == 0);
+		} else {
+			assert(bc[i].status == SAM_STAT_GOOD);
+			assert(bc[i].senselen_out == 0);
+		}
+	}
+	assert(bc[3].data_out_len == sizeof(wbuf));
+	assert(memcmp(bc[3].data_out, wbuf, sizeof(wbuf)) == 0);
+	osdemu_outbuf_release(osd, bc[3].data_out);
+
+	/* a reader elsewhere makes the commit fail, so everything fails */
+	ret = sqlite3_open("/tmp/osd/md/osd.db", &db);
+	assert(ret == SQLITE_OK);
+	ret = sqlite3_exec(db, "BEGIN; SELECT count(*) FROM obj;", NULL,
+			   NULL, NULL);
+	assert(ret == SQLITE_OK);
+	ret = osd_command_set_create(&cmd[0], pid, oid + 1000, 1);
+	assert(ret == 0);
+	ret = osd_command_set_read(&cmd[1], pid, oid + 1001, sizeof(wbuf), 0);
+	assert(ret == 0);
+	memset(bc, 0, sizeof(bc));
+	for (i = 0; i < 2; i++) {
+		bc[i].cdb = cmd[i].cdb;
+		bc[i].sense_out = sense[i];
+	}
+	ret = osdemu_cmd_submit_batch(osd, bc, 2);
+	assert(ret == 2);
+	assert(bc[0].status == SAM_STAT_CHECK_CONDITION);
+	assert(bc[0].senselen_out > 0);
+	assert(sense[0][1] == OSD_SSK_HARDWARE_ERROR);
+	assert(bc[1].status == SAM_STAT_CHECK_CONDITION);
+	assert(sense[1][1] == OSD_SSK_ILLEGAL_REQUEST);
+	sqlite3_exec(db, "END;", NULL, NULL, NULL);
+	sqlite3_close(db);
+}
+
+/* read one histogram of the root latency page, returns its count */
+static uint64_t get_lat(struct osd_device *osd, uint16_t action, int phase,
+			uint64_t *sum)
+{
+	struct osd_command cmd;
+	uint8_t sense_out[OSD_MAX_SENSE];
+	int senselen_out;
+	uint8_t *data_out = NULL;
+	uint64_t data_out_len;
+	uint64_t count, n = 0;
+	uint8_t *cp;
+	int i, ret;
+	struct attribute_list attr = {
+		ATTR_GET, ROOT_LATENCY_PG, RLAT_ATTR_NUM(action, phase),
+		NULL, RLAT_LEN, 0
+	};
+
+	ret = osd_command_set_get_attributes(&cmd, 0, 0);
+	assert(ret == 0);
+	ret = osd_command_attr_build(&cmd, &attr, 1);
+	assert(ret == 0);
+	ret = osdemu_cmd_submit(osd, cmd.cdb, cmd.outdata, cmd.outlen,
+				&data_out, &data_out_len,
+				sense_out, &senselen_out);
+	assert(ret == 0);
+	cp = &data_out[8];
+	assert(get_ntohl(&cp[LE_NUMBER_OFF]) == attr.number);
+	assert(get_ntohs(&cp[LE_LEN_OFF]) == RLAT_LEN);
+	cp += LE_VAL_OFF;
+	count = get_ntohll(&cp[RLAT_COUNT_OFF]);
+	*sum = get_ntohll(&cp[RLAT_SUM_OFF]);
+	assert(get_ntohll(&cp[RLAT_MAX_OFF]) <= *sum);
+	for (i = 0; i < RLAT_BUCKETS; i++)
+		n += get_ntohll(&cp[RLAT_BUCKET_OFF + 8 * i]);
+	assert(n == count);
+	osdemu_outbuf_release(osd, data_out);
+	osd_command_attr_free(&cmd);
+	return count;
+}
+
+/* commands are timed per service action and phase, and can be reset */
+static void test_latency(struct osd_device *osd)
+{
+	struct osd_command cmd;
+	uint8_t sense_out[OSD_MAX_SENSE];
+	int senselen_out;
+	uint8_t *data_out = NULL;
+	uint64_t data_out_len;
+	uint64_t pid = USEROBJECT_PID_LB + 7;
+	uint64_t oid = USEROBJECT_OID_LB + 1;
+	uint64_t sum, data;
+	uint8_t buf[4096];
+	int ret;
+
+	set_one_attr_int(osd, ROOT_PID, ROOT_OID, ROOT_LATENCY_PG, RLAT_RESET,
+			 1);
+	assert(get_lat(osd, OSD_WRITE, RLAT_CMD, &sum) == 0);
+
+	ret = osd_command_set_create(&cmd, pid, oid, 1);
+	assert(ret == 0);
+	ret = osdemu_cmd_submit(osd, cmd.cdb, NULL, 0, &data_out,
+				&data_out_len, sense_out, &senselen_out);
+	assert(ret == 0);
+	memset(buf, 0xa5, sizeof(buf));
+	ret = osd_command_set_write(&cmd, pid, oid, sizeof(buf), 0);
+	assert(ret == 0);
+	ret = osdemu_cmd_submit(osd, cmd.cdb, buf, sizeof(buf), &data_out,
+				&data_out_len, sense_out, &senselen_out);
+	assert(ret == 0);
+	ret = osd_command_set_read(&cmd, pid, oid, sizeof(buf), 0);
+	assert(ret == 0);
+	data_out = NULL;
+	ret = osdemu_cmd_submit(osd, cmd.cdb, NULL, 0, &data_out,
+				&data_out_len, sense_out, &senselen_out);
+	assert(ret == 0);
+	free(data_out);
+
+	assert(get_lat(osd, OSD_CREATE, RLAT_CMD, &sum) == 1);
+	assert(get_lat(osd, OSD_CREATE, RLAT_DATA, &data) == 0);
+	assert(get_lat(osd, OSD_WRITE, RLAT_CMD, &sum) == 1);
+	assert(get_lat(osd, OSD_WRITE, RLAT_DATA, &data) == 1);
+	assert(data > 0 && data <= sum);
+	assert(get_lat(osd, OSD_READ, RLAT_PARSE, &data) == 1);
+	assert(get_lat(osd, OSD_READ, RLAT_META, &data) == 1);
+	assert(get_lat(osd, OSD_READ, RLAT_DATA, &data) == 1);
+	assert(get_lat(osd, OSD_READ, RLAT_ATTR, &data) == 1);
+
+	/* the nine reads above, this one is not done yet */
+	assert(get_lat(osd, OSD_GET_ATTRIBUTES, RLAT_CMD, &sum) == 9);
+
+	set_one_attr_int(osd, ROOT_PID, ROOT_OID, ROOT_LATENCY_PG,
+			 RLAT_ATTR_NUM(OSD_READ, RLAT_DATA), 0);
+	assert(get_lat(osd, OSD_READ, RLAT_DATA, &data) == 0);
+	assert(get_lat(osd, OSD_READ, RLAT_CMD, &sum) == 1);
+}
+
+static uint64_t sql_runs(struct osd_device *osd, const char *sql)
+{
+	char *report = NULL;
+	size_t size = 0;
+	FILE *fp;
+	char *line;
+	uint64_t runs;
+	int ret;
+
+	fp = open_memstream(&report, &size);
+	assert(fp);
+	ret = osdemu_sql_report(osd, fp, 0);
+	assert(ret == 0);
+	fclose(fp);
+	line = strstr(report, sql);
+	if (!line) {
+		free(report);
+		return 0;
+	}
+	while (line > report && line[-1] != '\n')
+		line--;
+	runs = strtoull(line, NULL, 10);
+	free(report);
+	return runs;
+}
+
+/* statements are counted while profiling and ranked in the report */
+static void test_sqlprof(struct osd_device *osd)
+{
+	struct osd_command cmd;
+	uint8_t sense_out[OSD_MAX_SENSE];
+	int senselen_out;
+	uint8_t *data_out = NULL;
+	uint64_t data_out_len;
+	uint64_t pid = USEROBJECT_PID_LB + 7;
+	uint64_t oid = USEROBJECT_OID_LB + 2;
+	char *report = NULL;
+	size_t size = 0;
+	FILE *fp;
+	char *line;
+	char sql[32];
+	int i, ret;
+
+	ret = osdemu_sql_profile(osd, 0);
+	assert(ret == 0);
+	for (i = 0; i < 3; i++) {
+		ret = osd_command_set_create(&cmd, pid, oid + i, 1);
+		assert(ret == 0);
+		ret = osdemu_cmd_submit(osd, cmd.cdb, NULL, 0, &data_out,
+					&data_out_len, sense_out,
+					&senselen_out);
+		assert(ret == 0);
+	}
+
+	fp = open_memstream(&report, &size);
+	assert(fp);
+	ret = osdemu_sql_report(osd, fp, 0);
+	assert(ret == 0);
+	fclose(fp);
+	assert(strncmp(report + strspn(report, " "), "runs", 4) == 0);
+
+	/* each create inserted one row into obj */
+	line = strstr(report, "INSERT INTO obj ");
+	assert(line);
+	while (line > report && line[-1] != '\n')
+		line--;
+	assert(strtoull(line, NULL, 10) == 3);
+	free(report);
+
+	/* distinct SQL past the limit is counted in one entry */
+	for (i = 0; i < SQLPROF_MAX_ENT + 10; i++) {
+		snprintf(sql, sizeof(sql), "SELECT %d;", i);
+		ret = sqlite3_exec(osd->dbc->db, sql, NULL, NULL, NULL);
+		assert(ret == SQLITE_OK);
+	}
+	assert(sql_runs(osd, SQLPROF_OTHER) >= 10);
+	assert(sql_runs(osd, "SELECT 0;") == 1);
+
+	osdemu_sql_profile_stop(osd);
+	assert(osdemu_sql_report(osd, stdout, 0) == -EINVAL);
+}
+
+#define MULTI_N 40
+
+/*
+ * A GET ATTRIBUTES list of many objects comes back attribute by attribute,
+ * object by object, with a stored attribute read in one query for all.
+ */
+static void test_getattr_multi(struct osd_device *osd)
+{
+	struct osd_command cmd;
+	uint8_t sense_out[OSD_MAX_SENSE];
+	int senselen_out;
+	uint8_t *data_out = NULL;
+	uint64_t data_out_len;
+	uint64_t pid = USEROBJECT_PID_LB + 7;
+	uint64_t oid = 0;
+	uint32_t page = USEROBJECT_PG + LUN_PG_LB + 3;
+	const char *str = "multi";
+	uint8_t *cp, *end;
+	uint32_t len;
+	int i, j, ret;
+	struct attribute_list attr[] = {
+		{ ATTR_SET, page, 1, (void *)(uintptr_t) str, strlen(str) + 1,
+		  0 },
+		{ ATTR_GET_MULTI, page, 1, NULL, 16, 0 },
+		{ ATTR_GET_MULTI, USER_INFO_PG, UIAP_LOGICAL_LEN, NULL, 8, 0 },
+		{ ATTR_GET_MULTI, page, 2, NULL, 8, 0 },
+	};
+
+	ret = osdemu_sql_profile(osd, 0);
+	assert(ret == 0);
+	ret = osd_command_set_create(&cmd, pid, 0, MULTI_N);
+	assert(ret == 0);
+	ret = osd_command_attr_build(&cmd, attr, 4);
+	assert(ret == 0);
+	ret = osdemu_cmd_submit(osd, cmd.cdb, cmd.outdata, cmd.outlen,
+				&data_out, &data_out_len, sense_out,
+				&senselen_out);
+	assert(ret == 0);
+	assert(sql_runs(osd, "SELECT oid, value FROM attr") == 2);
+	assert(sql_runs(osd, "SELECT oid, type FROM obj") == 1);
+	osdemu_sql_profile_stop(osd);
+
+	assert(data_out[0] == RTRVD_MULTIOBJ_LIST);
+	end = &data_out[8 + get_ntohl(&data_out[4])];
+	cp = &data_out[8];
+	for (i = 1; i < 4; i++) {
+		for (j = 0; j < MULTI_N; j++) {
+			/* the oid, then a list entry */
+			if (oid == 0)
+				oid = get_ntohll(cp);
+			assert(get_ntohll(cp) == oid + j);
+			assert(get_ntohl(&cp[8 + LE_PAGE_OFF]) == attr[i].page);
+			assert(get_ntohl(&cp[8 + LE_NUMBER_OFF]) ==
+			       attr[i].number);
+			len = get_ntohs(&cp[8 + LE_LEN_OFF]);
+			if (i == 1) {
+				assert(len == strlen(str) + 1);
+				assert(!strcmp((char *) &cp[8 + LE_VAL_OFF],
+					       str));
+			} else if (i == 2) {
+				assert(len == 8);
+				assert(get_ntohll(&cp[8 + LE_VAL_OFF]) == 0);
+			} else {
+				assert(len == 0);
+			}
+			cp += roundup8(8 + LE_VAL_OFF + len);
+		}
+	}
+	assert(cp == end);
+
+	free(data_out);
+	osd_command_attr_free(&cmd);
+}
+
+static uint64_t atomic_op(struct osd_device *osd, uint16_t action,
+			  uint64_t oid, uint64_t a, uint64_t b)
+{
+	struct osd_command cmd;
+	uint8_t sense_out[OSD_MAX_SENSE];
+	int senselen_out;
+	uint8_t *data_out = NULL;
+	uint64_t data_out_len;
+	uint8_t in[16];
+	uint64_t val;
+	int ret;
+
+	if (action == OSD_CAS)
+		ret = osd_command_set_cas(&cmd, USEROBJECT_PID_LB, oid, 8, 0);
+	else
+		ret = osd_command_set_fa(&cmd, USEROBJECT_PID_LB, oid, 8, 0);
+	assert(ret == 0);
+	set_htonll(&in[0], a);
+	set_htonll(&in[8], b);
+	ret = osdemu_cmd_submit(osd, cmd.cdb, in, sizeof(in), &data_out,
+				&data_out_len, sense_out, &senselen_out);
+	assert(ret == 0);
+	assert(data_out_len == 8);
+	val = get_ntohll(data_out);
+	free(data_out);
+	return val;
+}
+
+#define ASYNC_N 32
+
+struct async_done {
+	int order[ASYNC_N];
+	int n;
+};
+
+static void async_cb(struct osdemu_cmd *c, void *arg)
+{
+	struct async_done *d = arg;
+
+	assert(d->n < ASYNC_N);
+	d->order[d->n++] = (int) (c->cdb[16 + 15]); /* low byte of oid */
+}
+
+/* wait on the eventfd and reap until want callbacks were called */
+static void async_wait(struct osd_device *osd, int efd, struct async_done *d,
+		       int want)
+{
+	struct pollfd pfd = { .fd = efd, .events = POLLIN };
+	int ret;
+
+	while (d->n < want) {
+		ret = poll(&pfd, 1, 10000);
+		assert(ret == 1);
+		osdemu_async_reap(osd, 3); /* several rounds */
+	}
+	assert(d->n == want);
+}
+
+#define IDLE_STEPS 8
+static int idle_steps;
+
+static int idle_step(struct osd_device *osd __attribute__((unused)),
+		     struct job *job __attribute__((unused)))
+{
+	return __atomic_add_fetch(&idle_steps, 1, __ATOMIC_SEQ_CST) <
+	       IDLE_STEPS ? OSD_REPEAT : OSD_OK;
+}
+
+/*
+ * Async submission: every command completes once with its own result,
+ * whatever the order; report how often that differed from submission.
+ * A command parked on a CAS WAIT is overtaken by those after it.
+ */
+static void test_async(void)
+{
+	int ret = 0;
+	const char *root = "/tmp/osd-async/";
+	struct osd_device osd;
+	struct osd_command cmd[ASYNC_N];
+	struct osdemu_cmd bc[ASYNC_N];
+	uint8_t sense[ASYNC_N][OSD_MAX_SENSE];
+	uint8_t *wbuf[ASYNC_N];
+	uint8_t *data_out = NULL;
+	uint64_t data_out_len;
+	uint8_t sense_out[OSD_MAX_SENSE];
+	int senselen_out;
+	uint64_t pid = USEROBJECT_PID_LB;
+	uint64_t oid = USEROBJECT_OID_LB;	/* low byte is 0 */
+	struct async_done d;
+	uint8_t in[12];
+	struct async_queue *dev;
+	int i, efd, ooo;
+
+	system("rm -rf /tmp/osd-async");
+	ret = osd_open(root, &osd);
+	assert(ret == 0);
+	efd = osdemu_async_start(&osd);
+	assert(efd >= 0);
+
+	/* the synchronous call still works, serialized with the workers */
+	ret = osd_command_set_create_partition(&cmd[0], pid);
+	assert(ret == 0);
+	ret = osdemu_cmd_submit(&osd, cmd[0].cdb, NULL, 0, &data_out,
+				&data_out_len, sense_out, &senselen_out);
+	assert(ret == 0);
+	for (i = 0; i < ASYNC_N; i++) {
+		ret = osd_command_set_create(&cmd[0], pid, oid + i, 1);
+		assert(ret == 0);
+		ret = osdemu_cmd_submit(&osd, cmd[0].cdb, NULL, 0, &data_out,
+					&data_out_len, sense_out,
+					&senselen_out);
+		assert(ret == 0);
+	}
+
+	/* after the command that left it pending, a job runs on its own */
+	dev = async_lock(&osd);
+	ret = job_submit(&osd, 0, 0, NULL, idle_step);
+	assert(ret == 0);
+	async_unlock(dev);
+	ret = osd_command_set_get_attributes(&cmd[0], ROOT_PID, ROOT_OID);
+	assert(ret == 0);
+	data_out = NULL;
+	ret = osdemu_cmd_submit(&osd, cmd[0].cdb, NULL, 0, &data_out,
+				&data_out_len, sense_out, &senselen_out);
+	assert(ret == 0);
+	osdemu_outbuf_release(&osd, data_out);
+	data_out = NULL;
+	for (i = 0; i < 1000 && __atomic_load_n(&idle_steps, __ATOMIC_SEQ_CST)
+	     < IDLE_STEPS; i++)
+		usleep(1000);
+	assert(idle_steps == IDLE_STEPS);
+
+	/* writes of different sizes, one per object */
+	memset(&d, 0, sizeof(d));
+	memset(bc, 0, sizeof(bc));
+	for (i = 0; i < ASYNC_N; i++) {
+		wbuf[i] = malloc(4096 << (i % 6));
+		assert(wbuf[i]);
+		memset(wbuf[i], i, 4096 << (i % 6));
+		ret = osd_command_set_write(&cmd[i], pid, oid + i,
+					    4096 << (i % 6), 0);
+		assert(ret == 0);
+		bc[i].cdb = cmd[i].cdb;
+		bc[i].data_in = wbuf[i];
+		bc[i].data_in_len = 4096 << (i % 6);
+		bc[i].sense_out = sense[i];
+		ret = osdemu_cmd_submit_async(&osd, &bc[i], async_cb, &d);
+		assert(ret == 0);
+	}
+	async_wait(&osd, efd, &d, ASYNC_N);
+	for (i = 0; i < ASYNC_N; i++)
+		assert(bc[i].status == SAM_STAT_GOOD);
+
+	/* read back, plus one that fails */
+	memset(&d, 0, sizeof(d));
+	memset(bc, 0, sizeof(bc));
+	for (i = 0; i < ASYNC_N; i++) {
+		ret = osd_command_set_read(&cmd[i], pid, oid + i,
+					   4096 << (i % 6), 0);
+		assert(ret == 0);
+		if (i == ASYNC_N - 1)
+			set_htonll(&cmd[i].cdb[16], pid + 1);
+		bc[i].cdb = cmd[i].cdb;
+		bc[i].sense_out = sense[i];
+		ret = osdemu_cmd_submit_async(&osd, &bc[i], async_cb, &d);
+		assert(ret == 0);
+	}
+	async_wait(&osd, efd, &d, ASYNC_N);
+	ooo = 0;
+	for (i = 0; i < ASYNC_N; i++) {
+		if (d.order[i] != i)
+			ooo++;
+		if (i == ASYNC_N - 1) {
+			assert(bc[i].status == SAM_STAT_CHECK_CONDITION);
+			assert(bc[i].senselen_out > 0);
+			continue;
+		}
+		assert(bc[i].status == SAM_STAT_GOOD);
+		assert(bc[i].data_out_len == (uint64_t) (4096 << (i % 6)));
+		assert(memcmp(bc[i].data_out, wbuf[i], 4096 << (i % 6)) == 0);
+		osdemu_outbuf_release(&osd, bc[i].data_out);
+	}
+	printf("async: %d of %d completed out of order\n", ooo, ASYNC_N);
+
+	/*
+	 * A CAS WAIT first, then reads: the wait lets go of its worker and
+	 * the reads all complete before the CAS that ends it.
+	 */
+	memset(&d, 0, sizeof(d));
+	memset(bc, 0, sizeof(bc));
+	ret = osd_command_set_cas_wait(&cmd[0], pid, oid, 8, 0);
+	assert(ret == 0);
+	set_htonll(&in[0], 0);
+	set_htonl(&in[8], 10000);
+	bc[0].cdb = cmd[0].cdb;
+	bc[0].data_in = in;
+	bc[0].data_in_len = sizeof(in);
+	bc[0].sense_out = sense[0];
+	ret = osdemu_cmd_submit_async(&osd, &bc[0], async_cb, &d);
+	assert(ret == 0);
+	for (i = 1; i < ASYNC_N; i++) {
+		ret = osd_command_set_read(&cmd[i], pid, oid + i, 4096, 0);
+		assert(ret == 0);
+		bc[i].cdb = cmd[i].cdb;
+		bc[i].sense_out = sense[i];
+		ret = osdemu_cmd_submit_async(&osd, &bc[i], async_cb, &d);
+		assert(ret == 0);
+	}
+	async_wait(&osd, efd, &d, ASYNC_N - 1);
+	assert(atomic_op(&osd, OSD_CAS, oid, 0, 1) == 0);
+	async_wait(&osd, efd, &d, ASYNC_N);
+	assert(d.order[ASYNC_N - 1] == 0);
+	assert(bc[0].status == SAM_STAT_GOOD);
+	assert(get_ntohll(bc[0].data_out) == 1);
+	free(bc[0].data_out);
+	for (i = 1; i < ASYNC_N; i++) {
+		assert(bc[i].status == SAM_STAT_GOOD);
+		osdemu_outbuf_release(&osd, bc[i].data_out);
+	}
+
+	/* close finishes what is queued and calls back */
+	memset(&d, 0, sizeof(d));
+	memset(bc, 0, sizeof(bc));
+	ret = osd_command_set_read(&cmd[0], pid, oid, 4096, 0);
+	assert(ret == 0);
+	bc[0].cdb = cmd[0].cdb;
+	bc[0].sense_out = sense[0];
+	ret = osdemu_cmd_submit_async(&osd, &bc[0], async_cb, &d);
+	assert(ret == 0);
+	ret = osd_close(&osd);
+	assert(ret == 0);
+	assert(d.n == 1 && bc[0].status == SAM_STAT_GOOD);
+	free(bc[0].data_out);
+
+	/* FORMAT OSD on a worker: commands of the caller wait, then run */
+	ret = osd_open(root, &osd);
+	assert(ret == 0);
+	efd = osdemu_async_start(&osd);
+	assert(efd >= 0);
+	memset(&d, 0, sizeof(d));
+	memset(bc, 0, sizeof(bc));
+	ret = osd_command_set_format_osd(&cmd[0], 1 << 30);
+	assert(ret == 0);
+	bc[0].cdb = cmd[0].cdb;
+	bc[0].sense_out = sense[0];
+	ret = osdemu_cmd_submit_async(&osd, &bc[0], async_cb, &d);
+	assert(ret == 0);
+	for (i = 0; i < 64; i++) {
+		ret = osd_command_set_get_attributes(&cmd[1], ROOT_PID,
+						     ROOT_OID);
+		assert(ret == 0);
+		data_out = NULL;
+		ret = osdemu_cmd_submit(&osd, cmd[1].cdb, NULL, 0, &data_out,
+					&data_out_len, sense_out,
+					&senselen_out);
+		assert(ret == SAM_STAT_GOOD);
+		osdemu_outbuf_release(&osd, data_out);
+	}
+	async_wait(&osd, efd, &d, 1);
+	assert(bc[0].status == SAM_STAT_GOOD);
+	ret = osd_close(&osd);
+	assert(ret == 0);
+
+	for (i = 0; i < ASYNC_N; i++)
+		free(wbuf[i]);
+}
+
+/* data-in buffers from the pool are aligned and reused */
+void test_outbuf(void)
+{
+	int ret = 0;
+	const char *root = "/tmp/osd-outbuf/";
+	struct osd_device osd;
+	struct osd_command cmd;
+	uint8_t sense_out[OSD_MAX_SENSE];
+	int senselen_out;
+	uint8_t *data_out = NULL, *first;
+	uint64_t data_out_len;
+	uint64_t hits;
+	uint64_t pid = USEROBJECT_PID_LB;
+	uint64_t oid = USEROBJECT_OID_LB;
+	const uint64_t len = 100000;
+	uint8_t *wbuf;
+
+	system("rm -rf /tmp/osd-outbuf");
+	ret = osd_open(root, &osd);
+	assert(ret == 0);
+	ret = osdemu_outbuf_pool(&osd, OSDEMU_OUTBUF_HUGE);
+	assert(ret == 0);
+
+	ret = osd_command_set_create_partition(&cmd, pid);
+	assert(ret == 0);
+	ret = osdemu_cmd_submit(&osd, cmd.cdb, NULL, 0, &data_out,
+				&data_out_len, sense_out, &senselen_out);
+	assert(ret == 0);
+	ret = osd_command_set_create(&cmd, pid, oid, 1);
+	assert(ret == 0);
+	ret = osdemu_cmd_submit(&osd, cmd.cdb, NULL, 0, &data_out,
+				&data_out_len, sense_out, &senselen_out);
+	assert(ret == 0);
+
+	wbuf = malloc(len);
+	assert(wbuf);
+	memset(wbuf, 0x5a, len);
+	ret = osd_command_set_write(&cmd, pid, oid, len, 0);
+	assert(ret == 0);
+	ret = osdemu_cmd_submit(&osd, cmd.cdb, wbuf, len, &data_out,
+				&data_out_len, sense_out, &senselen_out);
+	assert(ret == 0);
+
+	ret = osd_command_set_read(&cmd, pid, oid, len, 0);
+	assert(ret == 0);
+	data_out = NULL;
+	ret = osdemu_cmd_submit(&osd, cmd.cdb, NULL, 0, &data_out,
+				&data_out_len, sense_out, &senselen_out);
+	assert(ret == 0);
+	assert(data_out_len == len);
+	assert(((uintptr_t)data_out & 4095) == 0);
+	assert(memcmp(data_out, wbuf, len) == 0);
+	first = data_out;
+	osdemu_outbuf_release(&osd, data_out);
+
+	/* same size class again: the released buffer comes back */
+	hits = get_stat(&osd, RSTATS_OUTBUF_HITS);
+	data_out = NULL;
+	ret = osdemu_cmd_submit(&osd, cmd.cdb, NULL, 0, &data_out,
+				&data_out_len, sense_out, &senselen_out);
+	assert(ret == 0);
+	assert(data_out == first);
+	assert(memcmp(data_out, wbuf, len) == 0);
+	osdemu_outbuf_release(&osd, data_out);
+	assert(get_stat(&osd, RSTATS_OUTBUF_HITS) > hits);
+
+	free(wbuf);
+	ret = osd_close(&osd);
+	assert(ret == 0);
+}
+
 /* only to be used by test_osd_query */
 static void set_attr_int(struct osd_device *osd, uint64_t pid, uint64_t oid, 
 			 uint32_t page, uint32_t number, uint64_t val)
@@ -1235,36 +1985,862 @@ void test_list(struct osd_device *osd)
 	test_oids_with_attr(osd, pid, getattr, 6, 680, 680, 784, 65546, 
 			    (0x22 << 2), attrs, ARRAY_SIZE(attrs));
 
-	/* clean up */
-	oid = USEROBJECT_OID_LB;
-	for (i=0; i<12; i++) {
-		if (i == 0 || i == 7)
-			continue;
-		ret = osd_command_set_remove(&cmd, pid, oid + i);
+	/* clean up */
+	oid = USEROBJECT_OID_LB;
+	for (i=0; i<12; i++) {
+		if (i == 0 || i == 7)
+			continue;
+		ret = osd_command_set_remove(&cmd, pid, oid + i);
+		assert(ret == 0);
+		ret = osdemu_cmd_submit(osd, cmd.cdb, NULL, 0, &data_out,
+					&data_out_len, sense_out,
+					&senselen_out);
+		assert(ret == 0);
+	}
+	cid = COLLECTION_OID_LB;
+	ret = osd_command_set_remove_collection(&cmd, pid, cid, 0);
+	assert(ret == 0);
+	ret = osdemu_cmd_submit(osd, cmd.cdb, NULL, 0, &data_out,
+				&data_out_len, sense_out, &senselen_out);
+	assert(ret == 0);
+	cid = COLLECTION_OID_LB + 7;
+	ret = osd_command_set_remove_collection(&cmd, pid, cid, 0);
+	assert(ret == 0);
+	ret = osdemu_cmd_submit(osd, cmd.cdb, NULL, 0, &data_out,
+				&data_out_len, sense_out, &senselen_out);
+	assert(ret == 0);
+
+	ret = osd_command_set_remove_partition(&cmd, pid);
+	assert(ret == 0);
+	ret = osdemu_cmd_submit(osd, cmd.cdb, NULL, 0, &data_out,
+				&data_out_len, sense_out, &senselen_out);
+	assert(ret == 0);
+}
+
+#define LIST_N 6
+
+/*
+ * Run LIST, or LIST COLLECTION of cid, with attributes from initial_oid and
+ * check each object descriptor returned; see list_attr_setup. returns the
+ * number of objects listed.
+ */
+static int list_attr(struct osd_device *osd, uint64_t pid, uint64_t cid,
+		     uint64_t initial_oid, uint64_t alloc_len,
+		     uint64_t *add_len, uint64_t *cont_id)
+{
+	struct osd_command cmd;
+	uint8_t sense_out[OSD_MAX_SENSE];
+	int senselen_out;
+	uint8_t *data_out = NULL;
+	uint64_t data_out_len;
+	uint32_t page = USEROBJECT_PG + LUN_PG_LB;
+	uint8_t *cp, *end, *ode;
+	uint64_t oid;
+	uint32_t len;
+	int n = 0, i, ret;
+	struct attribute_list attr[] = {
+		{ ATTR_GET, page, 1, NULL, 8, 0 },
+		{ ATTR_GET, USER_INFO_PG, UIAP_LOGICAL_LEN, NULL, 8, 0 },
+		{ ATTR_GET, page, 1, NULL, 8, 0 }, /* once is enough */
+	};
+
+	if (cid)
+		ret = osd_command_set_list_collection(&cmd, pid, cid, 0,
+						      alloc_len, initial_oid,
+						      1);
+	else
+		ret = osd_command_set_list(&cmd, pid, 0, alloc_len,
+					   initial_oid, 1);
+	assert(ret == 0);
+	ret = osd_command_attr_build(&cmd, attr, 3);
+	assert(ret == 0);
+	ret = osdemu_cmd_submit(osd, cmd.cdb, cmd.outdata, cmd.outlen,
+				&data_out, &data_out_len, sense_out,
+				&senselen_out);
+	assert(ret == 0);
+	*add_len = get_ntohll(&data_out[0]);
+	*cont_id = get_ntohll(&data_out[8]);
+	assert(data_out[23] == (0x22 << 2));
+
+	cp = &data_out[24];
+	end = &data_out[data_out_len];
+	while (cp < end) {
+		oid = get_ntohll(cp);
+		i = oid - USEROBJECT_OID_LB - 1;
+		assert(i >= 0 && i < LIST_N);
+		assert(!cid || i != 2);
+		len = get_ntohl(&cp[12]);
+		ode = cp + 16;
+		cp = ode + len;
+		assert(cp <= end);
+
+		/* in (page, number) order: information page first */
+		assert(get_ntohl(&ode[LE_PAGE_OFF]) == USER_INFO_PG);
+		assert(get_ntohl(&ode[LE_NUMBER_OFF]) == UIAP_LOGICAL_LEN);
+		assert(get_ntohs(&ode[LE_LEN_OFF]) == 8);
+		assert(get_ntohll(&ode[LE_VAL_OFF]) == (uint64_t) 16 * (i + 1));
+		ode += roundup8(LE_VAL_OFF + 8);
+		if (i == 4) {
+			assert(ode == cp); /* not defined, not listed */
+		} else {
+			assert(get_ntohl(&ode[LE_PAGE_OFF]) == page);
+			assert(get_ntohl(&ode[LE_NUMBER_OFF]) == 1);
+			assert(get_ntohll(&ode[LE_VAL_OFF]) ==
+			       (uint64_t) 100 + i);
+			assert(ode + roundup8(LE_VAL_OFF + 8) == cp);
+		}
+		n++;
+	}
+	free(data_out);
+	osd_command_attr_free(&cmd);
+	return n;
+}
+
+/* LIST and LIST COLLECTION return stored and computed attributes */
+static void test_list_attr(struct osd_device *osd)
+{
+	struct osd_command cmd;
+	uint8_t sense_out[OSD_MAX_SENSE];
+	int senselen_out;
+	uint8_t *data_out = NULL;
+	uint64_t data_out_len;
+	uint64_t pid = USEROBJECT_PID_LB + 9;
+	uint64_t cid = USEROBJECT_OID_LB;
+	uint64_t oid = cid + 1;
+	uint64_t add_len, cont_id, full_len, attrval;
+	uint8_t buf[LIST_N * 16];
+	int i, ret;
+	struct attribute_list attr = {
+		ATTR_SET, USER_COLL_PG, 1, &attrval, 8, 0
+	};
+
+	ret = osd_command_set_create_partition(&cmd, pid);
+	assert(ret == 0);
+	ret = osdemu_cmd_submit(osd, cmd.cdb, NULL, 0, &data_out,
+				&data_out_len, sense_out, &senselen_out);
+	assert(ret == 0);
+	ret = osd_command_set_create_collection(&cmd, pid, cid);
+	assert(ret == 0);
+	ret = osdemu_cmd_submit(osd, cmd.cdb, NULL, 0, &data_out,
+				&data_out_len, sense_out, &senselen_out);
+	assert(ret == 0);
+
+	/* all but the third in the collection, all but the fifth with attr */
+	set_htonll(&attrval, cid);
+	memset(buf, 0x5a, sizeof(buf));
+	for (i = 0; i < LIST_N; i++) {
+		ret = osd_command_set_create(&cmd, pid, oid + i, 1);
+		assert(ret == 0);
+		if (i != 2) {
+			ret = osd_command_attr_build(&cmd, &attr, 1);
+			assert(ret == 0);
+		}
+		ret = osdemu_cmd_submit(osd, cmd.cdb, cmd.outdata, cmd.outlen,
+					&data_out, &data_out_len, sense_out,
+					&senselen_out);
+		assert(ret == 0);
+		osd_command_attr_free(&cmd);
+		ret = osd_command_set_write(&cmd, pid, oid + i, 16 * (i + 1),
+					    0);
+		assert(ret == 0);
+		ret = osdemu_cmd_submit(osd, cmd.cdb, buf, 16 * (i + 1),
+					&data_out, &data_out_len, sense_out,
+					&senselen_out);
+		assert(ret == 0);
+		if (i != 4)
+			set_attr_int(osd, pid, oid + i,
+				     USEROBJECT_PG + LUN_PG_LB, 1, 100 + i);
+	}
+
+	assert(list_attr(osd, pid, 0, 0, 4096, &add_len, &cont_id) ==
+	       LIST_N);
+	assert(cont_id == 0);
+	full_len = add_len;
+
+	/* room for two and a half: two whole, continue at the third */
+	assert(list_attr(osd, pid, 0, 0, 24 + 2 * 64 + 32, &add_len,
+			 &cont_id) == 2);
+	assert(add_len == full_len);
+	assert(cont_id == oid + 2);
+	assert(list_attr(osd, pid, 0, cont_id, 4096, &add_len, &cont_id) ==
+	       LIST_N - 2);
+	assert(cont_id == 0);
+
+	assert(list_attr(osd, pid, cid, 0, 4096, &add_len, &cont_id) ==
+	       LIST_N - 1);
+	assert(cont_id == 0);
+}
+
+#define MEMBER_N 6
+
+/*
+ * GET MEMBER ATTRIBUTES of cid from initial_oid on, at most numoid; checks
+ * the multi-object list of the members returned, see test_member_attr.
+ * returns the number of members in it.
+ */
+static int member_attr(struct osd_device *osd, uint64_t pid, uint64_t cid,
+		       uint64_t initial_oid, uint16_t numoid,
+		       uint64_t *add_len, uint64_t *cont_id)
+{
+	struct osd_command cmd;
+	uint8_t sense_out[OSD_MAX_SENSE];
+	int senselen_out;
+	uint8_t *data_out = NULL;
+	uint64_t data_out_len;
+	uint8_t hdr[24];
+	uint32_t page = USEROBJECT_PG + LUN_PG_LB;
+	uint8_t *cp, *end;
+	uint64_t oid, last = 0;
+	int n = 0, i, ret;
+	struct attribute_list attr[] = {
+		{ ATTR_GET_MULTI, page, 1, NULL, 8, 0 },
+		{ ATTR_GET_MULTI, USER_INFO_PG, UIAP_LOGICAL_LEN, NULL, 8, 0 },
+	};
+
+	ret = osd_command_set_get_member_attributes(&cmd, pid, cid,
+						    sizeof(hdr), initial_oid,
+						    numoid);
+	assert(ret == 0);
+	cmd.indata = hdr;
+	cmd.inlen_alloc = sizeof(hdr);
+	ret = osd_command_attr_build(&cmd, attr, 2);
+	assert(ret == 0);
+	ret = osdemu_sql_profile(osd, 0);
+	assert(ret == 0);
+	ret = osdemu_cmd_submit(osd, cmd.cdb, cmd.outdata, cmd.outlen,
+				&data_out, &data_out_len, sense_out,
+				&senselen_out);
+	assert(ret == 0);
+	assert(sql_runs(osd, "SELECT oid FROM coll") == 1);
+	assert(sql_runs(osd, "SELECT oid, page, number, value FROM attr") ==
+	       1);
+	osdemu_sql_profile_stop(osd);
+
+	*add_len = get_ntohll(&data_out[0]);
+	*cont_id = get_ntohll(&data_out[8]);
+	cp = &data_out[get_ntohoffset(&cmd.cdb[64])];
+	assert(cp[0] == RTRVD_MULTIOBJ_LIST);
+	end = &cp[8 + get_ntohl(&cp[4])];
+	assert(end <= &data_out[data_out_len]);
+
+	/* oid and a list entry, members in order, (page, number) in each */
+	for (cp += 8; cp < end; cp += roundup8(8 + LE_VAL_OFF + 8)) {
+		oid = get_ntohll(cp);
+		i = oid - USEROBJECT_OID_LB - 1;
+		assert(i >= 0 && i < MEMBER_N);
+		if (get_ntohl(&cp[8 + LE_PAGE_OFF]) == USER_INFO_PG) {
+			assert(oid > last);
+			last = oid;
+			assert(get_ntohl(&cp[8 + LE_NUMBER_OFF]) ==
+			       UIAP_LOGICAL_LEN);
+			assert(get_ntohll(&cp[8 + LE_VAL_OFF]) ==
+			       (uint64_t) 8 * (i + 1));
+			n++;
+		} else {
+			assert(oid == last && i != 3);
+			assert(get_ntohl(&cp[8 + LE_PAGE_OFF]) == page);
+			assert(get_ntohll(&cp[8 + LE_VAL_OFF]) ==
+			       (uint64_t) 100 + i);
+		}
+		assert(get_ntohs(&cp[8 + LE_LEN_OFF]) == 8);
+	}
+	assert(cp == end);
+
+	free(data_out);
+	osd_command_attr_free(&cmd);
+	return n;
+}
+
+/* one scan of the collection returns an attribute of every member */
+static void test_member_attr(struct osd_device *osd)
+{
+	struct osd_command cmd;
+	uint8_t sense_out[OSD_MAX_SENSE];
+	int senselen_out;
+	uint8_t *data_out = NULL;
+	uint64_t data_out_len;
+	uint64_t pid = USEROBJECT_PID_LB + 10;
+	uint64_t cid = USEROBJECT_OID_LB;
+	uint64_t oid = cid + 1;
+	uint64_t add_len, cont_id, full_len, attrval;
+	uint8_t buf[MEMBER_N * 8];
+	int i, ret;
+	struct attribute_list attr = {
+		ATTR_SET, USER_COLL_PG, 1, &attrval, 8, 0
+	};
+
+	ret = osd_command_set_create_partition(&cmd, pid);
+	assert(ret == 0);
+	ret = osdemu_cmd_submit(osd, cmd.cdb, NULL, 0, &data_out,
+				&data_out_len, sense_out, &senselen_out);
+	assert(ret == 0);
+	ret = osd_command_set_create_collection(&cmd, pid, cid);
+	assert(ret == 0);
+	ret = osdemu_cmd_submit(osd, cmd.cdb, NULL, 0, &data_out,
+				&data_out_len, sense_out, &senselen_out);
+	assert(ret == 0);
+
+	/* the last one is no member, the fourth has no attr */
+	set_htonll(&attrval, cid);
+	memset(buf, 0xa5, sizeof(buf));
+	for (i = 0; i <= MEMBER_N; i++) {
+		ret = osd_command_set_create(&cmd, pid, oid + i, 1);
+		assert(ret == 0);
+		if (i < MEMBER_N) {
+			ret = osd_command_attr_build(&cmd, &attr, 1);
+			assert(ret == 0);
+		}
+		ret = osdemu_cmd_submit(osd, cmd.cdb, cmd.outdata, cmd.outlen,
+					&data_out, &data_out_len, sense_out,
+					&senselen_out);
+		assert(ret == 0);
+		if (i < MEMBER_N)
+			osd_command_attr_free(&cmd);
+		ret = osd_command_set_write(&cmd, pid, oid + i, 8 * (i + 1),
+					    0);
+		assert(ret == 0);
+		ret = osdemu_cmd_submit(osd, cmd.cdb, buf, 8 * (i + 1),
+					&data_out, &data_out_len, sense_out,
+					&senselen_out);
+		assert(ret == 0);
+		if (i != 3)
+			set_attr_int(osd, pid, oid + i,
+				     USEROBJECT_PG + LUN_PG_LB, 1, 100 + i);
+	}
+
+	assert(member_attr(osd, pid, cid, 0, MEMBER_N, &add_len, &cont_id) ==
+	       MEMBER_N);
+	assert(cont_id == 0);
+	assert(add_len == 8 + (2 * MEMBER_N - 1) * roundup8(8 + LE_VAL_OFF + 8));
+	full_len = add_len;
+
+	/* two at a time, then the rest */
+	assert(member_attr(osd, pid, cid, 0, 2, &add_len, &cont_id) == 2);
+	assert(add_len == full_len);
+	assert(cont_id == oid + 2);
+	assert(member_attr(osd, pid, cid, cont_id, MEMBER_N, &add_len,
+			   &cont_id) == MEMBER_N - 2);
+	assert(cont_id == 0);
+
+	/* not a collection */
+	ret = osd_command_set_get_member_attributes(&cmd, pid, oid, 0, 0, 0);
+	assert(ret == 0);
+	ret = osdemu_cmd_submit(osd, cmd.cdb, NULL, 0, &data_out,
+				&data_out_len, sense_out, &senselen_out);
+	assert(ret != 0);
+}
+
+/* returns: length of attribute (page, number) of oid, 0 if it has none */
+static uint16_t get_attr_val(struct osd_device *osd, uint64_t pid,
+			     uint64_t oid, uint32_t page, uint32_t number,
+			     void *val, uint16_t len)
+{
+	struct osd_command cmd;
+	uint8_t sense_out[OSD_MAX_SENSE];
+	int senselen_out;
+	uint8_t *data_out = NULL;
+	uint64_t data_out_len;
+	uint8_t *cp;
+	int ret;
+	struct attribute_list attr = {
+		ATTR_GET, page, number, NULL, len, 0
+	};
+
+	ret = osd_command_set_get_attributes(&cmd, pid, oid);
+	assert(ret == 0);
+	ret = osd_command_attr_build(&cmd, &attr, 1);
+	assert(ret == 0);
+	ret = osdemu_cmd_submit(osd, cmd.cdb, cmd.outdata, cmd.outlen,
+				&data_out, &data_out_len,
+				sense_out, &senselen_out);
+	assert(ret == 0);
+	assert(data_out[0] == RTRVD_SET_ATTR_LIST);
+	cp = &data_out[8];
+	len = get_ntohs(&cp[LE_LEN_OFF]);
+	if (len == 0xFFFF)
+		len = 0;
+	memcpy(val, &cp[LE_VAL_OFF], len);
+	osdemu_outbuf_release(osd, data_out);
+	osd_command_attr_free(&cmd);
+	return len;
+}
+
+static uint8_t percent_complete(struct osd_device *osd, uint64_t pid,
+				uint64_t cid)
+{
+	uint8_t percent = 0;
+
+	assert(get_attr_val(osd, pid, cid, COLL_TRACKING_PG,
+			    CTP_PERCENT_COMPLETE, &percent, 1) == 1);
+	return percent;
+}
+
+#define SETMEMBER_N (3 * 1024 + 5)
+#define SETMEMBER_MANY 64
+
+/*
+ * SET MEMBER ATTRIBUTES on more members than fit in one chunk: later
+ * commands finish it, and after a crash the next open does.
+ */
+static void test_set_member_chunks(struct osd_device *osd)
+{
+	struct osd_command cmd;
+	struct osd_device osd2;
+	uint8_t sense_out[OSD_MAX_SENSE];
+	int senselen_out;
+	uint8_t *data_out = NULL;
+	uint64_t data_out_len;
+	uint64_t pid = USEROBJECT_PID_LB + 11;
+	uint64_t cid = USEROBJECT_OID_LB;
+	uint64_t oid = cid + 1;
+	uint64_t last = oid + SETMEMBER_N - 1;
+	uint32_t page = USEROBJECT_PG + LUN_PG_LB;
+	uint64_t attrval, val, val2;
+	uint8_t percent;
+	int i, ret;
+	struct attribute_list attr = {
+		ATTR_SET, USER_COLL_PG, 1, &attrval, 8, 0
+	};
+	struct attribute_list set[] = {
+		{ ATTR_SET, page, 2, &val, 8, 0 },
+		{ ATTR_SET, page, 3, &val2, 8, 0 },
+	};
+	struct attribute_list many[SETMEMBER_MANY];
+
+	ret = osd_command_set_create_partition(&cmd, pid);
+	assert(ret == 0);
+	ret = osdemu_cmd_submit(osd, cmd.cdb, NULL, 0, &data_out,
+				&data_out_len, sense_out, &senselen_out);
+	assert(ret == 0);
+	ret = osd_command_set_create_collection(&cmd, pid, cid);
+	assert(ret == 0);
+	ret = osdemu_cmd_submit(osd, cmd.cdb, NULL, 0, &data_out,
+				&data_out_len, sense_out, &senselen_out);
+	assert(ret == 0);
+
+	set_htonll(&attrval, cid);
+	for (i = 0; i < SETMEMBER_N; i++) {
+		ret = osd_command_set_create(&cmd, pid, oid + i, 1);
 		assert(ret == 0);
-		ret = osdemu_cmd_submit(osd, cmd.cdb, NULL, 0, &data_out,
-					&data_out_len, sense_out,
+		ret = osd_command_attr_build(&cmd, &attr, 1);
+		assert(ret == 0);
+		ret = osdemu_cmd_submit(osd, cmd.cdb, cmd.outdata, cmd.outlen,
+					&data_out, &data_out_len, sense_out,
 					&senselen_out);
 		assert(ret == 0);
+		osd_command_attr_free(&cmd);
 	}
-	cid = COLLECTION_OID_LB;
-	ret = osd_command_set_remove_collection(&cmd, pid, cid, 0);
+
+	/* the atomics page only through SET ATTRIBUTES */
+	set[1].page = USER_ATOMICS_PG;
+	set[1].number = UAP_CAS;
+	ret = osd_command_set_set_member_attributes(&cmd, pid, cid);
 	assert(ret == 0);
-	ret = osdemu_cmd_submit(osd, cmd.cdb, NULL, 0, &data_out,
-				&data_out_len, sense_out, &senselen_out);
+	ret = osd_command_attr_build(&cmd, set, 2);
 	assert(ret == 0);
-	cid = COLLECTION_OID_LB + 7;
-	ret = osd_command_set_remove_collection(&cmd, pid, cid, 0);
+	ret = osdemu_cmd_submit(osd, cmd.cdb, cmd.outdata, cmd.outlen,
+				&data_out, &data_out_len, sense_out,
+				&senselen_out);
+	assert(ret == SAM_STAT_CHECK_CONDITION);
+	osd_command_attr_free(&cmd);
+	set[1].page = page;
+	set[1].number = 3;
+
+	set_htonll(&val, 4242);
+	set_htonll(&val2, 4343);
+	ret = osd_command_set_set_member_attributes(&cmd, pid, cid);
 	assert(ret == 0);
-	ret = osdemu_cmd_submit(osd, cmd.cdb, NULL, 0, &data_out,
-				&data_out_len, sense_out, &senselen_out);
+	ret = osd_command_attr_build(&cmd, set, 2);
+	assert(ret == 0);
+	ret = osdemu_cmd_submit(osd, cmd.cdb, cmd.outdata, cmd.outlen,
+				&data_out, &data_out_len, sense_out,
+				&senselen_out);
 	assert(ret == 0);
+	osd_command_attr_free(&cmd);
 
-	ret = osd_command_set_remove_partition(&cmd, pid);
+	/* each command is followed by a chunk, the first ran inline */
+	assert(get_attr_val(osd, pid, last, page, 2, &val, 8) == 0);
+
+	/* what a crash now would leave behind */
+	ret = system("rm -rf /tmp/osd-resume && cp -a /tmp/osd /tmp/osd-resume");
 	assert(ret == 0);
-	ret = osdemu_cmd_submit(osd, cmd.cdb, NULL, 0, &data_out,
-				&data_out_len, sense_out, &senselen_out);
+
+	assert(percent_complete(osd, pid, cid) < 100);
+	assert(get_attr_val(osd, pid, oid, page, 2, &val, 8) == 8);
+	assert(get_ntohll(&val) == 4242);
+
+	for (i = 0; i < 8; i++) {
+		percent = percent_complete(osd, pid, cid);
+		if (percent == 100)
+			break;
+	}
+	assert(percent == 100);
+	assert(get_attr_val(osd, pid, last, page, 2, &val, 8) == 8);
+	assert(get_ntohll(&val) == 4242);
+	assert(get_attr_val(osd, pid, last, page, 3, &val, 8) == 8);
+	assert(get_ntohll(&val) == 4343);
+
+	/* the copy goes on where it was cut off, and finishes on close */
+	ret = osd_open("/tmp/osd-resume/", &osd2);
+	assert(ret == 0);
+	assert(get_attr_val(&osd2, pid, last, page, 2, &val, 8) == 0);
+	ret = osd_close(&osd2);
+	assert(ret == 0);
+	ret = osd_open("/tmp/osd-resume/", &osd2);
+	assert(ret == 0);
+	assert(get_attr_val(&osd2, pid, last, page, 2, &val, 8) == 8);
+	assert(get_ntohll(&val) == 4242);
+	assert(percent_complete(&osd2, pid, cid) == 100);
+	ret = osd_close(&osd2);
+	assert(ret == 0);
+	system("rm -rf /tmp/osd-resume");
+
+	/* many attributes at once make a statement of many MAXSQLENs */
+	for (i = 0; i < SETMEMBER_MANY; i++) {
+		many[i].type = ATTR_SET;
+		many[i].page = page;
+		many[i].number = 10 + i;
+		many[i].val = &val;
+		many[i].len = 8;
+	}
+	set_htonll(&val, 4444);
+	ret = osd_command_set_set_member_attributes(&cmd, pid, cid);
+	assert(ret == 0);
+	ret = osd_command_attr_build(&cmd, many, SETMEMBER_MANY);
+	assert(ret == 0);
+	ret = osdemu_cmd_submit(osd, cmd.cdb, cmd.outdata, cmd.outlen,
+				&data_out, &data_out_len, sense_out,
+				&senselen_out);
+	assert(ret == 0);
+	osd_command_attr_free(&cmd);
+	assert(get_attr_val(osd, pid, oid, page, 10 + SETMEMBER_MANY - 1,
+			    &val, 8) == 8);
+	assert(get_ntohll(&val) == 4444);
+}
+
+/* run a command, returns its status */
+static int sec_run(struct osd_device *osd, struct osd_command *cmd)
+{
+	uint8_t sense_out[OSD_MAX_SENSE];
+	int senselen_out;
+	uint8_t *data_out = NULL;
+	uint64_t data_out_len = 0;
+	int ret;
+
+	ret = osdemu_cmd_submit(osd, cmd->cdb, cmd->outdata, cmd->outlen,
+				&data_out, &data_out_len, sense_out,
+				&senselen_out);
+	if (data_out)
+		osdemu_outbuf_release(osd, data_out);
+	return ret;
+}
+
+/* run a command that must fail the security check with asc */
+static void sec_fail(struct osd_device *osd, struct osd_command *cmd,
+		     uint16_t asc)
+{
+	uint8_t sense_out[OSD_MAX_SENSE];
+	int senselen_out;
+	uint8_t *data_out = NULL;
+	uint64_t data_out_len = 0;
+	int ret;
+
+	ret = osdemu_cmd_submit(osd, cmd->cdb, cmd->outdata, cmd->outlen,
+				&data_out, &data_out_len, sense_out,
+				&senselen_out);
+	assert(ret == SAM_STAT_CHECK_CONDITION && data_out == NULL);
+	assert(sense_out[1] == OSD_SSK_ILLEGAL_REQUEST);
+	assert(sense_out[2] == asc >> 8 && sense_out[3] == (asc & 0xFF));
+}
+
+/* sign the command as the holder of the capability key would */
+static void sec_cap_sign(struct osd_command *cmd, const uint8_t *secret)
+{
+	uint8_t cap_key[OSD_KEY_LEN];
+
+	sec_hmac(secret, &cmd->cdb[CAP_OFF], CAP_LEN, cap_key);
+	sec_sign(cmd->cdb, cap_key);
+}
+
+static int sec_get(struct osd_device *osd, uint8_t method, uint8_t version,
+		   uint64_t pid, uint64_t oid, const uint8_t *secret)
+{
+	struct osd_command cmd;
+
+	osd_command_set_get_attributes(&cmd, pid, oid);
+	osd_command_set_capability(&cmd, method, version, CAP_PERM_GET_ATTR,
+				   CAP_ODT_OBJECT, pid, oid);
+	if (secret)
+		sec_cap_sign(&cmd, secret);
+	return sec_run(osd, &cmd);
+}
+
+static void sec_set_method_attr(struct osd_device *osd, uint8_t method,
+				const uint8_t *secret)
+{
+	struct osd_command cmd;
+	struct attribute_list attr = {
+		ATTR_SET, ROOT_POLICY_PG, RPSAP_DEFAULT_SECURITY_METHOD,
+		&method, 1, 0
+	};
+	int ret;
+
+	ret = osd_command_set_set_attributes(&cmd, ROOT_PID, ROOT_OID);
 	assert(ret == 0);
+	ret = osd_command_attr_build(&cmd, &attr, 1);
+	assert(ret == 0);
+	osd_command_set_capability(&cmd, OSD_SEC_CAPKEY, 0,
+				   CAP_PERM_SET_ATTR, CAP_ODT_LU, 0, 0);
+	if (secret)
+		sec_cap_sign(&cmd, secret);
+	assert(sec_run(osd, &cmd) == SAM_STAT_GOOD);
+	osd_command_attr_free(&cmd);
+}
+
+static void sec_set_key_cmd(struct osd_device *osd, int key_to_set,
+			    uint64_t pid, uint8_t version, uint8_t fill,
+			    const uint8_t *parent, uint8_t *key)
+{
+	struct osd_command cmd;
+	uint8_t seed[OSD_KEY_LEN];
+
+	memset(seed, fill, sizeof(seed));
+	osd_command_set_set_key(&cmd, key_to_set, pid,
+				(uint64_t)version << 56, seed);
+	osd_command_set_capability(&cmd, OSD_SEC_CAPKEY, 0, CAP_PERM_POL_SEC,
+				   pid ? CAP_ODT_PARTITION : CAP_ODT_LU,
+				   pid, 0);
+	sec_cap_sign(&cmd, parent);
+	assert(sec_run(osd, &cmd) == SAM_STAT_GOOD);
+	sec_hmac(parent, seed, sizeof(seed), key);
+}
+
+/* capabilities are checked once security is on, and cached */
+static void test_security(struct osd_device *osd)
+{
+	struct osd_command cmd;
+	uint64_t pid = USEROBJECT_PID_LB + 12;
+	uint64_t oid = USEROBJECT_OID_LB;
+	uint8_t master[OSD_KEY_LEN], root[OSD_KEY_LEN], part[OSD_KEY_LEN];
+	uint8_t work[OSD_KEY_LEN], old[OSD_KEY_LEN];
+	uint64_t hits, misses, hits0, misses0;
+	int i, ret;
+
+	memset(master, 0x5a, sizeof(master));
+	ret = osd_set_master(osd, master);
+	assert(ret == 0);
+	osd_command_set_create_partition(&cmd, pid);
+	assert(sec_run(osd, &cmd) == SAM_STAT_GOOD);
+	osd_command_set_create(&cmd, pid, oid, 1);
+	assert(sec_run(osd, &cmd) == SAM_STAT_GOOD);
+
+	sec_set_method_attr(osd, OSD_SEC_CAPKEY, NULL);
+	assert(sec_get(osd, OSD_SEC_CAPKEY, 0, pid, oid, NULL) ==
+	       SAM_STAT_CHECK_CONDITION);
+
+	/* each key is set under a capability of its parent */
+	sec_set_key_cmd(osd, OSD_KEY_ROOT, ROOT_PID, 0, 1, master, root);
+	sec_set_key_cmd(osd, OSD_KEY_PARTITION, pid, 0, 2, root, part);
+	sec_set_key_cmd(osd, OSD_KEY_WORKING, pid, 3, 3, part, work);
+
+	/* the capability key is computed once */
+	sec_stats(osd, &hits0, &misses0);
+	for (i = 0; i < 10; i++)
+		assert(sec_get(osd, OSD_SEC_CAPKEY, 3, pid, oid, work) ==
+		       SAM_STAT_GOOD);
+	sec_stats(osd, &hits, &misses);
+	assert(misses == misses0 + 1);
+	assert(hits == hits0 + 9);
+
+	/* wrong key version, method, object, permission, check value */
+	assert(sec_get(osd, OSD_SEC_CAPKEY, 4, pid, oid, work) ==
+	       SAM_STAT_CHECK_CONDITION);
+	assert(sec_get(osd, OSD_SEC_NOSEC, 3, pid, oid, work) ==
+	       SAM_STAT_CHECK_CONDITION);
+	assert(sec_get(osd, OSD_SEC_CAPKEY, 3, pid, oid, part) ==
+	       SAM_STAT_CHECK_CONDITION);
+	osd_command_set_get_attributes(&cmd, pid, oid + 1);
+	osd_command_set_capability(&cmd, OSD_SEC_CAPKEY, 3, CAP_PERM_GET_ATTR,
+				   CAP_ODT_OBJECT, pid, oid);
+	sec_cap_sign(&cmd, work);
+	sec_fail(osd, &cmd, OSD_ASC_ACCESS_DENIED_NO_ACCESS_RIGHTS);
+	osd_command_set_remove(&cmd, pid, oid);
+	osd_command_set_capability(&cmd, OSD_SEC_CAPKEY, 3, CAP_PERM_GET_ATTR,
+				   CAP_ODT_OBJECT, pid, oid);
+	sec_cap_sign(&cmd, work);
+	sec_fail(osd, &cmd, OSD_ASC_ACCESS_DENIED_NO_ACCESS_RIGHTS);
+	osd_command_set_get_attributes(&cmd, pid, oid);
+	osd_command_set_capability(&cmd, OSD_SEC_CAPKEY, 3, CAP_PERM_GET_ATTR,
+				   CAP_ODT_OBJECT, pid, oid);
+	sec_cap_sign(&cmd, work);
+	cmd.cdb[SEC_RICV_OFF] ^= 1;
+	sec_fail(osd, &cmd, OSD_ASC_ACCESS_DENIED_NO_ACCESS_RIGHTS);
+
+	/* expired */
+	osd_command_set_capability(&cmd, OSD_SEC_CAPKEY, 3, CAP_PERM_GET_ATTR,
+				   CAP_ODT_OBJECT, pid, oid);
+	set_htontime(&cmd.cdb[CAP_OFF + CAP_EXPIRATION_TIME], 1);
+	sec_cap_sign(&cmd, work);
+	sec_fail(osd, &cmd, OSD_ASC_ACCESS_DENIED_NO_ACCESS_RIGHTS);
+
+	/* a capability format the target does not know */
+	osd_command_set_capability(&cmd, OSD_SEC_CAPKEY, 3, CAP_PERM_GET_ATTR,
+				   CAP_ODT_OBJECT, pid, oid);
+	cmd.cdb[CAP_OFF + CAP_FORMAT] ^= 0x3;
+	sec_cap_sign(&cmd, work);
+	sec_fail(osd, &cmd, OSD_ASC_INVALID_FIELD_IN_CDB);
+
+	/* CMDRSP covers all of the CDB, CAPKEY does not */
+	osd_command_set_capability(&cmd, OSD_SEC_CMDRSP, 3, CAP_PERM_GET_ATTR,
+				   CAP_ODT_OBJECT, pid, oid);
+	sec_cap_sign(&cmd, work);
+	assert(sec_run(osd, &cmd) == SAM_STAT_GOOD);
+	cmd.cdb[SEC_NONCE_OFF] ^= 1;
+	assert(sec_run(osd, &cmd) == SAM_STAT_CHECK_CONDITION);
+	osd_command_set_capability(&cmd, OSD_SEC_CAPKEY, 3, CAP_PERM_GET_ATTR,
+				   CAP_ODT_OBJECT, pid, oid);
+	sec_cap_sign(&cmd, work);
+	cmd.cdb[SEC_NONCE_OFF] ^= 1;
+	assert(sec_run(osd, &cmd) == SAM_STAT_GOOD);
+
+	/* keys and the method outlive a restart */
+	ret = osd_close(osd);
+	assert(ret == 0);
+	ret = osd_open("/tmp/osd/", osd);
+	assert(ret == 0);
+	assert(sec_get(osd, OSD_SEC_CAPKEY, 3, pid, oid, NULL) ==
+	       SAM_STAT_CHECK_CONDITION);
+	assert(sec_get(osd, OSD_SEC_CAPKEY, 3, pid, oid, work) ==
+	       SAM_STAT_GOOD);
+
+	/* a new working key retires the capabilities of the old one */
+	memcpy(old, work, sizeof(old));
+	sec_set_key_cmd(osd, OSD_KEY_WORKING, pid, 3, 4, part, work);
+	assert(sec_get(osd, OSD_SEC_CAPKEY, 3, pid, oid, old) ==
+	       SAM_STAT_CHECK_CONDITION);
+	assert(sec_get(osd, OSD_SEC_CAPKEY, 3, pid, oid, work) ==
+	       SAM_STAT_GOOD);
+
+	sec_set_method_attr(osd, OSD_SEC_NOSEC, root);
+	assert(sec_get(osd, OSD_SEC_NOSEC, 0, pid, oid, NULL) ==
+	       SAM_STAT_GOOD);
+	osd_command_set_remove(&cmd, pid, oid);
+	assert(sec_run(osd, &cmd) == SAM_STAT_GOOD);
+	osd_command_set_remove_partition(&cmd, pid);
+	assert(sec_run(osd, &cmd) == SAM_STAT_GOOD);
+}
+
+static int multi_run(struct osd_device *osd, struct osd_command *cmd,
+		     uint8_t **data_out, uint64_t *data_out_len)
+{
+	uint8_t sense_out[OSD_MAX_SENSE];
+	int senselen_out;
+
+	*data_out = NULL;
+	*data_out_len = 0;
+	return osdemu_cmd_submit(osd, cmd->cdb, cmd->outdata, cmd->outlen,
+				 data_out, data_out_len, sense_out,
+				 &senselen_out);
+}
+
+/* many small objects read and written with one command */
+static void test_multi_rw(struct osd_device *osd)
+{
+	struct osd_command cmd;
+	uint64_t pid = USEROBJECT_PID_LB + 13;
+	uint64_t oid = USEROBJECT_OID_LB;
+	uint8_t a[4096], b[10], c[8];
+	struct osd_object_io io[4] = {
+		{ oid, 0, sizeof(a), a },
+		{ oid + 1, 100, sizeof(b), b },
+		{ oid + 2, 0, sizeof(c), c },
+		{ oid + 50, 0, 16, a },
+	};
+	uint8_t *buf, *out, *st, *p;
+	uint64_t outlen;
+	int i;
+
+	osd_command_set_create_partition(&cmd, pid);
+	assert(sec_run(osd, &cmd) == SAM_STAT_GOOD);
+	osd_command_set_create(&cmd, pid, 0, 3); /* oid up to oid + 2 */
+	assert(sec_run(osd, &cmd) == SAM_STAT_GOOD);
+	memset(a, 'a', sizeof(a));
+	memset(b, 'b', sizeof(b));
+	memset(c, 'c', sizeof(c));
+
+	buf = Malloc(osd_command_multi_rw_outlen(io, 4, 1));
+	assert(buf);
+
+	/* the object that does not exist fails alone */
+	assert(osd_command_set_multi_rw(&cmd, pid, 1, io, 4, buf) == 0);
+	assert(multi_run(osd, &cmd, &out, &outlen) == SAM_STAT_GOOD);
+	assert(outlen == 4 * MULTI_RW_STATUS_LEN);
+	for (i = 0; i < 3; i++) {
+		st = out + i * MULTI_RW_STATUS_LEN;
+		assert(st[0] == SAM_STAT_GOOD);
+		assert(get_ntohll(&st[8]) == io[i].len);
+	}
+	assert(st[MULTI_RW_STATUS_LEN] == SAM_STAT_CHECK_CONDITION);
+	assert(get_ntohll(&st[MULTI_RW_STATUS_LEN + 8]) == 0);
+	osdemu_outbuf_release(osd, out);
+
+	/* the write landed at its offset */
+	osd_command_set_read(&cmd, pid, oid + 1, 110, 0);
+	assert(multi_run(osd, &cmd, &out, &outlen) == SAM_STAT_GOOD);
+	assert(outlen == 110 && out[99] == 0 && out[100] == 'b');
+	osdemu_outbuf_release(osd, out);
+
+	/* short read of oid + 2 comes back zero filled */
+	io[2].len = 16;
+	assert(osd_command_set_multi_rw(&cmd, pid, 0, io, 4, buf) == 0);
+	assert(cmd.inlen_alloc == 4 * MULTI_RW_STATUS_LEN + 4096 + 10 + 16 +
+	       16);
+	assert(multi_run(osd, &cmd, &out, &outlen) == SAM_STAT_GOOD);
+	assert(outlen == cmd.inlen_alloc);
+	st = out;
+	assert(st[0] == SAM_STAT_GOOD && st[MULTI_RW_STATUS_LEN] ==
+	       SAM_STAT_GOOD);
+	st += 2 * MULTI_RW_STATUS_LEN;
+	assert(st[0] == SAM_STAT_CHECK_CONDITION);
+	assert(st[1] == OSD_SSK_RECOVERED_ERROR);
+	assert(get_ntohll(&st[8]) == sizeof(c));
+	st += MULTI_RW_STATUS_LEN;
+	assert(st[0] == SAM_STAT_CHECK_CONDITION);
+	assert(st[1] == OSD_SSK_ILLEGAL_REQUEST);
+	assert(get_ntohll(&st[8]) == 0);
+	p = out + 4 * MULTI_RW_STATUS_LEN;
+	assert(memcmp(p, a, sizeof(a)) == 0);
+	p += sizeof(a);
+	assert(memcmp(p, b, sizeof(b)) == 0);
+	p += sizeof(b);
+	assert(memcmp(p, c, sizeof(c)) == 0);
+	for (i = sizeof(c); i < 16 + 16; i++)
+		assert(p[i] == 0);
+	osdemu_outbuf_release(osd, out);
+
+	/* too little room for the data, too little data to write */
+	assert(osd_command_set_multi_rw(&cmd, pid, 0, io, 3, buf) == 0);
+	set_htonll(&cmd.cdb[32], cmd.inlen_alloc - 1);
+	assert(multi_run(osd, &cmd, &out, &outlen) ==
+	       SAM_STAT_CHECK_CONDITION);
+	io[2].len = sizeof(c);
+	assert(osd_command_set_multi_rw(&cmd, pid, 1, io, 3, buf) == 0);
+	cmd.outlen--;
+	assert(multi_run(osd, &cmd, &out, &outlen) ==
+	       SAM_STAT_CHECK_CONDITION);
+	/* one descriptor of the list is all it takes */
+	assert(osd_command_set_multi_rw(&cmd, pid, 0, io, 3, buf) == 0);
+	set_htons(&buf[40], SCATTER_GATHER_LIST);
+	assert(multi_run(osd, &cmd, &out, &outlen) ==
+	       SAM_STAT_CHECK_CONDITION);
+	free(buf);
+
+	for (i = 0; i < 3; i++) {
+		osd_command_set_remove(&cmd, pid, oid + i);
+		assert(sec_run(osd, &cmd) == SAM_STAT_GOOD);
+	}
+	osd_command_set_remove_partition(&cmd, pid);
+	assert(sec_run(osd, &cmd) == SAM_STAT_GOOD);
 }
 
 static void test_attr_vals(uint8_t *cp, struct attribute_list *attrs, 
@@ -1704,6 +3280,362 @@ void test_atomics(struct osd_device *osd)
 
 }
 
+/* CAS or FA on the object, returns the value before */
+#define ATOMICS_THREADS 4
+#define ATOMICS_ITER 2000
+
+struct atomics_arg {
+	struct osd_device *osd;
+	uint64_t id;
+	uint64_t *counter;	/* protected by the CAS lock */
+};
+
+/* a spin lock on the CAS value, counted with FA and a plain counter */
+static void *atomics_worker(void *p)
+{
+	struct atomics_arg *a = p;
+	int i;
+
+	for (i = 0; i < ATOMICS_ITER; i++) {
+		while (atomic_op(a->osd, OSD_CAS, USEROBJECT_OID_LB, 0,
+				 a->id) != 0)
+			;
+		(*a->counter)++;
+		atomic_op(a->osd, OSD_FA, USEROBJECT_OID_LB, 1, 0);
+		assert(atomic_op(a->osd, OSD_CAS, USEROBJECT_OID_LB, a->id,
+				 0) == a->id);
+	}
+	return NULL;
+}
+
+/*
+ * CAS and FA from several threads at once are atomic, and the values
+ * reach the db for GET ATTRIBUTES and across osd_close.
+ */
+void test_atomics_mt(void)
+{
+	int ret = 0;
+	const char *root = "/tmp/osd-atomics/";
+	struct osd_device osd;
+	struct osd_command cmd;
+	uint8_t sense_out[OSD_MAX_SENSE];
+	int senselen_out;
+	uint8_t *data_out = NULL;
+	uint64_t data_out_len;
+	uint64_t counter = 0, val;
+	pthread_t th[ATOMICS_THREADS];
+	struct atomics_arg arg[ATOMICS_THREADS];
+	struct attribute_list attr = {
+		ATTR_GET, USER_ATOMICS_PG, UAP_FA, NULL, 8, 0
+	};
+	int i;
+
+	system("rm -rf /tmp/osd-atomics");
+	ret = osd_open(root, &osd);
+	assert(ret == 0);
+	ret = osdemu_async_start(&osd); /* submit from several threads */
+	assert(ret >= 0);
+	ret = osd_command_set_create_partition(&cmd, USEROBJECT_PID_LB);
+	assert(ret == 0);
+	ret = osdemu_cmd_submit(&osd, cmd.cdb, NULL, 0, &data_out,
+				&data_out_len, sense_out, &senselen_out);
+	assert(ret == 0);
+	ret = osd_command_set_create(&cmd, USEROBJECT_PID_LB,
+				     USEROBJECT_OID_LB, 1);
+	assert(ret == 0);
+	ret = osdemu_cmd_submit(&osd, cmd.cdb, NULL, 0, &data_out,
+				&data_out_len, sense_out, &senselen_out);
+	assert(ret == 0);
+
+	for (i = 0; i < ATOMICS_THREADS; i++) {
+		arg[i].osd = &osd;
+		arg[i].id = i + 1;
+		arg[i].counter = &counter;
+		ret = pthread_create(&th[i], NULL, atomics_worker, &arg[i]);
+		assert(ret == 0);
+	}
+	for (i = 0; i < ATOMICS_THREADS; i++)
+		pthread_join(th[i], NULL);
+	assert(counter == ATOMICS_THREADS * ATOMICS_ITER);
+	assert(atomic_op(&osd, OSD_FA, USEROBJECT_OID_LB, 0, 0) == counter);
+
+	/* written before any other command looks */
+	ret = osd_command_set_get_attributes(&cmd, USEROBJECT_PID_LB,
+					     USEROBJECT_OID_LB);
+	assert(ret == 0);
+	ret = osd_command_attr_build(&cmd, &attr, 1);
+	assert(ret == 0);
+	ret = osdemu_cmd_submit(&osd, cmd.cdb, cmd.outdata, cmd.outlen,
+				&data_out, &data_out_len, sense_out,
+				&senselen_out);
+	assert(ret == 0);
+	assert(get_ntohs(&data_out[8 + LE_LEN_OFF]) == 8);
+	memcpy(&val, &data_out[8 + LE_VAL_OFF], sizeof(val));
+	assert(val == counter);
+	free(data_out);
+	data_out = NULL;
+	osd_command_attr_free(&cmd);
+
+	/* and across close */
+	atomic_op(&osd, OSD_FA, USEROBJECT_OID_LB, 5, 0);
+	ret = osd_close(&osd);
+	assert(ret == 0);
+	ret = osd_open(root, &osd);
+	assert(ret == 0);
+	assert(atomic_op(&osd, OSD_FA, USEROBJECT_OID_LB, 0, 0) ==
+	       counter + 5);
+
+	/* a new object of the same id starts from 0 */
+	ret = osd_command_set_remove(&cmd, USEROBJECT_PID_LB,
+				     USEROBJECT_OID_LB);
+	assert(ret == 0);
+	ret = osdemu_cmd_submit(&osd, cmd.cdb, NULL, 0, &data_out,
+				&data_out_len, sense_out, &senselen_out);
+	assert(ret == 0);
+	ret = osd_command_set_create(&cmd, USEROBJECT_PID_LB,
+				     USEROBJECT_OID_LB, 1);
+	assert(ret == 0);
+	ret = osdemu_cmd_submit(&osd, cmd.cdb, NULL, 0, &data_out,
+				&data_out_len, sense_out, &senselen_out);
+	assert(ret == 0);
+	assert(atomic_op(&osd, OSD_FA, USEROBJECT_OID_LB, 0, 0) == 0);
+
+	ret = osd_close(&osd);
+	assert(ret == 0);
+}
+
+/* CAS WAIT while the CAS value is val, up to ms; returns the value then */
+static uint64_t cas_wait(struct osd_device *osd, uint64_t oid, uint64_t val,
+			 uint32_t ms, uint8_t *in)
+{
+	struct osd_command cmd;
+	uint8_t sense_out[OSD_MAX_SENSE];
+	int senselen_out;
+	uint8_t *data_out = NULL;
+	uint64_t data_out_len;
+	int ret;
+
+	ret = osd_command_set_cas_wait(&cmd, USEROBJECT_PID_LB, oid, 8, 0);
+	assert(ret == 0);
+	set_htonll(&in[0], val);
+	set_htonl(&in[8], ms);
+	ret = osdemu_cmd_submit(osd, cmd.cdb, in, 12, &data_out,
+				&data_out_len, sense_out, &senselen_out);
+	assert(ret == 0);
+	assert(data_out_len == 8);
+	val = get_ntohll(data_out);
+	free(data_out);
+	return val;
+}
+
+struct cas_wait_arg {
+	struct osd_device *osd;
+	uint64_t val;
+	uint64_t got;
+};
+
+static void *cas_wait_thread(void *p)
+{
+	struct cas_wait_arg *a = p;
+	uint8_t in[12];
+
+	a->got = cas_wait(a->osd, USEROBJECT_OID_LB, a->val, 10000, in);
+	return NULL;
+}
+
+#define CAS_WAIT_N 4
+
+static struct osdemu_cmd *cas_wait_bc;
+
+static void cas_wait_cb(struct osdemu_cmd *c, void *arg)
+{
+	struct async_done *d = arg;
+
+	d->order[d->n++] = (int) (c - cas_wait_bc);
+}
+
+/*
+ * CAS WAIT returns when a CAS changes the value, at its timeout, or when
+ * the object goes; parked async commands complete oldest first.
+ */
+void test_cas_wait(void)
+{
+	int ret = 0;
+	const char *root = "/tmp/osd-caswait/";
+	struct osd_device osd;
+	struct osd_command cmd[CAS_WAIT_N];
+	struct osdemu_cmd bc[CAS_WAIT_N];
+	uint8_t sense[CAS_WAIT_N][OSD_MAX_SENSE];
+	uint8_t in[CAS_WAIT_N][12];
+	uint8_t sense_out[OSD_MAX_SENSE];
+	int senselen_out;
+	uint8_t *data_out = NULL;
+	uint64_t data_out_len;
+	uint64_t t;
+	struct cas_wait_arg arg;
+	struct async_done d;
+	pthread_t th;
+	int i, efd;
+
+	system("rm -rf /tmp/osd-caswait");
+	ret = osd_open(root, &osd);
+	assert(ret == 0);
+	ret = osd_command_set_create_partition(&cmd[0], USEROBJECT_PID_LB);
+	assert(ret == 0);
+	ret = osdemu_cmd_submit(&osd, cmd[0].cdb, NULL, 0, &data_out,
+				&data_out_len, sense_out, &senselen_out);
+	assert(ret == 0);
+	ret = osd_command_set_create(&cmd[0], USEROBJECT_PID_LB,
+				     USEROBJECT_OID_LB, 1);
+	assert(ret == 0);
+	ret = osdemu_cmd_submit(&osd, cmd[0].cdb, NULL, 0, &data_out,
+				&data_out_len, sense_out, &senselen_out);
+	assert(ret == 0);
+
+	/* nobody else submits before async is started, no waiting */
+	t = time(NULL);
+	assert(cas_wait(&osd, USEROBJECT_OID_LB, 0, 10000, in[0]) == 0);
+	assert(time(NULL) - t < 5);
+
+	efd = osdemu_async_start(&osd);
+	assert(efd >= 0);
+
+	/* a caller on another thread wakes on the CAS */
+	arg.osd = &osd;
+	arg.val = 0;
+	arg.got = 0;
+	ret = pthread_create(&th, NULL, cas_wait_thread, &arg);
+	assert(ret == 0);
+	usleep(50000);
+	assert(atomic_op(&osd, OSD_CAS, USEROBJECT_OID_LB, 0, 7) == 0);
+	pthread_join(th, NULL);
+	assert(arg.got == 7);
+
+	/* a value that differs already, and a timeout */
+	assert(cas_wait(&osd, USEROBJECT_OID_LB, 0, 10000, in[0]) == 7);
+	t = time(NULL);
+	assert(cas_wait(&osd, USEROBJECT_OID_LB, 7, 100, in[0]) == 7);
+	assert(time(NULL) - t < 5);
+
+	/* parked async commands, one CAS completes them in order */
+	memset(&d, 0, sizeof(d));
+	memset(bc, 0, sizeof(bc));
+	cas_wait_bc = bc;
+	for (i = 0; i < CAS_WAIT_N; i++) {
+		ret = osd_command_set_cas_wait(&cmd[i], USEROBJECT_PID_LB,
+					       USEROBJECT_OID_LB, 8, 0);
+		assert(ret == 0);
+		set_htonll(&in[i][0], 7);
+		set_htonl(&in[i][8], 10000);
+		bc[i].cdb = cmd[i].cdb;
+		bc[i].data_in = in[i];
+		bc[i].data_in_len = 12;
+		bc[i].sense_out = sense[i];
+		ret = osdemu_cmd_submit_async(&osd, &bc[i], cas_wait_cb, &d);
+		assert(ret == 0);
+		usleep(20000); /* parked in this order */
+	}
+	assert(osdemu_async_reap(&osd, -1) == 0);
+	assert(atomic_op(&osd, OSD_CAS, USEROBJECT_OID_LB, 7, 8) == 7);
+	async_wait(&osd, efd, &d, CAS_WAIT_N);
+	for (i = 0; i < CAS_WAIT_N; i++) {
+		assert(d.order[i] == i);
+		assert(bc[i].status == SAM_STAT_GOOD);
+		assert(get_ntohll(bc[i].data_out) == 8);
+		free(bc[i].data_out);
+	}
+
+	/* removing the object ends the wait with its error */
+	memset(&d, 0, sizeof(d));
+	memset(bc, 0, sizeof(bc));
+	set_htonll(&in[0][0], 8);
+	bc[0].cdb = cmd[0].cdb;
+	bc[0].data_in = in[0];
+	bc[0].data_in_len = 12;
+	bc[0].sense_out = sense[0];
+	ret = osdemu_cmd_submit_async(&osd, &bc[0], cas_wait_cb, &d);
+	assert(ret == 0);
+	usleep(20000);
+	ret = osd_command_set_remove(&cmd[1], USEROBJECT_PID_LB,
+				     USEROBJECT_OID_LB);
+	assert(ret == 0);
+	ret = osdemu_cmd_submit(&osd, cmd[1].cdb, NULL, 0, &data_out,
+				&data_out_len, sense_out, &senselen_out);
+	assert(ret == 0);
+	async_wait(&osd, efd, &d, 1);
+	assert(bc[0].status == SAM_STAT_CHECK_CONDITION);
+
+	ret = osd_close(&osd);
+	assert(ret == 0);
+}
+
+static void *blog_thread(void *arg)
+{
+	osd_rlog(OSD_LOG_WARNING, "blog thread %d", *(int *) arg);
+	return NULL;
+}
+
+static void test_blog(void)
+{
+	char *buf = NULL;
+	size_t len = 0;
+	FILE *fp;
+	int i, fd;
+	pthread_t tid;
+	int level = osd_rlog_level;
+
+	osd_rlog(OSD_LOG_INFO, "blog %s %d %llu", __func__, -7, llu(1ULL << 40));
+	osd_rlog(OSD_LOG_INFO, "blog %*d|%-3hx|%lx %c %u%%", 4, -7, 0x12345,
+		 0xabcUL, 'z', 7U);
+	osd_rlog_level = OSD_LOG_WARNING;
+	osd_rlog(OSD_LOG_INFO, "blog dropped");
+	osd_rlog(OSD_LOG_WARNING, "blog last");
+	osd_rlog_level = level;
+
+	/* the second thread reuses the ring of the first, which keeps its
+	 * record */
+	for (i = 1; i <= 2; i++) {
+		assert(pthread_create(&tid, NULL, blog_thread, &i) == 0);
+		assert(pthread_join(tid, NULL) == 0);
+	}
+
+	fp = open_memstream(&buf, &len);
+	assert(fp);
+	blog_dump(fp);
+	fclose(fp);
+	assert(strstr(buf, " I: blog test_blog -7 1099511627776\n"));
+	assert(strstr(buf, " I: blog   -7|2345|abc z 7%\n"));
+	assert(strstr(buf, " W: blog thread 1\n"));
+	assert(strstr(buf, " W: blog thread 2\n"));
+	assert(strstr(buf, "blog dropped") == NULL);
+	assert(strstr(buf, " W: blog last\n"));
+	assert(strstr(buf, "blog test_blog") < strstr(buf, "blog last"));
+	free(buf);
+
+	/* kill -USR1 dumps to stderr */
+	assert(blog_dump_on_signal(SIGUSR1, stderr) == 0);
+	fp = tmpfile();
+	assert(fp);
+	fflush(stderr);
+	fd = dup(2);
+	assert(fd >= 0);
+	assert(dup2(fileno(fp), 2) == 2);
+	raise(SIGUSR1);
+	buf = Calloc(1, 1 << 20);
+	for (i = 0; i < 1000; i++) {
+		len = pread(fileno(fp), buf, (1 << 20) - 1, 0);
+		if (len != (size_t) -1 && strstr(buf, " W: blog last\n"))
+			break;
+		usleep(1000);
+	}
+	assert(i < 1000);
+	fflush(stderr);
+	assert(dup2(fd, 2) == 2);
+	close(fd);
+	fclose(fp);
+	free(buf);
+}
+
 int main()
 {
 	int ret = 0;
@@ -1715,6 +3647,16 @@ int main()
 	assert(ret == 0);
 	
 	test_set_one_attr(&osd); 
+	test_stats(&osd);
+	test_batch(&osd);
+	test_latency(&osd);
+	test_sqlprof(&osd);
+	test_getattr_multi(&osd);
+	test_list_attr(&osd);
+	test_member_attr(&osd);
+	test_set_member_chunks(&osd);
+	test_security(&osd);
+	test_multi_rw(&osd);
 	/* test_partition(&osd); */
 	/* test_create(&osd); */
 	/* test_query(&osd); */
@@ -1725,5 +3667,11 @@ int main()
 	ret = osd_close(&osd);
 	assert(ret == 0);
 
+	test_outbuf();
+	test_async();
+	test_atomics_mt();
+	test_cas_wait();
+	test_blog();
+
 	return 0;
 }
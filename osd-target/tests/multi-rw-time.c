@@ -0,0 +1,185 @@
+/*
+ * Time READ and WRITE of many small objects, one command per object
+ * against OSD_MULTI_RW commands of a number of objects each.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <assert.h>
+#include <limits.h>
+
+#include "osd-types.h"
+#include "cdb.h"
+#include "osd.h"
+#include "command.h"
+#include "osd-util/osd-util.h"
+
+static inline void run(struct osd_device *osd, struct osd_command *c)
+{
+	int ret;
+	uint8_t *data_in = NULL;
+	uint64_t data_in_len = 0;
+	uint8_t sense_out[OSD_MAX_SENSE];
+	int senselen_out;
+
+	ret = osdemu_cmd_submit(osd, c->cdb, c->outdata, c->outlen, &data_in,
+				&data_in_len, sense_out, &senselen_out);
+	assert(ret == 0);
+	if (data_in)
+		osdemu_outbuf_release(osd, data_in);
+}
+
+/* per object time of numobj objects, per object or batch at a time */
+static void rw_speed(struct osd_device *osd, int numiter, int numobj,
+		     int batch, int write, const uint8_t *data, uint64_t size)
+{
+	int i, j, k, n;
+	double *v;
+	double mu, sd;
+	struct osd_command cmd;
+	struct osd_object_io *io;
+	uint8_t *buf = NULL;
+	uint64_t start, end;
+	uint64_t pid = USEROBJECT_PID_LB;
+
+	v = malloc(numiter * sizeof(*v));
+	io = malloc(batch * sizeof(*io));
+	if (!v || !io)
+		osd_error_fatal("out of memory");
+	for (k = 0; k < batch; k++) {
+		io[k].offset = 0;
+		io[k].len = size;
+		io[k].data = data;
+	}
+	if (batch > 1) {
+		buf = malloc(osd_command_multi_rw_outlen(io, batch, 1));
+		if (!buf)
+			osd_error_fatal("out of memory");
+	}
+
+	for (i = 0; i < numiter; i++) {
+		rdtsc(start);
+		for (j = 0; j < numobj; j += n) {
+			n = (numobj - j < batch ? numobj - j : batch);
+			if (batch == 1) {
+				if (write)
+					osd_command_set_write(&cmd, pid,
+						USEROBJECT_OID_LB + j, size, 0);
+				else
+					osd_command_set_read(&cmd, pid,
+						USEROBJECT_OID_LB + j, size, 0);
+				cmd.outdata = (write ? data : NULL);
+				cmd.outlen = (write ? size : 0);
+			} else {
+				for (k = 0; k < n; k++)
+					io[k].oid = USEROBJECT_OID_LB + j + k;
+				osd_command_set_multi_rw(&cmd, pid, write, io,
+							 n, buf);
+			}
+			run(osd, &cmd);
+		}
+		rdtsc(end);
+		v[i] = ((double) (end - start)) / mhz / numobj;
+	}
+
+	mu = mean(v, numiter);
+	sd = stddev(v, mu, numiter);
+	printf("%-5s numobj %d size %llu batch %4d avg %9.3lf +- %8.3lf us"
+	       " per object\n", write ? "write" : "read", numobj, llu(size),
+	       batch, mu, sd);
+	free(buf);
+	free(io);
+	free(v);
+}
+
+static void usage(void)
+{
+	fprintf(stderr, "Usage: %s [-o <numobj>] [-i <numiter>] [-b <batch>]"
+		" [-s <size>]\n", osd_get_progname());
+	exit(1);
+}
+
+int main(int argc, char **argv)
+{
+	int ret = 0;
+	int numiter = 10;
+	int numobj = 1000;
+	int batch = 64;
+	int fac, rem;
+	uint64_t size = 4096;
+	uint8_t *data;
+	static struct osd_device osd;
+	struct osd_command cmd;
+
+	osd_set_progname(argc, argv);
+	while (++argv, --argc > 0) {
+		const char *s = *argv;
+		if (s[0] == '-') {
+			switch (s[1]) {
+			case 'i':
+				++argv, --argc;
+				if (argc < 1)
+					usage();
+				numiter = atoi(*argv);
+				break;
+			case 'o':
+				++argv, --argc;
+				if (argc < 1)
+					usage();
+				numobj = atoi(*argv);
+				break;
+			case 'b':
+				++argv, --argc;
+				if (argc < 1)
+					usage();
+				batch = atoi(*argv);
+				break;
+			case 's':
+				++argv, --argc;
+				if (argc < 1)
+					usage();
+				size = atoi(*argv);
+				break;
+			default:
+				usage();
+			}
+		} else {
+			usage();
+		}
+	}
+	if (numobj < 1 || batch < 2 || numiter < 1)
+		usage();
+
+	data = malloc(size);
+	if (!data)
+		osd_error_fatal("out of memory");
+	memset(data, 0x5a, size);
+
+	system("rm -rf /tmp/osd");
+	ret = osd_open("/tmp/osd", &osd);
+	assert(ret == 0);
+
+	osd_command_set_create_partition(&cmd, USEROBJECT_PID_LB);
+	run(&osd, &cmd);
+	fac = numobj / USHRT_MAX;
+	rem = numobj % USHRT_MAX;
+	while (fac--) {
+		osd_command_set_create(&cmd, USEROBJECT_PID_LB, 0, USHRT_MAX);
+		run(&osd, &cmd);
+	}
+	if (rem) {
+		osd_command_set_create(&cmd, USEROBJECT_PID_LB, 0, rem);
+		run(&osd, &cmd);
+	}
+
+	rw_speed(&osd, numiter, numobj, 1, 1, data, size);
+	rw_speed(&osd, numiter, numobj, batch, 1, data, size);
+	rw_speed(&osd, numiter, numobj, 1, 0, data, size);
+	rw_speed(&osd, numiter, numobj, batch, 0, data, size);
+
+	ret = osd_close(&osd);
+	assert(ret == 0);
+	free(data);
+
+	return 0;
+}
@@ -0,0 +1,155 @@
+/*
+ * Time osd_open of an existing store, e.g. a restart after failover.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <assert.h>
+#include <limits.h>
+
+#include "osd-types.h"
+#include "cdb.h"
+#include "osd.h"
+#include "command.h"
+#include "job.h"
+#include "osd-util/osd-util.h"
+
+static inline void run(struct osd_device *osd, struct osd_command *c)
+{
+	int ret;
+	uint8_t *data_in = NULL;
+	uint64_t data_in_len = 0;
+	uint8_t sense_out[252];
+	int senselen_out;
+
+	ret = osdemu_cmd_submit(osd, c->cdb, c->outdata, c->outlen, &data_in,
+				&data_in_len, sense_out, &senselen_out);
+	assert(ret == 0);
+}
+
+static void populate(struct osd_device *osd, uint64_t numobj)
+{
+	struct osd_command cmd;
+	uint64_t pid = PARTITION_PID_LB;
+	uint64_t fac = 0, rem = 0;
+
+	osd_command_set_create_partition(&cmd, pid);
+	run(osd, &cmd);
+
+	fac = numobj / USHRT_MAX;
+	rem = numobj % USHRT_MAX;
+	while (fac--) {
+		osd_command_set_create(&cmd, pid, 0, USHRT_MAX);
+		run(osd, &cmd);
+	}
+	if (rem) {
+		osd_command_set_create(&cmd, pid, 0, rem);
+		run(osd, &cmd);
+	}
+}
+
+static void open_speed(struct osd_device *osd, int numiter, uint64_t numobj,
+		       int warmup)
+{
+	int i, ret;
+	double *v, *w;
+	double mu, sd, wmu, wsd;
+	struct osd_command cmd;
+	uint64_t start, end;
+	uint64_t pid = PARTITION_PID_LB;
+
+	v = malloc(numiter * sizeof(*v));
+	w = malloc(numiter * sizeof(*w));
+	if (!v || !w)
+		osd_error_fatal("out of memory");
+
+	for (i = 0; i < numiter; i++) {
+		ret = osd_close(osd);
+		assert(ret == 0);
+
+		rdtsc(start);
+		ret = osd_open("/tmp/osd", osd);
+		rdtsc(end);
+		assert(ret == 0);
+		v[i] = ((double) (end - start)) / mhz;  /* time in usec */
+
+		if (warmup) {
+			ret = osd_warmup(osd);
+			assert(ret == 0);
+			job_drain(osd);
+		}
+
+		/* first command after the open, pays for cold statements */
+		osd_command_set_create(&cmd, pid, 0, 1);
+		rdtsc(start);
+		run(osd, &cmd);
+		rdtsc(end);
+		w[i] = ((double) (end - start)) / mhz;
+	}
+
+	mu = mean(v, numiter);
+	sd = stddev(v, mu, numiter);
+	wmu = mean(w, numiter);
+	wsd = stddev(w, wmu, numiter);
+	printf("open numiter %d numobj %llu warmup %d avg %9.3lf +- %8.3lf us"
+	       " first create %9.3lf +- %8.3lf us\n", numiter, llu(numobj),
+	       warmup, mu, sd, wmu, wsd);
+	free(w);
+	free(v);
+}
+
+static void usage(void)
+{
+	fprintf(stderr, "Usage: %s [-o <numobj>] [-i <numiter>] [-w]\n",
+		osd_get_progname());
+	exit(1);
+}
+
+int main(int argc, char **argv)
+{
+	int ret = 0;
+	int numiter = 10;
+	int numobj = 10;
+	int warmup = 0;
+	static struct osd_device osd;
+
+	osd_set_progname(argc, argv);
+	while (++argv, --argc > 0) {
+		const char *s = *argv;
+		if (s[0] == '-') {
+			switch (s[1]) {
+			case 'i':
+				++argv, --argc;
+				if (argc < 1)
+					usage();
+				numiter = atoi(*argv);
+				break;
+			case 'o':
+				++argv, --argc;
+				if (argc < 1)
+					usage();
+				numobj = atoi(*argv);
+				break;
+			case 'w':
+				warmup = 1;
+				break;
+			default:
+				usage();
+			}
+		} else {
+			usage();
+		}
+	}
+
+	system("rm -rf /tmp/osd");
+	ret = osd_open("/tmp/osd", &osd);
+	assert(ret == 0);
+
+	populate(&osd, numobj);
+	open_speed(&osd, numiter, numobj, warmup);
+
+	ret = osd_close(&osd);
+	assert(ret == 0);
+
+	return 0;
+}
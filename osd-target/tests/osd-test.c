@@ -23,12 +23,19 @@
 #include <sys/types.h>
 #include <sys/stat.h>
 #include <unistd.h>
+#include <fcntl.h>
+#include <pthread.h>
 
 #include "osd.h"
+#include "cdb.h"
 #include "db.h"
 #include "attr.h"
 #include "obj.h"
 #include "coll.h"
+#include "job.h"
+#include "part.h"
+#include "intent.h"
+#include "tracking.h"
 #include "osd-util/osd-util.h"
 #include "osd-util/osd-sense.h"
 #include "target-sense.h"
@@ -46,6 +53,8 @@ static void test_osd_create(struct osd_device *osd)
 	int ret = 0;
 	void *sense = Calloc(1, 1024);
 	uint32_t cdb_cont_len = 0;
+	char path[MAXNAMELEN];
+	struct stat sb;
 
 	/* invalid pid/oid, test must fail */
 	ret = osd_create(osd, 0, 1, 0, cdb_cont_len, sense);
@@ -68,11 +77,15 @@ static void test_osd_create(struct osd_device *osd)
 	ret = osd_remove(osd, USEROBJECT_PID_LB, USEROBJECT_OID_LB, cdb_cont_len, sense);
 	assert(ret == 0);
 
+	/* data file is gone at once, the reaper unlinks it later */
+	get_dfile_name(path, osd->root, USEROBJECT_PID_LB, USEROBJECT_OID_LB);
+	assert(stat(path, &sb) == -1 && errno == ENOENT);
+
 	/* remove non-existing object, test must fail */
 	ret = osd_remove(osd, USEROBJECT_PID_LB, USEROBJECT_OID_LB, cdb_cont_len, sense);
 	assert(ret != 0);
 
-	ret = osd_remove_partition(osd, PARTITION_PID_LB, cdb_cont_len, sense);
+	ret = osd_remove_partition(osd, PARTITION_PID_LB, 0, cdb_cont_len, sense);
 	assert(ret == 0);
 
 	free(sense);
@@ -128,21 +141,54 @@ static void test_osd_set_attributes(struct osd_device *osd)
 	ret = osd_remove(osd, USEROBJECT_PID_LB, USEROBJECT_OID_LB, cdb_cont_len, sense);
 	assert(ret == 0);
 
-	ret = osd_remove_partition(osd, PARTITION_PID_LB, cdb_cont_len, sense);
+	ret = osd_remove_partition(osd, PARTITION_PID_LB, 0, cdb_cont_len, sense);
 	assert(ret == 0);
 
 	free(sense);
 	free(val);
 }
 
+static int format_steps;
+
+static int format_step(struct osd_device *osd __attribute__((unused)),
+		       struct job *job __attribute__((unused)))
+{
+	format_steps++;
+	return OSD_OK;
+}
+
 static void test_osd_format(struct osd_device *osd)
 {
 	int ret = 0;
+	int present = 0;
 	void *sense = Calloc(1, 1024);
 	uint32_t cdb_cont_len = 0;
+	char path[MAXNAMELEN];
+	struct stat sb;
+
+	ret = osd_format_osd(osd, 0, cdb_cont_len, sense);
+	assert(ret == 0);
+
+	/* old trees are moved aside, the new osd starts out empty */
+	ret = osd_create_partition(osd, PARTITION_PID_LB, cdb_cont_len, sense);
+	assert(ret == 0);
+	ret = osd_create(osd, USEROBJECT_PID_LB, USEROBJECT_OID_LB, 0,
+			 cdb_cont_len, sense);
+	assert(ret == 0);
 
+	/* pending background work is dropped, not run */
+	ret = job_submit(osd, PARTITION_PID_LB, 0, NULL, format_step);
+	assert(ret == 0);
 	ret = osd_format_osd(osd, 0, cdb_cont_len, sense);
 	assert(ret == 0);
+	assert(format_steps == 0);
+	assert(job_run(osd, 1) == 0 && format_steps == 0);
+
+	ret = obj_ispresent(osd->dbc, PARTITION_PID_LB, PARTITION_OID,
+			    &present);
+	assert(ret == 0 && present == 0);
+	get_dfile_name(path, osd->root, USEROBJECT_PID_LB, USEROBJECT_OID_LB);
+	assert(stat(path, &sb) == -1 && errno == ENOENT);
 
 	free(sense);
 }
@@ -191,7 +237,7 @@ static void test_osd_clear(struct osd_device *osd)
 	ret = osd_remove(osd, USEROBJECT_PID_LB, USEROBJECT_OID_LB, cdb_cont_len, sense);
 	assert(ret == 0);
 
-	ret = osd_remove_partition(osd, PARTITION_PID_LB, cdb_cont_len, sense);
+	ret = osd_remove_partition(osd, PARTITION_PID_LB, 0, cdb_cont_len, sense);
 	assert(ret == 0);
 
 	free(sense);
@@ -282,7 +328,7 @@ static void test_osd_punch(struct osd_device *osd)
 	ret = osd_remove(osd, USEROBJECT_PID_LB, USEROBJECT_OID_LB, cdb_cont_len, sense);
 	assert(ret == 0);
 
-	ret = osd_remove_partition(osd, PARTITION_PID_LB, cdb_cont_len, sense);
+	ret = osd_remove_partition(osd, PARTITION_PID_LB, 0, cdb_cont_len, sense);
 	assert(ret == 0);
 
 	free(sense);
@@ -330,7 +376,7 @@ static void test_osd_flush(struct osd_device *osd)
 	ret = osd_remove(osd, USEROBJECT_PID_LB, USEROBJECT_OID_LB, cdb_cont_len, sense);
 	assert(ret == 0);
 
-	ret = osd_remove_partition(osd, PARTITION_PID_LB, cdb_cont_len, sense);
+	ret = osd_remove_partition(osd, PARTITION_PID_LB, 0, cdb_cont_len, sense);
 	assert(ret == 0);
 
 	free(sense);
@@ -479,7 +525,7 @@ static void test_osd_io(struct osd_device *osd)
 	ret = osd_remove(osd, USEROBJECT_PID_LB, USEROBJECT_OID_LB, cdb_cont_len, sense);
 	assert(ret == 0);
 
-	ret = osd_remove_partition(osd, PARTITION_PID_LB, cdb_cont_len, sense);
+	ret = osd_remove_partition(osd, PARTITION_PID_LB, 0, cdb_cont_len, sense);
 	assert(ret == 0);
 
 	free(sense);
@@ -501,11 +547,11 @@ static void test_osd_create_partition(struct osd_device *osd)
 	ret = osd_create_partition(osd, PARTITION_PID_LB, cdb_cont_len, sense);
 	assert(ret != 0);
 
-	ret = osd_remove_partition(osd, PARTITION_PID_LB, cdb_cont_len, sense);
+	ret = osd_remove_partition(osd, PARTITION_PID_LB, 0, cdb_cont_len, sense);
 	assert(ret == 0);
 
 	/* remove non-existing object, test must succeed: sqlite semantics */
-	ret = osd_remove_partition(osd, PARTITION_PID_LB, cdb_cont_len, sense);
+	ret = osd_remove_partition(osd, PARTITION_PID_LB, 0, cdb_cont_len, sense);
 	assert(ret == 0);
 
 	free(sense);
@@ -548,7 +594,7 @@ static void test_osd_get_ccap(struct osd_device *osd)
 	ret = osd_remove(osd, USEROBJECT_PID_LB, USEROBJECT_OID_LB, cdb_cont_len, sense);
 	assert(ret == 0);
 
-	ret = osd_remove_partition(osd, PARTITION_PID_LB, cdb_cont_len, sense);
+	ret = osd_remove_partition(osd, PARTITION_PID_LB, 0, cdb_cont_len, sense);
 	assert(ret == 0);
 
 	free(sense);
@@ -618,7 +664,7 @@ static void test_osd_get_utsap(struct osd_device *osd)
 	ret = osd_remove(osd, USEROBJECT_PID_LB, USEROBJECT_OID_LB, cdb_cont_len, sense);
 	assert(ret == 0);
 
-	ret = osd_remove_partition(osd, PARTITION_PID_LB, cdb_cont_len, sense);
+	ret = osd_remove_partition(osd, PARTITION_PID_LB, 0, cdb_cont_len, sense);
 	assert(ret == 0);
 
 	free(sense);
@@ -706,7 +752,7 @@ static void test_osd_get_attributes(struct osd_device *osd)
 	ret = osd_remove(osd, USEROBJECT_PID_LB, USEROBJECT_OID_LB, cdb_cont_len, sense);
 	assert(ret == 0);
 
-	ret = osd_remove_partition(osd, PARTITION_PID_LB, cdb_cont_len, sense);
+	ret = osd_remove_partition(osd, PARTITION_PID_LB, 0, cdb_cont_len, sense);
 	assert(ret == 0);
 
 	free(getval);
@@ -714,6 +760,278 @@ static void test_osd_get_attributes(struct osd_device *osd)
 	free(val);
 }
 
+/*
+ * The cached length must follow every path that changes the data file,
+ * and must not outlive the object.
+ */
+static uint64_t logical_len(struct osd_device *osd, uint64_t pid,
+			    uint64_t oid)
+{
+	int ret = 0;
+	uint32_t used_len = 0;
+	uint8_t sense[1024];
+	uint8_t buf[64];
+	struct list_entry *le = (struct list_entry *)buf;
+
+	ret = osd_getattr_list(osd, pid, oid, USER_INFO_PG, UIAP_LOGICAL_LEN,
+			       buf, sizeof(buf), TRUE, RTRVD_SET_ATTR_LIST,
+			       &used_len, 0, sense);
+	assert(ret == 0);
+	assert(get_ntohl(&le->number) == UIAP_LOGICAL_LEN);
+	return get_ntohll(&le->val);
+}
+
+static void test_osd_oinfo(struct osd_device *osd)
+{
+	int ret = 0;
+	uint32_t cdb_cont_len = 0;
+	uint8_t *sense = Calloc(1, 1024);
+	uint8_t *buf = Calloc(1, 4096);
+	uint64_t pid = USEROBJECT_PID_LB, oid = USEROBJECT_OID_LB;
+	char path[MAXNAMELEN];
+	struct stat sb;
+
+	ret = osd_create_partition(osd, pid, cdb_cont_len, sense);
+	assert(ret == 0);
+	ret = osd_create(osd, pid, oid, 0, cdb_cont_len, sense);
+	assert(ret == 0);
+	get_dfile_name(path, osd->root, pid, oid);
+
+	assert(logical_len(osd, pid, oid) == 0);
+
+	ret = osd_write(osd, pid, oid, 1000, 3000, buf, NULL, sense,
+			DDT_CONTIG);
+	assert(ret == 0);
+	assert(logical_len(osd, pid, oid) == 4000);
+
+	ret = osd_write(osd, pid, oid, 100, 0, buf, NULL, sense, DDT_CONTIG);
+	assert(ret == 0);
+	assert(logical_len(osd, pid, oid) == 4000);
+
+	ret = osd_append(osd, pid, oid, 96, buf, cdb_cont_len, sense,
+			 DDT_CONTIG);
+	assert(ret == 0);
+	assert(logical_len(osd, pid, oid) == 4096);
+
+	ret = osd_punch(osd, pid, oid, 1000, 1000, cdb_cont_len, sense);
+	assert(ret == 0);
+	assert(logical_len(osd, pid, oid) == 3096);
+
+	ret = osd_clear(osd, pid, oid, 100, 5000, cdb_cont_len, sense);
+	assert(ret == 0);
+	assert(logical_len(osd, pid, oid) == 5100);
+
+	ret = stat(path, &sb);
+	assert(ret == 0 && sb.st_size == 5100);
+
+	/* a new object under the same id starts empty */
+	ret = osd_remove(osd, pid, oid, cdb_cont_len, sense);
+	assert(ret == 0);
+	ret = osd_create(osd, pid, oid, 0, cdb_cont_len, sense);
+	assert(ret == 0);
+	assert(logical_len(osd, pid, oid) == 0);
+
+	ret = osd_remove(osd, pid, oid, cdb_cont_len, sense);
+	assert(ret == 0);
+	ret = osd_remove_partition(osd, pid, 0, cdb_cont_len, sense);
+	assert(ret == 0);
+
+	free(buf);
+	free(sense);
+}
+
+static uint64_t partition_attr(struct osd_device *osd, uint64_t pid,
+			       uint32_t page, uint32_t number)
+{
+	int ret = 0;
+	uint32_t used_len = 0;
+	uint8_t sense[1024];
+	uint8_t buf[64];
+	struct list_entry *le = (struct list_entry *)buf;
+
+	ret = osd_getattr_list(osd, pid, PARTITION_OID, page, number, buf,
+			       sizeof(buf), TRUE, RTRVD_SET_ATTR_LIST,
+			       &used_len, 0, sense);
+	assert(ret == 0);
+	assert(get_ntohl(&le->number) == number);
+	return get_ntohll(&le->val);
+}
+
+static void reopen(struct osd_device *osd, int clean)
+{
+	int ret = 0;
+	char root[MAXNAMELEN];
+	char path[MAXNAMELEN];
+
+	strcpy(root, osd->root);
+	ret = osd_close(osd);
+	assert(ret == 0);
+	if (!clean) {
+		sprintf(path, "%s/md/acct.clean", root);
+		assert(unlink(path) == 0);
+	}
+	ret = osd_open(root, osd);
+	assert(ret == 0);
+}
+
+/*
+ * Partition used bytes and object count follow the data paths, survive a
+ * reopen, are recounted after an unclean one, and the quota holds.
+ */
+static void test_osd_partition_acct(struct osd_device *osd)
+{
+	int ret = 0;
+	uint32_t cdb_cont_len = 0;
+	uint8_t *sense = Calloc(1, 1024);
+	uint8_t *buf = Calloc(1, 4096);
+	uint8_t ll[8];
+	uint64_t pid = USEROBJECT_PID_LB, oid = USEROBJECT_OID_LB;
+	const uint32_t info = PARTITION_PG + INFO_OFFSET;
+	const uint32_t quota = PARTITION_PG + QUOTA_OFFSET;
+
+	ret = osd_create_partition(osd, pid, cdb_cont_len, sense);
+	assert(ret == 0);
+	ret = osd_create(osd, pid, 0, 2, cdb_cont_len, sense);
+	assert(ret == 0);
+	assert(partition_attr(osd, pid, info, UIAP_USED_CAPACITY) == 0);
+	assert(partition_attr(osd, pid, info, PARTITION_NUMBER_OF_OBJECTS) == 2);
+
+	set_htonll(ll, 1000);
+	ret = osd_set_attributes(osd, pid, PARTITION_OID, quota,
+				 PARTITION_CAPACITY_QUOTA, ll, sizeof(ll),
+				 TRUE, cdb_cont_len, sense);
+	assert(ret == 0);
+	assert(partition_attr(osd, pid, quota, PARTITION_CAPACITY_QUOTA) == 1000);
+
+	ret = osd_write(osd, pid, oid, 600, 0, buf, NULL, sense, DDT_CONTIG);
+	assert(ret == 0);
+	ret = osd_write(osd, pid, oid + 1, 600, 0, buf, NULL, sense,
+			DDT_CONTIG);
+	assert(ret != 0);
+	assert(sense_test_type(sense, OSD_SSK_DATA_PROTECTION,
+			       OSD_ASC_QUOTA_ERROR));
+	ret = osd_append(osd, pid, oid + 1, 400, buf, cdb_cont_len, sense,
+			 DDT_CONTIG);
+	assert(ret == 0);
+	/* overwriting does not grow */
+	ret = osd_write(osd, pid, oid, 600, 0, buf, NULL, sense, DDT_CONTIG);
+	assert(ret == 0);
+	assert(partition_attr(osd, pid, info, UIAP_USED_CAPACITY) == 1000);
+
+	ret = osd_punch(osd, pid, oid, 100, 0, cdb_cont_len, sense);
+	assert(ret == 0);
+	assert(partition_attr(osd, pid, info, UIAP_USED_CAPACITY) == 900);
+
+	/* growth reserved by a write in flight counts until it is released */
+	assert(part_reserve(osd, pid, 100) == OSD_OK);
+	assert(part_reserve(osd, pid, 1) == -EDQUOT);
+	ret = osd_write(osd, pid, oid + 1, 1, 400, buf, NULL, sense,
+			DDT_CONTIG);
+	assert(ret != 0);
+	assert(sense_test_type(sense, OSD_SSK_DATA_PROTECTION,
+			       OSD_ASC_QUOTA_ERROR));
+	part_release(osd, pid, 100);
+	/* and a write that is done gives its reservation back */
+	ret = osd_write(osd, pid, oid + 1, 50, 400, buf, NULL, sense,
+			DDT_CONTIG);
+	assert(ret == 0);
+	assert(part_reserve(osd, pid, 50) == OSD_OK);
+	assert(part_reserve(osd, pid, 1) == -EDQUOT);
+	part_release(osd, pid, 50);
+	ret = osd_punch(osd, pid, oid + 1, 50, 400, cdb_cont_len, sense);
+	assert(ret == 0);
+	assert(partition_attr(osd, pid, info, UIAP_USED_CAPACITY) == 900);
+
+	reopen(osd, 1);
+	assert(partition_attr(osd, pid, info, UIAP_USED_CAPACITY) == 900);
+	assert(partition_attr(osd, pid, info, PARTITION_NUMBER_OF_OBJECTS) == 2);
+	ret = osd_write(osd, pid, oid, 200, 500, buf, NULL, sense, DDT_CONTIG);
+	assert(ret != 0);
+
+	ret = osd_remove(osd, pid, oid + 1, cdb_cont_len, sense);
+	assert(ret == 0);
+	reopen(osd, 0);
+	assert(partition_attr(osd, pid, info, UIAP_USED_CAPACITY) == 500);
+	assert(partition_attr(osd, pid, info, PARTITION_NUMBER_OF_OBJECTS) == 1);
+
+	/* no quota, writes are only bounded by the filesystem */
+	ret = osd_set_attributes(osd, pid, PARTITION_OID, quota,
+				 PARTITION_CAPACITY_QUOTA, ll, 0, TRUE,
+				 cdb_cont_len, sense);
+	assert(ret == 0);
+	ret = osd_write(osd, pid, oid, 4096, 500, buf, NULL, sense, DDT_CONTIG);
+	assert(ret == 0);
+	assert(partition_attr(osd, pid, info, UIAP_USED_CAPACITY) == 4596);
+
+	ret = osd_remove(osd, pid, oid, cdb_cont_len, sense);
+	assert(ret == 0);
+	assert(partition_attr(osd, pid, info, UIAP_USED_CAPACITY) == 0);
+	assert(partition_attr(osd, pid, info, PARTITION_NUMBER_OF_OBJECTS) == 0);
+	ret = osd_remove_partition(osd, pid, 0, cdb_cont_len, sense);
+	assert(ret == 0);
+
+	free(buf);
+	free(sense);
+}
+
+#define RECOUNT_OBJS 1100 /* more than a step of the recount */
+
+/*
+ * After an unclean reopen, the first write starts a recount job; writes
+ * meanwhile are charged once, whether the job counted the object yet or
+ * not.
+ */
+static void test_osd_partition_recount(struct osd_device *osd)
+{
+	int ret = 0;
+	uint32_t cdb_cont_len = 0;
+	uint8_t *sense = Calloc(1, 1024);
+	uint8_t *buf = Calloc(1, 4096);
+	uint64_t i, oid, pid = USEROBJECT_PID_LB;
+	const uint32_t info = PARTITION_PG + INFO_OFFSET;
+
+	ret = osd_create_partition(osd, pid, cdb_cont_len, sense);
+	assert(ret == 0);
+	ret = osd_create(osd, pid, 0, RECOUNT_OBJS, cdb_cont_len, sense);
+	assert(ret == 0);
+	oid = osd->ccap.oid - RECOUNT_OBJS + 1;
+	osd_begin_txn(osd);
+	for (i = 0; i < RECOUNT_OBJS; i++) {
+		ret = osd_write(osd, pid, oid + i, 10, 0, buf, NULL, sense,
+				DDT_CONTIG);
+		assert(ret == 0);
+	}
+	osd_end_txn(osd);
+
+	reopen(osd, 0);
+	ret = osd_write(osd, pid, oid, 100, 0, buf, NULL, sense, DDT_CONTIG);
+	assert(ret == 0);
+	assert(job_run(osd, 1) == 1); /* one step done, more to come */
+	ret = osd_write(osd, pid, oid + 1, 100, 0, buf, NULL, sense,
+			DDT_CONTIG);
+	assert(ret == 0);
+	ret = osd_write(osd, pid, oid + RECOUNT_OBJS - 1, 100, 0, buf, NULL,
+			sense, DDT_CONTIG);
+	assert(ret == 0);
+	assert(job_run(osd, 1) == 0);
+
+	assert(partition_attr(osd, pid, info, UIAP_USED_CAPACITY) ==
+	       (RECOUNT_OBJS - 3) * 10 + 3 * 100);
+	assert(partition_attr(osd, pid, info, PARTITION_NUMBER_OF_OBJECTS) ==
+	       RECOUNT_OBJS);
+
+	for (i = 0; i < RECOUNT_OBJS; i++) {
+		ret = osd_remove(osd, pid, oid + i, cdb_cont_len, sense);
+		assert(ret == 0);
+	}
+	assert(partition_attr(osd, pid, info, UIAP_USED_CAPACITY) == 0);
+	ret = osd_remove_partition(osd, pid, 0, cdb_cont_len, sense);
+	assert(ret == 0);
+
+	free(buf);
+	free(sense);
+}
+
 static void test_osd_create_user_tracking_collection(struct osd_device *osd)
 {
         int ret = 0;
@@ -860,7 +1178,7 @@ static void test_osd_create_user_tracking_collection(struct osd_device *osd)
 	assert(ret == 0);
 	
 	/* remove partition */
-	ret = osd_remove_partition(osd, PARTITION_PID_LB, cdb_cont_len, sense);
+	ret = osd_remove_partition(osd, PARTITION_PID_LB, 0, cdb_cont_len, sense);
 	assert(ret == 0);
 	
 	free(outdata);
@@ -1012,7 +1330,7 @@ static void test_osd_create_collection(struct osd_device *osd)
 	ret = osd_remove(osd, USEROBJECT_PID_LB, oid, cdb_cont_len, sense);
 	assert(ret == 0);
 
-	ret = osd_remove_partition(osd, PARTITION_PID_LB, cdb_cont_len, sense);
+	ret = osd_remove_partition(osd, PARTITION_PID_LB, 0, cdb_cont_len, sense);
 	assert(ret == 0);
 
 	free(sense);
@@ -1020,6 +1338,187 @@ static void test_osd_create_collection(struct osd_device *osd)
 }
 
 
+/* more members than one removal batch, so the background job is used */
+#define NUM_BULK_OBJS (1100)
+
+static void test_osd_remove_member_objects(struct osd_device *osd)
+{
+	int ret = 0;
+	int present = 0;
+	uint64_t i = 0;
+	uint64_t cid = COLLECTION_OID_LB;
+	uint64_t oid = 0;
+	uint32_t cdb_cont_len = 0;
+	void *buf = Calloc(1, 1024);
+	void *sense = Calloc(1, 1024);
+	char path[MAXNAMELEN];
+	struct stat sb;
+
+	ret = osd_create_partition(osd, PARTITION_PID_LB, cdb_cont_len, sense);
+	assert(ret == 0);
+	ret = osd_create_collection(osd, COLLECTION_PID_LB, cid,
+				    cdb_cont_len, sense);
+	assert(ret == 0);
+
+	/* not a collection, test must fail */
+	ret = osd_remove_member_objects(osd, COLLECTION_PID_LB, cid + 1,
+					cdb_cont_len, sense);
+	assert(ret != 0);
+
+	ret = osd_create(osd, USEROBJECT_PID_LB, 0, NUM_BULK_OBJS,
+			 cdb_cont_len, sense);
+	assert(ret == 0);
+	oid = osd->ccap.oid - NUM_BULK_OBJS + 1;
+
+	set_htonll(buf, cid);
+	osd_begin_txn(osd);
+	for (i = oid; i < oid + NUM_BULK_OBJS; i++) {
+		ret = osd_set_attributes(osd, USEROBJECT_PID_LB, i,
+					 USER_COLL_PG, 1, buf, sizeof(cid), 0,
+					 cdb_cont_len, sense);
+		assert(ret == 0);
+	}
+	osd_end_txn(osd);
+
+	ret = osd_remove_member_objects(osd, COLLECTION_PID_LB, cid,
+					cdb_cont_len, sense);
+	assert(ret == 0);
+	/* an idle transport finishes it, no command needed */
+	while (osdemu_jobs_run(osd, 1) > 0)
+		;
+
+	ret = coll_isempty_cid(osd->dbc, COLLECTION_PID_LB, cid, &present);
+	assert(ret == 0 && present == 1);
+	for (i = oid; i < oid + NUM_BULK_OBJS; i++) {
+		ret = obj_ispresent(osd->dbc, USEROBJECT_PID_LB, i, &present);
+		assert(ret == 0 && present == 0);
+		get_dfile_name(path, osd->root, USEROBJECT_PID_LB, i);
+		assert(stat(path, &sb) == -1 && errno == ENOENT);
+	}
+
+	/* collection itself survives */
+	ret = obj_ispresent(osd->dbc, COLLECTION_PID_LB, cid, &present);
+	assert(ret == 0 && present == 1);
+
+	/* populated partition: plain remove fails, forced remove succeeds */
+	ret = osd_create(osd, USEROBJECT_PID_LB, 0, NUM_BULK_OBJS,
+			 cdb_cont_len, sense);
+	assert(ret == 0);
+	ret = osd_remove_partition(osd, PARTITION_PID_LB, 0, cdb_cont_len,
+				   sense);
+	assert(ret != 0);
+	ret = osd_remove_partition(osd, PARTITION_PID_LB, 1, cdb_cont_len,
+				   sense);
+	assert(ret == 0);
+	job_drain(osd);
+
+	ret = obj_ispresent(osd->dbc, PARTITION_PID_LB, PARTITION_OID,
+			    &present);
+	assert(ret == 0 && present == 0);
+	ret = obj_isempty_pid(osd->dbc, PARTITION_PID_LB, &present);
+	assert(ret == 0 && present == 1);
+
+	free(sense);
+	free(buf);
+}
+
+
+/*
+ * Pretend to crash: keep the intent log across osd_close, which would
+ * otherwise checkpoint and truncate it, and replay it in osd_open.
+ */
+static void crash_and_reopen(struct osd_device *osd)
+{
+	int fd, ret;
+	ssize_t len;
+	char root[MAXNAMELEN];
+	char path[MAXNAMELEN];
+	char *log;
+	struct stat sb;
+
+	strcpy(root, osd->root);
+	sprintf(path, "%s/md/intent.log", root);
+	fd = open(path, O_RDONLY);
+	assert(fd >= 0);
+	assert(fstat(fd, &sb) == 0 && sb.st_size > 0);
+	log = Malloc(sb.st_size);
+	assert(log);
+	len = read(fd, log, sb.st_size);
+	assert(len == sb.st_size);
+	close(fd);
+
+	ret = osd_close(osd);
+	assert(ret == 0);
+
+	fd = open(path, O_WRONLY|O_TRUNC);
+	assert(fd >= 0);
+	assert(write(fd, log, len) == len);
+	close(fd);
+	free(log);
+
+	ret = osd_open(root, osd);
+	assert(ret == 0);
+}
+
+static void test_osd_intent_replay(struct osd_device *osd)
+{
+	int ret = 0;
+	int present = 0;
+	uint64_t seq = 0;
+	uint64_t oid = USEROBJECT_OID_LB;
+	uint32_t cdb_cont_len = 0;
+	void *sense = Calloc(1, 1024);
+	char path[MAXNAMELEN];
+	struct stat sb;
+
+	ret = osd_create_partition(osd, PARTITION_PID_LB, cdb_cont_len, sense);
+	assert(ret == 0);
+
+	/* completed create, survives */
+	ret = osd_create(osd, USEROBJECT_PID_LB, oid, 1, cdb_cont_len, sense);
+	assert(ret == 0);
+
+	/* completed create whose row got lost, data file must go */
+	ret = osd_create(osd, USEROBJECT_PID_LB, oid + 1, 1, cdb_cont_len,
+			 sense);
+	assert(ret == 0);
+	ret = obj_delete(osd->dbc, USEROBJECT_PID_LB, oid + 1);
+	assert(ret == 0);
+
+	/* create whose END was lost, the row it left survives */
+	seq = intent_begin(osd, INTENT_CREATE, USEROBJECT_PID_LB, oid + 2, 1);
+	assert(seq != 0);
+	ret = osd_create(osd, USEROBJECT_PID_LB, oid + 2, 1, cdb_cont_len,
+			 sense);
+	assert(ret == 0);
+
+	crash_and_reopen(osd);
+
+	ret = obj_ispresent(osd->dbc, USEROBJECT_PID_LB, oid, &present);
+	assert(ret == 0 && present == 1);
+	get_dfile_name(path, osd->root, USEROBJECT_PID_LB, oid);
+	assert(stat(path, &sb) == 0);
+
+	get_dfile_name(path, osd->root, USEROBJECT_PID_LB, oid + 1);
+	assert(stat(path, &sb) == -1 && errno == ENOENT);
+
+	ret = obj_ispresent(osd->dbc, USEROBJECT_PID_LB, oid + 2, &present);
+	assert(ret == 0 && present == 1);
+	get_dfile_name(path, osd->root, USEROBJECT_PID_LB, oid + 2);
+	assert(stat(path, &sb) == 0);
+
+	ret = osd_remove(osd, USEROBJECT_PID_LB, oid, cdb_cont_len, sense);
+	assert(ret == 0);
+	ret = osd_remove(osd, USEROBJECT_PID_LB, oid + 2, cdb_cont_len, sense);
+	assert(ret == 0);
+	ret = osd_remove_partition(osd, PARTITION_PID_LB, 0, cdb_cont_len,
+				   sense);
+	assert(ret == 0);
+
+	free(sense);
+}
+
+
 /* only to be used by test_osd_query */
 static inline void set_attr_int(struct osd_device *osd, uint64_t oid,
 				uint32_t page, uint32_t number, uint64_t val,
@@ -1467,7 +1966,7 @@ static void test_osd_query(struct osd_device *osd)
 	}
 
 	/* remove partition */
-	ret = osd_remove_partition(osd, PARTITION_PID_LB, cdb_cont_len, sense);
+	ret = osd_remove_partition(osd, PARTITION_PID_LB, 0, cdb_cont_len, sense);
 	assert(ret == 0);
 
 out:
@@ -1477,6 +1976,99 @@ out:
 	free(idlist);
 }
 
+/* an attribute of the command tracking page, -1 if it has none */
+static int64_t track_attr(struct osd_device *osd, uint64_t pid, uint64_t cid,
+			  uint32_t number)
+{
+	int ret = 0;
+	uint8_t buf[64];
+	uint32_t used = 0;
+	uint16_t len;
+
+	ret = get_ctp(osd, pid, cid, number, buf, sizeof(buf),
+		      RTRVD_SET_ATTR_LIST, &used);
+	assert(ret == 0);
+	if (used == 0)
+		return -1;
+	len = get_ntohs(&buf[LE_LEN_OFF]);
+	if (len == 1)
+		return buf[LE_VAL_OFF];
+	if (len == 2)
+		return get_ntohs(&buf[LE_VAL_OFF]);
+	if (len == 8)
+		return get_ntohll(&buf[LE_VAL_OFF]);
+	return -1;
+}
+
+#define TRACK_CMDS 20
+#define TRACK_THREADS 4
+#define TRACK_STEPS 1000
+
+static void *track_worker(void *arg)
+{
+	int i;
+
+	for (i = 0; i < TRACK_STEPS; i++)
+		ctp_progress(arg, 1);
+	return NULL;
+}
+
+static void test_osd_tracking(struct osd_device *osd)
+{
+	int i;
+	uint64_t pid = COLLECTION_PID_LB + 100;
+	uint64_t cid = COLLECTION_OID_LB;
+	struct ctp *ctp[TRACK_CMDS], *c;
+	pthread_t th[TRACK_THREADS];
+
+	/* more running commands than the old list held */
+	for (i = 0; i < TRACK_CMDS; i++) {
+		ctp[i] = init_ctp(osd, pid, cid + i,
+				  OSD_REMOVE_MEMBER_OBJECTS);
+		assert(ctp[i] != NULL);
+	}
+	assert(init_ctp(osd, pid, cid, OSD_QUERY) == NULL);
+	assert(ctp_status(osd, pid, cid) == CTP_ACTIVE);
+	assert(ctp_status(osd, pid, cid + TRACK_CMDS) == 0);
+
+	/* workers count without the lock, readers see the command run */
+	ctp_members(ctp[0], TRACK_THREADS * TRACK_STEPS);
+	for (i = 0; i < TRACK_THREADS; i++)
+		assert(pthread_create(&th[i], NULL, track_worker,
+				      ctp[0]) == 0);
+	assert(track_attr(osd, pid, cid, CTP_ACTIVE_COMMAND_STATUS) ==
+	       OSD_REMOVE_MEMBER_OBJECTS);
+	assert(track_attr(osd, pid, cid, CTP_PERCENT_COMPLETE) <= 100);
+	for (i = 0; i < TRACK_THREADS; i++)
+		pthread_join(th[i], NULL);
+	assert(track_attr(osd, pid, cid, CTP_OBJECTS_PROCESSED) ==
+	       TRACK_THREADS * TRACK_STEPS);
+	assert(track_attr(osd, pid, cid, CTP_PERCENT_COMPLETE) == 100);
+
+	for (i = 0; i < TRACK_CMDS; i++)
+		finish_ctp(osd, ctp[i], SAM_STAT_GOOD);
+	assert(ctp_status(osd, pid, cid) == SAM_STAT_GOOD);
+	assert(track_attr(osd, pid, cid, CTP_ACTIVE_COMMAND_STATUS) == 0);
+	assert(track_attr(osd, pid, cid, CTP_ENDED_COMMAND_STATUS) ==
+	       SAM_STAT_GOOD);
+
+	/* many more ended commands push the first out, the db has it */
+	for (i = 0; i < 300; i++) {
+		c = init_ctp(osd, pid + 1, cid + i, OSD_QUERY);
+		assert(c != NULL);
+		end_ctp(osd, c, SAM_STAT_GOOD);
+	}
+	assert(ctp_status(osd, pid, cid) == 0);
+	assert(track_attr(osd, pid, cid, CTP_ACTIVE_COMMAND_STATUS) == 0);
+	assert(track_attr(osd, pid, cid, CTP_PERCENT_COMPLETE) == 100);
+	assert(track_attr(osd, pid, cid, CTP_ENDED_COMMAND_STATUS) ==
+	       SAM_STAT_GOOD);
+	assert(track_attr(osd, pid, cid, CTP_NUMBER_OF_MEMBERS) ==
+	       TRACK_THREADS * TRACK_STEPS);
+	assert(track_attr(osd, pid, cid, CTP_OBJECTS_PROCESSED) ==
+	       TRACK_THREADS * TRACK_STEPS);
+}
+
 int main()
 {
 	int ret = 0;
@@ -1498,8 +2090,14 @@ int main()
 	test_osd_get_attributes(&osd);
 	test_osd_get_ccap(&osd);
 	test_osd_get_utsap(&osd);
+	test_osd_oinfo(&osd);
+	test_osd_partition_acct(&osd);
+	test_osd_partition_recount(&osd);
 	test_osd_create_collection(&osd);
 	test_osd_create_user_tracking_collection(&osd);
+	test_osd_remove_member_objects(&osd);
+	test_osd_tracking(&osd);
+	test_osd_intent_replay(&osd);
 	test_osd_query(&osd);
 	test_osd_read_map(&osd);
 
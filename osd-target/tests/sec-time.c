@@ -0,0 +1,195 @@
+/*
+ * Time commands with the security methods off and on: CAPKEY with the
+ * same capability each time is answered by the verified-capability
+ * cache, a new capability each time pays for the capability key.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <assert.h>
+
+#include "osd-types.h"
+#include "cdb.h"
+#include "osd.h"
+#include "sec.h"
+#include "command.h"
+#include "osd-util/osd-util.h"
+
+enum {
+	SEC_TIME_OFF,
+	SEC_TIME_HIT,
+	SEC_TIME_MISS,
+	SEC_TIME_CMDRSP,
+};
+
+static const char *const sec_time_name[] = {
+	"off", "capkey-hit", "capkey-miss", "cmdrsp",
+};
+
+static inline void run(struct osd_device *osd, struct osd_command *c)
+{
+	int ret;
+	uint8_t *data_in = NULL;
+	uint64_t data_in_len = 0;
+	uint8_t sense_out[OSD_MAX_SENSE];
+	int senselen_out;
+
+	ret = osdemu_cmd_submit(osd, c->cdb, c->outdata, c->outlen, &data_in,
+				&data_in_len, sense_out, &senselen_out);
+	assert(ret == 0);
+	if (data_in)
+		osdemu_outbuf_release(osd, data_in);
+}
+
+static void sign(struct osd_command *cmd, const uint8_t *secret)
+{
+	uint8_t cap_key[OSD_KEY_LEN];
+
+	sec_hmac(secret, &cmd->cdb[CAP_OFF], CAP_LEN, cap_key);
+	sec_sign(cmd->cdb, cap_key);
+}
+
+static void set_key(struct osd_device *osd, int key_to_set, uint64_t pid,
+		    uint8_t fill, const uint8_t *parent, uint8_t *key)
+{
+	struct osd_command cmd;
+	uint8_t seed[OSD_KEY_LEN];
+
+	memset(seed, fill, sizeof(seed));
+	osd_command_set_set_key(&cmd, key_to_set, pid, 0, seed);
+	run(osd, &cmd);
+	sec_hmac(parent, seed, sizeof(seed), key);
+}
+
+static void set_method(struct osd_device *osd, uint8_t method,
+		       const uint8_t *secret)
+{
+	struct osd_command cmd;
+	struct attribute_list attr = {
+		ATTR_SET, ROOT_POLICY_PG, RPSAP_DEFAULT_SECURITY_METHOD,
+		&method, 1, 0
+	};
+	int ret;
+
+	ret = osd_command_set_set_attributes(&cmd, ROOT_PID, ROOT_OID);
+	assert(ret == 0);
+	ret = osd_command_attr_build(&cmd, &attr, 1);
+	assert(ret == 0);
+	osd_command_set_capability(&cmd, OSD_SEC_CAPKEY, 0,
+				   CAP_PERM_SET_ATTR, CAP_ODT_LU, 0, 0);
+	if (secret)
+		sign(&cmd, secret);
+	run(osd, &cmd);
+	osd_command_attr_free(&cmd);
+}
+
+static void sec_speed(struct osd_device *osd, int numiter, int mode,
+		      const uint8_t *work)
+{
+	int i;
+	double *v;
+	double mu, sd;
+	struct osd_command cmd;
+	uint64_t start, end;
+	uint64_t pid = USEROBJECT_PID_LB;
+	uint64_t oid = USEROBJECT_OID_LB;
+
+	v = malloc(numiter * sizeof(*v));
+	if (!v)
+		osd_error_fatal("out of memory");
+
+	osd_command_set_get_attributes(&cmd, pid, oid);
+	if (mode != SEC_TIME_OFF)
+		osd_command_set_capability(&cmd, mode == SEC_TIME_CMDRSP ?
+					   OSD_SEC_CMDRSP : OSD_SEC_CAPKEY, 0,
+					   CAP_PERM_GET_ATTR, CAP_ODT_OBJECT,
+					   pid, oid);
+	if (mode != SEC_TIME_OFF)
+		sign(&cmd, work);
+
+	for (i = 0; i < numiter; i++) {
+		/* the client's side of the work is not timed */
+		if (mode == SEC_TIME_MISS) {
+			set_htonl(&cmd.cdb[CAP_OFF + CAP_AUDIT], i);
+			sign(&cmd, work);
+		} else if (mode == SEC_TIME_CMDRSP) {
+			set_htonl(&cmd.cdb[SEC_NONCE_OFF], i);
+			sign(&cmd, work);
+		}
+		rdtsc(start);
+		run(osd, &cmd);
+		rdtsc(end);
+		v[i] = ((double) (end - start)) / mhz;  /* time in usec */
+	}
+
+	mu = mean(v, numiter);
+	sd = stddev(v, mu, numiter);
+	printf("security %-11s numiter %d avg %9.3lf +- %8.3lf us"
+	       " %10.0lf cmd/s\n", sec_time_name[mode], numiter, mu, sd,
+	       1e6 / mu);
+	free(v);
+}
+
+static void usage(void)
+{
+	fprintf(stderr, "Usage: %s [-i <numiter>]\n", osd_get_progname());
+	exit(1);
+}
+
+int main(int argc, char **argv)
+{
+	int ret = 0;
+	int numiter = 10000;
+	int mode;
+	static struct osd_device osd;
+	struct osd_command cmd;
+	uint8_t master[OSD_KEY_LEN], root[OSD_KEY_LEN], part[OSD_KEY_LEN];
+	uint8_t work[OSD_KEY_LEN];
+
+	osd_set_progname(argc, argv);
+	while (++argv, --argc > 0) {
+		const char *s = *argv;
+		if (s[0] == '-') {
+			switch (s[1]) {
+			case 'i':
+				++argv, --argc;
+				if (argc < 1)
+					usage();
+				numiter = atoi(*argv);
+				break;
+			default:
+				usage();
+			}
+		} else {
+			usage();
+		}
+	}
+
+	system("rm -rf /tmp/osd");
+	ret = osd_open("/tmp/osd", &osd);
+	assert(ret == 0);
+
+	osd_command_set_create_partition(&cmd, USEROBJECT_PID_LB);
+	run(&osd, &cmd);
+	osd_command_set_create(&cmd, USEROBJECT_PID_LB, USEROBJECT_OID_LB, 1);
+	run(&osd, &cmd);
+
+	/* keys are handed out before security is on */
+	memset(master, 0x5a, sizeof(master));
+	ret = osd_set_master(&osd, master);
+	assert(ret == 0);
+	set_key(&osd, OSD_KEY_ROOT, ROOT_PID, 1, master, root);
+	set_key(&osd, OSD_KEY_PARTITION, USEROBJECT_PID_LB, 2, root, part);
+	set_key(&osd, OSD_KEY_WORKING, USEROBJECT_PID_LB, 3, part, work);
+
+	sec_speed(&osd, numiter, SEC_TIME_OFF, work);
+	set_method(&osd, OSD_SEC_CAPKEY, NULL);
+	for (mode = SEC_TIME_HIT; mode <= SEC_TIME_CMDRSP; mode++)
+		sec_speed(&osd, numiter, mode, work);
+	set_method(&osd, OSD_SEC_NOSEC, root);
+
+	ret = osd_close(&osd);
+	assert(ret == 0);
+
+	return 0;
+}
@@ -16,128 +16,280 @@
  * along with this program.  If not, see <http://www.gnu.org/licenses/>.
  */
 
-/* Writing command tracking info to the attribute database may be
-   expensive.  So, just keep an array of command tracking pages in
-   memory in a linked list.  When the command is complete, we will
-   flush the attributes to the database.  The problem is that if the
-   OSD target crashes before we flush, we can't return a meaningful
-   SAM-4 error to initiator.  All we can do is return the previous
-   command call or that "no command is using the collection."  */
+/*
+ * Command tracking pages (COLL_TRACKING_PG) of the collections, and the
+ * partitions, that have a long running command: REMOVE MEMBER OBJECTS,
+ * SET MEMBER ATTRIBUTES, QUERY into a matches collection, and REMOVE
+ * PARTITION of a partition that is not empty.
+ *
+ * Pages are kept in memory, in a hash table keyed by (pid, cid), and
+ * finish_ctp writes them to the attribute db when the command ends. GET
+ * ATTRIBUTES is served from memory while an entry exists and from the db
+ * after.  If the target crashes before finish_ctp, the page in the db is
+ * that of the command before.
+ *
+ * The buckets are guarded by the table lock.  The owner of a running
+ * entry, whoever got it from init_ctp, changes its counters with atomic
+ * stores and without the lock, so bulk work can report progress from any
+ * thread; readers copy them under the lock.  status changes only under
+ * the lock, and sense is filled before it does.
+ *
+ * An ended entry stays until the next command on its collection reuses
+ * it, or until the table holds more than CTP_KEEP entries; then init_ctp
+ * drops all ended ones.  Running entries are never dropped, there is no
+ * limit to their number.
+ */
 
 #include <stdlib.h>
+#include <string.h>
 #include <errno.h>
 #include <stdio.h>
+#include <pthread.h>
 #include <assert.h>
 
+#include "osd.h"
 #include "tracking.h"
 #include "attr.h"
 #include "obj.h"
 #include "list-entry.h"
 #include "osd-util/osd-util.h"
 
-#define NUM_CTPS 10
-struct ctp_node {
-	struct ctp ctp;
-	struct ctp_node *next;
+#define CTP_BUCKETS 64 /* power of 2 */
+#define CTP_KEEP 256
+
+struct track_table {
+	pthread_mutex_t lock;
+	uint64_t n;		/* entries in the table */
+	struct ctp *bucket[CTP_BUCKETS];
 };
 
-struct ctp_node *ctp_head = NULL, *ctp_tail = NULL;
-int num_ctps = 0;
+static inline struct ctp **ctp_bucket(struct track_table *tt, uint64_t pid,
+				      uint64_t cid)
+{
+	return &tt->bucket[(cid ^ (pid * 0x9e3779b1)) & (CTP_BUCKETS - 1)];
+}
+
+int tracking_init(struct osd_device *osd)
+{
+	struct track_table *tt;
+
+	tt = Calloc(1, sizeof(*tt));
+	if (!tt)
+		return -ENOMEM;
+	pthread_mutex_init(&tt->lock, NULL);
+	osd->tt = tt;
+	return OSD_OK;
+}
+
+void tracking_fini(struct osd_device *osd)
+{
+	int i;
+	struct ctp *ctp, *next;
+	struct track_table *tt = osd->tt;
+
+	if (!tt)
+		return;
+	for (i = 0; i < CTP_BUCKETS; i++) {
+		for (ctp = tt->bucket[i]; ctp; ctp = next) {
+			next = ctp->next;
+			free(ctp);
+		}
+	}
+	pthread_mutex_destroy(&tt->lock);
+	free(tt);
+	osd->tt = NULL;
+}
 
-struct ctp *init_ctp(uint64_t pid, uint64_t cid, uint16_t service_action)
+/* lock held */
+static struct ctp *lookup(struct track_table *tt, uint64_t pid, uint64_t cid)
 {
-	struct ctp_node *ctpn = NULL;
 	struct ctp *ctp;
 
-	if (num_ctps == NUM_CTPS) {
-		/* find a ctp that has completed.  if it has
-		   completed, it has been flushed to the database, we
-		   can remove from queue and reuse it */
-		struct ctp_node **ctpnp;
-		for (ctpnp = &ctp_head; *ctpnp; ctpnp = &((*ctpnp)->next)) {
-			ctpn = *ctpnp;
-			if (ctpn->ctp.status != 0xFFFF) {
-				*ctpnp = ctpn->next;
-				break;
+	for (ctp = *ctp_bucket(tt, pid, cid); ctp; ctp = ctp->next)
+		if (ctp->pid == pid && ctp->cid == cid)
+			return ctp;
+	return NULL;
+}
+
+/* lock held; their pages are in the db */
+static void drop_ended(struct track_table *tt)
+{
+	int i;
+	struct ctp *ctp, **pp;
+
+	for (i = 0; i < CTP_BUCKETS; i++) {
+		pp = &tt->bucket[i];
+		while ((ctp = *pp)) {
+			if (ctp->status == CTP_ACTIVE) {
+				pp = &ctp->next;
+				continue;
 			}
+			*pp = ctp->next;
+			free(ctp);
+			tt->n--;
 		}
-		if (ctpn == NULL) {
-			return NULL;
-		}
-	} else {
-		ctpn = (struct ctp_node *)malloc(sizeof(*ctpn));
-		if (num_ctps == 0) {
-			ctp_head = ctp_tail = ctpn;
-		}
-		num_ctps++;
 	}
+}
 
-	if (ctp_tail)
-	    ctp_tail->next = ctpn;
-	ctpn->next = NULL;
-	ctp_tail = ctpn;
+struct ctp *init_ctp(struct osd_device *osd, uint64_t pid, uint64_t cid,
+		     uint16_t service_action)
+{
+	struct ctp *ctp = NULL;
+	struct ctp **head;
+	struct track_table *tt = osd->tt;
 
-	ctp = &ctpn->ctp;
+	if (!tt)
+		return NULL;
 
+	pthread_mutex_lock(&tt->lock);
+	ctp = lookup(tt, pid, cid);
+	if (ctp) {
+		/* a collection has at most one tracking page, reuse it */
+		if (ctp->status == CTP_ACTIVE) {
+			ctp = NULL;
+			goto out;
+		}
+		memset(ctp, 0, offsetof(struct ctp, next));
+	} else {
+		if (tt->n >= CTP_KEEP)
+			drop_ended(tt);
+		ctp = Calloc(1, sizeof(*ctp));
+		if (!ctp)
+			goto out;
+		head = ctp_bucket(tt, pid, cid);
+		ctp->next = *head;
+		*head = ctp;
+		tt->n++;
+	}
 	ctp->pid = pid;
 	ctp->cid = cid;
 	ctp->service_action = service_action;
-	ctp->status = 0xFFFF;
-	ctp->percent_complete = 0;
+	ctp->status = CTP_ACTIVE;
 
+out:
+	pthread_mutex_unlock(&tt->lock);
 	return ctp;
 }
 
-/* finish_ctp is called when the command completes.  The caller should
-   set ctp->status and ctp->sense before calling finish_ctp.  The ctp
-   struct will no longer be valid after this call */
+void ctp_members(struct ctp *ctp, uint64_t number_of_members)
+{
+	__atomic_store_n(&ctp->number_of_members, number_of_members,
+			 __ATOMIC_RELAXED);
+}
+
+/*
+ * processed more members are done; percent complete follows, if the
+ * number of members is known.
+ */
+void ctp_progress(struct ctp *ctp, uint64_t processed)
+{
+	uint64_t done, members;
+	uint8_t percent;
 
-void finish_ctp(struct osd_device *osd, struct ctp *ctp)
+	done = __atomic_add_fetch(&ctp->objects_processed, processed,
+				  __ATOMIC_RELAXED);
+	members = __atomic_load_n(&ctp->number_of_members, __ATOMIC_RELAXED);
+	if (members == 0)
+		return;
+	percent = done >= members ? 100 : (done * 100) / members;
+	__atomic_store_n(&ctp->percent_complete, percent, __ATOMIC_RELAXED);
+}
+
+void end_ctp(struct osd_device *osd, struct ctp *ctp, uint16_t status)
 {
-	attr_set_attr(osd->dbc, ctp->pid, ctp->cid, COLL_TRACKING_PG,
-		      CTP_PERCENT_COMPLETE, &ctp->percent_complete,
-		      sizeof(ctp->percent_complete));
-	attr_set_attr(osd->dbc, ctp->pid, ctp->cid, COLL_TRACKING_PG,
-		      CTP_ENDED_COMMAND_STATUS, &ctp->status,
-		      sizeof(ctp->status));
-	if (ctp->status) {
-		attr_set_attr(osd->dbc, ctp->pid, ctp->cid, COLL_TRACKING_PG,
-			      CTP_SENSE_DATA, ctp->sense, ctp->senselen);
-	}
-	if (ctp->number_of_members) {
-		attr_set_attr(osd->dbc, ctp->pid, ctp->cid, COLL_TRACKING_PG,
-			      CTP_NUMBER_OF_MEMBERS, &ctp->number_of_members,
-			      sizeof(ctp->number_of_members));
-	}
-	if (ctp->objects_processed) {
-		attr_set_attr(osd->dbc, ctp->pid, ctp->cid, COLL_TRACKING_PG,
-			      CTP_OBJECTS_PROCESSED, &ctp->objects_processed,
-			      sizeof(ctp->objects_processed));
-	}
-	if (ctp->newer_objects_skipped) {
-		attr_set_attr(osd->dbc, ctp->pid, ctp->cid, COLL_TRACKING_PG,
-			      CTP_NEWER_OBJECTS_SKIPPED,
-			      &ctp->newer_objects_skipped,
-			      sizeof(ctp->newer_objects_skipped));
-	}
-	if (ctp->missing_objects_skipped) {
-		attr_set_attr(osd->dbc, ctp->pid, ctp->cid, COLL_TRACKING_PG,
-			      CTP_MISSING_OBJECTS_SKIPPED,
-			      &ctp->missing_objects_skipped,
-			      sizeof(ctp->missing_objects_skipped));
-	}
-	return;
+	struct track_table *tt = osd->tt;
+
+	pthread_mutex_lock(&tt->lock);
+	if (status == SAM_STAT_GOOD)
+		__atomic_store_n(&ctp->percent_complete, 100,
+				 __ATOMIC_RELAXED);
+	ctp->status = status;
+	pthread_mutex_unlock(&tt->lock);
 }
 
-struct ctp *find_ctp(uint64_t pid, uint64_t cid)
+/* lock held */
+static void snapshot(const struct ctp *ctp, struct ctp *snap)
 {
-	struct ctp_node *ctpn;
-	for (ctpn = ctp_head; ctpn; ctpn = ctpn->next) {
-		if (ctpn->ctp.pid == pid && ctpn->ctp.cid == cid) {
-			return &ctpn->ctp;
-		}
+	memcpy(snap, ctp, offsetof(struct ctp, percent_complete));
+	snap->percent_complete = __atomic_load_n(&ctp->percent_complete,
+						 __ATOMIC_RELAXED);
+	snap->senselen = 0;
+	if (ctp->status != CTP_ACTIVE) {
+		snap->senselen = ctp->senselen;
+		memcpy(snap->sense, ctp->sense, ctp->senselen);
 	}
-	return NULL;
+	snap->number_of_members =
+		__atomic_load_n(&ctp->number_of_members, __ATOMIC_RELAXED);
+	snap->objects_processed =
+		__atomic_load_n(&ctp->objects_processed, __ATOMIC_RELAXED);
+	snap->newer_objects_skipped =
+		__atomic_load_n(&ctp->newer_objects_skipped, __ATOMIC_RELAXED);
+	snap->missing_objects_skipped =
+		__atomic_load_n(&ctp->missing_objects_skipped,
+				__ATOMIC_RELAXED);
+	snap->next = NULL;
+}
+
+static int store(struct osd_device *osd, const struct ctp *ctp,
+		 uint32_t number, uint64_t val)
+{
+	uint8_t ll[8];
+
+	set_htonll(ll, val);
+	return attr_set_attr(osd->dbc, ctp->pid, ctp->cid, COLL_TRACKING_PG,
+			     number, ll, sizeof(ll));
+}
+
+/*
+ * Values are written as GET ATTRIBUTES returns them.
+ */
+void finish_ctp(struct osd_device *osd, struct ctp *ctp, uint16_t status)
+{
+	uint8_t ss[2];
+	struct ctp snap;
+
+	end_ctp(osd, ctp, status);
+	pthread_mutex_lock(&osd->tt->lock);
+	snapshot(ctp, &snap);
+	pthread_mutex_unlock(&osd->tt->lock);
+
+	attr_set_attr(osd->dbc, snap.pid, snap.cid, COLL_TRACKING_PG,
+		      CTP_PERCENT_COMPLETE, &snap.percent_complete,
+		      sizeof(snap.percent_complete));
+	set_htons(ss, snap.status);
+	attr_set_attr(osd->dbc, snap.pid, snap.cid, COLL_TRACKING_PG,
+		      CTP_ENDED_COMMAND_STATUS, ss, sizeof(ss));
+	if (snap.status)
+		attr_set_attr(osd->dbc, snap.pid, snap.cid, COLL_TRACKING_PG,
+			      CTP_SENSE_DATA, snap.sense, snap.senselen);
+	if (snap.number_of_members)
+		store(osd, &snap, CTP_NUMBER_OF_MEMBERS,
+		      snap.number_of_members);
+	if (snap.objects_processed)
+		store(osd, &snap, CTP_OBJECTS_PROCESSED,
+		      snap.objects_processed);
+	if (snap.newer_objects_skipped)
+		store(osd, &snap, CTP_NEWER_OBJECTS_SKIPPED,
+		      snap.newer_objects_skipped);
+	if (snap.missing_objects_skipped)
+		store(osd, &snap, CTP_MISSING_OBJECTS_SKIPPED,
+		      snap.missing_objects_skipped);
+}
+
+uint16_t ctp_status(struct osd_device *osd, uint64_t pid, uint64_t cid)
+{
+	uint16_t status = 0;
+	struct ctp *ctp;
+	struct track_table *tt = osd->tt;
+
+	if (!tt)
+		return 0;
+	pthread_mutex_lock(&tt->lock);
+	ctp = lookup(tt, pid, cid);
+	if (ctp)
+		status = ctp->status;
+	pthread_mutex_unlock(&tt->lock);
+	return status;
 }
 
 int get_ctp(struct osd_device *osd, uint64_t pid, uint64_t cid,
@@ -152,8 +304,19 @@ int get_ctp(struct osd_device *osd, uint64_t pid, uint64_t cid,
 	uint8_t ll[8];
 	uint64_t pcount;
 	uint32_t page = COLL_TRACKING_PG;
+	struct ctp snap;
+	struct ctp *ctp = NULL;
 
-	struct ctp* ctp = find_ctp(pid, cid);
+	/* a copy, the command may go on meanwhile */
+	if (osd->tt) {
+		pthread_mutex_lock(&osd->tt->lock);
+		ctp = lookup(osd->tt, pid, cid);
+		if (ctp) {
+			snapshot(ctp, &snap);
+			ctp = &snap;
+		}
+		pthread_mutex_unlock(&osd->tt->lock);
+	}
 
 	switch (number) {
 	case 0:
@@ -170,7 +333,7 @@ int get_ctp(struct osd_device *osd, uint64_t pid, uint64_t cid,
 		break;
 
 	case CTP_ACTIVE_COMMAND_STATUS:
-		if (ctp && ctp->status == 0xFFFF) {
+		if (ctp && ctp->status == CTP_ACTIVE) {
 			set_htons(ll, ctp->service_action);
 		} else {
 			set_htons(ll, 0);
@@ -19,6 +19,13 @@
 #include "osd-util/osd-defs.h"
 #include "osd-types.h"
 
+/* status of a command that has not ended */
+#define CTP_ACTIVE 0xFFFF
+
+/*
+ * Counters are changed by the command's owner with ctp_progress and
+ * ctp_members, sense is filled by it before the command ends.
+ */
 struct ctp {
 	uint64_t pid;
 	uint64_t cid;
@@ -31,24 +38,38 @@ struct ctp {
 	uint64_t objects_processed;
 	uint64_t newer_objects_skipped;
 	uint64_t missing_objects_skipped;
+	struct ctp *next;
 };
 
-/* init_ctp creates a command tracking page for the specified collection */
+int tracking_init(struct osd_device *osd);
+
+void tracking_fini(struct osd_device *osd);
+
+/*
+ * init_ctp creates the command tracking page of the specified collection,
+ * or resets the one of its previous command.  NULL if a command is
+ * tracked there already, or out of memory.
+ */
+struct ctp *init_ctp(struct osd_device *osd, uint64_t pid, uint64_t cid,
+		     uint16_t service_action);
+
+void ctp_members(struct ctp *ctp, uint64_t number_of_members);
 
-struct ctp *init_ctp(uint64_t pid, uint64_t cid, uint16_t service_action);
+void ctp_progress(struct ctp *ctp, uint64_t processed);
 
-/* finish_ctp is called when the command completes.  The caller should
-   set ctp->status and ctp->sense before calling finish_ctp.  The ctp
-   struct will no longer be valid after this call */
+/*
+ * end_ctp is called when the command completes, finish_ctp in addition
+ * writes the page to the attribute db.  The ctp struct is no longer valid
+ * to the caller after either.
+ */
+void end_ctp(struct osd_device *osd, struct ctp *ctp, uint16_t status);
 
-void finish_ctp(struct osd_device *osd, struct ctp *ctp);
+void finish_ctp(struct osd_device *osd, struct ctp *ctp, uint16_t status);
 
-/* find_ctp returns a command tracking page in ctp struct format */
-struct ctp *find_ctp(uint64_t pid, uint64_t cid);
+/* status of the last command on the collection, 0 if none is known */
+uint16_t ctp_status(struct osd_device *osd, uint64_t pid, uint64_t cid);
 
 /* get_ctp returns a command tracking page in attribute format */
 int get_ctp(struct osd_device *osd, uint64_t pid, uint64_t oid,
 	    uint32_t number, void *outbuf, uint64_t outlen,
 	    uint8_t listfmt, uint32_t *used_outlen);
-
-
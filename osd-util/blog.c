@@ -0,0 +1,426 @@
+/*
+ * Binary ring log.
+ *
+ * Copyright (C) 2007 OSD Team <pvfs-osd@osc.edu>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, version 2 of the License.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/*
+ * osd_rlog stores the format pointer and raw arguments of a message in a
+ * ring of the calling thread, no formatting and no locks, so it can stay
+ * on in hot paths.  The newest BLOG_RING records of each thread are kept.
+ * blog_dump formats them, merged in time order; osd_error_fatal calls it
+ * before exit.  A program that wants to inspect a live or hung target
+ * can have blog_dump_on_signal call it whenever the process gets a
+ * signal.
+ *
+ * Each thread writes only its own ring.  A record is published by storing
+ * its sequence number last; the dump copies a record and uses it only if
+ * the number did not change meanwhile.  A thread takes a ring on its first
+ * record and gives it back when it exits.  A ring given back goes to the
+ * next new thread, so threads that come and go with FORMAT or osd_open
+ * use no more rings than ever ran at once.  Rings are linked into a list
+ * that never shrinks, and records carry the thread id, so the records of
+ * exited threads remain until their ring is reused.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <stdarg.h>
+#include <unistd.h>
+#include <time.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <signal.h>
+#include <pthread.h>
+#include <sys/syscall.h>
+
+#include "osd-util.h"
+
+#define BLOG_RING 4096 /* records per thread, power of 2 */
+
+int osd_rlog_level = OSD_LOG_DEBUG;
+
+struct blog_rec {
+	uint64_t seq;		/* index + 1 once complete, 0 while written */
+	uint64_t ns;		/* CLOCK_MONOTONIC */
+	const char *fmt;
+	int32_t tid;		/* the ring may have had other owners */
+	uint16_t level;
+	uint16_t nargs;
+	uint64_t arg[BLOG_MAX_ARGS];
+};
+
+struct blog_ring {
+	struct blog_ring *next;
+	struct blog_ring *next_free;
+	long tid;
+	uint64_t head;		/* next index to write */
+	struct blog_rec rec[BLOG_RING];
+};
+
+static struct blog_ring *rings;
+static __thread struct blog_ring *my_ring;
+
+static pthread_once_t ring_once = PTHREAD_ONCE_INIT;
+static pthread_key_t ring_key;
+static int ring_key_ok;
+static pthread_mutex_t free_lock = PTHREAD_MUTEX_INITIALIZER;
+static struct blog_ring *free_rings;
+
+/* the thread exits, the next new one takes over its ring */
+static void ring_put(void *arg)
+{
+	struct blog_ring *r = arg;
+
+	my_ring = NULL;
+	pthread_mutex_lock(&free_lock);
+	r->next_free = free_rings;
+	free_rings = r;
+	pthread_mutex_unlock(&free_lock);
+}
+
+static void ring_key_init(void)
+{
+	ring_key_ok = (pthread_key_create(&ring_key, ring_put) == 0);
+}
+
+static struct blog_ring *ring_get(void)
+{
+	struct blog_ring *r;
+
+	if (my_ring)
+		return my_ring;
+
+	pthread_once(&ring_once, ring_key_init);
+	pthread_mutex_lock(&free_lock);
+	r = free_rings;
+	if (r)
+		free_rings = r->next_free;
+	pthread_mutex_unlock(&free_lock);
+
+	if (!r) {
+		r = calloc(1, sizeof(*r));
+		if (!r)
+			return NULL;
+		r->next = __atomic_load_n(&rings, __ATOMIC_ACQUIRE);
+		while (!__atomic_compare_exchange_n(&rings, &r->next, r, 0,
+						    __ATOMIC_RELEASE,
+						    __ATOMIC_ACQUIRE))
+			;
+	}
+	r->tid = syscall(SYS_gettid);
+	if (ring_key_ok)
+		pthread_setspecific(ring_key, r);
+	my_ring = r;
+	return r;
+}
+
+/*
+ * The nargs arguments are uint64_t, converted by BLOG_ARG in osd_rlog.
+ */
+void blog_write(int level, const char *fmt, int nargs, ...)
+{
+	int i;
+	va_list ap;
+	struct timespec ts;
+	struct blog_ring *r = ring_get();
+	struct blog_rec *rec;
+	uint64_t idx;
+
+	if (!r)
+		return;
+	idx = r->head;
+	rec = &r->rec[idx & (BLOG_RING - 1)];
+	__atomic_store_n(&rec->seq, 0, __ATOMIC_RELAXED);
+	__atomic_thread_fence(__ATOMIC_RELEASE);
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	rec->ns = (uint64_t) ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+	rec->fmt = fmt;
+	rec->tid = r->tid;
+	rec->level = level;
+	if (nargs > BLOG_MAX_ARGS)
+		nargs = BLOG_MAX_ARGS;
+	rec->nargs = nargs;
+	va_start(ap, nargs);
+	for (i = 0; i < nargs; i++)
+		rec->arg[i] = va_arg(ap, uint64_t);
+	va_end(ap);
+
+	__atomic_store_n(&rec->seq, idx + 1, __ATOMIC_RELEASE);
+	__atomic_store_n(&r->head, idx + 1, __ATOMIC_RELEASE);
+}
+
+/*
+ * Print one record, each conversion of fmt on its own with its argument
+ * cast back to the type the conversion expects.  '*' widths and
+ * precisions take an argument too.  Floating point and %n print '?'.
+ */
+static void rec_print(FILE *fp, const struct blog_rec *rec)
+{
+	const char *f = rec->fmt, *start;
+	char spec[32];
+	size_t len;
+	int i = 0, n, wide;
+	uint64_t v;
+
+#define NEXT_ARG() (i < (int) rec->nargs ? rec->arg[i++] : 0)
+	while (*f) {
+		if (*f != '%') {
+			fputc(*f++, fp);
+			continue;
+		}
+		if (f[1] == '%') {
+			fputc('%', fp);
+			f += 2;
+			continue;
+		}
+		/* flags, width, precision, length, conversion */
+		start = f;
+		spec[0] = *f++;
+		len = 1;
+		for (; *f && strchr("-+ #0123456789.*", *f); f++) {
+			if (*f == '*') {
+				n = (int) NEXT_ARG();
+				if (len < sizeof(spec) - 16)
+					len += sprintf(spec + len, "%d", n);
+			} else if (len < sizeof(spec) - 16) {
+				spec[len++] = *f;
+			}
+		}
+		/* h and hh stay, all others become ll, all 64 bit here */
+		wide = 0;
+		for (; *f && strchr("hlLqjzt", *f); f++) {
+			if (*f != 'h')
+				wide = 1;
+			else if (len < sizeof(spec) - 8)
+				spec[len++] = *f;
+		}
+		if (wide) {
+			spec[len++] = 'l';
+			spec[len++] = 'l';
+		}
+		if (!*f) {
+			fputs(start, fp);
+			break;
+		}
+		spec[len++] = *f;
+		spec[len] = '\0';
+		v = NEXT_ARG();
+		switch (*f++) {
+		case 'd':
+		case 'i':
+			if (wide)
+				fprintf(fp, spec, (long long) v);
+			else
+				fprintf(fp, spec, (int) v);
+			break;
+		case 'u':
+		case 'o':
+		case 'x':
+		case 'X':
+			if (wide)
+				fprintf(fp, spec, (unsigned long long) v);
+			else
+				fprintf(fp, spec, (unsigned int) v);
+			break;
+		case 'c':
+			fprintf(fp, spec, (int) v);
+			break;
+		case 's':
+			fprintf(fp, spec, (const char *) (uintptr_t) v);
+			break;
+		case 'p':
+			fprintf(fp, spec, (void *) (uintptr_t) v);
+			break;
+		default:
+			fputc('?', fp);
+			break;
+		}
+	}
+#undef NEXT_ARG
+}
+
+static int cmp_ns(const void *a, const void *b)
+{
+	const struct blog_rec *x = a, *y = b;
+
+	if (x->ns != y->ns)
+		return x->ns < y->ns ? -1 : 1;
+	return 0;
+}
+
+/* records a ring holds */
+static uint64_t ring_len(struct blog_ring *r)
+{
+	uint64_t head = __atomic_load_n(&r->head, __ATOMIC_ACQUIRE);
+
+	return head < BLOG_RING ? head : BLOG_RING;
+}
+
+/* copy the newest of the records of r, at most room */
+static int snap(struct blog_ring *r, struct blog_rec *out, uint64_t room)
+{
+	int n = 0;
+	uint64_t i, head, len, seq;
+	struct blog_rec *rec;
+
+	head = __atomic_load_n(&r->head, __ATOMIC_ACQUIRE);
+	len = head < BLOG_RING ? head : BLOG_RING;
+	if (len > room)
+		len = room;
+	for (i = head - len; i < head; i++) {
+		rec = &r->rec[i & (BLOG_RING - 1)];
+		seq = __atomic_load_n(&rec->seq, __ATOMIC_ACQUIRE);
+		if (seq != i + 1)
+			continue;
+		memcpy(&out[n], rec, sizeof(*rec));
+		__atomic_thread_fence(__ATOMIC_ACQUIRE);
+		if (__atomic_load_n(&rec->seq, __ATOMIC_RELAXED) != seq)
+			continue; /* overwritten while copying */
+		n++;
+	}
+	return n;
+}
+
+/*
+ * Format the records of all threads to fp, oldest first.  May run while
+ * other threads log; records they overwrite meanwhile are skipped.
+ */
+void blog_dump(FILE *fp)
+{
+	static const char lvl[] = "EWID";
+	size_t i, n = 0, max = 0;
+	struct blog_ring *r, *first;
+	struct blog_rec *v;
+	struct blog_rec *rec;
+
+	/* rings are only ever added, at the front */
+	first = __atomic_load_n(&rings, __ATOMIC_ACQUIRE);
+	for (r = first; r; r = r->next)
+		max += ring_len(r);
+	if (max == 0)
+		return;
+	v = malloc(max * sizeof(*v));
+	if (!v) {
+		osd_error("%s: no memory for %zu records", __func__, max);
+		return;
+	}
+	for (r = first; r && n < max; r = r->next)
+		n += snap(r, &v[n], max - n);
+	qsort(v, n, sizeof(*v), cmp_ns);
+
+	for (i = 0; i < n; i++) {
+		rec = &v[i];
+		fprintf(fp, "%llu.%06llu %d %c: ", llu(rec->ns / 1000000000),
+			llu(rec->ns % 1000000000 / 1000), rec->tid,
+			lvl[rec->level & 3]);
+		rec_print(fp, rec);
+		fputc('\n', fp);
+	}
+	free(v);
+}
+
+static int dump_pipe[2] = { -1, -1 };
+static FILE *dump_fp;
+
+static void dump_signal(int sig __attribute__((unused)))
+{
+	int saved = errno;
+	char c = 0;
+	ssize_t ret;
+
+	/* a full pipe means a dump is pending already */
+	ret = write(dump_pipe[1], &c, 1);
+	(void) ret;
+	errno = saved;
+}
+
+static void *dump_thread(void *arg __attribute__((unused)))
+{
+	char c;
+
+	for (;;) {
+		if (read(dump_pipe[0], &c, 1) < 0) {
+			if (errno == EINTR)
+				continue;
+			break;
+		}
+		blog_dump(dump_fp);
+		fflush(dump_fp);
+	}
+	return NULL;
+}
+
+/*
+ * Dump to fp each time the process gets sig.  The handler only writes a
+ * byte to a pipe; a detached thread reads it and formats the records, so
+ * the dump works whatever the other threads are stuck in.  Leaves a
+ * handler the program installed itself alone.
+ *
+ * returns: 0 or if already on, -EBUSY if sig has a handler, -errno
+ */
+int blog_dump_on_signal(int sig, FILE *fp)
+{
+	static pthread_mutex_t lock = PTHREAD_MUTEX_INITIALIZER;
+	struct sigaction sa, old;
+	pthread_attr_t attr;
+	pthread_t tid;
+	int ret = 0;
+
+	pthread_mutex_lock(&lock);
+	if (dump_pipe[0] >= 0)
+		goto out_unlock;
+	if (sigaction(sig, NULL, &old) < 0) {
+		ret = -errno;
+		goto out_unlock;
+	}
+	if (old.sa_handler != SIG_DFL) {
+		ret = -EBUSY;
+		goto out_unlock;
+	}
+	if (pipe(dump_pipe) < 0) {
+		ret = -errno;
+		goto out_unlock;
+	}
+	fcntl(dump_pipe[0], F_SETFD, FD_CLOEXEC);
+	fcntl(dump_pipe[1], F_SETFD, FD_CLOEXEC);
+	fcntl(dump_pipe[1], F_SETFL, O_NONBLOCK);
+	dump_fp = fp;
+
+	pthread_attr_init(&attr);
+	pthread_attr_setdetachstate(&attr, PTHREAD_CREATE_DETACHED);
+	ret = -pthread_create(&tid, &attr, dump_thread, NULL);
+	pthread_attr_destroy(&attr);
+	if (ret)
+		goto out_close;
+
+	memset(&sa, 0, sizeof(sa));
+	sa.sa_handler = dump_signal;
+	sigemptyset(&sa.sa_mask);
+	sa.sa_flags = SA_RESTART;
+	if (sigaction(sig, &sa, NULL) < 0)
+		ret = -errno; /* the thread just waits */
+	goto out_unlock;
+
+out_close:
+	close(dump_pipe[0]);
+	close(dump_pipe[1]);
+	dump_pipe[0] = dump_pipe[1] = -1;
+out_unlock:
+	pthread_mutex_unlock(&lock);
+	return ret;
+}
@@ -72,6 +72,8 @@
 #define OSD_FA				0x8890
 #define OSD_COND_SETATTR		0x8891
 #define OSD_GEN_CAS			0x88a5               
+#define OSD_CAS_WAIT			0x88a6
+#define OSD_MULTI_RW			0x88a7
 
 /* Data Distribution Types */
 #define DDT_CONTIG	0x0
@@ -123,6 +125,20 @@
 #define COPY_USER_OBJECT_SOURCE 0x0101
 #define EXTENSION_CAPABILITIES 0xFFEE
 
+/*
+ * OSD_MULTI_RW: one descriptor of type OBJECT_IO_LIST in the continuation
+ * lists the user objects, oid, offset and length each.  Write data of
+ * all follow the continuation in the data-out buffer.  The data-in buffer
+ * starts with a status record per object, read data of all follow.
+ */
+#define OBJECT_IO_LIST 0xFF00
+#define MULTI_RW_WRITE 0x1		/* in CDB byte 11 */
+enum {
+	MULTI_RW_ENTRY_LEN = 24,
+	MULTI_RW_STATUS_LEN = 16,	/* status, sense key, asc, ascq, */
+					/* 4 reserved, bytes transferred */
+};
+
 /* object duplication methods, osd2r04 sec 4.13.3 */
 #define DEFAULT 0x00
 #define SPACE_EFFICIENT 0x01
@@ -272,6 +288,7 @@ enum {
 	UIAP_USERNAME = 0x9,
 	UIAP_USED_CAPACITY = 0x81,
 	UIAP_LOGICAL_LEN = 0x82,
+	PARTITION_NUMBER_OF_OBJECTS = 0xC1, /* user objects in a partition */
 	PARTITION_CAPACITY_QUOTA = 0x10001,
 
 	/* lengths */
@@ -310,6 +327,134 @@ enum {
 	RIAP_CLOCK_LEN                    = 6,
 };
 
+/* OSDEMU statistics, vendor specific root page, non-standard */
+enum {
+	ROOT_STATS_PG = (ROOT_PG + VEND_PG_LB),
+
+	/* attributes, all 8 bytes */
+	RSTATS_COMMANDS			= 0x1,	/* commands completed */
+	RSTATS_ARENA_ALLOCS		= 0x2,	/* by the last command */
+	RSTATS_ARENA_BYTES		= 0x3,	/* by the last command */
+	RSTATS_ARENA_MAX_ALLOCS		= 0x4,	/* most by any command */
+	RSTATS_ARENA_MAX_BYTES		= 0x5,	/* most by any command */
+	RSTATS_ARENA_TOTAL_ALLOCS	= 0x6,
+	RSTATS_ARENA_MALLOCS		= 0x7,	/* arena chunks malloc'ed */
+	RSTATS_OUTBUF_HITS		= 0x8,	/* data-in buffer reused */
+	RSTATS_OUTBUF_MISSES		= 0x9,	/* data-in buffer mapped */
+	RSTATS_CAP_HITS			= 0xA,	/* capability key cached */
+	RSTATS_CAP_MISSES		= 0xB,	/* capability key computed */
+
+	RSTATS_LEN = 8,
+};
+
+/*
+ * OSDEMU latency histograms, vendor specific root page, non-standard.
+ * Attribute (action << 4) | phase holds those of service action
+ * 0x8880..0x88bf.  Setting RLAT_RESET clears all, setting one of them
+ * clears that one.
+ */
+enum {
+	ROOT_LATENCY_PG = (ROOT_PG + VEND_PG_LB + 1),
+
+	RLAT_RESET			= 0x1,
+
+	/* phases */
+	RLAT_CMD			= 0x0,	/* whole command */
+	RLAT_PARSE			= 0x1,	/* cdb, lists, continuations */
+	RLAT_META			= 0x2,	/* rest: db and bookkeeping */
+	RLAT_DATA			= 0x3,	/* data file io */
+	RLAT_ATTR			= 0x4,	/* get and set attributes */
+	RLAT_PHASES			= 0x5,
+
+	/* value, all fields 8 bytes, times in ns */
+	RLAT_COUNT_OFF			= 0,
+	RLAT_SUM_OFF			= 8,
+	RLAT_MAX_OFF			= 16,
+	RLAT_BUCKET_OFF			= 24,	/* [0, 2us), [2us, 4us) ... */
+	RLAT_BUCKETS			= 24,
+	RLAT_LEN			= 24 + 8 * 24,
+};
+
+#define RLAT_ATTR_NUM(action, phase) (((uint32_t)(action) << 4) | (phase))
+
+/* root policy/security attribute page osd2r04 sec 7.1.3.8 (selected) */
+enum {
+	ROOT_POLICY_PG = (ROOT_PG + POLICY_OFFSET),
+
+	RPSAP_DEFAULT_SECURITY_METHOD	= 0x1,	/* 1        */
+	RPSAP_DEFAULT_SECURITY_METHOD_LEN = 1,
+};
+
+/* security methods osd2r04 sec 4.11.1 */
+enum {
+	OSD_SEC_NOSEC = 0x0,
+	OSD_SEC_CAPKEY = 0x1,
+	OSD_SEC_CMDRSP = 0x2,
+	OSD_SEC_ALLDATA = 0x3,
+};
+
+/* keys of SET KEY osd2r04 sec 6.36, and the master key */
+enum {
+	OSD_KEY_MASTER = 0x0,
+	OSD_KEY_ROOT = 0x1,
+	OSD_KEY_PARTITION = 0x2,
+	OSD_KEY_WORKING = 0x3,
+
+	OSD_KEY_LEN = 20,		/* HMAC-SHA1 */
+	OSD_WORKING_KEYS = 16,		/* versions per partition */
+};
+
+/*
+ * Capability osd2r04 sec 4.11.2.2, at CAP_OFF in the CDB, and the
+ * security parameters after it.  Offsets are within the capability.
+ */
+enum {
+	CAP_OFF			= 80,
+	CAP_LEN			= 104,
+
+	CAP_FORMAT		= 0,	/* low nibble, CAP_FORMAT_V2 */
+	CAP_KEY_VERSION		= 1,	/* high nibble; low: algorithm */
+	CAP_SECURITY_METHOD	= 2,	/* low nibble */
+	CAP_EXPIRATION_TIME	= 4,	/* 6, ms since the epoch, 0 never */
+	CAP_AUDIT		= 10,	/* 20 */
+	CAP_DISCRIMINATOR	= 30,	/* 12 */
+	CAP_OBJECT_CREATED_TIME	= 42,	/* 6 */
+	CAP_OBJECT_TYPE		= 48,
+	CAP_PERMISSIONS		= 49,	/* 5, see below */
+	CAP_OBJECT_DESC_TYPE	= 55,	/* high nibble */
+	CAP_ALLOWED_PID		= 64,	/* 8 */
+	CAP_ALLOWED_OID		= 72,	/* 8 */
+
+	CAP_FORMAT_V2		= 0x1,
+	CAP_ALG_HMAC_SHA1	= 0x1,
+
+	/* object descriptor types */
+	CAP_ODT_LU		= 0x1,	/* any object */
+	CAP_ODT_PARTITION	= 0x2,	/* any object of the partition */
+	CAP_ODT_OBJECT		= 0x4,	/* this object only */
+
+	/* permissions, bits of CAP_PERMISSIONS and the byte after it */
+	CAP_PERM_APPEND		= 0x0001,
+	CAP_PERM_OBJ_MGMT	= 0x0002,
+	CAP_PERM_REMOVE		= 0x0004,
+	CAP_PERM_CREATE		= 0x0008,
+	CAP_PERM_SET_ATTR	= 0x0010,
+	CAP_PERM_GET_ATTR	= 0x0020,
+	CAP_PERM_WRITE		= 0x0040,
+	CAP_PERM_READ		= 0x0080,
+	CAP_PERM_QUERY		= 0x0800,
+	CAP_PERM_M_OBJECT	= 0x1000,
+	CAP_PERM_POL_SEC	= 0x2000,
+	CAP_PERM_GLOBAL		= 0x4000,
+	CAP_PERM_DEV_MGMT	= 0x8000,
+
+	/* security parameters, offsets in the CDB */
+	SEC_RICV_OFF		= 184,	/* request integrity check value */
+	SEC_RICV_LEN		= 20,
+	SEC_NONCE_OFF		= 204,
+	SEC_NONCE_LEN		= 12,
+};
+
 /* Collection information attribute page osd2r05 sec 7.1.3.10 */
 enum {
 	/* attributes */
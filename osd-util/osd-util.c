@@ -34,6 +34,7 @@
 /* global */
 static const char *progname = "(pre-main)";
 double mhz = -1.0;
+int osd_log_level = OSD_LOG_INFO;
 
 /*
  * Set the program name, first statement of code usually.
@@ -65,6 +66,8 @@ osd_info(const char *fmt, ...)
 	time_t tp;
 	char buffer[16];
 
+	if (osd_log_level < OSD_LOG_INFO)
+		return;
 	gettimeofday(&tv, NULL);
 	tp = tv.tv_sec;
 	strftime(buffer, 9, "%H:%M:%S", localtime(&tp));
@@ -85,6 +88,8 @@ osd_warning(const char *fmt, ...)
 {
 	va_list ap;
 
+	if (osd_log_level < OSD_LOG_WARNING)
+		return;
 	fprintf(stdout, "%s: Warning: ", progname);
 	va_start(ap, fmt);
 	vfprintf(stdout, fmt, ap);
@@ -151,6 +156,7 @@ osd_error_fatal(const char *fmt, ...)
 	vfprintf(stderr, fmt, ap);
 	va_end(ap);
 	fprintf(stderr, ": %s.\n", strerror(errno));
+	blog_dump(stderr);
 	exit(1);
 }
 
@@ -633,12 +639,17 @@ double median(double *v, int N)
 	return median;
 }
 
+/* cpu clock for the rdtsc timings, looked up only once */
 double get_mhz(void)
 {
 	FILE *fp;
 	char s[1024];
 	double mhz = 0;
+	static double cached = 0;
 	static const double cpufrequency_not_found = 1717.17;
+
+	if (cached != 0)
+		return cached;
 #if defined(__FreeBSD__) || defined(__APPLE__)
 #ifdef __APPLE__
 	#define hw_cpufrequency "hw.cpufrequency"
@@ -684,6 +695,7 @@ no_cpufrequency:
 				osd_error("scanf got no value");
 				goto no_cpufrequency;
 			}
+			break; /* first cpu will do */
 		}
 	}
 	if (!found)
@@ -693,7 +705,8 @@ no_cpufrequency:
 	fclose(fp); 
 #endif /*  else defined(__FreeBSD__) || defined(__APPLE__) */
 
-	return mhz != 0 ? mhz : cpufrequency_not_found ;
+	cached = mhz != 0 ? mhz : cpufrequency_not_found;
+	return cached;
 }
 
 /*
@@ -19,6 +19,7 @@
 #ifndef __OSD_UTIL_H
 #define __OSD_UTIL_H
 
+#include <stdio.h>
 #include <stdint.h>
 #include <stdlib.h>
 #include <endian.h>
@@ -57,16 +58,76 @@ double get_mhz(void);
 uint32_t jenkins_one_at_a_time_hash(uint8_t *key, size_t key_len);
 
 /*
- * Disable debugging with -DNDEBUG in CFLAGS.  This also disables assert().
+ * Log levels, settable at runtime.  osd_log_level picks the messages
+ * printed by osd_info, osd_warning and osd_debug; errors always are.
+ * osd_rlog_level picks the records kept in the binary log, see blog.c.
  */
-#ifndef NDEBUG
+enum {
+	OSD_LOG_ERROR = 0,
+	OSD_LOG_WARNING = 1,
+	OSD_LOG_INFO = 2,
+	OSD_LOG_DEBUG = 3,
+};
+
+extern int osd_log_level;
+extern int osd_rlog_level;
+
 #define osd_debug(fmt,args...) \
 	do { \
-		osd_info(fmt,##args); \
+		if (osd_log_level >= OSD_LOG_DEBUG) \
+			osd_info(fmt,##args); \
 	} while (0)
-#else
-#define osd_debug(fmt,...) do { } while (0)
-#endif
+
+/*
+ * Binary log: a record of fmt and up to BLOG_MAX_ARGS integer or pointer
+ * arguments in a ring of the calling thread, formatted only by blog_dump.
+ * fmt and %s arguments must stay valid, string literals or __func__.
+ *
+ * Each argument is converted to uint64_t at the call site by BLOG_ARG,
+ * which refuses floating point and anything wider than 64 bits at
+ * compile time, so blog_write reads all of them as uint64_t.  fmt is
+ * still checked against the arguments as written.
+ */
+#define BLOG_MAX_ARGS 6
+
+#define BLOG_NARGS(...) BLOG_NARGS_(0, ##__VA_ARGS__, 6, 5, 4, 3, 2, 1, 0)
+#define BLOG_NARGS_(_0, _1, _2, _3, _4, _5, _6, n, ...) n
+
+/* integer, enum, bool or pointer (class 1 to 5), arrays as pointers */
+#define BLOG_ARG(x) \
+	((uint64_t) (uintptr_t) (x) + 0 * sizeof(char [ \
+		(sizeof(0 ? (x) : (x)) <= sizeof(uint64_t) && \
+		 __builtin_classify_type(0 ? (x) : (x)) >= 1 && \
+		 __builtin_classify_type(0 ? (x) : (x)) <= 5) ? 1 : -1]))
+
+#define BLOG_ARGS(...) BLOG_ARGS_(BLOG_NARGS(__VA_ARGS__), ##__VA_ARGS__)
+#define BLOG_ARGS_(n, ...) BLOG_ARGS__(n, ##__VA_ARGS__)
+#define BLOG_ARGS__(n, ...) BLOG_ARGS_##n(__VA_ARGS__)
+#define BLOG_ARGS_0()
+#define BLOG_ARGS_1(a) , BLOG_ARG(a)
+#define BLOG_ARGS_2(a, ...) , BLOG_ARG(a) BLOG_ARGS_1(__VA_ARGS__)
+#define BLOG_ARGS_3(a, ...) , BLOG_ARG(a) BLOG_ARGS_2(__VA_ARGS__)
+#define BLOG_ARGS_4(a, ...) , BLOG_ARG(a) BLOG_ARGS_3(__VA_ARGS__)
+#define BLOG_ARGS_5(a, ...) , BLOG_ARG(a) BLOG_ARGS_4(__VA_ARGS__)
+#define BLOG_ARGS_6(a, ...) , BLOG_ARG(a) BLOG_ARGS_5(__VA_ARGS__)
+
+#define osd_rlog(level,fmt,args...) \
+	do { \
+		if (0) \
+			blog_check(fmt, ##args); \
+		if (osd_rlog_level >= (level)) \
+			blog_write(level, fmt, BLOG_NARGS(args) \
+				   BLOG_ARGS(args)); \
+	} while (0)
+
+static inline void __attribute__((format(printf,1,2)))
+blog_check(const char *fmt __attribute__((unused)), ...)
+{
+}
+
+void blog_write(int level, const char *fmt, int nargs, ...);
+void blog_dump(FILE *fp);
+int blog_dump_on_signal(int sig, FILE *fp);
 
 #ifndef ARRAY_SIZE
 #define ARRAY_SIZE(x) (int)(sizeof(x) / sizeof((x)[0]))